@@ -46,81 +46,269 @@
 #include <string.h>
 #include <stdio.h>
 
-// the maximum payload transferred by block1 we accumulate per server
-#define MAX_BLOCK1_SIZE 4096
-
-uint8_t coap_block1_handler(lwm2m_block1_data_t ** pBlock1Data,
-                            uint16_t mid,
-                            uint8_t * buffer,
-                            size_t length,
-                            uint16_t blockSize,
-                            uint32_t blockNum,
-                            bool blockMore,
+// a transfer without activity for this duration is released
+#ifndef LWM2M_BLOCK1_TIMEOUT
+#define LWM2M_BLOCK1_TIMEOUT COAP_EXCHANGE_LIFETIME
+#endif
+
+// the maximum number of transfers in progress per server
+#ifndef LWM2M_BLOCK1_MAX_TRANSFERS
+#define LWM2M_BLOCK1_MAX_TRANSFERS 4
+#endif
+
+// capacity reserved on the first block when the request has no Size1 option, in blocks
+#define BLOCK1_INITIAL_BLOCKS 4
+
+static void prv_free(lwm2m_context_t * contextP,
+                     lwm2m_block1_data_t * block1Data)
+{
+    lwm2m_block1_data_t ** nextP;
+
+    timer_cancel(contextP, &block1Data->timer);
+    for (nextP = block1Data->listP ; *nextP != NULL ; nextP = &(*nextP)->next)
+    {
+        if (*nextP == block1Data)
+        {
+            *nextP = block1Data->next;
+            break;
+        }
+    }
+    if (block1Data->block1buffer != NULL) memory_free(contextP, block1Data->block1buffer);
+    memory_free(contextP, block1Data);
+}
+
+static void prv_timeout(lwm2m_context_t * contextP,
+                        void * itemP,
+                        time_t currentTime)
+{
+    (void)currentTime;
+
+    LOG("Releasing idle block1 transfer");
+    prv_free(contextP, (lwm2m_block1_data_t *)itemP);
+}
+
+// the key is the URI path with its segments preceded by '/'
+static int prv_buildKey(coap_packet_t * message,
+                        uint8_t * key)
+{
+    multi_option_t * optionP;
+    int length = 0;
+
+    for (optionP = message->uri_path ; optionP != NULL ; optionP = optionP->next)
+    {
+        if (length + 1 + optionP->len > LWM2M_BLOCK1_KEY_LEN) return -1;
+        key[length++] = '/';
+        memcpy(key + length, optionP->data, optionP->len);
+        length += optionP->len;
+    }
+
+    return length;
+}
+
+// returns the transfer of message, moved first as the list is kept with the most
+// recently used first. countP is set to the number of transfers looked at.
+static lwm2m_block1_data_t * prv_find(lwm2m_block1_data_t ** pBlock1Data,
+                                      coap_packet_t * message,
+                                      uint8_t * key,
+                                      int keyLen,
+                                      int * countP)
+{
+    lwm2m_block1_data_t ** nextP;
+
+    *countP = 0;
+    for (nextP = pBlock1Data ; *nextP != NULL ; nextP = &(*nextP)->next)
+    {
+        (*countP)++;
+        if ((*nextP)->code == message->code
+         && (*nextP)->keyLen == keyLen
+         && memcmp((*nextP)->key, key, keyLen) == 0)
+        {
+            lwm2m_block1_data_t * block1Data = *nextP;
+
+            *nextP = block1Data->next;
+            block1Data->next = *pBlock1Data;
+            *pBlock1Data = block1Data;
+            return block1Data;
+        }
+    }
+
+    return NULL;
+}
+
+// returns a new transfer first in the list of count transfers, or NULL
+static lwm2m_block1_data_t * prv_new(lwm2m_context_t * contextP,
+                                     lwm2m_block1_data_t ** pBlock1Data,
+                                     coap_packet_t * message,
+                                     uint8_t * key,
+                                     int keyLen,
+                                     int count)
+{
+    lwm2m_block1_data_t * block1Data;
+
+    // the least recently used transfer makes room for the new one
+    if (count >= LWM2M_BLOCK1_MAX_TRANSFERS)
+    {
+        lwm2m_block1_data_t * lastP = *pBlock1Data;
+
+        while (lastP->next != NULL) lastP = lastP->next;
+        prv_free(contextP, lastP);
+    }
+
+    block1Data = (lwm2m_block1_data_t *)memory_alloc(contextP, sizeof(lwm2m_block1_data_t));
+    if (NULL == block1Data) return NULL;
+    memset(block1Data, 0, sizeof(lwm2m_block1_data_t));
+    block1Data->listP = pBlock1Data;
+    block1Data->code = message->code;
+    block1Data->keyLen = keyLen;
+    memcpy(block1Data->key, key, keyLen);
+    timer_init(&block1Data->timer, prv_timeout, block1Data);
+    block1Data->next = *pBlock1Data;
+    *pBlock1Data = block1Data;
+
+    return block1Data;
+}
+
+// grows the buffer geometrically up to MAX_BLOCK1_SIZE
+static bool prv_reserve(lwm2m_context_t * contextP,
+                        lwm2m_block1_data_t * block1Data,
+                        size_t capacity)
+{
+    uint8_t * newBuffer;
+    size_t newCapacity;
+
+    if (capacity <= block1Data->block1bufferCapacity) return true;
+
+    newCapacity = block1Data->block1bufferCapacity;
+    if (newCapacity == 0) newCapacity = capacity;
+    while (newCapacity < capacity) newCapacity *= 2;
+    if (newCapacity > MAX_BLOCK1_SIZE) newCapacity = MAX_BLOCK1_SIZE;
+
+    newBuffer = (uint8_t *)memory_alloc(contextP, newCapacity);
+    if (newBuffer == NULL) return false;
+    if (block1Data->block1buffer != NULL)
+    {
+        memcpy(newBuffer, block1Data->block1buffer, block1Data->block1bufferSize);
+        memory_free(contextP, block1Data->block1buffer);
+    }
+    block1Data->block1buffer = newBuffer;
+    block1Data->block1bufferCapacity = newCapacity;
+
+    return true;
+}
+
+uint8_t coap_block1_handler(lwm2m_context_t * contextP,
+                            lwm2m_block1_data_t ** pBlock1Data,
+                            coap_packet_t * message,
                             uint8_t ** outputBuffer,
                             size_t * outputLength)
 {
-    lwm2m_block1_data_t * block1Data = *pBlock1Data;;
+    lwm2m_block1_data_t * block1Data;
+    uint8_t key[LWM2M_BLOCK1_KEY_LEN];
+    int keyLen;
+    int count;
+    uint32_t blockNum;
+    uint8_t blockMore;
+    uint16_t blockSize;
+    uint32_t size1 = 0;
+
+    if (!coap_get_header_block1(message, &blockNum, &blockMore, &blockSize, NULL)) return COAP_400_BAD_REQUEST;
+    keyLen = prv_buildKey(message, key);
+    if (keyLen < 0) return COAP_400_BAD_REQUEST;
+
+    block1Data = prv_find(pBlock1Data, message, key, keyLen, &count);
 
     // manage new block1 transfer
     if (blockNum == 0)
     {
-       // we already have block1 data for this server, clear it
-       if (block1Data != NULL)
-       {
-           lwm2m_free(block1Data->block1buffer);
-       }
-       else
-       {
-           block1Data = lwm2m_malloc(sizeof(lwm2m_block1_data_t));
-           *pBlock1Data = block1Data;
-           if (NULL == block1Data) return COAP_500_INTERNAL_SERVER_ERROR;
-       }
-
-       block1Data->block1buffer = lwm2m_malloc(length);
-       block1Data->block1bufferSize = length;
-
-       // write new block in buffer
-       memcpy(block1Data->block1buffer, buffer, length);
-       block1Data->lastmid = mid;
+        size_t capacity;
+
+        if (message->payload_len >= MAX_BLOCK1_SIZE
+         || (coap_get_header_size1(message, &size1) && size1 >= MAX_BLOCK1_SIZE))
+        {
+            if (block1Data != NULL) prv_free(contextP, block1Data);
+            return COAP_413_ENTITY_TOO_LARGE;
+        }
+
+        if (block1Data == NULL)
+        {
+            block1Data = prv_new(contextP, pBlock1Data, message, key, keyLen, count);
+            if (NULL == block1Data) return COAP_500_INTERNAL_SERVER_ERROR;
+        }
+
+        // restart the transfer reusing its buffer
+        block1Data->block1bufferSize = 0;
+        if (IS_OPTION(message, COAP_OPTION_SIZE1))
+        {
+            capacity = size1;
+        }
+        else if (blockMore)
+        {
+            capacity = BLOCK1_INITIAL_BLOCKS * (size_t)message->payload_len;
+        }
+        else
+        {
+            capacity = message->payload_len;
+        }
+        if (capacity < message->payload_len) capacity = message->payload_len;
+        if (!prv_reserve(contextP, block1Data, capacity))
+        {
+            prv_free(contextP, block1Data);
+            return COAP_500_INTERNAL_SERVER_ERROR;
+        }
+
+        // write new block in buffer
+        if (message->payload_len > 0)
+        {
+            memcpy(block1Data->block1buffer, message->payload, message->payload_len);
+        }
+        block1Data->block1bufferSize = message->payload_len;
+        block1Data->lastmid = message->mid;
     }
     // manage already started block1 transfer
     else
     {
-       if (block1Data == NULL)
-       {
-           // we never receive the first block
-           // TODO should we clean block1 data for this server ?
-           return COAP_408_REQ_ENTITY_INCOMPLETE;
-       }
-
-       // If this is a retransmission, we already did that.
-       if (block1Data->lastmid != mid)
-       {
-          uint8_t * oldBuffer = block1Data->block1buffer;
-          size_t oldSize = block1Data->block1bufferSize;
-
-          if (block1Data->block1bufferSize != blockSize * blockNum)
-          {
-              // we don't receive block in right order
-              // TODO should we clean block1 data for this server ?
-              return COAP_408_REQ_ENTITY_INCOMPLETE;
-          }
-
-          // is it too large?
-          if (block1Data->block1bufferSize + length >= MAX_BLOCK1_SIZE) {
-              return COAP_413_ENTITY_TOO_LARGE;
-          }
-          // re-alloc new buffer
-          block1Data->block1bufferSize = oldSize+length;
-          block1Data->block1buffer = lwm2m_malloc(block1Data->block1bufferSize);
-          if (NULL == block1Data->block1buffer) return COAP_500_INTERNAL_SERVER_ERROR;
-          memcpy(block1Data->block1buffer, oldBuffer, oldSize);
-          lwm2m_free(oldBuffer);
-
-          // write new block in buffer
-          memcpy(block1Data->block1buffer + oldSize, buffer, length);
-          block1Data->lastmid = mid;
-       }
+        if (block1Data == NULL)
+        {
+            // we never receive the first block
+            return COAP_408_REQ_ENTITY_INCOMPLETE;
+        }
+
+        // If this is a retransmission, we already did that.
+        if (block1Data->lastmid != message->mid)
+        {
+            if (block1Data->block1bufferSize != blockSize * blockNum
+             || (block1Data->block1bufferSize > 0 && block1Data->block1buffer == NULL))
+            {
+                // we don't receive block in right order, or the previous ones were streamed
+                // TODO should we clean block1 data for this server ?
+                return COAP_408_REQ_ENTITY_INCOMPLETE;
+            }
+
+            // is it too large?
+            if (block1Data->block1bufferSize + message->payload_len >= MAX_BLOCK1_SIZE)
+            {
+                prv_free(contextP, block1Data);
+                return COAP_413_ENTITY_TOO_LARGE;
+            }
+
+            if (!prv_reserve(contextP, block1Data, block1Data->block1bufferSize + message->payload_len))
+            {
+                prv_free(contextP, block1Data);
+                return COAP_500_INTERNAL_SERVER_ERROR;
+            }
+
+            // append the new block in place
+            memcpy(block1Data->block1buffer + block1Data->block1bufferSize, message->payload, message->payload_len);
+            block1Data->block1bufferSize += message->payload_len;
+            block1Data->lastmid = message->mid;
+        }
+    }
+
+    // a transfer without its timer would never be released
+    if (0 != timer_schedule(contextP, &block1Data->timer, lwm2m_gettime() + LWM2M_BLOCK1_TIMEOUT))
+    {
+        prv_free(contextP, block1Data);
+        return COAP_500_INTERNAL_SERVER_ERROR;
     }
 
     if (blockMore)
@@ -139,15 +327,141 @@ uint8_t coap_block1_handler(lwm2m_block1_data_t ** pBlock1Data,
     }
 }
 
-void free_block1_buffer(lwm2m_block1_data_t * block1Data)
+#ifdef LWM2M_CLIENT_MODE
+// returns the object taking the payload of message by stream, NULL if it is reassembled
+static lwm2m_object_t * prv_findStreamObject(lwm2m_context_t * contextP,
+                                             lwm2m_server_t * serverP,
+                                             coap_packet_t * message,
+                                             lwm2m_uri_t * uriP)
+{
+    lwm2m_object_t * objectP;
+    lwm2m_uri_t * decodedP;
+
+    // a write of an opaque resource by a registered server
+    if (message->code != COAP_PUT
+     || !IS_OPTION(message, COAP_OPTION_CONTENT_TYPE)
+     || message->content_type != APPLICATION_OCTET_STREAM
+     || IS_OPTION(message, COAP_OPTION_URI_QUERY)
+     || (serverP->status != STATE_REGISTERED
+      && serverP->status != STATE_REG_UPDATE_NEEDED
+      && serverP->status != STATE_REG_FULL_UPDATE_NEEDED
+      && serverP->status != STATE_REG_UPDATE_PENDING))
+    {
+        return NULL;
+    }
+
+    decodedP = uri_decode(contextP->altPath, message->uri_path);
+    if (decodedP == NULL) return NULL;
+    memcpy(uriP, decodedP, sizeof(lwm2m_uri_t));
+    lwm2m_free(decodedP);
+    if ((uriP->flag & LWM2M_URI_MASK_TYPE) != LWM2M_URI_FLAG_DM
+     || !LWM2M_URI_IS_SET_RESOURCE(uriP)
+     || uriP->objectId == LWM2M_SECURITY_OBJECT_ID)
+    {
+        return NULL;
+    }
+
+    objectP = (lwm2m_object_t *)LWM2M_LIST_FIND(contextP->objectList, uriP->objectId);
+    if (objectP == NULL
+     || objectP->writeStreamFunc == NULL
+     || LWM2M_LIST_FIND(objectP->instanceList, uriP->instanceId) == NULL)
+    {
+        return NULL;
+    }
+
+    return objectP;
+}
+
+uint8_t coap_block1_stream(lwm2m_context_t * contextP,
+                           lwm2m_server_t * serverP,
+                           coap_packet_t * message)
+{
+    lwm2m_block1_data_t * block1Data;
+    lwm2m_object_t * objectP;
+    lwm2m_uri_t uri;
+    uint8_t key[LWM2M_BLOCK1_KEY_LEN];
+    int keyLen;
+    int count;
+    uint32_t blockNum;
+    uint8_t blockMore;
+    uint16_t blockSize;
+    uint8_t result;
+
+    objectP = prv_findStreamObject(contextP, serverP, message, &uri);
+    if (objectP == NULL) return NO_ERROR;
+
+    if (!coap_get_header_block1(message, &blockNum, &blockMore, &blockSize, NULL)) return COAP_400_BAD_REQUEST;
+    keyLen = prv_buildKey(message, key);
+    if (keyLen < 0) return COAP_400_BAD_REQUEST;
+
+    // the transfer only follows the offset, the blocks are not kept
+    block1Data = prv_find(&serverP->block1Data, message, key, keyLen, &count);
+
+    // If this is a retransmission, the object already has the block.
+    if (block1Data == NULL || block1Data->lastmid != message->mid)
+    {
+        if (blockNum == 0)
+        {
+            if (block1Data == NULL)
+            {
+                block1Data = prv_new(contextP, &serverP->block1Data, message, key, keyLen, count);
+                if (NULL == block1Data) return COAP_500_INTERNAL_SERVER_ERROR;
+            }
+            // the buffer of a payload reassembled before for the same URI is not needed
+            if (block1Data->block1buffer != NULL)
+            {
+                memory_free(contextP, block1Data->block1buffer);
+                block1Data->block1buffer = NULL;
+                block1Data->block1bufferCapacity = 0;
+            }
+            block1Data->block1bufferSize = 0;
+        }
+        else if (block1Data == NULL)
+        {
+            // we never receive the first block
+            return COAP_408_REQ_ENTITY_INCOMPLETE;
+        }
+        else if (block1Data->block1bufferSize != (size_t)blockSize * blockNum
+              || block1Data->block1buffer != NULL)
+        {
+            // out of order, or started as a payload to reassemble
+            return COAP_408_REQ_ENTITY_INCOMPLETE;
+        }
+
+        result = objectP->writeStreamFunc(uri.instanceId, uri.resourceId,
+                                          block1Data->block1bufferSize,
+                                          message->payload, message->payload_len,
+                                          blockMore != 0, objectP);
+        if (result != COAP_204_CHANGED)
+        {
+            prv_free(contextP, block1Data);
+            return result;
+        }
+        block1Data->block1bufferSize += message->payload_len;
+        block1Data->lastmid = message->mid;
+    }
+
+    if (0 != timer_schedule(contextP, &block1Data->timer, lwm2m_gettime() + LWM2M_BLOCK1_TIMEOUT))
+    {
+        prv_free(contextP, block1Data);
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+
+    return blockMore ? COAP_231_CONTINUE : COAP_204_CHANGED;
+}
+#endif
+
+void free_block1_buffer(lwm2m_context_t * contextP,
+                        lwm2m_block1_data_t * block1Data)
 {
-    if (block1Data != NULL)
+    // free every transfer of the list
+    while (block1Data != NULL)
     {
-        // free block1 buffer
-        lwm2m_free(block1Data->block1buffer);
-        block1Data->block1bufferSize = 0 ;
+        lwm2m_block1_data_t * nextP = block1Data->next;
 
-        // free current element
-        lwm2m_free(block1Data);
+        timer_cancel(contextP, &block1Data->timer);
+        if (block1Data->block1buffer != NULL) memory_free(contextP, block1Data->block1buffer);
+        memory_free(contextP, block1Data);
+        block1Data = nextP;
     }
 }
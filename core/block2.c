@@ -0,0 +1,320 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Cache of the responses sent by blocks (RFC 7959 Block2).
+ *
+ * The body of a response too large for one block is kept when its first
+ * block is sent. The following blocks requested by the same peer on the same
+ * URI with the same Accept option are sliced from the cache instead of
+ * handling the whole request again. The response carries an ETag computed on
+ * the body: a block served after the entry was dropped comes from a new read
+ * and, if the data changed meanwhile, a different ETag.
+ *
+ * A request for the first block always handles the request again and
+ * replaces the entry. Entries are listed oldest first, dropped after
+ * LWM2M_BLOCK2_CACHE_LIFETIME seconds and when they and their bodies use more
+ * than LWM2M_BLOCK2_CACHE_SIZE bytes. A size of 0 disables the cache. The
+ * entries of one peer use at most LWM2M_BLOCK2_CACHE_PEER_SIZE bytes: the
+ * oldest of its own entries make room first.
+ */
+
+#include "internals.h"
+
+// a few bodies as large as the payloads reassembled by block1
+#ifndef LWM2M_BLOCK2_CACHE_SIZE
+#define LWM2M_BLOCK2_CACHE_SIZE (4 * MAX_BLOCK1_SIZE + 1024)
+#endif
+
+#ifndef LWM2M_BLOCK2_CACHE_PEER_SIZE
+#define LWM2M_BLOCK2_CACHE_PEER_SIZE (LWM2M_BLOCK2_CACHE_SIZE / 2)
+#endif
+
+#ifndef LWM2M_BLOCK2_CACHE_LIFETIME
+#define LWM2M_BLOCK2_CACHE_LIFETIME 60
+#endif
+
+// longer URIs are not cached
+#define BLOCK2_MAX_KEY_LENGTH 64
+#define BLOCK2_ETAG_LENGTH    4
+#define BLOCK2_NO_ACCEPT      0xFFFF
+
+struct _lwm2m_block2_entry_
+{
+    struct _lwm2m_block2_entry_ * next;
+    void *   sessionH;
+    time_t   time;
+    uint16_t accept;        // BLOCK2_NO_ACCEPT if there was no Accept option
+    uint16_t contentType;
+    uint8_t  etag[BLOCK2_ETAG_LENGTH];
+    size_t   keyLength;     // of the URI following the entry
+    size_t   length;        // of the body following the URI
+};
+
+typedef struct
+{
+    uint8_t  uri[BLOCK2_MAX_KEY_LENGTH];
+    size_t   length;
+    uint16_t accept;
+} block2_key_t;
+
+static uint8_t * prv_entryKey(lwm2m_block2_entry_t * entryP)
+{
+    return (uint8_t *)(entryP + 1);
+}
+
+static uint8_t * prv_entryData(lwm2m_block2_entry_t * entryP)
+{
+    return prv_entryKey(entryP) + entryP->keyLength;
+}
+
+static size_t prv_entrySize(size_t keyLength,
+                            size_t length)
+{
+    return sizeof(lwm2m_block2_entry_t) + keyLength + length;
+}
+
+// returns false if the request can not be cached
+static bool prv_getKey(coap_packet_t * message,
+                       block2_key_t * keyP)
+{
+    multi_option_t * optionP;
+
+    if (message->code != COAP_GET
+     || IS_OPTION(message, COAP_OPTION_OBSERVE))
+    {
+        return false;
+    }
+
+    keyP->length = 0;
+    for (optionP = message->uri_path ; optionP != NULL ; optionP = optionP->next)
+    {
+        if (keyP->length + 1 + optionP->len > BLOCK2_MAX_KEY_LENGTH) return false;
+        keyP->uri[keyP->length++] = '/';
+        memcpy(keyP->uri + keyP->length, optionP->data, optionP->len);
+        keyP->length += optionP->len;
+    }
+    for (optionP = message->uri_query ; optionP != NULL ; optionP = optionP->next)
+    {
+        if (keyP->length + 1 + optionP->len > BLOCK2_MAX_KEY_LENGTH) return false;
+        keyP->uri[keyP->length++] = (optionP == message->uri_query) ? '?' : '&';
+        memcpy(keyP->uri + keyP->length, optionP->data, optionP->len);
+        keyP->length += optionP->len;
+    }
+
+    if (IS_OPTION(message, COAP_OPTION_ACCEPT) && message->accept_num > 0)
+    {
+        keyP->accept = message->accept[0];
+    }
+    else
+    {
+        keyP->accept = BLOCK2_NO_ACCEPT;
+    }
+
+    return true;
+}
+
+static void prv_unlink(lwm2m_context_t * contextP,
+                       lwm2m_block2_entry_t * prevP,
+                       lwm2m_block2_entry_t * entryP)
+{
+    lwm2m_block2_cache_t * cacheP = &(contextP->block2Cache);
+
+    if (prevP == NULL) cacheP->head = entryP->next;
+    else prevP->next = entryP->next;
+    if (cacheP->tail == entryP) cacheP->tail = prevP;
+    cacheP->size -= prv_entrySize(entryP->keyLength, entryP->length);
+    memory_free(contextP, entryP);
+}
+
+static void prv_expire(lwm2m_context_t * contextP,
+                       time_t currentTime)
+{
+    while (contextP->block2Cache.head != NULL
+        && contextP->block2Cache.head->time + LWM2M_BLOCK2_CACHE_LIFETIME <= currentTime)
+    {
+        prv_unlink(contextP, NULL, contextP->block2Cache.head);
+    }
+}
+
+// returns the entry of the peer matching keyP and its predecessor in the list
+static lwm2m_block2_entry_t * prv_find(lwm2m_context_t * contextP,
+                                       void * sessionH,
+                                       block2_key_t * keyP,
+                                       lwm2m_block2_entry_t ** prevP)
+{
+    lwm2m_block2_entry_t * entryP;
+
+    *prevP = NULL;
+    for (entryP = contextP->block2Cache.head ; entryP != NULL ; entryP = entryP->next)
+    {
+        if (entryP->keyLength == keyP->length
+         && entryP->accept == keyP->accept
+         && memcmp(prv_entryKey(entryP), keyP->uri, keyP->length) == 0
+         && lwm2m_session_is_equal(entryP->sessionH, sessionH, contextP->userData))
+        {
+            return entryP;
+        }
+        *prevP = entryP;
+    }
+
+    return NULL;
+}
+
+// returns the size of the entries of the peer
+static size_t prv_peerSize(lwm2m_context_t * contextP,
+                           void * sessionH)
+{
+    lwm2m_block2_entry_t * entryP;
+    size_t size;
+
+    size = 0;
+    for (entryP = contextP->block2Cache.head ; entryP != NULL ; entryP = entryP->next)
+    {
+        if (lwm2m_session_is_equal(entryP->sessionH, sessionH, contextP->userData))
+        {
+            size += prv_entrySize(entryP->keyLength, entryP->length);
+        }
+    }
+
+    return size;
+}
+
+// drops the oldest entries of the peer until size more bytes fit in its share
+static void prv_makePeerRoom(lwm2m_context_t * contextP,
+                             void * sessionH,
+                             size_t size)
+{
+    lwm2m_block2_entry_t * entryP;
+    lwm2m_block2_entry_t * prevP;
+    size_t peerSize;
+
+    peerSize = prv_peerSize(contextP, sessionH);
+    prevP = NULL;
+    entryP = contextP->block2Cache.head;
+    while (entryP != NULL && peerSize + size > LWM2M_BLOCK2_CACHE_PEER_SIZE)
+    {
+        lwm2m_block2_entry_t * nextP = entryP->next;
+
+        if (lwm2m_session_is_equal(entryP->sessionH, sessionH, contextP->userData))
+        {
+            peerSize -= prv_entrySize(entryP->keyLength, entryP->length);
+            prv_unlink(contextP, prevP, entryP);
+        }
+        else
+        {
+            prevP = entryP;
+        }
+        entryP = nextP;
+    }
+}
+
+bool block2_load(lwm2m_context_t * contextP,
+                 void * sessionH,
+                 coap_packet_t * message,
+                 coap_packet_t * response)
+{
+    lwm2m_block2_entry_t * entryP;
+    lwm2m_block2_entry_t * prevP;
+    block2_key_t key;
+    time_t currentTime;
+
+    if (LWM2M_BLOCK2_CACHE_SIZE == 0 || contextP->block2Cache.head == NULL) return false;
+
+    currentTime = lwm2m_gettime();
+    if (currentTime < 0) return false;
+    prv_expire(contextP, currentTime);
+
+    if (!prv_getKey(message, &key)) return false;
+    entryP = prv_find(contextP, sessionH, &key, &prevP);
+    if (entryP == NULL) return false;
+
+    LOG_ARG("Blockwise: serving %u bytes from the cache", entryP->length);
+    response->code = COAP_205_CONTENT;
+    coap_set_header_content_type(response, entryP->contentType);
+    coap_set_header_etag(response, entryP->etag, BLOCK2_ETAG_LENGTH);
+    coap_set_payload(response, prv_entryData(entryP), entryP->length);
+
+    return true;
+}
+
+void block2_store(lwm2m_context_t * contextP,
+                  void * sessionH,
+                  coap_packet_t * message,
+                  coap_packet_t * response)
+{
+    lwm2m_block2_cache_t * cacheP = &(contextP->block2Cache);
+    lwm2m_block2_entry_t * entryP;
+    lwm2m_block2_entry_t * prevP;
+    block2_key_t key;
+    uint8_t etag[BLOCK2_ETAG_LENGTH];
+    size_t hash;
+    size_t size;
+    time_t currentTime;
+
+    // the ETag tells the blocks of different bodies apart even when the cache is not used
+    hash = index_hashBuffer(response->payload, response->payload_len);
+    etag[0] = (uint8_t)(hash >> 24);
+    etag[1] = (uint8_t)(hash >> 16);
+    etag[2] = (uint8_t)(hash >> 8);
+    etag[3] = (uint8_t)hash;
+    coap_set_header_etag(response, etag, BLOCK2_ETAG_LENGTH);
+
+    if (LWM2M_BLOCK2_CACHE_SIZE == 0) return;
+    if (!prv_getKey(message, &key)) return;
+    currentTime = lwm2m_gettime();
+    if (currentTime < 0) return;
+    prv_expire(contextP, currentTime);
+
+    // the previous body of the same request is replaced
+    entryP = prv_find(contextP, sessionH, &key, &prevP);
+    if (entryP != NULL) prv_unlink(contextP, prevP, entryP);
+
+    size = prv_entrySize(key.length, response->payload_len);
+    if (size > LWM2M_BLOCK2_CACHE_PEER_SIZE || size > LWM2M_BLOCK2_CACHE_SIZE) return;
+    prv_makePeerRoom(contextP, sessionH, size);
+    while (cacheP->head != NULL && cacheP->size + size > LWM2M_BLOCK2_CACHE_SIZE)
+    {
+        prv_unlink(contextP, NULL, cacheP->head);
+    }
+
+    entryP = (lwm2m_block2_entry_t *)memory_alloc(contextP, size);
+    if (entryP == NULL) return;
+    entryP->next = NULL;
+    entryP->sessionH = sessionH;
+    entryP->time = currentTime;
+    entryP->accept = key.accept;
+    entryP->contentType = (uint16_t)response->content_type;
+    memcpy(entryP->etag, etag, BLOCK2_ETAG_LENGTH);
+    entryP->keyLength = key.length;
+    entryP->length = response->payload_len;
+    memcpy(prv_entryKey(entryP), key.uri, key.length);
+    memcpy(prv_entryData(entryP), response->payload, response->payload_len);
+
+    if (cacheP->tail == NULL) cacheP->head = entryP;
+    else cacheP->tail->next = entryP;
+    cacheP->tail = entryP;
+    cacheP->size += size;
+}
+
+void block2_clear(lwm2m_context_t * contextP)
+{
+    while (contextP->block2Cache.head != NULL)
+    {
+        prv_unlink(contextP, NULL, contextP->block2Cache.head);
+    }
+}
@@ -100,7 +100,7 @@ static void prv_requestBootstrap(lwm2m_context_t * context,
 
         LOG("Bootstrap server connection opened");
 
-        transaction = transaction_new(bootstrapServer->sessionH, COAP_POST, NULL, NULL, context->nextMID++, 4, NULL);
+        transaction = transaction_new(context, bootstrapServer->sessionH, COAP_POST, NULL, NULL, context->nextMID++, 4, NULL);
         if (transaction == NULL)
         {
             bootstrapServer->status = STATE_BS_FAILING;
@@ -111,7 +111,7 @@ static void prv_requestBootstrap(lwm2m_context_t * context,
         coap_set_header_uri_query(transaction->message, query);
         transaction->callback = prv_handleBootstrapReply;
         transaction->userData = (void *)bootstrapServer;
-        context->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(context->transactionList, transaction);
+        transaction_add(context, transaction);
         if (transaction_send(context, transaction) == 0)
         {
             LOG("CI bootstrap requested to BS server");
@@ -419,7 +419,7 @@ uint8_t bootstrap_handleCommand(lwm2m_context_t * contextP,
                 }
                 else
                 {
-                    size = lwm2m_data_parse(uriP, message->payload, message->payload_len, format, &dataP);
+                    size = data_parse(contextP, uriP, message->payload, message->payload_len, format, &dataP);
                     if (size == 0)
                     {
                         result = COAP_500_INTERNAL_SERVER_ERROR;
@@ -458,7 +458,7 @@ uint8_t bootstrap_handleCommand(lwm2m_context_t * contextP,
                             result = COAP_400_BAD_REQUEST;
                         }
                     }
-                    lwm2m_data_free(size, dataP);
+                    data_free(contextP, size, dataP);
                 }
             }
         }
@@ -663,13 +663,13 @@ int lwm2m_bootstrap_delete(lwm2m_context_t * contextP,
     bs_data_t * dataP;
 
     LOG_URI(uriP);
-    transaction = transaction_new(sessionH, COAP_DELETE, NULL, uriP, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, sessionH, COAP_DELETE, NULL, uriP, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
 
     dataP = (bs_data_t *)lwm2m_malloc(sizeof(bs_data_t));
     if (dataP == NULL)
     {
-        transaction_free(transaction);
+        transaction_free(contextP, transaction);
         return COAP_500_INTERNAL_SERVER_ERROR;
     }
     if (uriP == NULL)
@@ -687,7 +687,7 @@ int lwm2m_bootstrap_delete(lwm2m_context_t * contextP,
     transaction->callback = prv_resultCallback;
     transaction->userData = (void *)dataP;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
 
     return transaction_send(contextP, transaction);
 }
@@ -710,16 +710,27 @@ int lwm2m_bootstrap_write(lwm2m_context_t * contextP,
         return COAP_400_BAD_REQUEST;
     }
 
-    transaction = transaction_new(sessionH, COAP_PUT, NULL, uriP, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, sessionH, COAP_PUT, NULL, uriP, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
 
     coap_set_header_content_type(transaction->message, format);
-    coap_set_payload(transaction->message, buffer, length);
+    if (length > LWM2M_DEFAULT_BLOCK_SIZE)
+    {
+        if (0 != transaction_setBlock1(contextP, transaction, LWM2M_DEFAULT_BLOCK_SIZE, length, buffer, NULL, NULL))
+        {
+            transaction_free(contextP, transaction);
+            return COAP_500_INTERNAL_SERVER_ERROR;
+        }
+    }
+    else
+    {
+        coap_set_payload(transaction->message, buffer, length);
+    }
 
     dataP = (bs_data_t *)lwm2m_malloc(sizeof(bs_data_t));
     if (dataP == NULL)
     {
-        transaction_free(transaction);
+        transaction_free(contextP, transaction);
         return COAP_500_INTERNAL_SERVER_ERROR;
     }
     dataP->isUri = true;
@@ -730,7 +741,7 @@ int lwm2m_bootstrap_write(lwm2m_context_t * contextP,
     transaction->callback = prv_resultCallback;
     transaction->userData = (void *)dataP;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
 
     return transaction_send(contextP, transaction);
 }
@@ -742,7 +753,7 @@ int lwm2m_bootstrap_finish(lwm2m_context_t * contextP,
     bs_data_t * dataP;
 
     LOG("Entering");
-    transaction = transaction_new(sessionH, COAP_POST, NULL, NULL, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, sessionH, COAP_POST, NULL, NULL, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
 
     coap_set_header_uri_path(transaction->message, "/"URI_BOOTSTRAP_SEGMENT);
@@ -750,7 +761,7 @@ int lwm2m_bootstrap_finish(lwm2m_context_t * contextP,
     dataP = (bs_data_t *)lwm2m_malloc(sizeof(bs_data_t));
     if (dataP == NULL)
     {
-        transaction_free(transaction);
+        transaction_free(contextP, transaction);
         return COAP_500_INTERNAL_SERVER_ERROR;
     }
     dataP->isUri = false;
@@ -760,7 +771,7 @@ int lwm2m_bootstrap_finish(lwm2m_context_t * contextP,
     transaction->callback = prv_resultCallback;
     transaction->userData = (void *)dataP;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
 
     return transaction_send(contextP, transaction);
 }
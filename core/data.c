@@ -186,6 +186,33 @@ void lwm2m_data_free(int size,
     lwm2m_free(dataP);
 }
 
+lwm2m_data_t * data_new(lwm2m_context_t * contextP,
+                        int size)
+{
+    lwm2m_data_t * dataP;
+
+    if (contextP == NULL) return lwm2m_data_new(size);
+    if (size <= 0) return NULL;
+
+    dataP = (lwm2m_data_t *)memory_arenaAlloc(contextP, size * sizeof(lwm2m_data_t));
+    if (dataP != NULL)
+    {
+        memset(dataP, 0, size * sizeof(lwm2m_data_t));
+    }
+
+    return dataP;
+}
+
+void data_free(lwm2m_context_t * contextP,
+               int size,
+               lwm2m_data_t * dataP)
+{
+    // data in the arena is released when the arena is reset
+    if (contextP != NULL && dataP != NULL && memory_arenaOwns(contextP, dataP)) return;
+
+    lwm2m_data_free(size, dataP);
+}
+
 void lwm2m_data_encode_string(const char * string,
                               lwm2m_data_t * dataP)
 {
@@ -516,11 +543,35 @@ void lwm2m_data_encode_instances(lwm2m_data_t * subDataP,
     dataP->type = LWM2M_TYPE_MULTIPLE_RESOURCE;
 }
 
+// in the arena, the value points into buffer
+static int prv_setValue(lwm2m_context_t * contextP,
+                        lwm2m_data_t * dataP,
+                        uint8_t * buffer,
+                        size_t bufferLen)
+{
+    if (contextP == NULL) return prv_setBuffer(dataP, buffer, bufferLen);
+
+    dataP->value.asBuffer.buffer = buffer;
+    dataP->value.asBuffer.length = bufferLen;
+
+    return 1;
+}
+
 int lwm2m_data_parse(lwm2m_uri_t * uriP,
                      uint8_t * buffer,
                      size_t bufferLen,
                      lwm2m_media_type_t format,
                      lwm2m_data_t ** dataP)
+{
+    return data_parse(NULL, uriP, buffer, bufferLen, format, dataP);
+}
+
+int data_parse(lwm2m_context_t * contextP,
+               lwm2m_uri_t * uriP,
+               uint8_t * buffer,
+               size_t bufferLen,
+               lwm2m_media_type_t format,
+               lwm2m_data_t ** dataP)
 {
     int res;
 
@@ -530,28 +581,28 @@ int lwm2m_data_parse(lwm2m_uri_t * uriP,
     {
     case LWM2M_CONTENT_TEXT:
         if (!LWM2M_URI_IS_SET_RESOURCE(uriP)) return 0;
-        *dataP = lwm2m_data_new(1);
+        *dataP = data_new(contextP, 1);
         if (*dataP == NULL) return 0;
         (*dataP)->id = uriP->resourceId;
         (*dataP)->type = LWM2M_TYPE_STRING;
-        res = prv_setBuffer(*dataP, buffer, bufferLen);
+        res = prv_setValue(contextP, *dataP, buffer, bufferLen);
         if (res == 0)
         {
-            lwm2m_data_free(1, *dataP);
+            data_free(contextP, 1, *dataP);
             *dataP = NULL;
         }
         return res;
 
     case LWM2M_CONTENT_OPAQUE:
         if (!LWM2M_URI_IS_SET_RESOURCE(uriP)) return 0;
-        *dataP = lwm2m_data_new(1);
+        *dataP = data_new(contextP, 1);
         if (*dataP == NULL) return 0;
         (*dataP)->id = uriP->resourceId;
         (*dataP)->type = LWM2M_TYPE_OPAQUE;
-        res = prv_setBuffer(*dataP, buffer, bufferLen);
+        res = prv_setValue(contextP, *dataP, buffer, bufferLen);
         if (res == 0)
         {
-            lwm2m_data_free(1, *dataP);
+            data_free(contextP, 1, *dataP);
             *dataP = NULL;
     }
         return res;
@@ -560,14 +611,14 @@ int lwm2m_data_parse(lwm2m_uri_t * uriP,
     case LWM2M_CONTENT_TLV_OLD:
 #endif
     case LWM2M_CONTENT_TLV:
-        return tlv_parse(buffer, bufferLen, dataP);
+        return tlv_parse(contextP, buffer, bufferLen, dataP);
 
 #ifdef LWM2M_SUPPORT_JSON
 #ifdef LWM2M_OLD_CONTENT_FORMAT_SUPPORT
     case LWM2M_CONTENT_JSON_OLD:
 #endif
     case LWM2M_CONTENT_JSON:
-        return json_parse(uriP, buffer, bufferLen, dataP);
+        return json_parse(contextP, uriP, buffer, bufferLen, dataP);
 #endif
 
     default:
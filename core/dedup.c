@@ -0,0 +1,209 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Deduplication of the confirmable requests received.
+ *
+ * The ACK answering a confirmable request is kept, serialized, for
+ * EXCHANGE_LIFETIME. A retransmission of the request, i.e. a confirmable
+ * request from the same peer with the same message ID, gets the same ACK
+ * again without being parsed nor handled.
+ *
+ * Entries are indexed by message ID and listed oldest first. The entries and
+ * their responses use at most LWM2M_DEDUP_SIZE bytes, the oldest entries are
+ * dropped to make room. A value of 0 disables the cache.
+ */
+
+#include "internals.h"
+
+#ifndef LWM2M_DEDUP_SIZE
+#define LWM2M_DEDUP_SIZE 8192
+#endif
+
+#define DEDUP_LIFETIME ((time_t)COAP_EXCHANGE_LIFETIME)
+
+struct _lwm2m_dedup_entry_
+{
+    struct _lwm2m_dedup_entry_ * next;
+    void *   sessionH;
+    uint16_t mid;
+    time_t   time;
+    size_t   length;    // of the response following the entry
+};
+
+typedef struct
+{
+    lwm2m_context_t * contextP;
+    void *            sessionH;
+    uint16_t          mid;
+} dedup_key_t;
+
+static size_t prv_entryHash(void * itemP)
+{
+    return index_hashInt(((lwm2m_dedup_entry_t *)itemP)->mid);
+}
+
+static bool prv_entryMatch(void * itemP,
+                           void * keyP)
+{
+    lwm2m_dedup_entry_t * entryP = (lwm2m_dedup_entry_t *)itemP;
+    dedup_key_t * dedupKeyP = (dedup_key_t *)keyP;
+
+    return (entryP->mid == dedupKeyP->mid
+         && lwm2m_session_is_equal(entryP->sessionH, dedupKeyP->sessionH, dedupKeyP->contextP->userData));
+}
+
+static uint8_t * prv_entryData(lwm2m_dedup_entry_t * entryP)
+{
+    return (uint8_t *)(entryP + 1);
+}
+
+static size_t prv_entrySize(size_t length)
+{
+    return sizeof(lwm2m_dedup_entry_t) + length;
+}
+
+// removes the oldest entry
+static void prv_dropHead(lwm2m_context_t * contextP)
+{
+    lwm2m_dedup_t * dedupP = &(contextP->dedup);
+    lwm2m_dedup_entry_t * entryP = dedupP->head;
+
+    dedupP->head = entryP->next;
+    if (dedupP->head == NULL) dedupP->tail = NULL;
+    index_remove(&(dedupP->index), entryP, prv_entryHash);
+    dedupP->size -= prv_entrySize(entryP->length);
+    memory_free(contextP, entryP);
+}
+
+static void prv_expire(lwm2m_context_t * contextP,
+                       time_t currentTime)
+{
+    while (contextP->dedup.head != NULL
+        && contextP->dedup.head->time + DEDUP_LIFETIME <= currentTime)
+    {
+        prv_dropHead(contextP);
+    }
+}
+
+bool dedup_check(lwm2m_context_t * contextP,
+                 uint8_t * buffer,
+                 size_t length,
+                 void * fromSessionH)
+{
+    lwm2m_dedup_entry_t * entryP;
+    dedup_key_t key;
+    time_t currentTime;
+
+    contextP->dedup.pending = false;
+    if (LWM2M_DEDUP_SIZE == 0) return false;
+
+    // only confirmable requests, read from the header before any parsing
+    if (length < COAP_HEADER_LEN
+     || (buffer[0] & COAP_HEADER_VERSION_MASK) >> COAP_HEADER_VERSION_POSITION != 1
+     || (buffer[0] & COAP_HEADER_TYPE_MASK) >> COAP_HEADER_TYPE_POSITION != COAP_TYPE_CON
+     || buffer[1] < COAP_GET
+     || buffer[1] > COAP_DELETE)
+    {
+        return false;
+    }
+
+    currentTime = lwm2m_gettime();
+    if (currentTime < 0) return false;
+    prv_expire(contextP, currentTime);
+
+    key.contextP = contextP;
+    key.sessionH = fromSessionH;
+    key.mid = (uint16_t)((buffer[2] << 8) | buffer[3]);
+    entryP = (lwm2m_dedup_entry_t *)index_find(&(contextP->dedup.index), index_hashInt(key.mid), prv_entryMatch, &key);
+    if (entryP != NULL)
+    {
+        LOG_ARG("Duplicate of MID %u, replaying %d bytes", key.mid, entryP->length);
+#ifdef LWM2M_WITH_SEND_QUEUE
+        if (!sendqueue_push(contextP, fromSessionH, prv_entryData(entryP), entryP->length, NULL, 0))
+#endif
+        (void)lwm2m_buffer_send(fromSessionH, prv_entryData(entryP), entryP->length, contextP->userData);
+        return true;
+    }
+
+    // the ACK sent while the request is handled is stored by dedup_store()
+    contextP->dedup.pending = true;
+    contextP->dedup.pendingSessionH = fromSessionH;
+    contextP->dedup.pendingMid = key.mid;
+    contextP->dedup.pendingTime = currentTime;
+
+    return false;
+}
+
+void dedup_store(lwm2m_context_t * contextP,
+                 void * sessionH,
+                 uint16_t mid,
+                 uint8_t * header,
+                 size_t headerLength,
+                 uint8_t * payload,
+                 size_t payloadLength)
+{
+    lwm2m_dedup_t * dedupP = &(contextP->dedup);
+    lwm2m_dedup_entry_t * entryP;
+    size_t size;
+
+    if (!dedupP->pending
+     || dedupP->pendingMid != mid
+     || !lwm2m_session_is_equal(dedupP->pendingSessionH, sessionH, contextP->userData))
+    {
+        return;
+    }
+    dedupP->pending = false;
+
+    // a response too large for the cache is generated again for a duplicate
+    size = prv_entrySize(headerLength + payloadLength);
+    if (size > LWM2M_DEDUP_SIZE) return;
+    while (dedupP->head != NULL && dedupP->size + size > LWM2M_DEDUP_SIZE)
+    {
+        prv_dropHead(contextP);
+    }
+
+    entryP = (lwm2m_dedup_entry_t *)memory_alloc(contextP, size);
+    if (entryP == NULL) return;
+    entryP->next = NULL;
+    entryP->sessionH = sessionH;
+    entryP->mid = mid;
+    entryP->time = dedupP->pendingTime;
+    entryP->length = headerLength + payloadLength;
+    memcpy(prv_entryData(entryP), header, headerLength);
+    if (payloadLength > 0) memcpy(prv_entryData(entryP) + headerLength, payload, payloadLength);
+
+    if (0 != index_insert(contextP, &(dedupP->index), entryP, prv_entryHash))
+    {
+        memory_free(contextP, entryP);
+        return;
+    }
+    if (dedupP->tail == NULL) dedupP->head = entryP;
+    else dedupP->tail->next = entryP;
+    dedupP->tail = entryP;
+    dedupP->size += size;
+}
+
+void dedup_clear(lwm2m_context_t * contextP)
+{
+    while (contextP->dedup.head != NULL)
+    {
+        prv_dropHead(contextP);
+    }
+    index_clear(contextP, &(contextP->dedup.index));
+    contextP->dedup.pending = false;
+}
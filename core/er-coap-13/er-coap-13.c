@@ -261,6 +261,7 @@ coap_add_multi_option(multi_option_t **dst, uint8_t *option, size_t option_len,
   if (opt)
   {
     opt->next = NULL;
+    opt->is_inline = 0;
     opt->len = (uint8_t)option_len;
     if (is_static)
     {
@@ -306,7 +307,10 @@ free_multi_option(multi_option_t *dst)
     {
         lwm2m_free(dst->data);
     }
-    lwm2m_free(dst);
+    if (dst->is_inline == 0)
+    {
+        lwm2m_free(dst);
+    }
     free_multi_option(n);
   }
 }
@@ -513,6 +517,11 @@ size_t coap_serialize_get_size(void *packet)
     {
         length += COAP_MAX_OPTION_HEADER_LEN + coap_pkt->proxy_uri_len;
     }
+    if (IS_OPTION(coap_pkt, COAP_OPTION_SIZE1))
+    {
+        // can be stored in extended fields
+        length += COAP_MAX_OPTION_HEADER_LEN;
+    }
 
     if (coap_pkt->payload_len)
     {
@@ -525,7 +534,7 @@ size_t coap_serialize_get_size(void *packet)
 
 /*-----------------------------------------------------------------------------------*/
 size_t
-coap_serialize_message(void *packet, uint8_t *buffer)
+coap_serialize_header(void *packet, uint8_t *buffer)
 {
   coap_packet_t *const coap_pkt = (coap_packet_t *) packet;
   uint8_t *option;
@@ -580,13 +589,13 @@ coap_serialize_message(void *packet, uint8_t *buffer)
   COAP_SERIALIZE_BLOCK_OPTION(  COAP_OPTION_BLOCK1,         block1, "Block1")
   COAP_SERIALIZE_INT_OPTION(    COAP_OPTION_SIZE,           size, "Size")
   COAP_SERIALIZE_STRING_OPTION( COAP_OPTION_PROXY_URI,      proxy_uri, '\0', "Proxy-Uri")
+  COAP_SERIALIZE_INT_OPTION(    COAP_OPTION_SIZE1,          size1, "Size1")
 
   PRINTF("-Done serializing at %p----\n", option);
 
   /* Free allocated header fields */
   coap_free_header(packet);
 
-  /* Pack payload */
   /* Payload marker */
   if (coap_pkt->payload_len)
   {
@@ -594,10 +603,6 @@ coap_serialize_message(void *packet, uint8_t *buffer)
     ++option;
   }
 
-  memmove(option, coap_pkt->payload, coap_pkt->payload_len);
-
-  PRINTF("-Done %u B (header len %u, payload len %u)-\n", coap_pkt->payload_len + option - buffer, option - buffer, coap_pkt->payload_len);
-
   PRINTF("Dump [0x%02X %02X %02X %02X  %02X %02X %02X %02X]\n",
       coap_pkt->buffer[0],
       coap_pkt->buffer[1],
@@ -609,7 +614,52 @@ coap_serialize_message(void *packet, uint8_t *buffer)
       coap_pkt->buffer[7]
     );
 
-  return (option - buffer) + coap_pkt->payload_len; /* packet length */
+  return option - buffer; /* header length */
+}
+/*-----------------------------------------------------------------------------------*/
+size_t
+coap_serialize_message(void *packet, uint8_t *buffer)
+{
+  coap_packet_t *const coap_pkt = (coap_packet_t *) packet;
+  size_t header_len;
+
+  header_len = coap_serialize_header(packet, buffer);
+
+  /* Pack payload */
+  memmove(buffer + header_len, coap_pkt->payload, coap_pkt->payload_len);
+
+  PRINTF("-Done %u B (header len %u, payload len %u)-\n", coap_pkt->payload_len + header_len, header_len, coap_pkt->payload_len);
+
+  return header_len + coap_pkt->payload_len; /* packet length */
+}
+/*-----------------------------------------------------------------------------------*/
+/* Appends an option pointing into the packet buffer. Nodes are taken from the packet while available. */
+static void
+coap_add_parsed_option(coap_packet_t *coap_pkt, multi_option_t ***tail, uint8_t *option, size_t option_len)
+{
+  multi_option_t *opt;
+
+  if (coap_pkt->parsed_option_count < COAP_MAX_PARSED_OPTIONS)
+  {
+    opt = &(coap_pkt->parsed_options[coap_pkt->parsed_option_count++]);
+    opt->is_inline = 1;
+  }
+  else
+  {
+    opt = (multi_option_t *)lwm2m_malloc(sizeof(multi_option_t));
+    if (opt == NULL)
+    {
+      return;
+    }
+    opt->is_inline = 0;
+  }
+  opt->next = NULL;
+  opt->is_static = 1;
+  opt->len = (uint8_t)option_len;
+  opt->data = option;
+
+  **tail = opt;
+  *tail = &(opt->next);
 }
 /*-----------------------------------------------------------------------------------*/
 coap_status_t
@@ -621,6 +671,9 @@ coap_parse_message(void *packet, uint8_t *data, uint16_t data_len)
   unsigned int option_delta = 0;
   size_t option_length = 0;
   unsigned int *x;
+  multi_option_t **uri_path_tail;
+  multi_option_t **uri_query_tail;
+  multi_option_t **location_path_tail;
 
   /* Initialize packet */
   memset(coap_pkt, 0, sizeof(coap_packet_t));
@@ -628,6 +681,10 @@ coap_parse_message(void *packet, uint8_t *data, uint16_t data_len)
   /* pointer to packet bytes */
   coap_pkt->buffer = data;
 
+  uri_path_tail = &(coap_pkt->uri_path);
+  uri_query_tail = &(coap_pkt->uri_query);
+  location_path_tail = &(coap_pkt->location_path);
+
   /* parse header fields */
   coap_pkt->version = (COAP_HEADER_VERSION_MASK & coap_pkt->buffer[0])>>COAP_HEADER_VERSION_POSITION;
   coap_pkt->type = (COAP_HEADER_TYPE_MASK & coap_pkt->buffer[0])>>COAP_HEADER_TYPE_POSITION;
@@ -776,18 +833,18 @@ coap_parse_message(void *packet, uint8_t *data, uint16_t data_len)
       case COAP_OPTION_URI_PATH:
         /* coap_merge_multi_option() operates in-place on the IPBUF, but final packet field should be const string -> cast to string */
         // coap_merge_multi_option( (char **) &(coap_pkt->uri_path), &(coap_pkt->uri_path_len), current_option, option_length, 0);
-        coap_add_multi_option( &(coap_pkt->uri_path), current_option, option_length, 1);
+        coap_add_parsed_option(coap_pkt, &uri_path_tail, current_option, option_length);
         PRINTF("Uri-Path [%.*s]\n", option_length, current_option);
         break;
       case COAP_OPTION_URI_QUERY:
         /* coap_merge_multi_option() operates in-place on the IPBUF, but final packet field should be const string -> cast to string */
         // coap_merge_multi_option( (char **) &(coap_pkt->uri_query), &(coap_pkt->uri_query_len), current_option, option_length, '&');
-        coap_add_multi_option( &(coap_pkt->uri_query), current_option, option_length, 1);
+        coap_add_parsed_option(coap_pkt, &uri_query_tail, current_option, option_length);
         PRINTF("Uri-Query [%.*s]\n", option_length, current_option);
         break;
 
       case COAP_OPTION_LOCATION_PATH:
-        coap_add_multi_option( &(coap_pkt->location_path), current_option, option_length, 1);
+        coap_add_parsed_option(coap_pkt, &location_path_tail, current_option, option_length);
         break;
       case COAP_OPTION_LOCATION_QUERY:
         /* coap_merge_multi_option() operates in-place on the IPBUF, but final packet field should be const string -> cast to string */
@@ -829,6 +886,10 @@ coap_parse_message(void *packet, uint8_t *data, uint16_t data_len)
         coap_pkt->size = coap_parse_int_option(current_option, option_length);
         PRINTF("Size [%lu]\n", coap_pkt->size);
         break;
+      case COAP_OPTION_SIZE1:
+        coap_pkt->size1 = coap_parse_int_option(current_option, option_length);
+        PRINTF("Size1 [%lu]\n", coap_pkt->size1);
+        break;
       default:
         PRINTF("unknown (%u)\n", option_number);
         /* Check if critical (odd) */
@@ -1356,6 +1417,27 @@ coap_set_header_size(void *packet, uint32_t size)
   return 1;
 }
 /*-----------------------------------------------------------------------------------*/
+int
+coap_get_header_size1(void *packet, uint32_t *size)
+{
+  coap_packet_t *const coap_pkt = (coap_packet_t *) packet;
+
+  if (!IS_OPTION(coap_pkt, COAP_OPTION_SIZE1)) return 0;
+
+  *size = coap_pkt->size1;
+  return 1;
+}
+
+int
+coap_set_header_size1(void *packet, uint32_t size)
+{
+  coap_packet_t *const coap_pkt = (coap_packet_t *) packet;
+
+  coap_pkt->size1 = size;
+  SET_OPTION(coap_pkt, COAP_OPTION_SIZE1);
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
 /*- PAYLOAD -------------------------------------------------------------------------*/
 /*-----------------------------------------------------------------------------------*/
 int
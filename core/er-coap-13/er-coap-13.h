@@ -178,6 +178,7 @@ typedef enum {
   COAP_OPTION_BLOCK1 = 27,        /* 1-3 B */
   COAP_OPTION_SIZE = 28,          /* 0-4 B */
   COAP_OPTION_PROXY_URI = 35,     /* 1-270 B */
+  COAP_OPTION_SIZE1 = 60,         /* 0-4 B */
   OPTION_MAX_VALUE = 0xFFFF
 } coap_option_t;
 
@@ -210,11 +211,17 @@ typedef enum {
 
 typedef struct _multi_option_t {
   struct _multi_option_t *next;
-  uint8_t is_static;
+  uint8_t is_static; /* data is not allocated */
+  uint8_t is_inline; /* node is part of a coap_packet_t, not allocated */
   uint8_t len;
   uint8_t *data;
 } multi_option_t;
 
+/* Number of Uri-Path, Uri-Query and Location-Path options parsed without allocation */
+#ifndef COAP_MAX_PARSED_OPTIONS
+#define COAP_MAX_PARSED_OPTIONS 8
+#endif
+
 /* Parsed message struct */
 typedef struct {
   uint8_t *buffer; /* pointer to CoAP header / incoming packet buffer / memory to serialize packet */
@@ -224,7 +231,7 @@ typedef struct {
   uint8_t code;
   uint16_t mid;
 
-  uint8_t options[COAP_OPTION_PROXY_URI / OPTION_MAP_SIZE + 1]; /* Bitmap to check if option is set */
+  uint8_t options[COAP_OPTION_SIZE1 / OPTION_MAP_SIZE + 1]; /* Bitmap to check if option is set */
 
   coap_content_type_t content_type; /* Parse options once and store; allows setting options in random order  */
   uint32_t max_age;
@@ -255,12 +262,16 @@ typedef struct {
   uint16_t block1_size;
   uint32_t block1_offset;
   uint32_t size;
+  uint32_t size1;
   multi_option_t *uri_query;
   uint8_t if_none_match;
 
   uint16_t payload_len;
   uint8_t *payload;
 
+  /* storage of the parsed multi options, pointing into buffer */
+  uint8_t parsed_option_count;
+  multi_option_t parsed_options[COAP_MAX_PARSED_OPTIONS];
 } coap_packet_t;
 
 /* Option format serialization*/
@@ -327,6 +338,8 @@ uint16_t coap_get_mid(void);
 void coap_init_message(void *packet, coap_message_type_t type, uint8_t code, uint16_t mid);
 size_t coap_serialize_get_size(void *packet);
 size_t coap_serialize_message(void *packet, uint8_t *buffer);
+/* Serializes everything but the payload, returns the header length */
+size_t coap_serialize_header(void *packet, uint8_t *buffer);
 coap_status_t coap_parse_message(void *request, uint8_t *data, uint16_t data_len);
 void coap_free_header(void *packet);
 
@@ -393,6 +406,9 @@ int coap_set_header_block1(void *packet, uint32_t num, uint8_t more, uint16_t si
 int coap_get_header_size(void *packet, uint32_t *size);
 int coap_set_header_size(void *packet, uint32_t size);
 
+int coap_get_header_size1(void *packet, uint32_t *size);
+int coap_set_header_size1(void *packet, uint32_t size);
+
 int coap_get_payload(void *packet, const uint8_t **payload);
 int coap_set_payload(void *packet, const void *payload, size_t length);
 
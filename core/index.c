@@ -0,0 +1,177 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Intel Corporation and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Open-addressing hash index of pointers.
+ *
+ * The index does not own the items, it only references them. Items are found
+ * by linear probing from the slot given by their hash. Removal uses backward
+ * shifting so that no tombstone is needed and probe sequences stay short.
+ * The table doubles when it becomes half full.
+ */
+
+#include "internals.h"
+
+#define INDEX_MIN_SIZE  16
+
+// FNV-1a
+size_t index_hashBuffer(const uint8_t * buffer,
+                        size_t length)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0 ; i < length ; i++)
+    {
+        hash ^= buffer[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+size_t index_hashInt(uint32_t value)
+{
+    // Knuth's multiplicative hash, folded so that the low bits used as slot are well mixed
+    uint32_t hash = value * 2654435761u;
+
+    return (size_t)(hash ^ (hash >> 16));
+}
+
+static void prv_place(void ** slots,
+                      size_t mask,
+                      size_t hash,
+                      void * itemP)
+{
+    size_t slot = hash & mask;
+
+    while (slots[slot] != NULL)
+    {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = itemP;
+}
+
+static int prv_grow(lwm2m_context_t * contextP,
+                    lwm2m_index_t * indexP,
+                    index_hash_callback_t hashFunc)
+{
+    void ** newSlots;
+    size_t newSize;
+    size_t i;
+
+    newSize = indexP->size == 0 ? INDEX_MIN_SIZE : indexP->size * 2;
+    newSlots = (void **)memory_alloc(contextP, newSize * sizeof(void *));
+    if (newSlots == NULL) return -1;
+    memset(newSlots, 0, newSize * sizeof(void *));
+
+    for (i = 0 ; i < indexP->size ; i++)
+    {
+        if (indexP->slots[i] != NULL)
+        {
+            prv_place(newSlots, newSize - 1, hashFunc(indexP->slots[i]), indexP->slots[i]);
+        }
+    }
+
+    if (indexP->slots != NULL) memory_free(contextP, indexP->slots);
+    indexP->slots = newSlots;
+    indexP->size = newSize;
+
+    return 0;
+}
+
+int index_insert(lwm2m_context_t * contextP,
+                 lwm2m_index_t * indexP,
+                 void * itemP,
+                 index_hash_callback_t hashFunc)
+{
+    if ((indexP->count + 1) * 2 > indexP->size)
+    {
+        if (prv_grow(contextP, indexP, hashFunc) != 0) return -1;
+    }
+
+    prv_place(indexP->slots, indexP->size - 1, hashFunc(itemP), itemP);
+    indexP->count++;
+
+    return 0;
+}
+
+void * index_find(lwm2m_index_t * indexP,
+                  size_t hash,
+                  index_match_callback_t matchFunc,
+                  void * keyP)
+{
+    size_t mask;
+    size_t slot;
+
+    if (indexP->count == 0) return NULL;
+
+    mask = indexP->size - 1;
+    slot = hash & mask;
+    while (indexP->slots[slot] != NULL)
+    {
+        if (matchFunc(indexP->slots[slot], keyP)) return indexP->slots[slot];
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+void index_remove(lwm2m_index_t * indexP,
+                  void * itemP,
+                  index_hash_callback_t hashFunc)
+{
+    size_t mask;
+    size_t slot;
+    size_t next;
+
+    if (indexP->count == 0) return;
+
+    mask = indexP->size - 1;
+    slot = hashFunc(itemP) & mask;
+    while (indexP->slots[slot] != itemP)
+    {
+        if (indexP->slots[slot] == NULL) return;
+        slot = (slot + 1) & mask;
+    }
+
+    indexP->slots[slot] = NULL;
+    indexP->count--;
+
+    // shift back the following items of the cluster which can not be reached anymore
+    next = (slot + 1) & mask;
+    while (indexP->slots[next] != NULL)
+    {
+        size_t home;
+
+        home = hashFunc(indexP->slots[next]) & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            indexP->slots[slot] = indexP->slots[next];
+            indexP->slots[next] = NULL;
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+void index_clear(lwm2m_context_t * contextP,
+                 lwm2m_index_t * indexP)
+{
+    if (indexP->slots != NULL) memory_free(contextP, indexP->slots);
+    memset(indexP, 0, sizeof(lwm2m_index_t));
+}
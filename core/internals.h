@@ -230,6 +230,50 @@ typedef enum
     URI_DEPTH_RESOURCE_INSTANCE
 } uri_depth_t;
 
+// the maximum payload transferred by block1 we accumulate per transfer
+#ifndef MAX_BLOCK1_SIZE
+#define MAX_BLOCK1_SIZE 4096
+#endif
+
+// block size of the payloads sent by block1 when the peer did not negotiate one
+#ifndef LWM2M_DEFAULT_BLOCK_SIZE
+#define LWM2M_DEFAULT_BLOCK_SIZE 512
+#endif
+
+// the maximum response body received by block2 we accumulate per transaction,
+// at most 65535 as coap_packet_t::payload_len is 16 bits
+#ifndef MAX_BLOCK2_SIZE
+#define MAX_BLOCK2_SIZE 16384
+#endif
+
+// outgoing messages up to this size are serialized on the stack by message_send()
+#ifndef LWM2M_SEND_BUFFER_SIZE
+#define LWM2M_SEND_BUFFER_SIZE (COAP_HEADER_LEN + COAP_TOKEN_LEN + 64 + REST_MAX_CHUNK_SIZE)
+#endif
+
+// the header of a notification: header, token room, Observe and Content-Format options and payload marker
+#define LWM2M_NOTIFY_HEADER_SIZE (COAP_HEADER_LEN + COAP_TOKEN_LEN + 16)
+
+// A notification serialized once for all the watchers of an observed item.
+// Per watcher, only the message ID, the token and the Observe value are patched.
+typedef struct
+{
+    uint8_t            header[LWM2M_NOTIFY_HEADER_SIZE];
+    uint8_t            firstByte;      // version and type, without the token length
+    uint8_t            code;
+    size_t             optionsLength;  // options and payload marker, serialized after the token room
+    lwm2m_media_type_t format;
+    uint8_t *          payload;
+    size_t             payloadLength;
+    uint8_t *          buffer;         // header room followed by a copy of the payload, see message_sendNotify()
+} notify_template_t;
+
+struct _lwm2m_packet_workspace_
+{
+    coap_packet_t message;
+    coap_packet_t response;
+};
+
 #ifdef LWM2M_BOOTSTRAP_SERVER_MODE
 typedef struct
 {
@@ -240,6 +284,105 @@ typedef struct
 } bs_data_t;
 #endif
 
+#ifdef LWM2M_SUPPORT_JSON
+#define JSON_TOKEN_MAX_LEN  64
+
+// state of the streaming JSON parser, private to json.c
+typedef struct
+{
+    int         state;
+    int         key;
+    uint16_t    found;          // keys already seen at the top-level and in the current record
+    bool        inRecord;
+    bool        escaped;
+    bool        persistent;
+    uint8_t     token[JSON_TOKEN_MAX_LEN];
+    size_t      tokenLen;
+    uint8_t *   stringP;        // start of the current string value in the current chunk
+    bool        stringCopied;
+    size_t      stringOffset;
+    void *      recordArray;
+    size_t      recordCount;
+    size_t      recordSize;
+    uint8_t *   text;           // string values copied from the chunks
+    size_t      textLen;
+    size_t      textSize;
+    bool        baseIsRoot;
+    lwm2m_uri_t baseUri;
+} json_parser_t;
+#endif
+
+// defined in index.c
+typedef size_t (*index_hash_callback_t) (void * itemP);
+typedef bool (*index_match_callback_t) (void * itemP, void * keyP);
+size_t index_hashBuffer(const uint8_t * buffer, size_t length);
+size_t index_hashInt(uint32_t value);
+int index_insert(lwm2m_context_t * contextP, lwm2m_index_t * indexP, void * itemP, index_hash_callback_t hashFunc);
+void * index_find(lwm2m_index_t * indexP, size_t hash, index_match_callback_t matchFunc, void * keyP);
+void index_remove(lwm2m_index_t * indexP, void * itemP, index_hash_callback_t hashFunc);
+void index_clear(lwm2m_context_t * contextP, lwm2m_index_t * indexP);
+
+// defined in timer.c
+void timer_init(lwm2m_timer_t * timerP, lwm2m_timer_callback_t callback, void * itemP);
+int timer_schedule(lwm2m_context_t * contextP, lwm2m_timer_t * timerP, time_t deadline);
+void timer_cancel(lwm2m_context_t * contextP, lwm2m_timer_t * timerP);
+void timer_step(lwm2m_context_t * contextP, time_t currentTime, time_t * timeoutP);
+void timer_clear(lwm2m_context_t * contextP);
+
+// defined in memory.c
+void * memory_alloc(lwm2m_context_t * contextP, size_t size);
+void memory_free(lwm2m_context_t * contextP, void * ptr);
+void * memory_poolAlloc(lwm2m_context_t * contextP, lwm2m_pool_id_t id);
+void memory_poolFree(void * objectP);
+void * memory_arenaAlloc(lwm2m_context_t * contextP, size_t size);
+bool memory_arenaOwns(lwm2m_context_t * contextP, void * ptr);
+void memory_arenaReset(lwm2m_context_t * contextP);
+void memory_clear(lwm2m_context_t * contextP);
+
+// defined in peer.c
+// the transactions to a peer keep it alive, NULL when out of memory
+lwm2m_peer_t * peer_acquire(lwm2m_context_t * contextP, void * sessionH, time_t currentTime);
+void peer_release(lwm2m_peer_t * peerP);
+// timeouts are in milliseconds, peerP can be NULL
+uint32_t peer_getRto(lwm2m_peer_t * peerP, time_t currentTime);
+uint32_t peer_initialTimeout(uint32_t rto);
+uint32_t peer_nextTimeout(uint32_t rto, uint32_t timeout);
+void peer_addSample(lwm2m_peer_t * peerP, time_t currentTime, time_t rtt, int retransmissions);
+// returns true if transacP can be sent, otherwise it is queued until peer_endExchange() hands it back
+bool peer_startExchange(lwm2m_peer_t * peerP, lwm2m_transaction_t * transacP, time_t currentTime);
+// returns the queued transaction to send next, if any
+lwm2m_transaction_t * peer_endExchange(lwm2m_peer_t * peerP, lwm2m_transaction_t * transacP);
+void peer_unqueue(lwm2m_peer_t * peerP, lwm2m_transaction_t * transacP);
+void peer_clear(lwm2m_context_t * contextP);
+
+// defined in dedup.c
+// returns true if the datagram is a duplicate of a confirmable request, its ACK was sent again
+bool dedup_check(lwm2m_context_t * contextP, uint8_t * buffer, size_t length, void * fromSessionH);
+// keeps the ACK to the request passed to the last dedup_check()
+void dedup_store(lwm2m_context_t * contextP, void * sessionH, uint16_t mid, uint8_t * header, size_t headerLength, uint8_t * payload, size_t payloadLength);
+void dedup_clear(lwm2m_context_t * contextP);
+
+// defined in block2.c
+// returns true if the body of the response to message was cached, it is set in response
+bool block2_load(lwm2m_context_t * contextP, void * sessionH, coap_packet_t * message, coap_packet_t * response);
+// sets the ETag of the response and caches its body for the following blocks
+void block2_store(lwm2m_context_t * contextP, void * sessionH, coap_packet_t * message, coap_packet_t * response);
+void block2_clear(lwm2m_context_t * contextP);
+
+// defined in sendqueue.c
+#ifdef LWM2M_WITH_SEND_QUEUE
+// datagrams are queued between sendqueue_hold() and the matching sendqueue_release()
+void sendqueue_hold(lwm2m_context_t * contextP);
+void sendqueue_release(lwm2m_context_t * contextP);
+// returns false if the queue is not held or is out of memory, the caller sends the datagram itself.
+bool sendqueue_push(lwm2m_context_t * contextP, void * sessionH, uint8_t * header, size_t headerLength, uint8_t * payload, size_t payloadLength);
+// same as sendqueue_push() but only the header is copied, payload must stay valid until the flush.
+bool sendqueue_pushGather(lwm2m_context_t * contextP, void * sessionH, uint8_t * header, size_t headerLength, uint8_t * payload, size_t payloadLength);
+// drops the datagrams queued for sessionH with payload, e.g. before the storage of payload is freed.
+void sendqueue_forget(lwm2m_context_t * contextP, void * sessionH, uint8_t * payload);
+void sendqueue_clear(lwm2m_context_t * contextP);
+#endif
+
 // defined in uri.c
 lwm2m_uri_t * uri_decode(char * altPath, multi_option_t *uriPath);
 int uri_getNumber(uint8_t * uriString, size_t uriLength);
@@ -263,12 +406,15 @@ uint8_t object_createInstance(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lw
 uint8_t object_writeInstance(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lwm2m_data_t * dataP);
 
 // defined in transaction.c
-lwm2m_transaction_t * transaction_new(void * sessionH, coap_method_t method, char * altPath, lwm2m_uri_t * uriP, uint16_t mID, uint8_t token_len, uint8_t* token);
+lwm2m_transaction_t * transaction_new(lwm2m_context_t * contextP, void * sessionH, coap_method_t method, char * altPath, lwm2m_uri_t * uriP, uint16_t mID, uint8_t token_len, uint8_t* token);
 int transaction_send(lwm2m_context_t * contextP, lwm2m_transaction_t * transacP);
-void transaction_free(lwm2m_transaction_t * transacP);
+void transaction_free(lwm2m_context_t * contextP, lwm2m_transaction_t * transacP);
+// the payload of the request is sent by blocks of blockSize bytes, read by reader or from a copy of buffer if reader is NULL
+int transaction_setBlock1(lwm2m_context_t * contextP, lwm2m_transaction_t * transacP, uint16_t blockSize, size_t length, uint8_t * buffer, lwm2m_block_reader_t reader, void * readerData);
+// adds transacP to the transactionList of contextP
+void transaction_add(lwm2m_context_t * contextP, lwm2m_transaction_t * transacP);
 void transaction_remove(lwm2m_context_t * contextP, lwm2m_transaction_t * transacP);
 bool transaction_handleResponse(lwm2m_context_t * contextP, void * fromSessionH, coap_packet_t * message, coap_packet_t * response);
-void transaction_step(lwm2m_context_t * contextP, time_t currentTime, time_t * timeoutP);
 
 // defined in management.c
 uint8_t dm_handleRequest(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lwm2m_server_t * serverP, coap_packet_t * message, coap_packet_t * response);
@@ -277,7 +423,6 @@ uint8_t dm_handleRequest(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lwm2m_s
 uint8_t observe_handleRequest(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lwm2m_server_t * serverP, int size, lwm2m_data_t * dataP, coap_packet_t * message, coap_packet_t * response);
 void observe_cancel(lwm2m_context_t * contextP, uint16_t mid, void * fromSessionH);
 uint8_t observe_setParameters(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lwm2m_server_t * serverP, lwm2m_attributes_t * attrP);
-void observe_step(lwm2m_context_t * contextP, time_t currentTime, time_t * timeoutP);
 void observe_clear(lwm2m_context_t * contextP, lwm2m_uri_t * uriP);
 bool observe_handleNotify(lwm2m_context_t * contextP, void * fromSessionH, coap_packet_t * message, coap_packet_t * response);
 void observe_remove(lwm2m_observation_t * observationP);
@@ -287,12 +432,19 @@ lwm2m_observed_t * observe_findByUri(lwm2m_context_t * contextP, lwm2m_uri_t * u
 uint8_t registration_handleRequest(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, void * fromSessionH, coap_packet_t * message, coap_packet_t * response);
 void registration_deregister(lwm2m_context_t * contextP, lwm2m_server_t * serverP);
 void registration_freeClient(lwm2m_client_t * clientP);
+#ifdef LWM2M_SERVER_MODE
+lwm2m_client_t * registration_findClient(lwm2m_context_t * contextP, uint16_t clientID);
+void registration_clearClientIndex(lwm2m_context_t * contextP);
+#endif
 uint8_t registration_start(lwm2m_context_t * contextP);
 void registration_step(lwm2m_context_t * contextP, time_t currentTime, time_t * timeoutP);
 lwm2m_status_t registration_getStatus(lwm2m_context_t * contextP);
 
 // defined in packet.c
 uint8_t message_send(lwm2m_context_t * contextP, coap_packet_t * message, void * sessionH);
+uint8_t message_initNotify(notify_template_t * templateP, uint8_t code, lwm2m_media_type_t format, uint8_t * payload, size_t payloadLength);
+uint8_t message_sendNotify(lwm2m_context_t * contextP, notify_template_t * templateP, uint16_t mid, uint8_t * token, size_t tokenLen, uint32_t counter, void * sessionH);
+void message_clearNotify(notify_template_t * templateP);
 
 // defined in bootstrap.c
 void bootstrap_step(lwm2m_context_t * contextP, uint32_t currentTime, time_t* timeoutP);
@@ -303,13 +455,24 @@ uint8_t bootstrap_handleRequest(lwm2m_context_t * contextP, lwm2m_uri_t * uriP,
 void bootstrap_start(lwm2m_context_t * contextP);
 lwm2m_status_t bootstrap_getStatus(lwm2m_context_t * contextP);
 
+// defined in data.c
+// with a non-nil contextP, the data is allocated in the context arena and parsed values point into the input
+lwm2m_data_t * data_new(lwm2m_context_t * contextP, int size);
+void data_free(lwm2m_context_t * contextP, int size, lwm2m_data_t * dataP);
+int data_parse(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, uint8_t * buffer, size_t bufferLen, lwm2m_media_type_t format, lwm2m_data_t ** dataP);
+
 // defined in tlv.c
-int tlv_parse(uint8_t * buffer, size_t bufferLen, lwm2m_data_t ** dataP);
+int tlv_parse(lwm2m_context_t * contextP, uint8_t * buffer, size_t bufferLen, lwm2m_data_t ** dataP);
 int tlv_serialize(bool isResourceInstance, int size, lwm2m_data_t * dataP, uint8_t ** bufferP);
 
 // defined in json.c
 #ifdef LWM2M_SUPPORT_JSON
-int json_parse(lwm2m_uri_t * uriP, uint8_t * buffer, size_t bufferLen, lwm2m_data_t ** dataP);
+// the input can be fed in chunks. If persistent is true, the chunks must stay valid until json_parserFinish()
+void json_parserInit(json_parser_t * parserP, bool persistent);
+int json_parserFeed(json_parser_t * parserP, uint8_t * buffer, size_t bufferLen);
+int json_parserFinish(json_parser_t * parserP, lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lwm2m_data_t ** dataP);
+void json_parserClear(json_parser_t * parserP);
+int json_parse(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, uint8_t * buffer, size_t bufferLen, lwm2m_data_t ** dataP);
 int json_serialize(lwm2m_uri_t * uriP, int size, lwm2m_data_t * tlvP, uint8_t ** bufferP);
 #endif
 
@@ -317,8 +480,12 @@ int json_serialize(lwm2m_uri_t * uriP, int size, lwm2m_data_t * tlvP, uint8_t **
 int discover_serialize(lwm2m_context_t * contextP, lwm2m_uri_t * uriP, lwm2m_server_t * serverP, int size, lwm2m_data_t * dataP, uint8_t ** bufferP);
 
 // defined in block1.c
-uint8_t coap_block1_handler(lwm2m_block1_data_t ** block1Data, uint16_t mid, uint8_t * buffer, size_t length, uint16_t blockSize, uint32_t blockNum, bool blockMore, uint8_t ** outputBuffer, size_t * outputLength);
-void free_block1_buffer(lwm2m_block1_data_t * block1Data);
+uint8_t coap_block1_handler(lwm2m_context_t * contextP, lwm2m_block1_data_t ** pBlock1Data, coap_packet_t * message, uint8_t ** outputBuffer, size_t * outputLength);
+#ifdef LWM2M_CLIENT_MODE
+// hands a block written to an object with a writeStreamFunc to it. Returns NO_ERROR if the payload is reassembled instead.
+uint8_t coap_block1_stream(lwm2m_context_t * contextP, lwm2m_server_t * serverP, coap_packet_t * message);
+#endif
+void free_block1_buffer(lwm2m_context_t * contextP, lwm2m_block1_data_t * block1Data);
 
 // defined in utils.c
 lwm2m_data_type_t utils_depthToDatatype(uri_depth_t depth);
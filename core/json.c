@@ -27,10 +27,8 @@
 
 #define PRV_JSON_BUFFER_SIZE 1024
 
-#define JSON_MIN_ARRAY_LEN      21      // e":[{"n":"N","v":X}]}
-#define JSON_MIN_BASE_LEN        7      // n":"N",
-#define JSON_ITEM_MAX_SIZE      36      // with ten characters for value
-#define JSON_MIN_BX_LEN          5      // bt":1
+#define JSON_RECORD_MIN_COUNT    8
+#define JSON_TEXT_MIN_SIZE      64
 
 #define JSON_FALSE_STRING  "false"
 #define JSON_TRUE_STRING   "true"
@@ -59,30 +57,46 @@
 #define JSON_FOOTER             "]}"
 #define JSON_FOOTER_SIZE        2
 
+#define JSON_KEY_BIT(K)         (1 << (K))
+#define JSON_RECORD_KEYS        (JSON_KEY_BIT(_KEY_N) | JSON_KEY_BIT(_KEY_V) | JSON_KEY_BIT(_KEY_BV) \
+                               | JSON_KEY_BIT(_KEY_SV) | JSON_KEY_BIT(_KEY_OV) | JSON_KEY_BIT(_KEY_T))
 
-#define _GO_TO_NEXT_CHAR(I,B,L)         \
-    {                                   \
-        I++;                            \
-        I += prv_skipSpace(B+I, L-I);   \
-        if (I == L) goto error;         \
-    }
+typedef enum
+{
+    _STATE_START,
+    _STATE_KEY_START,
+    _STATE_KEY,
+    _STATE_COLON,
+    _STATE_VALUE_START,
+    _STATE_STRING,
+    _STATE_LITERAL,
+    _STATE_TOP_NEXT,
+    _STATE_RECORD_START,
+    _STATE_RECORD_NEXT,
+    _STATE_ARRAY_NEXT,
+    _STATE_DONE,
+    _STATE_ERROR
+} _state;
 
 typedef enum
 {
-    _STEP_START,
-    _STEP_TOKEN,
-    _STEP_ANY_SEPARATOR,
-    _STEP_SEPARATOR,
-    _STEP_QUOTED_VALUE,
-    _STEP_VALUE,
-    _STEP_DONE
-} _itemState;
+    _KEY_E,
+    _KEY_BN,
+    _KEY_BT,
+    _KEY_N,
+    _KEY_V,
+    _KEY_BV,
+    _KEY_SV,
+    _KEY_OV,
+    _KEY_T
+} _key;
 
 typedef enum
 {
     _TYPE_UNSET,
     _TYPE_FALSE,
     _TYPE_TRUE,
+    _TYPE_INTEGER,
     _TYPE_FLOAT,
     _TYPE_STRING
 } _type;
@@ -91,8 +105,15 @@ typedef struct
 {
     uint16_t    ids[4];
     _type       type;
-    uint8_t *   value;
-    size_t      valueLen;
+    union
+    {
+        int64_t asInteger;
+        double  asFloat;
+    } value;
+    uint8_t *   string;         // nil if the string was copied in the parser text
+    size_t      stringOffset;
+    size_t      stringLen;
+    size_t      order;
 } _record_t;
 
 static int prv_isReserved(char sign)
@@ -124,909 +145,858 @@ static int prv_isWhiteSpace(uint8_t sign)
     return 0;
 }
 
-static size_t prv_skipSpace(uint8_t * buffer,
-                            size_t bufferLen)
+static int prv_findKey(bool inRecord,
+                       uint8_t * token,
+                       size_t tokenLen)
 {
-    size_t i;
-
-    i = 0;
-    while ((i < bufferLen)
-        && prv_isWhiteSpace(buffer[i]))
+    if (tokenLen == 1)
     {
-        i++;
+        switch (token[0])
+        {
+        case 'e':
+            return inRecord ? -1 : _KEY_E;
+        case 'n':
+            return inRecord ? _KEY_N : -1;
+        case 'v':
+            return inRecord ? _KEY_V : -1;
+        case 't':
+            return inRecord ? _KEY_T : -1;
+        default:
+            return -1;
+        }
+    }
+    if (tokenLen == 2)
+    {
+        if (token[0] == 'b' && token[1] == 'n') return inRecord ? -1 : _KEY_BN;
+        if (token[0] == 'b' && token[1] == 't') return inRecord ? -1 : _KEY_BT;
+        if (token[1] != 'v' || !inRecord) return -1;
+        switch (token[0])
+        {
+        case 'b':
+            return _KEY_BV;
+        case 's':
+            return _KEY_SV;
+        case 'o':
+            return _KEY_OV;
+        default:
+            return -1;
+        }
     }
 
-    return i;
+    return -1;
 }
 
-static int prv_split(uint8_t * buffer,
-                     size_t bufferLen,
-                     int * tokenStartP,
-                     int * tokenLenP,
-                     int * valueStartP,
-                     int * valueLenP)
+static bool prv_pushToken(json_parser_t * parserP,
+                          uint8_t sign)
 {
-    size_t index;
-    _itemState step;
+    if (parserP->tokenLen == JSON_TOKEN_MAX_LEN) return false;
+    parserP->token[parserP->tokenLen] = sign;
+    parserP->tokenLen++;
 
-    index = 0;
-    step = _STEP_START;
-
-    index = prv_skipSpace(buffer + index, bufferLen - index);
-    if (index == bufferLen) return -1;
+    return true;
+}
 
-    while ((index < bufferLen)
-        && (buffer[index] != ','))
+static bool prv_appendText(json_parser_t * parserP,
+                           uint8_t * buffer,
+                           size_t length)
+{
+    if (parserP->textLen + length > parserP->textSize)
     {
-        switch (step)
+        uint8_t * newText;
+        size_t newSize;
+
+        newSize = parserP->textSize == 0 ? JSON_TEXT_MIN_SIZE : parserP->textSize;
+        while (newSize < parserP->textLen + length) newSize *= 2;
+        newText = (uint8_t *)lwm2m_malloc(newSize);
+        if (newText == NULL) return false;
+        if (parserP->text != NULL)
         {
-        case _STEP_START:
-            if (buffer[index] != '"') return -1;
-            *tokenStartP = index+1;
-            step = _STEP_TOKEN;
-            break;
-
-        case _STEP_TOKEN:
-            if (buffer[index] == '"')
-            {
-                *tokenLenP = index - *tokenStartP;
-                step = _STEP_ANY_SEPARATOR;
-            }
-            break;
-
-        case _STEP_ANY_SEPARATOR:
-            if (buffer[index] != ':') return -1;
-            step = _STEP_SEPARATOR;
-            break;
+            memcpy(newText, parserP->text, parserP->textLen);
+            lwm2m_free(parserP->text);
+        }
+        parserP->text = newText;
+        parserP->textSize = newSize;
+    }
+    if (length > 0)
+    {
+        memcpy(parserP->text + parserP->textLen, buffer, length);
+        parserP->textLen += length;
+    }
 
-        case _STEP_SEPARATOR:
-            if (buffer[index] == '"')
-            {
-                *valueStartP = index;
-                step = _STEP_QUOTED_VALUE;
-            } else if (!prv_isReserved(buffer[index]))
-            {
-                *valueStartP = index;
-                step = _STEP_VALUE;
-            } else
-            {
-                return -1;
-            }
-            break;
+    return true;
+}
 
-        case _STEP_QUOTED_VALUE:
-            if (buffer[index] == '"' && buffer[index-1] != '\\' )
-            {
-                *valueLenP = index - *valueStartP + 1;
-                step = _STEP_DONE;
-            }
-            break;
+static _record_t * prv_currentRecord(json_parser_t * parserP)
+{
+    return (_record_t *)parserP->recordArray + parserP->recordCount - 1;
+}
 
-        case _STEP_VALUE:
-            if (prv_isWhiteSpace(buffer[index]))
-            {
-                *valueLenP = index - *valueStartP;
-                step = _STEP_DONE;
-            }
-            break;
+static bool prv_newRecord(json_parser_t * parserP)
+{
+    _record_t * recordP;
 
-        case _STEP_DONE:
-        default:
-            return -1;
-        }
+    if (parserP->recordCount == parserP->recordSize)
+    {
+        _record_t * newArray;
+        size_t newSize;
 
-        index++;
-        if (step == _STEP_START
-         || step == _STEP_ANY_SEPARATOR
-         || step == _STEP_SEPARATOR
-         || step == _STEP_DONE)
+        newSize = parserP->recordSize == 0 ? JSON_RECORD_MIN_COUNT : parserP->recordSize * 2;
+        newArray = (_record_t *)lwm2m_malloc(newSize * sizeof(_record_t));
+        if (newArray == NULL) return false;
+        if (parserP->recordArray != NULL)
         {
-            index += prv_skipSpace(buffer + index, bufferLen - index);
+            memcpy(newArray, parserP->recordArray, parserP->recordCount * sizeof(_record_t));
+            lwm2m_free(parserP->recordArray);
         }
+        parserP->recordArray = newArray;
+        parserP->recordSize = newSize;
     }
 
-    if (step == _STEP_VALUE)
+    parserP->recordCount++;
+    recordP = prv_currentRecord(parserP);
+    memset(recordP, 0, sizeof(_record_t));
+    memset(recordP->ids, 0xFF, 4*sizeof(uint16_t));
+    recordP->type = _TYPE_UNSET;
+    recordP->order = parserP->recordCount;
+
+    return true;
+}
+
+// Reads "N", "N/N", ... up to four ids with an optional leading '/'.
+static bool prv_parseName(uint8_t * buffer,
+                          size_t bufferLen,
+                          uint16_t * ids)
+{
+    size_t i;
+    int j;
+
+    i = 0;
+    if (bufferLen > 0 && buffer[0] == '/') i++;
+    if (i == bufferLen) return false;
+
+    j = 0;
+    while (i < bufferLen)
     {
-        *valueLenP = index - *valueStartP;
-        step = _STEP_DONE;
-    }
+        uint32_t readId;
+        size_t start;
 
-    if (step != _STEP_DONE) return -1;
+        if (j == 4) return false;
+        readId = 0;
+        start = i;
+        while (i < bufferLen && buffer[i] != '/')
+        {
+            if (buffer[i] < '0' || buffer[i] > '9') return false;
+            readId *= 10;
+            readId += buffer[i] - '0';
+            if (readId >= LWM2M_MAX_ID) return false;
+            i++;
+        }
+        if (i == start) return false;
+        ids[j] = readId;
+        j++;
+        if (i < bufferLen) i++;
+    }
 
-    return (int)index;
+    return true;
 }
 
-static int prv_countItems(uint8_t * buffer,
-                          size_t bufferLen)
+static bool prv_endString(json_parser_t * parserP,
+                          uint8_t * endP)
 {
-    int count;
-    size_t index;
-    int in;
-
-    count = 0;
-    index = 0;
-    in = 0;
+    _record_t * recordP;
 
-    while (index < bufferLen)
+    switch (parserP->key)
     {
-        if (in == 0)
+    case _KEY_BN:
+        if (parserP->tokenLen == 1 && parserP->token[0] == '/')
         {
-            if (buffer[index] != '{') return -1;
-            in = 1;
-            _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
+            parserP->baseIsRoot = true;
         }
         else
         {
-            if (buffer[index] == '{') return -1;
-            if (buffer[index] == '}')
-            {
-                in = 0;
-                count++;
-                _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-                if (buffer[index] == ']')
-                {
-                    break;
-                }
-                if (buffer[index] != ',') return -1;
-                _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-            }
-            else
-            {
-                _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-            }
+            int res;
+
+            res = lwm2m_stringToUri((char *)parserP->token, parserP->tokenLen, &parserP->baseUri);
+            if (res <= 0 || res != (int)parserP->tokenLen) return false;
         }
-    }
-    if (in == 1) return -1;
+        return true;
 
-    return count;
+    case _KEY_N:
+        recordP = prv_currentRecord(parserP);
+        return prv_parseName(parserP->token, parserP->tokenLen, recordP->ids);
 
-error:
-    return -1;
+    case _KEY_SV:
+        recordP = prv_currentRecord(parserP);
+        if (recordP->type != _TYPE_UNSET) return false;
+        recordP->type = _TYPE_STRING;
+        if (parserP->persistent && !parserP->stringCopied)
+        {
+            recordP->string = parserP->stringP;
+            recordP->stringLen = endP - parserP->stringP;
+        }
+        else
+        {
+            if (!prv_appendText(parserP, parserP->stringP, endP - parserP->stringP)) return false;
+            recordP->string = NULL;
+            recordP->stringOffset = parserP->stringOffset;
+            recordP->stringLen = parserP->textLen - parserP->stringOffset;
+        }
+        return true;
+
+    case _KEY_OV:
+    default:
+        // TODO: support object link
+        return false;
+    }
 }
 
-static int prv_parseItem(uint8_t * buffer,
-                         size_t bufferLen,
-                         _record_t * recordP)
+static bool prv_endLiteral(json_parser_t * parserP)
 {
-    size_t index;
+    _record_t * recordP;
 
-    memset(recordP->ids, 0xFF, 4*sizeof(uint16_t));
-    recordP->type = _TYPE_UNSET;
-    recordP->value = NULL;
-    recordP->valueLen = 0;
-
-    index = 0;
-    do
+    switch (parserP->key)
     {
-        int tokenStart;
-        int tokenLen;
-        int valueStart;
-        int valueLen;
-        int next;
+    case _KEY_V:
+    {
+        size_t i;
 
-        next = prv_split(buffer+index, bufferLen-index, &tokenStart, &tokenLen, &valueStart, &valueLen);
-        if (next < 0) return -1;
+        recordP = prv_currentRecord(parserP);
+        if (recordP->type != _TYPE_UNSET) return false;
+        i = 0;
+        while (i < parserP->tokenLen
+            && parserP->token[i] != '.')
+        {
+            i++;
+        }
+        if (i == parserP->tokenLen)
+        {
+            if (1 != utils_textToInt(parserP->token, parserP->tokenLen, &recordP->value.asInteger)) return false;
+            recordP->type = _TYPE_INTEGER;
+        }
+        else
+        {
+            if (1 != utils_textToFloat(parserP->token, parserP->tokenLen, &recordP->value.asFloat)) return false;
+            recordP->type = _TYPE_FLOAT;
+        }
+        return true;
+    }
 
-        switch (tokenLen)
+    case _KEY_BV:
+        recordP = prv_currentRecord(parserP);
+        if (recordP->type != _TYPE_UNSET) return false;
+        if (parserP->tokenLen == strlen(JSON_TRUE_STRING)
+         && 0 == memcmp(JSON_TRUE_STRING, parserP->token, parserP->tokenLen))
         {
-        case 1:
+            recordP->type = _TYPE_TRUE;
+        }
+        else if (parserP->tokenLen == strlen(JSON_FALSE_STRING)
+              && 0 == memcmp(JSON_FALSE_STRING, parserP->token, parserP->tokenLen))
         {
-            switch (buffer[index+tokenStart])
-            {
-            case 'n':
-            {
-                int i;
-                int j;
+            recordP->type = _TYPE_FALSE;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
 
-                if (recordP->ids[0] != LWM2M_MAX_ID) return -1;
+    case _KEY_BT:
+    case _KEY_T:
+        // TODO: handle timed values
+        return true;
 
-                // Check for " around URI
-                if (valueLen < 3
-                 || buffer[index+valueStart] != '"'
-                 || buffer[index+valueStart+valueLen-1] != '"')
-                {
-                    return -1;
-                }
-                // Ignore starting /
-                if (buffer[index + valueStart + 1] == '/')
-                {
-                    if (valueLen < 4)
-                    {
-                        return -1;
-                    }
-                    valueStart += 1;
-                    valueLen -= 1;
-                }
-                i = 0;
-                j = 0;
-                do {
-                    uint32_t readId;
-
-                    readId = 0;
-                    i++;
-                    while (i < valueLen-1 && buffer[index+valueStart+i] != '/')
-                    {
-                        if (buffer[index+valueStart+i] < '0'
-                         || buffer[index+valueStart+i] > '9')
-                        {
-                            return -1;
-                        }
-                        readId *= 10;
-                        readId += buffer[index+valueStart+i] - '0';
-                        if (readId > LWM2M_MAX_ID) return -1;
-                        i++;
-                    }
-                    recordP->ids[j] = readId;
-                    j++;
-                } while (i < valueLen-1 && j < 4 && buffer[index+valueStart+i] == '/');
-                if (i < valueLen-1 ) return -1;
-            }
-            break;
+    default:
+        return false;
+    }
+}
 
-            case 'v':
-                if (recordP->type != _TYPE_UNSET) return -1;
-                recordP->type = _TYPE_FLOAT;
-                recordP->value = buffer + index + valueStart;
-                recordP->valueLen = valueLen;
-                break;
+// Processes one character. Returns false if the character must be processed again in the new state.
+static bool prv_step(json_parser_t * parserP,
+                     uint8_t * buffer,
+                     size_t index)
+{
+    uint8_t sign = buffer[index];
 
-            case 't':
-                // TODO: support time
-                break;
+    switch (parserP->state)
+    {
+    case _STATE_START:
+        if (prv_isWhiteSpace(sign)) break;
+        parserP->state = (sign == '{') ? _STATE_KEY_START : _STATE_ERROR;
+        break;
 
-            default:
-                return -1;
-            }
-        }
+    case _STATE_KEY_START:
+        if (prv_isWhiteSpace(sign)) break;
+        parserP->tokenLen = 0;
+        parserP->state = (sign == '"') ? _STATE_KEY : _STATE_ERROR;
         break;
 
-        case 2:
+    case _STATE_KEY:
+        if (sign == '"')
         {
-            // "bv", "ov", or "sv"
-            if (buffer[index+tokenStart+1] != 'v') return -1;
-            switch (buffer[index+tokenStart])
+            int key;
+
+            key = prv_findKey(parserP->inRecord, parserP->token, parserP->tokenLen);
+            if (key < 0 || (parserP->found & JSON_KEY_BIT(key)) != 0)
             {
-            case 'b':
-                if (recordP->type != _TYPE_UNSET) return -1;
-                if (0 == lwm2m_strncmp(JSON_TRUE_STRING, (char *)buffer + index + valueStart, valueLen))
-                {
-                    recordP->type = _TYPE_TRUE;
-                }
-                else if (0 == lwm2m_strncmp(JSON_FALSE_STRING, (char *)buffer + index + valueStart, valueLen))
-                {
-                    recordP->type = _TYPE_FALSE;
-                }
-                else
-                {
-                    return -1;
-                }
+                parserP->state = _STATE_ERROR;
                 break;
+            }
+            parserP->found |= JSON_KEY_BIT(key);
+            parserP->key = key;
+            parserP->state = _STATE_COLON;
+        }
+        else if (!prv_pushToken(parserP, sign))
+        {
+            parserP->state = _STATE_ERROR;
+        }
+        break;
 
-            case 'o':
-                if (recordP->type != _TYPE_UNSET) return -1;
-                // TODO: support object link
-                break;
+    case _STATE_COLON:
+        if (prv_isWhiteSpace(sign)) break;
+        parserP->state = (sign == ':') ? _STATE_VALUE_START : _STATE_ERROR;
+        break;
 
-            case 's':
-                if (recordP->type != _TYPE_UNSET) return -1;
-                // Check for " around value
-                if (valueLen < 2
-                 || buffer[index+valueStart] != '"'
-                 || buffer[index+valueStart+valueLen-1] != '"')
-                {
-                    return -1;
-                }
-                recordP->type = _TYPE_STRING;
-                recordP->value = buffer + index + valueStart + 1;
-                recordP->valueLen = valueLen - 2;
+    case _STATE_VALUE_START:
+        if (prv_isWhiteSpace(sign)) break;
+        parserP->tokenLen = 0;
+        if (parserP->key == _KEY_E)
+        {
+            parserP->state = (sign == '[') ? _STATE_RECORD_START : _STATE_ERROR;
+        }
+        else if (sign == '"')
+        {
+            switch (parserP->key)
+            {
+            case _KEY_BN:
+            case _KEY_N:
+            case _KEY_SV:
+            case _KEY_OV:
+                parserP->escaped = false;
+                parserP->stringP = buffer + index + 1;
+                parserP->stringCopied = false;
+                parserP->stringOffset = parserP->textLen;
+                parserP->state = _STATE_STRING;
                 break;
-
             default:
-                return -1;
+                parserP->state = _STATE_ERROR;
+                break;
             }
         }
-        break;
-
-        default:
-            return -1;
+        else if (prv_isReserved(sign)
+              || parserP->key == _KEY_BN
+              || parserP->key == _KEY_N
+              || parserP->key == _KEY_SV
+              || parserP->key == _KEY_OV)
+        {
+            parserP->state = _STATE_ERROR;
+        }
+        else
+        {
+            prv_pushToken(parserP, sign);
+            parserP->state = _STATE_LITERAL;
         }
-
-        index += next + 1;
-    } while (index < bufferLen);
-
-    return 0;
-}
-
-static bool prv_convertValue(_record_t * recordP,
-                             lwm2m_data_t * targetP)
-{
-    switch (recordP->type)
-    {
-    case _TYPE_FALSE:
-        lwm2m_data_encode_bool(false, targetP);
-        break;
-    case _TYPE_TRUE:
-        lwm2m_data_encode_bool(true, targetP);
         break;
-    case _TYPE_FLOAT:
-    {
-        size_t i;
 
-        i = 0;
-        while (i < recordP->valueLen
-            && recordP->value[i] != '.')
+    case _STATE_STRING:
+        if (!parserP->escaped && sign == '"')
         {
-            i++;
+            if (!prv_endString(parserP, buffer + index))
+            {
+                parserP->state = _STATE_ERROR;
+                break;
+            }
+            parserP->state = parserP->inRecord ? _STATE_RECORD_NEXT : _STATE_TOP_NEXT;
+            break;
         }
-        if (i == recordP->valueLen)
+        // escaped sequences are kept as is
+        parserP->escaped = !parserP->escaped && sign == '\\';
+        if (parserP->key != _KEY_SV
+         && !prv_pushToken(parserP, sign))
         {
-            int64_t value;
+            parserP->state = _STATE_ERROR;
+        }
+        break;
 
-            if ( 1 != utils_textToInt(recordP->value,
-                                      recordP->valueLen,
-                                      &value))
+    case _STATE_LITERAL:
+        if (prv_isWhiteSpace(sign) || prv_isReserved(sign))
+        {
+            if (!prv_endLiteral(parserP))
             {
-                return false;
+                parserP->state = _STATE_ERROR;
+                break;
             }
+            parserP->state = parserP->inRecord ? _STATE_RECORD_NEXT : _STATE_TOP_NEXT;
+            return false;
+        }
+        if (!prv_pushToken(parserP, sign))
+        {
+            parserP->state = _STATE_ERROR;
+        }
+        break;
 
-            lwm2m_data_encode_int(value, targetP);
+    case _STATE_TOP_NEXT:
+        if (prv_isWhiteSpace(sign)) break;
+        switch (sign)
+        {
+        case ',':
+            parserP->state = _STATE_KEY_START;
+            break;
+        case '}':
+            parserP->state = _STATE_DONE;
+            break;
+        default:
+            parserP->state = _STATE_ERROR;
+            break;
         }
-        else
+        break;
+
+    case _STATE_RECORD_START:
+        if (prv_isWhiteSpace(sign)) break;
+        if (sign != '{' || !prv_newRecord(parserP))
         {
-            double value;
+            parserP->state = _STATE_ERROR;
+            break;
+        }
+        parserP->inRecord = true;
+        parserP->found &= ~JSON_RECORD_KEYS;
+        parserP->state = _STATE_KEY_START;
+        break;
 
-            if ( 1 != utils_textToFloat(recordP->value,
-                                        recordP->valueLen,
-                                        &value))
-            {
-                return false;
-            }
+    case _STATE_RECORD_NEXT:
+        if (prv_isWhiteSpace(sign)) break;
+        switch (sign)
+        {
+        case ',':
+            parserP->state = _STATE_KEY_START;
+            break;
+        case '}':
+            parserP->inRecord = false;
+            parserP->state = (prv_currentRecord(parserP)->type != _TYPE_UNSET) ? _STATE_ARRAY_NEXT : _STATE_ERROR;
+            break;
+        default:
+            parserP->state = _STATE_ERROR;
+            break;
+        }
+        break;
 
-            lwm2m_data_encode_float(value, targetP);
+    case _STATE_ARRAY_NEXT:
+        if (prv_isWhiteSpace(sign)) break;
+        switch (sign)
+        {
+        case ',':
+            parserP->state = _STATE_RECORD_START;
+            break;
+        case ']':
+            parserP->state = _STATE_TOP_NEXT;
+            break;
+        default:
+            parserP->state = _STATE_ERROR;
+            break;
         }
-    }
-    break;
+        break;
 
-    case _TYPE_STRING:
-        lwm2m_data_encode_opaque(recordP->value, recordP->valueLen, targetP);
-        targetP->type = LWM2M_TYPE_STRING;
+    case _STATE_DONE:
+        if (!prv_isWhiteSpace(sign)) parserP->state = _STATE_ERROR;
         break;
 
-    case _TYPE_UNSET:
     default:
-        return false;
+        break;
     }
 
     return true;
 }
 
-static lwm2m_data_t * prv_findDataItem(lwm2m_data_t * listP,
-                                       int count,
-                                       uint16_t id)
+static int prv_compareRecords(const void * first,
+                              const void * second)
 {
+    const _record_t * firstP = (const _record_t *)first;
+    const _record_t * secondP = (const _record_t *)second;
     int i;
 
-    i = 0;
-    while (i < count)
+    for (i = 0 ; i < 4 ; i++)
     {
-        if (listP[i].type != LWM2M_TYPE_UNDEFINED && listP[i].id == id)
+        if (firstP->ids[i] != secondP->ids[i])
         {
-            return listP + i;
+            return firstP->ids[i] < secondP->ids[i] ? -1 : 1;
         }
-        i++;
     }
 
-    return NULL;
+    return firstP->order < secondP->order ? -1 : 1;
 }
 
-static uri_depth_t prv_decreaseLevel(uri_depth_t level)
+// Returns the number of distinct ids at depth in the sorted records.
+// If totalP is not nil, it receives the number of nodes at depth and below.
+static int prv_countNodes(_record_t * recordArray,
+                          size_t count,
+                          int depth,
+                          size_t * totalP)
 {
-    switch(level)
-    {
-    case URI_DEPTH_OBJECT:
-        return URI_DEPTH_OBJECT_INSTANCE;
-    case URI_DEPTH_OBJECT_INSTANCE:
-        return URI_DEPTH_RESOURCE;
-    case URI_DEPTH_RESOURCE:
-        return URI_DEPTH_RESOURCE_INSTANCE;
-    case URI_DEPTH_RESOURCE_INSTANCE:
-        return URI_DEPTH_RESOURCE_INSTANCE;
-    default:
-        return URI_DEPTH_RESOURCE;
-    }
-}
-
-static lwm2m_data_t * prv_extendData(lwm2m_data_t * parentP)
-{
-    lwm2m_data_t * newP;
+    size_t i;
+    int result = 0;
 
-    newP = lwm2m_data_new(parentP->value.asChildren.count + 1);
-    if (newP == NULL) return NULL;
-    if (parentP->value.asChildren.array != NULL)
+    if (totalP != NULL) *totalP = 0;
+    for (i = 0 ; i < count ; i++)
     {
-        memcpy(newP, parentP->value.asChildren.array, parentP->value.asChildren.count * sizeof(lwm2m_data_t));
-        lwm2m_free(parentP->value.asChildren.array);     // do not use lwm2m_data_free() to keep pointed values
-    }
-    parentP->value.asChildren.array = newP;
-    parentP->value.asChildren.count += 1;
-
-    return newP + parentP->value.asChildren.count - 1;
-}
-
-static int prv_convertRecord(lwm2m_uri_t * uriP,
-                             _record_t * recordArray,
-                             int count,
-                             lwm2m_data_t ** dataP)
-{
-    int index;
-    int freeIndex;
-    lwm2m_data_t * rootP;
-    int size;
-    uri_depth_t rootLevel;
+        int k;
 
-    if (uriP == NULL)
-    {
-        size = count;
-        *dataP = lwm2m_data_new(count);
-        if (NULL == *dataP) return -1;
-        rootLevel = URI_DEPTH_OBJECT;
-        rootP = *dataP;
-    }
-    else
-    {
-        lwm2m_data_t * parentP;
-        size = 1;
-
-        *dataP = lwm2m_data_new(1);
-        if (NULL == *dataP) return -1;
-        (*dataP)->type = LWM2M_TYPE_OBJECT;
-        (*dataP)->id = uriP->objectId;
-        rootLevel = URI_DEPTH_OBJECT_INSTANCE;
-        parentP = *dataP;
-        if (LWM2M_URI_IS_SET_INSTANCE(uriP))
+        k = depth;
+        if (i > 0)
         {
-            parentP->value.asChildren.count = 1;
-            parentP->value.asChildren.array = lwm2m_data_new(1);
-            if (NULL == parentP->value.asChildren.array) goto error;
-            parentP = parentP->value.asChildren.array;
-            parentP->type = LWM2M_TYPE_OBJECT_INSTANCE;
-            parentP->id = uriP->instanceId;
-            rootLevel = URI_DEPTH_RESOURCE;
-            if (LWM2M_URI_IS_SET_RESOURCE(uriP))
+            while (k < 4 && recordArray[i].ids[k] == recordArray[i - 1].ids[k]) k++;
+        }
+        if (k == depth) result++;
+        if (totalP != NULL)
+        {
+            while (k < 4 && recordArray[i].ids[k] != LWM2M_MAX_ID)
             {
-                parentP->value.asChildren.count = 1;
-                parentP->value.asChildren.array = lwm2m_data_new(1);
-                if (NULL == parentP->value.asChildren.array) goto error;
-                parentP = parentP->value.asChildren.array;
-                parentP->type = LWM2M_TYPE_UNDEFINED;
-                parentP->id = uriP->resourceId;
-                rootLevel = URI_DEPTH_RESOURCE_INSTANCE;
+                (*totalP)++;
+                k++;
             }
         }
-        parentP->value.asChildren.count = count;
-        parentP->value.asChildren.array = lwm2m_data_new(count);
-        if (NULL == parentP->value.asChildren.array) goto error;
-        rootP = parentP->value.asChildren.array;
     }
 
-    freeIndex = 0;
-    for (index = 0 ; index < count ; index++)
+    return result;
+}
+
+static bool prv_convertValue(json_parser_t * parserP,
+                             lwm2m_context_t * contextP,
+                             _record_t * recordP,
+                             lwm2m_data_t * targetP)
+{
+    switch (recordP->type)
     {
-        lwm2m_data_t * targetP;
-        int resSegmentIndex;
-        int i;
+    case _TYPE_FALSE:
+        lwm2m_data_encode_bool(false, targetP);
+        break;
+    case _TYPE_TRUE:
+        lwm2m_data_encode_bool(true, targetP);
+        break;
+    case _TYPE_INTEGER:
+        lwm2m_data_encode_int(recordP->value.asInteger, targetP);
+        break;
+    case _TYPE_FLOAT:
+        lwm2m_data_encode_float(recordP->value.asFloat, targetP);
+        break;
 
-        // check URI depth
-        // resSegmentIndex is set to the resource segment position
-        switch(rootLevel)
-        {
-        case URI_DEPTH_OBJECT:
-            resSegmentIndex = 2;
-            break;
-        case URI_DEPTH_OBJECT_INSTANCE:
-            resSegmentIndex = 1;
-            break;
-        case URI_DEPTH_RESOURCE:
-            resSegmentIndex = 0;
-            break;
-        case URI_DEPTH_RESOURCE_INSTANCE:
-            resSegmentIndex = -1;
-            break;
-        default:
-            goto error;
-        }
-        for (i = 0 ; i <= resSegmentIndex ; i++)
-        {
-            if (recordArray[index].ids[i] == LWM2M_MAX_ID) goto error;
-        }
-        if (resSegmentIndex < 2)
-        {
-            if (recordArray[index].ids[resSegmentIndex + 2] != LWM2M_MAX_ID) goto error;
-        }
+    case _TYPE_STRING:
+    {
+        uint8_t * stringP;
 
-        targetP = prv_findDataItem(rootP, count, recordArray[index].ids[0]);
-        if (targetP == NULL)
+        stringP = recordP->string != NULL ? recordP->string : parserP->text + recordP->stringOffset;
+        if (contextP == NULL)
         {
-            targetP = rootP + freeIndex;
-            freeIndex++;
-            targetP->id = recordArray[index].ids[0];
-            targetP->type = utils_depthToDatatype(rootLevel);
+            lwm2m_data_encode_opaque(stringP, recordP->stringLen, targetP);
         }
-        if (recordArray[index].ids[1] != LWM2M_MAX_ID)
+        else
         {
-            lwm2m_data_t * parentP;
-            uri_depth_t level;
-
-            parentP = targetP;
-            level = prv_decreaseLevel(rootLevel);
-            for (i = 1 ; i <= resSegmentIndex ; i++)
+            if (recordP->string == NULL && recordP->stringLen > 0)
             {
-                targetP = prv_findDataItem(parentP->value.asChildren.array, parentP->value.asChildren.count, recordArray[index].ids[i]);
-                if (targetP == NULL)
-                {
-                    targetP = prv_extendData(parentP);
-                    if (targetP == NULL) goto error;
-                    targetP->id = recordArray[index].ids[i];
-                    targetP->type = utils_depthToDatatype(level);
-                }
-                level = prv_decreaseLevel(level);
-                parentP = targetP;
-            }
-            if (recordArray[index].ids[resSegmentIndex + 1] != LWM2M_MAX_ID)
-            {
-                targetP->type = LWM2M_TYPE_MULTIPLE_RESOURCE;
-                targetP = prv_extendData(targetP);
-                if (targetP == NULL) goto error;
-                targetP->id = recordArray[index].ids[resSegmentIndex + 1];
-                targetP->type = LWM2M_TYPE_UNDEFINED;
+                uint8_t * copyP;
+
+                // the parser text does not outlive the parsing
+                copyP = (uint8_t *)memory_arenaAlloc(contextP, recordP->stringLen);
+                if (copyP == NULL) return false;
+                memcpy(copyP, stringP, recordP->stringLen);
+                stringP = copyP;
             }
+            targetP->value.asBuffer.buffer = recordP->stringLen > 0 ? stringP : NULL;
+            targetP->value.asBuffer.length = recordP->stringLen;
         }
-
-        if (true != prv_convertValue(recordArray + index, targetP)) goto error;
+        targetP->type = LWM2M_TYPE_STRING;
     }
+    break;
 
-    return size;
-
-error:
-    lwm2m_data_free(size, *dataP);
-    *dataP = NULL;
+    case _TYPE_UNSET:
+    default:
+        return false;
+    }
 
-    return -1;
+    return true;
 }
 
-static int prv_dataStrip(int size,
-                         lwm2m_data_t * dataP,
-                         lwm2m_data_t ** resultP)
+// Fills dataP with one node per distinct id at depth in the sorted records.
+// If contextP is nil, children arrays are allocated on the heap. Otherwise they are taken from *freePP.
+static bool prv_buildNodes(json_parser_t * parserP,
+                           lwm2m_context_t * contextP,
+                           _record_t * recordArray,
+                           size_t count,
+                           int depth,
+                           lwm2m_data_t * dataP,
+                           lwm2m_data_t ** freePP)
 {
+    size_t first;
     int i;
-    int j;
-    int realSize;
 
-    realSize = 0;
-    for (i = 0 ; i < size ; i++)
+    first = 0;
+    i = 0;
+    while (first < count)
     {
-        if (dataP[i].type != LWM2M_TYPE_UNDEFINED)
-        {
-            realSize++;
-        }
-    }
+        lwm2m_data_t * targetP;
+        size_t last;
 
-    *resultP = lwm2m_data_new(realSize);
-    if (*resultP == NULL) return -1;
+        last = first + 1;
+        while (last < count && recordArray[last].ids[depth] == recordArray[first].ids[depth]) last++;
 
-    j = 0;
-    for (i = 0 ; i < size ; i++)
-    {
-        if (dataP[i].type != LWM2M_TYPE_UNDEFINED)
+        targetP = dataP + i;
+        targetP->id = recordArray[first].ids[depth];
+        if (depth < 3 && recordArray[first].ids[depth + 1] != LWM2M_MAX_ID)
         {
-            memcpy((*resultP) + j, dataP + i, sizeof(lwm2m_data_t));
+            lwm2m_data_t * childrenP;
+            int childCount;
 
-            if (dataP[i].type == LWM2M_TYPE_OBJECT
-             || dataP[i].type == LWM2M_TYPE_OBJECT_INSTANCE
-             || dataP[i].type == LWM2M_TYPE_MULTIPLE_RESOURCE)
-            {
-                int childLen;
+            // a record ending at this level is sorted last
+            if (recordArray[last - 1].ids[depth + 1] == LWM2M_MAX_ID) return false;
 
-                childLen = prv_dataStrip(dataP[i].value.asChildren.count, dataP[i].value.asChildren.array, &((*resultP)[j].value.asChildren.array));
-                if (childLen <= 0)
-                {
-                    // skip this one
-                    j--;
-                }
-                else
-                {
-                    (*resultP)[j].value.asChildren.count = childLen;
-                }
+            childCount = prv_countNodes(recordArray + first, last - first, depth + 1, NULL);
+            if (contextP == NULL)
+            {
+                childrenP = lwm2m_data_new(childCount);
+                if (childrenP == NULL) return false;
             }
             else
             {
-                dataP[i].value.asBuffer.buffer = NULL;
+                childrenP = *freePP;
+                *freePP += childCount;
+            }
+            switch (depth)
+            {
+            case 0:
+                targetP->type = LWM2M_TYPE_OBJECT;
+                break;
+            case 1:
+                targetP->type = LWM2M_TYPE_OBJECT_INSTANCE;
+                break;
+            default:
+                targetP->type = LWM2M_TYPE_MULTIPLE_RESOURCE;
+                break;
             }
+            targetP->value.asChildren.array = childrenP;
+            targetP->value.asChildren.count = childCount;
 
-            j++;
+            if (!prv_buildNodes(parserP, contextP, recordArray + first, last - first, depth + 1, childrenP, freePP))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // the last value given for a path wins
+            if (!prv_convertValue(parserP, contextP, recordArray + last - 1, targetP)) return false;
         }
+
+        first = last;
+        i++;
     }
 
-    return realSize;
+    return true;
 }
 
-int json_parse(lwm2m_uri_t * uriP,
-               uint8_t * buffer,
-               size_t bufferLen,
-               lwm2m_data_t ** dataP)
+void json_parserInit(json_parser_t * parserP,
+                     bool persistent)
+{
+    memset(parserP, 0, sizeof(json_parser_t));
+    parserP->state = _STATE_START;
+    parserP->persistent = persistent;
+}
+
+int json_parserFeed(json_parser_t * parserP,
+                    uint8_t * buffer,
+                    size_t bufferLen)
 {
     size_t index;
-    int count = 0;
-    bool eFound = false;
-    bool bnFound = false;
-    bool btFound = false;
-    int bnStart;
-    int bnLen;
-    _record_t * recordArray;
-    lwm2m_data_t * parsedP;
 
-    LOG_ARG("bufferLen: %d, buffer: \"%s\"", bufferLen, (char *)buffer);
-    LOG_URI(uriP);
-    *dataP = NULL;
-    recordArray = NULL;
-    parsedP = NULL;
+    LOG_ARG("bufferLen: %d", bufferLen);
 
-    index = prv_skipSpace(buffer, bufferLen);
-    if (index == bufferLen) return -1;
+    if (parserP->state == _STATE_STRING) parserP->stringP = buffer;
 
-    if (buffer[index] != '{') return -1;
-    do
+    index = 0;
+    while (index < bufferLen && parserP->state != _STATE_ERROR)
     {
-        _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-        if (buffer[index] != '"') goto error;
-        if (index++ >= bufferLen) goto error;
-        switch (buffer[index])
-        {
-        case 'e':
-        {
-            int recordIndex;
-
-            if (bufferLen-index < JSON_MIN_ARRAY_LEN) goto error;
-            index++;
-            if (buffer[index] != '"') goto error;
-            if (eFound == true) goto error;
-            eFound = true;
-
-            _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-            if (buffer[index] != ':') goto error;
-            _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-            if (buffer[index] != '[') goto error;
-            _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-            count = prv_countItems(buffer + index, bufferLen - index);
-            if (count <= 0) goto error;
-            recordArray = (_record_t*)lwm2m_malloc(count * sizeof(_record_t));
-            if (recordArray == NULL) goto error;
-            // at this point we are sure buffer[index] is '{' and all { and } are matching
-            recordIndex = 0;
-            while (recordIndex < count)
-            {
-                int itemLen;
+        if (prv_step(parserP, buffer, index)) index++;
+    }
+    if (parserP->state == _STATE_ERROR) return -1;
 
-                if (buffer[index] != '{') goto error;
-                itemLen = 0;
-                while (buffer[index + itemLen] != '}') itemLen++;
-                if (0 != prv_parseItem(buffer + index + 1, itemLen - 1, recordArray + recordIndex))
-                {
-                    goto error;
-                }
-                recordIndex++;
-                index += itemLen;
-                _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-                switch (buffer[index])
-                {
-                case ',':
-                    _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-                    break;
-                case ']':
-                    if (recordIndex == count) break;
-                    // else this is an error
-                default:
-                    goto error;
-                }
-            }
-            if (buffer[index] != ']') goto error;
-        }
-        break;
+    // a string value split over chunks is copied as the chunk may not persist
+    if (parserP->state == _STATE_STRING && parserP->key == _KEY_SV)
+    {
+        if (!prv_appendText(parserP, parserP->stringP, buffer + bufferLen - parserP->stringP)) return -1;
+        parserP->stringCopied = true;
+    }
 
-        case 'b':
-            if (bufferLen-index < JSON_MIN_BX_LEN) goto error;
-            index++;
-            switch (buffer[index])
-            {
-            case 't':
-                index++;
-                if (buffer[index] != '"') goto error;
-                if (btFound == true) goto error;
-                btFound = true;
-
-                // TODO: handle timed values
-                // temp: skip this token
-                while(index < bufferLen && buffer[index] != ',' && buffer[index] != '}') index++;
-                if (index == bufferLen) goto error;
-                index--;
-                // end temp
-                break;
-            case 'n':
-                {
-                    int next;
-                    int tokenStart;
-                    int tokenLen;
-                    int itemLen;
-
-                    index++;
-                    if (buffer[index] != '"') goto error;
-                    if (bnFound == true) goto error;
-                    bnFound = true;
-                    index -= 3;
-                    itemLen = 0;
-                    while (buffer[index + itemLen] != '}'
-                        && buffer[index + itemLen] != ','
-                        && index + itemLen < bufferLen)
-                    {
-                        itemLen++;
-                    }
-                    if (index + itemLen == bufferLen) goto error;
-                    next = prv_split(buffer+index, itemLen, &tokenStart, &tokenLen, &bnStart, &bnLen);
-                    if (next < 0) goto error;
-                    bnStart += index;
-                    index += next - 1;
-                }
-                break;
-            default:
-                goto error;
-            }
-            break;
+    return 0;
+}
 
-        default:
-            goto error;
-        }
+void json_parserClear(json_parser_t * parserP)
+{
+    if (parserP->recordArray != NULL) lwm2m_free(parserP->recordArray);
+    if (parserP->text != NULL) lwm2m_free(parserP->text);
+    parserP->recordArray = NULL;
+    parserP->recordCount = 0;
+    parserP->recordSize = 0;
+    parserP->text = NULL;
+    parserP->textLen = 0;
+    parserP->textSize = 0;
+}
 
-        _GO_TO_NEXT_CHAR(index, buffer, bufferLen);
-    } while (buffer[index] == ',');
+// The records are sorted on their full path and the tree is built level by level with arrays of their
+// final size. Only the records under uriP are kept. If contextP is not nil, the whole tree is one
+// allocation in the context arena.
+int json_parserFinish(json_parser_t * parserP,
+                      lwm2m_context_t * contextP,
+                      lwm2m_uri_t * uriP,
+                      lwm2m_data_t ** dataP)
+{
+    _record_t * recordArray;
+    lwm2m_uri_t * baseUriP;
+    lwm2m_data_t * freeP;
+    uint16_t baseIds[3];
+    uint16_t uriIds[3];
+    int baseDepth;
+    int uriDepth;
+    int depth;
+    size_t count;
+    size_t total;
+    size_t i;
+    int size;
 
-    if (buffer[index] != '}') goto error;
+    LOG_URI(uriP);
+    *dataP = NULL;
+    size = -1;
+    recordArray = (_record_t *)parserP->recordArray;
+
+    if (parserP->state != _STATE_DONE) goto exit;
+    if ((parserP->found & JSON_KEY_BIT(_KEY_E)) == 0)
+    {
+        size = 0;
+        goto exit;
+    }
 
-    if (eFound == true)
+    // we ignore the request URI when there is a base name
+    if ((parserP->found & JSON_KEY_BIT(_KEY_BN)) == 0)
     {
-        lwm2m_uri_t baseURI;
-        lwm2m_uri_t * baseUriP;
-        lwm2m_data_t * resultP;
-        int size;
+        baseUriP = uriP;
+    }
+    else
+    {
+        baseUriP = parserP->baseIsRoot ? NULL : &parserP->baseUri;
+    }
 
-        memset(&baseURI, 0, sizeof(lwm2m_uri_t));
-        if (bnFound == false)
+    baseDepth = 0;
+    if (baseUriP != NULL)
+    {
+        baseIds[baseDepth++] = baseUriP->objectId;
+        if (LWM2M_URI_IS_SET_INSTANCE(baseUriP))
         {
-            baseUriP = uriP;
+            baseIds[baseDepth++] = baseUriP->instanceId;
+            if (LWM2M_URI_IS_SET_RESOURCE(baseUriP)) baseIds[baseDepth++] = baseUriP->resourceId;
         }
-        else
+    }
+    uriDepth = 0;
+    if (uriP != NULL)
+    {
+        uriIds[uriDepth++] = uriP->objectId;
+        if (LWM2M_URI_IS_SET_INSTANCE(uriP))
         {
-            int res;
-
-            // we ignore the request URI and use the bn one.
-
-            // Check for " around URI
-            if (bnLen < 3
-             || buffer[bnStart] != '"'
-             || buffer[bnStart+bnLen-1] != '"')
-            {
-                goto error;
-            }
-            bnStart += 1;
-            bnLen -= 2;
-
-            if (bnLen == 1)
-            {
-                if (buffer[bnStart] != '/') goto error;
-                baseUriP = NULL;
-            }
-            else
-            {
-                res = lwm2m_stringToUri((char *)buffer + bnStart, bnLen, &baseURI);
-                if (res < 0 || res != bnLen) goto error;
-                baseUriP = &baseURI;
-            }
+            uriIds[uriDepth++] = uriP->instanceId;
+            if (LWM2M_URI_IS_SET_RESOURCE(uriP)) uriIds[uriDepth++] = uriP->resourceId;
         }
+    }
 
-        count = prv_convertRecord(baseUriP, recordArray, count, &parsedP);
-        lwm2m_free(recordArray);
-        recordArray = NULL;
-
-        if (count > 0 && uriP != NULL)
+    // make the paths absolute and keep the ones under the request URI
+    count = 0;
+    for (i = 0 ; i < parserP->recordCount ; i++)
+    {
+        _record_t * recordP = recordArray + i;
+        int nameDepth;
+        int j;
+
+        nameDepth = 0;
+        while (nameDepth < 4 && recordP->ids[nameDepth] != LWM2M_MAX_ID) nameDepth++;
+        // the path must reach a resource or a resource instance
+        if (baseDepth + nameDepth < 3 || baseDepth + nameDepth > 4) goto exit;
+        for (j = nameDepth - 1 ; j >= 0 ; j--)
         {
-            if (parsedP->type != LWM2M_TYPE_OBJECT || parsedP->id != uriP->objectId) goto error;
-            if (!LWM2M_URI_IS_SET_INSTANCE(uriP))
-            {
-                size = parsedP->value.asChildren.count;
-                resultP = parsedP->value.asChildren.array;
-            }
-            else
-            {
-                int i;
-
-                resultP = NULL;
-                // be permissive and allow full object JSON when requesting for a single instance
-                for (i = 0 ; i < (int)parsedP->value.asChildren.count && resultP == NULL; i++)
-                {
-                    lwm2m_data_t * targetP;
-
-                    targetP = parsedP->value.asChildren.array + i;
-                    if (targetP->id == uriP->instanceId)
-                    {
-                        resultP = targetP->value.asChildren.array;
-                        size = targetP->value.asChildren.count;
-                    }
-                }
-                if (resultP == NULL) goto error;
-                if (LWM2M_URI_IS_SET_RESOURCE(uriP))
-                {
-                    lwm2m_data_t * resP;
-
-                    resP = NULL;
-                    for (i = 0 ; i < size && resP == NULL; i++)
-                    {
-                        lwm2m_data_t * targetP;
-
-                        targetP = resultP + i;
-                        if (targetP->id == uriP->resourceId)
-                        {
-                            if (targetP->type == LWM2M_TYPE_MULTIPLE_RESOURCE)
-                            {
-                                resP = targetP->value.asChildren.array;
-                                size = targetP->value.asChildren.count;
-                            }
-                            else
-                            {
-                                size = prv_dataStrip(1, targetP, &resP);
-                                if (size <= 0) goto error;
-                                lwm2m_data_free(count, parsedP);
-                                parsedP = NULL;
-                            }
-                        }
-                    }
-                    if (resP == NULL) goto error;
-                    resultP = resP;
-                }
-            }
+            recordP->ids[j + baseDepth] = recordP->ids[j];
         }
-        else
+        for (j = 0 ; j < baseDepth ; j++)
         {
-            resultP = parsedP;
-            size = count;
+            recordP->ids[j] = baseIds[j];
         }
 
-        if (parsedP != NULL)
+        // be permissive and allow full object JSON when requesting for a single instance
+        for (j = 0 ; j < uriDepth && recordP->ids[j] == uriIds[j] ; j++);
+        if (j == uriDepth)
         {
-            lwm2m_data_t * tempP;
-
-            size = prv_dataStrip(size, resultP, &tempP);
-            if (size <= 0) goto error;
-            lwm2m_data_free(count, parsedP);
-            resultP = tempP;
+            if (count != i) recordArray[count] = *recordP;
+            count++;
         }
-        count = size;
-        *dataP = resultP;
     }
+    if (count == 0) goto exit;
 
-    LOG_ARG("Parsing successful. count: %d", count);
-    return count;
+    qsort(recordArray, count, sizeof(_record_t), prv_compareRecords);
 
-error:
-    LOG("Parsing failed");
-    if (parsedP != NULL)
+    depth = uriDepth;
+    if (depth == 3 && recordArray[count - 1].ids[3] == LWM2M_MAX_ID)
     {
-        lwm2m_data_free(count, parsedP);
-        parsedP = NULL;
+        // a single resource is returned as is
+        depth = 2;
     }
-    if (recordArray != NULL)
+
+    size = prv_countNodes(recordArray, count, depth, &total);
+    if (contextP == NULL)
     {
-        lwm2m_free(recordArray);
+        *dataP = lwm2m_data_new(size);
+        freeP = NULL;
     }
-    return -1;
+    else
+    {
+        *dataP = data_new(contextP, total);
+        freeP = *dataP + size;
+    }
+    if (*dataP == NULL)
+    {
+        size = -1;
+        goto exit;
+    }
+
+    if (!prv_buildNodes(parserP, contextP, recordArray, count, depth, *dataP, &freeP))
+    {
+        data_free(contextP, size, *dataP);
+        *dataP = NULL;
+        size = -1;
+    }
+
+exit:
+    json_parserClear(parserP);
+    if (size < 0)
+    {
+        LOG("Parsing failed");
+    }
+    else
+    {
+        LOG_ARG("Parsing successful. count: %d", size);
+    }
+    return size;
+}
+
+int json_parse(lwm2m_context_t * contextP,
+               lwm2m_uri_t * uriP,
+               uint8_t * buffer,
+               size_t bufferLen,
+               lwm2m_data_t ** dataP)
+{
+    json_parser_t parser;
+
+    json_parserInit(&parser, true);
+    if (json_parserFeed(&parser, buffer, bufferLen) != 0)
+    {
+        json_parserClear(&parser);
+        *dataP = NULL;
+        LOG("Parsing failed");
+        return -1;
+    }
+
+    return json_parserFinish(&parser, contextP, uriP, dataP);
 }
 
 static int prv_serializeValue(lwm2m_data_t * tlvP,
@@ -58,14 +58,28 @@
 
 
 lwm2m_context_t * lwm2m_init(void * userData)
+{
+    return lwm2m_init_with_allocator(userData, NULL);
+}
+
+lwm2m_context_t * lwm2m_init_with_allocator(void * userData,
+                                            const lwm2m_allocator_t * allocatorP)
 {
     lwm2m_context_t * contextP;
 
     LOG("Entering");
-    contextP = (lwm2m_context_t *)lwm2m_malloc(sizeof(lwm2m_context_t));
+    if (allocatorP != NULL)
+    {
+        contextP = (lwm2m_context_t *)allocatorP->mallocFunc(sizeof(lwm2m_context_t), allocatorP->userData);
+    }
+    else
+    {
+        contextP = (lwm2m_context_t *)lwm2m_malloc(sizeof(lwm2m_context_t));
+    }
     if (NULL != contextP)
     {
         memset(contextP, 0, sizeof(lwm2m_context_t));
+        if (allocatorP != NULL) contextP->allocator = *allocatorP;
         contextP->userData = userData;
         srand((int)lwm2m_gettime());
         contextP->nextMID = rand();
@@ -87,18 +101,18 @@ void lwm2m_deregister(lwm2m_context_t * context)
     }
 }
 
-static void prv_deleteServer(lwm2m_server_t * serverP, void *userData)
+static void prv_deleteServer(lwm2m_context_t * contextP, lwm2m_server_t * serverP)
 {
     // TODO parse transaction and observation to remove the ones related to this server
     if (serverP->sessionH != NULL)
     {
-         lwm2m_close_connection(serverP->sessionH, userData);
+         lwm2m_close_connection(serverP->sessionH, contextP->userData);
     }
     if (NULL != serverP->location)
     {
         lwm2m_free(serverP->location);
     }
-    free_block1_buffer(serverP->block1Data);
+    free_block1_buffer(contextP, serverP->block1Data);
     lwm2m_free(serverP);
 }
 
@@ -109,19 +123,19 @@ static void prv_deleteServerList(lwm2m_context_t * context)
         lwm2m_server_t * server;
         server = context->serverList;
         context->serverList = server->next;
-        prv_deleteServer(server, context->userData);
+        prv_deleteServer(context, server);
     }
 }
 
-static void prv_deleteBootstrapServer(lwm2m_server_t * serverP, void *userData)
+static void prv_deleteBootstrapServer(lwm2m_context_t * contextP, lwm2m_server_t * serverP)
 {
     // TODO should we free location as in prv_deleteServer ?
     // TODO should we parse transaction and observation to remove the ones related to this server ?
     if (serverP->sessionH != NULL)
     {
-         lwm2m_close_connection(serverP->sessionH, userData);
+         lwm2m_close_connection(serverP->sessionH, contextP->userData);
     }
-    free_block1_buffer(serverP->block1Data);
+    free_block1_buffer(contextP, serverP->block1Data);
     lwm2m_free(serverP);
 }
 
@@ -132,7 +146,7 @@ static void prv_deleteBootstrapServerList(lwm2m_context_t * context)
         lwm2m_server_t * server;
         server = context->bootstrapServerList;
         context->bootstrapServerList = server->next;
-        prv_deleteBootstrapServer(server, context->userData);
+        prv_deleteBootstrapServer(context, server);
     }
 }
 
@@ -146,14 +160,19 @@ static void prv_deleteObservedList(lwm2m_context_t * contextP)
         targetP = contextP->observedList;
         contextP->observedList = contextP->observedList->next;
 
-        for (watcherP = targetP->watcherList ; watcherP != NULL ; watcherP = watcherP->next)
+        while (targetP->watcherList != NULL)
         {
+            watcherP = targetP->watcherList;
+            targetP->watcherList = watcherP->next;
             if (watcherP->parameters != NULL) lwm2m_free(watcherP->parameters);
+            memory_poolFree(watcherP);
         }
-        LWM2M_LIST_FREE(targetP->watcherList);
 
+        timer_cancel(contextP, &(targetP->timer));
         lwm2m_free(targetP);
     }
+    index_clear(contextP, &contextP->observedIndex);
+    index_clear(contextP, &contextP->watcherMidIndex);
 }
 #endif
 
@@ -165,8 +184,10 @@ void prv_deleteTransactionList(lwm2m_context_t * context)
 
         transaction = context->transactionList;
         context->transactionList = context->transactionList->next;
-        transaction_free(transaction);
+        transaction_free(context, transaction);
     }
+    index_clear(context, &context->transactionMidIndex);
+    index_clear(context, &context->transactionTokenIndex);
 }
 
 void lwm2m_close(lwm2m_context_t * contextP)
@@ -200,10 +221,19 @@ void lwm2m_close(lwm2m_context_t * contextP)
 
         registration_freeClient(clientP);
     }
+    registration_clearClientIndex(contextP);
 #endif
 
     prv_deleteTransactionList(contextP);
-    lwm2m_free(contextP);
+    peer_clear(contextP);
+    dedup_clear(contextP);
+    block2_clear(contextP);
+#ifdef LWM2M_WITH_SEND_QUEUE
+    sendqueue_clear(contextP);
+#endif
+    timer_clear(contextP);
+    memory_clear(contextP);
+    memory_free(contextP, contextP);
 }
 
 #ifdef LWM2M_CLIENT_MODE
@@ -226,7 +256,7 @@ static int prv_refreshServerList(lwm2m_context_t * contextP)
         }
         else
         {
-            prv_deleteServer(targetP, contextP->userData);
+            prv_deleteServer(contextP, targetP);
         }
         targetP = nextP;
     }
@@ -243,7 +273,7 @@ static int prv_refreshServerList(lwm2m_context_t * contextP)
         }
         else
         {
-            prv_deleteServer(targetP, contextP->userData);
+            prv_deleteServer(contextP, targetP);
         }
         targetP = nextP;
     }
@@ -361,8 +391,8 @@ int lwm2m_remove_object(lwm2m_context_t * contextP,
 #endif
 
 
-int lwm2m_step(lwm2m_context_t * contextP,
-               time_t * timeoutP)
+static int prv_step(lwm2m_context_t * contextP,
+                    time_t * timeoutP)
 {
     time_t tv_sec;
     int result;
@@ -468,12 +498,11 @@ next_step:
         // do nothing
         break;
     }
-
-    observe_step(contextP, tv_sec, timeoutP);
 #endif
 
     registration_step(contextP, tv_sec, timeoutP);
-    transaction_step(contextP, tv_sec, timeoutP);
+    // transaction retransmissions and clients lifetime
+    timer_step(contextP, tv_sec, timeoutP);
 
     LOG_ARG("Final timeoutP: %" PRId64, *timeoutP);
 #ifdef LWM2M_CLIENT_MODE
@@ -481,3 +510,19 @@ next_step:
 #endif
     return 0;
 }
+
+int lwm2m_step(lwm2m_context_t * contextP,
+               time_t * timeoutP)
+{
+#ifdef LWM2M_WITH_SEND_QUEUE
+    int result;
+
+    sendqueue_hold(contextP);
+    result = prv_step(contextP, timeoutP);
+    sendqueue_release(contextP);
+
+    return result;
+#else
+    return prv_step(contextP, timeoutP);
+#endif
+}
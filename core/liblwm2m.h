@@ -127,6 +127,20 @@ void lwm2m_close_connection(void * sessionH, void * userData);
 // buffer, length: data to send
 // userData: parameter to lwm2m_init()
 uint8_t lwm2m_buffer_send(void * sessionH, uint8_t * buffer, size_t length, void * userData);
+#ifdef LWM2M_WITH_GATHER_SEND
+// Same as lwm2m_buffer_send() for a datagram made of header followed by payload. payload may be nil.
+// Used to send messages without copying their payload.
+uint8_t lwm2m_buffer_send_gather(void * sessionH, uint8_t * header, size_t headerLength, uint8_t * payload, size_t payloadLength, void * userData);
+#endif
+#ifdef LWM2M_WITH_SEND_QUEUE
+// Send several datagrams at once. Datagram i is lengthArray[i] bytes at bufferArray[i] for sessionArray[i],
+// followed by payloadLengthArray[i] bytes at payloadArray[i] if payloadArray[i] is not nil. As with
+// lwm2m_buffer_send_gather(), the payload is meant to be sent from where it is.
+// The datagrams sent while lwm2m_step() or lwm2m_handle_packet() runs are queued and handed to this
+// function before they return, acknowledgements first. It must not call the core back.
+// Returns COAP_NO_ERROR or a COAP_NNN error code
+uint8_t lwm2m_buffer_send_batch(void ** sessionArray, uint8_t ** bufferArray, size_t * lengthArray, uint8_t ** payloadArray, size_t * payloadLengthArray, size_t count, void * userData);
+#endif
 // Compare two session handles
 // Returns true if the two sessions identify the same peer. false otherwise.
 // userData: parameter to lwm2m_init()
@@ -391,6 +405,11 @@ typedef uint8_t (*lwm2m_write_callback_t) (uint16_t instanceId, int numData, lwm
 typedef uint8_t (*lwm2m_execute_callback_t) (uint16_t instanceId, uint16_t resourceId, uint8_t * buffer, int length, lwm2m_object_t * objectP);
 typedef uint8_t (*lwm2m_create_callback_t) (uint16_t instanceId, int numData, lwm2m_data_t * dataArray, lwm2m_object_t * objectP);
 typedef uint8_t (*lwm2m_delete_callback_t) (uint16_t instanceId, lwm2m_object_t * objectP);
+// Optional. Receives an opaque resource written by blocks, one block at a time as it arrives, instead of
+// writeFunc once the payload is reassembled: the payload is not limited by MAX_BLOCK1_SIZE. offset 0
+// starts a new payload, abandoning any previous one. more is false for the last block.
+// Returns COAP_204_CHANGED, or an error code aborting the transfer.
+typedef uint8_t (*lwm2m_write_stream_callback_t) (uint16_t instanceId, uint16_t resourceId, size_t offset, uint8_t * buffer, size_t length, bool more, lwm2m_object_t * objectP);
 
 struct _lwm2m_object_t
 {
@@ -403,6 +422,7 @@ struct _lwm2m_object_t
     lwm2m_create_callback_t   createFunc;
     lwm2m_delete_callback_t   deleteFunc;
     lwm2m_discover_callback_t discoverFunc;
+    lwm2m_write_stream_callback_t writeStreamFunc;
     void * userData;
 };
 
@@ -443,19 +463,50 @@ typedef enum
     BINDING_UQS  // UDP queue mode plus SMS
 } lwm2m_binding_t;
 
+/*
+ * Timer
+ *
+ * Deadline embedded in an item of the context and scheduled in the context
+ * min-heap. For internal use only.
+ */
+
+struct _lwm2m_context_;
+
+typedef void (*lwm2m_timer_callback_t) (struct _lwm2m_context_ * contextP, void * itemP, time_t currentTime);
+
+typedef struct
+{
+    time_t                 deadline;
+    size_t                 position; // one-based position in the heap, 0 when not scheduled
+    lwm2m_timer_callback_t callback;
+    void *                 itemP;    // item owning the timer, passed to the callback
+} lwm2m_timer_t;
+
 /*
  * LWM2M block1 data
  *
- * Temporary data needed to handle block1 request.
- * Currently support only one block1 request by server.
+ * Temporary data needed to handle block1 requests. A server has a list of
+ * transfers identified by the method and the URI path of the request. A transfer
+ * without activity for LWM2M_BLOCK1_TIMEOUT seconds is released.
  */
+#ifndef LWM2M_BLOCK1_KEY_LEN
+#define LWM2M_BLOCK1_KEY_LEN 32
+#endif
+
 typedef struct _lwm2m_block1_data_ lwm2m_block1_data_t;
 
 struct _lwm2m_block1_data_
 {
-    uint8_t *             block1buffer;     // data buffer
-    size_t                block1bufferSize; // buffer size
-    uint16_t              lastmid;          // mid of the last message received
+    lwm2m_block1_data_t * next;
+    lwm2m_block1_data_t ** listP;               // list holding the transfer
+    uint8_t               code;                 // method of the request
+    uint8_t               keyLen;
+    uint8_t               key[LWM2M_BLOCK1_KEY_LEN]; // URI path of the request
+    uint8_t *             block1buffer;         // data buffer
+    size_t                block1bufferSize;     // size of the received data
+    size_t                block1bufferCapacity; // allocated size of the buffer
+    uint16_t              lastmid;              // mid of the last message received
+    lwm2m_timer_t         timer;
 };
 
 typedef struct _lwm2m_server_
@@ -470,7 +521,7 @@ typedef struct _lwm2m_server_
     lwm2m_status_t          status;
     char *                  location;
     bool                    dirty;
-    lwm2m_block1_data_t *   block1Data;   // buffer to handle block1 data, should be replace by a list to support several block1 transfer by server.
+    lwm2m_block1_data_t *   block1Data;   // list of the block1 transfers in progress
 } lwm2m_server_t;
 
 
@@ -525,6 +576,13 @@ typedef struct
     double      step;
 } lwm2m_attributes_t;
 
+typedef struct
+{
+    lwm2m_timer_t ** heap;
+    size_t           size;
+    size_t           count;
+} lwm2m_scheduler_t;
+
 /*
  * LWM2M Clients
  *
@@ -551,12 +609,66 @@ typedef struct _lwm2m_client_
     bool                    supportJSON;
     uint32_t                lifetime;
     time_t                  endOfLife;
+    lwm2m_timer_t           lifetimeTimer;
     void *                  sessionH;
     lwm2m_client_object_t * objectList;
     lwm2m_observation_t *   observationList;
+    uint16_t                blockSize;  // block size requested in the reads, 0 to let the client choose
+    struct _lwm2m_client_ * prev;       // in clientList, newest registration first
 } lwm2m_client_t;
 
 
+/*
+ * LWM2M peer
+ *
+ * Retransmission timeout of a peer estimated from the ACKs to its confirmable
+ * messages, as in CoAP Simple Congestion Control/Advanced (CoCoA). Times are
+ * in milliseconds but the samples have the one second resolution of
+ * lwm2m_gettime(). At most LWM2M_NSTART confirmable messages are outstanding
+ * to a peer, the following ones wait in its queue until an ACK, a response or
+ * a timeout completes one. An urgent message, such as the Deregister sent by
+ * lwm2m_close(), does not wait. Peers are told apart by their session handle and
+ * forgotten once idle for LWM2M_PEER_IDLE_TIME seconds.
+ */
+
+typedef struct
+{
+    uint32_t rto;             // overall retransmission timeout
+    uint32_t strongRto;       // estimated from exchanges without retransmission
+    uint32_t weakRto;         // estimated from exchanges with one or two retransmissions
+    uint32_t strongSamples;
+    uint32_t weakSamples;
+    uint32_t transmissions;   // confirmable messages sent, retransmissions excluded
+    uint32_t retransmissions;
+    uint32_t failures;        // confirmable messages never acknowledged
+    uint32_t inFlight;        // outstanding confirmable messages, at most LWM2M_NSTART
+    uint32_t queueDepth;      // messages waiting for an outstanding one to complete
+    uint32_t maxQueueDepth;
+    uint32_t queued;          // messages which had to wait
+    uint32_t totalWaitTime;   // in seconds, spent in the queue by the messages sent since
+    uint32_t maxWaitTime;
+} lwm2m_peer_stats_t;
+
+typedef struct
+{
+    uint32_t srtt;
+    uint32_t rttvar;
+} lwm2m_rtt_estimator_t;
+
+typedef struct _lwm2m_peer_
+{
+    void *                sessionH;
+    lwm2m_peer_stats_t    stats;
+    lwm2m_rtt_estimator_t strong;
+    lwm2m_rtt_estimator_t weak;
+    time_t                rtoTime;          // last update of stats.rto
+    time_t                lastTime;         // last exchange
+    size_t                transactionCount; // transactions to this peer, they keep it alive
+    struct _lwm2m_transaction_ * queueHead; // transactions waiting for NSTART, oldest first
+    struct _lwm2m_transaction_ * queueTail;
+    lwm2m_timer_t         timer;            // forgets the peer once idle
+} lwm2m_peer_t;
+
 /*
  * LWM2M transaction
  *
@@ -567,18 +679,47 @@ typedef struct _lwm2m_transaction_ lwm2m_transaction_t;
 
 typedef void (*lwm2m_transaction_callback_t) (lwm2m_transaction_t * transacP, void * message);
 
+// Provides the length bytes at offset of a payload sent by blocks. They are either copied
+// to buffer, which is returned, or returned from storage staying valid until the transfer
+// completes. Returns NULL on error.
+typedef const uint8_t * (*lwm2m_block_reader_t) (size_t offset, size_t length, uint8_t * buffer, void * userData);
+
 struct _lwm2m_transaction_
 {
     lwm2m_transaction_t * next;  // matches lwm2m_list_t::next
     uint16_t              mID;   // matches lwm2m_list_t::id
+    lwm2m_transaction_t * prev;  // transactionList is not sorted, see transaction_add()
     void *                peerH;
     uint8_t               ack_received; // indicates, that the ACK was received
     time_t                response_timeout; // timeout to wait for response, if token is used. When 0, use calculated acknowledge timeout.
     uint8_t  retrans_counter;
     time_t   retrans_time;
+    time_t   first_time;    // first transmission
+    uint32_t rto;           // retransmission timeout of the peer at the first transmission, in milliseconds
+    uint32_t timeout;       // current retransmission timeout, in milliseconds
+    lwm2m_peer_t * peerP;
+    bool           in_flight;   // counted in the outstanding messages of the peer
+    bool           queued;      // waiting in the queue of the peer
+    bool           urgent;      // sent at once, even over the outstanding messages limit of the peer
+    time_t         queue_time;
+    lwm2m_transaction_t * queue_next;
+    lwm2m_timer_t timer;
     void * message;
     uint16_t buffer_len;
     uint8_t * buffer;
+    uint8_t * payload;          // sent from where it is after buffer, if not NULL
+    size_t    payload_len;
+    uint8_t * block2_buffer;    // body of the response received so far by blocks
+    size_t    block2_len;
+    size_t    block2_size;      // allocated
+    uint8_t   block2_etag[8];   // ETag of the first block
+    uint8_t   block2_etag_len;
+    lwm2m_block_reader_t block1_reader; // provides the payload sent by blocks, if any
+    void *    block1_reader_data;
+    uint8_t * block1_buffer;    // copy of the payload without reader, otherwise the block read
+    size_t    block1_len;       // of the payload sent by blocks, 0 if there is none
+    size_t    block1_offset;    // of the block in flight
+    uint16_t  block1_size;
     lwm2m_transaction_callback_t callback;
     void * userData;
 };
@@ -589,6 +730,7 @@ struct _lwm2m_transaction_
 typedef struct _lwm2m_watcher_
 {
     struct _lwm2m_watcher_ * next;
+    struct _lwm2m_observed_ * observed;  // the item watched
 
     bool active;
     bool update;
@@ -613,6 +755,7 @@ typedef struct _lwm2m_observed_
 
     lwm2m_uri_t uri;
     lwm2m_watcher_t * watcherList;
+    lwm2m_timer_t timer;  // earliest deadline of the watchers, see observe.c
 } lwm2m_observed_t;
 
 #ifdef LWM2M_CLIENT_MODE
@@ -628,6 +771,90 @@ typedef enum
 } lwm2m_client_state_t;
 
 #endif
+
+/*
+ * Hash index
+ *
+ * Open-addressing table of pointers to items stored in one of the lists of
+ * the context. For internal use only.
+ */
+
+typedef struct
+{
+    void ** slots;  // NULL marks a free slot
+    size_t  size;   // number of slots, zero or a power of two
+    size_t  count;  // number of indexed items
+} lwm2m_index_t;
+
+/*
+ * Memory
+ *
+ * Memory tied to a context (the context itself, the pools and the request arena) is obtained
+ * through an allocator. The pools keep slabs of the fixed-size objects the core creates and
+ * frees all the time. The arena holds the temporary data trees built while a request is handled.
+ * Pools and arena are for internal use only.
+ *
+ * The hash indexes, the timer heap, the datagrams and payloads of the transactions, the block1
+ * transfers, the block2 cache and the deduplication cache use the allocator as well. The memory
+ * shared with the application (lwm2m_data_t arrays, URIs, strings, payloads returned by the
+ * objects) and the options parsed by the CoAP layer still come from lwm2m_malloc(), as their
+ * owner may not know the context.
+ */
+
+typedef struct
+{
+    void * (*mallocFunc)(size_t size, void * userData);
+    void   (*freeFunc)(void * ptr, void * userData);
+    void *   userData;
+} lwm2m_allocator_t;
+
+typedef enum
+{
+    LWM2M_POOL_TRANSACTION = 0,
+    LWM2M_POOL_PACKET,
+    LWM2M_POOL_WATCHER,
+    LWM2M_POOL_OBSERVATION,
+    LWM2M_POOL_CLIENT,
+    LWM2M_POOL_PEER,
+    LWM2M_POOL_COUNT
+} lwm2m_pool_id_t;
+
+typedef struct
+{
+    void * freeList;  // free objects
+    void * slabList;  // slabs the objects are carved from
+} lwm2m_pool_t;
+
+typedef struct
+{
+    void * chunkList; // most recent chunk first
+} lwm2m_arena_t;
+
+/*
+ * Send queue
+ *
+ * Datagrams waiting for lwm2m_buffer_send_batch(). For internal use only.
+ */
+
+#ifdef LWM2M_WITH_SEND_QUEUE
+typedef struct
+{
+    int        holdCount;  // the queue is flushed when it drops to zero
+    size_t     count;
+    size_t     ackCount;   // acknowledgements and resets, at the head of the queue
+    size_t     size;       // number of datagrams the arrays can hold
+    void **    sessions;
+    size_t *   offsets;    // in data
+    size_t *   lengths;
+    uint8_t ** buffers;    // filled when flushing
+    uint8_t ** payloads;   // sent from where they are, nil if the whole datagram is in data
+    size_t *   payloadLengths;
+    uint8_t *  data;
+    size_t     dataLength;
+    size_t     dataSize;
+} lwm2m_send_queue_t;
+#endif
+
 /*
  * LWM2M Context
  */
@@ -643,7 +870,45 @@ typedef enum
 typedef int (*lwm2m_bootstrap_callback_t) (void * sessionH, uint8_t status, lwm2m_uri_t * uriP, char * name, void * userData);
 #endif
 
+/*
+ * Deduplication cache
+ *
+ * ACKs sent to the confirmable requests received, replayed to their
+ * retransmissions. For internal use only, see dedup.c.
+ */
+
+typedef struct _lwm2m_dedup_entry_ lwm2m_dedup_entry_t;
+
+typedef struct
+{
+    lwm2m_index_t         index;  // entries indexed by MID
+    lwm2m_dedup_entry_t * head;   // oldest first
+    lwm2m_dedup_entry_t * tail;
+    size_t                size;   // bytes used by the entries
+    // the request being handled
+    bool                  pending;
+    void *                pendingSessionH;
+    uint16_t              pendingMid;
+    time_t                pendingTime;
+} lwm2m_dedup_t;
+
+/*
+ * Block2 cache
+ *
+ * Bodies of the responses sent by blocks, the following blocks are sliced
+ * from them. For internal use only, see block2.c.
+ */
+
+typedef struct _lwm2m_block2_entry_ lwm2m_block2_entry_t;
+
 typedef struct
+{
+    lwm2m_block2_entry_t * head;  // oldest first
+    lwm2m_block2_entry_t * tail;
+    size_t                 size;  // bytes used by the entries
+} lwm2m_block2_cache_t;
+
+typedef struct _lwm2m_context_
 {
 #ifdef LWM2M_CLIENT_MODE
     lwm2m_client_state_t state;
@@ -654,9 +919,14 @@ typedef struct
     lwm2m_server_t *     serverList;
     lwm2m_object_t *     objectList;
     lwm2m_observed_t *   observedList;
+    lwm2m_index_t        observedIndex;   // observedList indexed by URI
+    lwm2m_index_t        watcherMidIndex; // watchers of observedList which sent a notification, indexed by its MID
 #endif
 #ifdef LWM2M_SERVER_MODE
     lwm2m_client_t *        clientList;
+    lwm2m_index_t           clientIndex;     // clientList indexed by internalID
+    lwm2m_index_t           clientNameIndex; // clientList indexed by endpoint name
+    uint16_t                nextClientID;    // first internalID tried for the next registration
     lwm2m_result_callback_t monitorCallback;
     void *                  monitorUserData;
 #endif
@@ -666,20 +936,48 @@ typedef struct
 #endif
     uint16_t                nextMID;
     lwm2m_transaction_t *   transactionList;
+    lwm2m_index_t           transactionMidIndex;   // transactionList indexed by MID
+    lwm2m_index_t           transactionTokenIndex; // requests of transactionList indexed by token
+    lwm2m_index_t           peerIndex;             // peers of the transactions indexed by session
+    lwm2m_dedup_t           dedup;
+    lwm2m_block2_cache_t    block2Cache;
+    lwm2m_scheduler_t       scheduler;
+    lwm2m_allocator_t       allocator;
+    lwm2m_pool_t            pools[LWM2M_POOL_COUNT];
+    lwm2m_arena_t           arena;
+#ifdef LWM2M_WITH_SEND_QUEUE
+    lwm2m_send_queue_t      sendQueue;
+#endif
     void *                  userData;
 } lwm2m_context_t;
 
 
 // initialize a liblwm2m context.
 lwm2m_context_t * lwm2m_init(void * userData);
+// same as lwm2m_init() with the allocator used for the memory tied to the context.
+// allocatorP is copied. If nil, lwm2m_malloc() and lwm2m_free() are used.
+lwm2m_context_t * lwm2m_init_with_allocator(void * userData, const lwm2m_allocator_t * allocatorP);
 // close a liblwm2m context.
 void lwm2m_close(lwm2m_context_t * contextP);
 
 // perform any required pending operation and adjust timeoutP to the maximal time interval to wait in seconds.
 int lwm2m_step(lwm2m_context_t * contextP, time_t * timeoutP);
 // dispatch received data to liblwm2m
+// This function uses a shared workspace and must not be called concurrently, even on different contexts.
 void lwm2m_handle_packet(lwm2m_context_t * contextP, uint8_t * buffer, int length, void * fromSessionH);
 
+// Workspace holding the parsed message, the response and their options while a packet is handled.
+typedef struct _lwm2m_packet_workspace_ lwm2m_packet_workspace_t;
+lwm2m_packet_workspace_t * lwm2m_packet_workspace_new(void);
+void lwm2m_packet_workspace_free(lwm2m_packet_workspace_t * workspaceP);
+// same as lwm2m_handle_packet() using the provided workspace. Different contexts can handle packets
+// concurrently as long as each thread uses its own workspace.
+void lwm2m_handle_packet_with_workspace(lwm2m_context_t * contextP, lwm2m_packet_workspace_t * workspaceP, uint8_t * buffer, int length, void * fromSessionH);
+
+// get the retransmission statistics of the peer reached through sessionH.
+// returns 0, or -1 if the peer is not known and gets the default retransmission timeout.
+int lwm2m_peer_get_stats(lwm2m_context_t * contextP, void * sessionH, lwm2m_peer_stats_t * statsP);
+
 #ifdef LWM2M_CLIENT_MODE
 // configure the client side with the Endpoint Name, binding, MSISDN (can be nil), alternative path
 // for objects (can be nil) and a list of objects.
@@ -705,11 +1003,23 @@ void lwm2m_resource_value_changed(lwm2m_context_t * contextP, lwm2m_uri_t * uriP
 // The callback's parameters uri, data, dataLength are always NULL.
 // The lwm2m_client_t is present in the lwm2m_context_t's clientList when the callback is called. On a deregistration, it deleted when the callback returns.
 void lwm2m_set_monitoring_callback(lwm2m_context_t * contextP, lwm2m_result_callback_t callback, void * userData);
+// Returns the registered client with the internal ID clientID or NULL. clientList is not sorted, this looks it up in an index.
+lwm2m_client_t * lwm2m_get_client(lwm2m_context_t * contextP, uint16_t clientID);
+
+// Block size requested from the client in the reads and used for the payloads written,
+// 0 to let the client choose in the reads and use LWM2M_DEFAULT_BLOCK_SIZE in the writes.
+// blockSize is a power of two between 16 and 1024. Responses sent by blocks are
+// reassembled before being reported, whatever the block size. Larger payloads are
+// written by blocks, in smaller ones if the client asks for it.
+int lwm2m_set_client_block_size(lwm2m_context_t * contextP, uint16_t clientID, uint16_t blockSize);
 
 // Device Management APIs
 int lwm2m_dm_read(lwm2m_context_t * contextP, uint16_t clientID, lwm2m_uri_t * uriP, lwm2m_result_callback_t callback, void * userData);
 int lwm2m_dm_discover(lwm2m_context_t * contextP, uint16_t clientID, lwm2m_uri_t * uriP, lwm2m_result_callback_t callback, void * userData);
 int lwm2m_dm_write(lwm2m_context_t * contextP, uint16_t clientID, lwm2m_uri_t * uriP, lwm2m_media_type_t format, uint8_t * buffer, int length, lwm2m_result_callback_t callback, void * userData);
+// Same as lwm2m_dm_write() with the length bytes of the payload provided block by block by
+// reader, which is called with readerData until the callback is.
+int lwm2m_dm_write_stream(lwm2m_context_t * contextP, uint16_t clientID, lwm2m_uri_t * uriP, lwm2m_media_type_t format, size_t length, lwm2m_block_reader_t reader, void * readerData, lwm2m_result_callback_t callback, void * userData);
 int lwm2m_dm_write_attributes(lwm2m_context_t * contextP, uint16_t clientID, lwm2m_uri_t * uriP, lwm2m_attributes_t * attrP, lwm2m_result_callback_t callback, void * userData);
 int lwm2m_dm_execute(lwm2m_context_t * contextP, uint16_t clientID, lwm2m_uri_t * uriP, lwm2m_media_type_t format, uint8_t * buffer, int length, lwm2m_result_callback_t callback, void * userData);
 int lwm2m_dm_create(lwm2m_context_t * contextP, uint16_t clientID, lwm2m_uri_t * uriP, lwm2m_media_type_t format, uint8_t * buffer, int length, lwm2m_result_callback_t callback, void * userData);
@@ -50,6 +50,7 @@
 
 #include "internals.h"
 #include <stdio.h>
+#include <limits.h>
 
 
 #ifdef LWM2M_CLIENT_MODE
@@ -424,6 +425,8 @@ static int prv_makeOperation(lwm2m_context_t * contextP,
                              lwm2m_media_type_t format,
                              uint8_t * buffer,
                              int length,
+                             lwm2m_block_reader_t reader,
+                             void * readerData,
                              lwm2m_result_callback_t callback,
                              void * userData)
 {
@@ -431,21 +434,40 @@ static int prv_makeOperation(lwm2m_context_t * contextP,
     lwm2m_transaction_t * transaction;
     dm_data_t * dataP;
 
-    clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, clientID);
+    clientP = registration_findClient(contextP, clientID);
     if (clientP == NULL) return COAP_404_NOT_FOUND;
 
-    transaction = transaction_new(clientP->sessionH, method, clientP->altPath, uriP, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, clientP->sessionH, method, clientP->altPath, uriP, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
 
     if (method == COAP_GET)
     {
         coap_set_header_accept(transaction->message, format);
+        if (clientP->blockSize != 0)
+        {
+            // early negotiation of the block size, the following blocks are requested by the transaction
+            coap_set_header_block2(transaction->message, 0, 0, clientP->blockSize);
+        }
     }
-    else if (buffer != NULL)
+    else if (buffer != NULL || reader != NULL)
     {
+        uint16_t blockSize;
+
         coap_set_header_content_type(transaction->message, format);
-        // TODO: Take care of fragmentation
-        coap_set_payload(transaction->message, buffer, length);
+        blockSize = (clientP->blockSize != 0) ? clientP->blockSize : LWM2M_DEFAULT_BLOCK_SIZE;
+        if (reader != NULL || length > blockSize)
+        {
+            // the following blocks are sent by the transaction as the client asks for them
+            if (0 != transaction_setBlock1(contextP, transaction, blockSize, (size_t)length, buffer, reader, readerData))
+            {
+                transaction_free(contextP, transaction);
+                return COAP_500_INTERNAL_SERVER_ERROR;
+            }
+        }
+        else
+        {
+            coap_set_payload(transaction->message, buffer, length);
+        }
     }
 
     if (callback != NULL)
@@ -453,7 +475,7 @@ static int prv_makeOperation(lwm2m_context_t * contextP,
         dataP = (dm_data_t *)lwm2m_malloc(sizeof(dm_data_t));
         if (dataP == NULL)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         memcpy(&dataP->uri, uriP, sizeof(lwm2m_uri_t));
@@ -465,11 +487,33 @@ static int prv_makeOperation(lwm2m_context_t * contextP,
         transaction->userData = (void *)dataP;
     }
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
 
     return transaction_send(contextP, transaction);
 }
 
+int lwm2m_set_client_block_size(lwm2m_context_t * contextP,
+                                uint16_t clientID,
+                                uint16_t blockSize)
+{
+    lwm2m_client_t * clientP;
+
+    LOG_ARG("clientID: %d, blockSize: %u", clientID, blockSize);
+
+    clientP = registration_findClient(contextP, clientID);
+    if (clientP == NULL) return COAP_404_NOT_FOUND;
+
+    // a power of two between 16 and 1024
+    if (blockSize != 0
+     && (blockSize < 16 || blockSize > 1024 || (blockSize & (blockSize - 1)) != 0))
+    {
+        return COAP_400_BAD_REQUEST;
+    }
+    clientP->blockSize = blockSize;
+
+    return COAP_NO_ERROR;
+}
+
 int lwm2m_dm_read(lwm2m_context_t * contextP,
                   uint16_t clientID,
                   lwm2m_uri_t * uriP,
@@ -482,7 +526,7 @@ int lwm2m_dm_read(lwm2m_context_t * contextP,
     LOG_ARG("clientID: %d", clientID);
     LOG_URI(uriP);
 
-    clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, clientID);
+    clientP = registration_findClient(contextP, clientID);
     if (clientP == NULL) return COAP_404_NOT_FOUND;
 
     if (clientP->supportJSON == true)
@@ -498,6 +542,7 @@ int lwm2m_dm_read(lwm2m_context_t * contextP,
                              COAP_GET,
                              format,
                              NULL, 0,
+                             NULL, NULL,
                              callback, userData);
 }
 
@@ -523,6 +568,7 @@ int lwm2m_dm_write(lwm2m_context_t * contextP,
         return prv_makeOperation(contextP, clientID, uriP,
                                   COAP_PUT,
                                   format, buffer, length,
+                                  NULL, NULL,
                                   callback, userData);
     }
     else
@@ -530,10 +576,38 @@ int lwm2m_dm_write(lwm2m_context_t * contextP,
         return prv_makeOperation(contextP, clientID, uriP,
                                   COAP_POST,
                                   format, buffer, length,
+                                  NULL, NULL,
                                   callback, userData);
     }
 }
 
+int lwm2m_dm_write_stream(lwm2m_context_t * contextP,
+                          uint16_t clientID,
+                          lwm2m_uri_t * uriP,
+                          lwm2m_media_type_t format,
+                          size_t length,
+                          lwm2m_block_reader_t reader,
+                          void * readerData,
+                          lwm2m_result_callback_t callback,
+                          void * userData)
+{
+    LOG_ARG("clientID: %d, format: %s, length: %u", clientID, STR_MEDIA_TYPE(format), length);
+    LOG_URI(uriP);
+    if (!LWM2M_URI_IS_SET_INSTANCE(uriP)
+     || length == 0
+     || length > INT_MAX
+     || reader == NULL)
+    {
+        return COAP_400_BAD_REQUEST;
+    }
+
+    return prv_makeOperation(contextP, clientID, uriP,
+                             LWM2M_URI_IS_SET_RESOURCE(uriP) ? COAP_PUT : COAP_POST,
+                             format, NULL, (int)length,
+                             reader, readerData,
+                             callback, userData);
+}
+
 int lwm2m_dm_execute(lwm2m_context_t * contextP,
                      uint16_t clientID,
                      lwm2m_uri_t * uriP,
@@ -553,6 +627,7 @@ int lwm2m_dm_execute(lwm2m_context_t * contextP,
     return prv_makeOperation(contextP, clientID, uriP,
                               COAP_POST,
                               format, buffer, length,
+                              NULL, NULL,
                               callback, userData);
 }
 
@@ -577,6 +652,7 @@ int lwm2m_dm_create(lwm2m_context_t * contextP,
     return prv_makeOperation(contextP, clientID, uriP,
                               COAP_POST,
                               format, buffer, length,
+                              NULL, NULL,
                               callback, userData);
 }
 
@@ -597,6 +673,7 @@ int lwm2m_dm_delete(lwm2m_context_t * contextP,
     return prv_makeOperation(contextP, clientID, uriP,
                               COAP_DELETE,
                               LWM2M_CONTENT_TEXT, NULL, 0,
+                              NULL, NULL,
                               callback, userData);
 }
 
@@ -623,10 +700,10 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
     if (ATTR_FLAG_NUMERIC == (attrP->toSet & ATTR_FLAG_NUMERIC)
      && (attrP->lessThan + 2 * attrP->step >= attrP->greaterThan)) return COAP_400_BAD_REQUEST;
 
-    clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, clientID);
+    clientP = registration_findClient(contextP, clientID);
     if (clientP == NULL) return COAP_404_NOT_FOUND;
 
-    transaction = transaction_new(clientP->sessionH, COAP_PUT, clientP->altPath, uriP, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, clientP->sessionH, COAP_PUT, clientP->altPath, uriP, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
 
     if (callback != NULL)
@@ -636,7 +713,7 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
         dataP = (dm_data_t *)lwm2m_malloc(sizeof(dm_data_t));
         if (dataP == NULL)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         memcpy(&dataP->uri, uriP, sizeof(lwm2m_uri_t));
@@ -656,7 +733,7 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
         length = utils_intToText(attrP->minPeriod, buffer + ATTR_MIN_PERIOD_LEN, _PRV_BUFFER_SIZE - ATTR_MIN_PERIOD_LEN);
         if (length == 0)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         coap_add_multi_option(&(coap_pkt->uri_query), buffer, ATTR_MIN_PERIOD_LEN + length, 0);
@@ -668,7 +745,7 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
         length = utils_intToText(attrP->maxPeriod, buffer + ATTR_MAX_PERIOD_LEN, _PRV_BUFFER_SIZE - ATTR_MAX_PERIOD_LEN);
         if (length == 0)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         coap_add_multi_option(&(coap_pkt->uri_query), buffer, ATTR_MAX_PERIOD_LEN + length, 0);
@@ -680,7 +757,7 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
         length = utils_floatToText(attrP->greaterThan, buffer + ATTR_GREATER_THAN_LEN, _PRV_BUFFER_SIZE - ATTR_GREATER_THAN_LEN);
         if (length == 0)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         coap_add_multi_option(&(coap_pkt->uri_query), buffer, ATTR_GREATER_THAN_LEN + length, 0);
@@ -692,7 +769,7 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
         length = utils_floatToText(attrP->lessThan, buffer + ATTR_LESS_THAN_LEN, _PRV_BUFFER_SIZE - ATTR_LESS_THAN_LEN);
         if (length == 0)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         coap_add_multi_option(&(coap_pkt->uri_query), buffer, ATTR_LESS_THAN_LEN + length, 0);
@@ -704,7 +781,7 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
         length = utils_floatToText(attrP->step, buffer + ATTR_STEP_LEN, _PRV_BUFFER_SIZE - ATTR_STEP_LEN);
         if (length == 0)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         coap_add_multi_option(&(coap_pkt->uri_query), buffer, ATTR_STEP_LEN + length, 0);
@@ -736,7 +813,7 @@ int lwm2m_dm_write_attributes(lwm2m_context_t * contextP,
         SET_OPTION(coap_pkt, COAP_OPTION_URI_QUERY);
     }
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
 
     return transaction_send(contextP, transaction);
 }
@@ -753,10 +830,10 @@ int lwm2m_dm_discover(lwm2m_context_t * contextP,
 
     LOG_ARG("clientID: %d", clientID);
     LOG_URI(uriP);
-    clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, clientID);
+    clientP = registration_findClient(contextP, clientID);
     if (clientP == NULL) return COAP_404_NOT_FOUND;
 
-    transaction = transaction_new(clientP->sessionH, COAP_GET, clientP->altPath, uriP, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, clientP->sessionH, COAP_GET, clientP->altPath, uriP, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
 
     coap_set_header_accept(transaction->message, LWM2M_CONTENT_LINK);
@@ -766,7 +843,7 @@ int lwm2m_dm_discover(lwm2m_context_t * contextP,
         dataP = (dm_data_t *)lwm2m_malloc(sizeof(dm_data_t));
         if (dataP == NULL)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
         memcpy(&dataP->uri, uriP, sizeof(lwm2m_uri_t));
@@ -778,7 +855,7 @@ int lwm2m_dm_discover(lwm2m_context_t * contextP,
         transaction->userData = (void *)dataP;
     }
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
 
     return transaction_send(contextP, transaction);
 }
@@ -0,0 +1,248 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Intel Corporation and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Memory tied to a context.
+ *
+ * Pools hand out fixed-size objects carved from slabs of LWM2M_POOL_SLAB_COUNT
+ * objects. Each object is preceded by a header pointing to its pool while in
+ * use and to the next free object while in the free list, so that objects can
+ * be released without their context. Slabs are only released by memory_clear().
+ *
+ * The arena is a bump allocator for memory living until memory_arenaReset().
+ * When a reset finds several chunks, they are replaced by a single one large
+ * enough for all of them so that the arena settles on one chunk.
+ */
+
+#include "internals.h"
+
+#ifndef LWM2M_POOL_SLAB_COUNT
+#define LWM2M_POOL_SLAB_COUNT 8
+#endif
+
+#ifndef LWM2M_ARENA_CHUNK_SIZE
+#define LWM2M_ARENA_CHUNK_SIZE 512
+#endif
+
+// also gives the alignment of the memory following it
+typedef union
+{
+    lwm2m_pool_t * poolP;
+    void *         nextP;
+    double         d;
+    long long      ll;
+} memory_header_t;
+
+typedef struct
+{
+    void * nextP;
+    size_t size;
+    size_t used;
+} arena_chunk_t;
+
+#define ALIGN_SIZE(S)   ((((S) + sizeof(memory_header_t) - 1) / sizeof(memory_header_t)) * sizeof(memory_header_t))
+#define CHUNK_HEADER    ALIGN_SIZE(sizeof(arena_chunk_t))
+
+static size_t prv_objectSize(lwm2m_pool_id_t id)
+{
+    switch (id)
+    {
+    case LWM2M_POOL_TRANSACTION:
+        return sizeof(lwm2m_transaction_t);
+    case LWM2M_POOL_PACKET:
+        return sizeof(coap_packet_t);
+    case LWM2M_POOL_WATCHER:
+        return sizeof(lwm2m_watcher_t);
+    case LWM2M_POOL_OBSERVATION:
+        return sizeof(lwm2m_observation_t);
+    case LWM2M_POOL_CLIENT:
+        return sizeof(lwm2m_client_t);
+    case LWM2M_POOL_PEER:
+        return sizeof(lwm2m_peer_t);
+    default:
+        return 0;
+    }
+}
+
+void * memory_alloc(lwm2m_context_t * contextP,
+                    size_t size)
+{
+    if (contextP->allocator.mallocFunc == NULL) return lwm2m_malloc(size);
+    return contextP->allocator.mallocFunc(size, contextP->allocator.userData);
+}
+
+void memory_free(lwm2m_context_t * contextP,
+                 void * ptr)
+{
+    if (contextP->allocator.freeFunc == NULL)
+    {
+        lwm2m_free(ptr);
+    }
+    else
+    {
+        contextP->allocator.freeFunc(ptr, contextP->allocator.userData);
+    }
+}
+
+void * memory_poolAlloc(lwm2m_context_t * contextP,
+                        lwm2m_pool_id_t id)
+{
+    lwm2m_pool_t * poolP = contextP->pools + id;
+    memory_header_t * headerP;
+
+    if (poolP->freeList == NULL)
+    {
+        memory_header_t * slabP;
+        size_t step;
+        uint8_t * objectP;
+        int i;
+
+        step = sizeof(memory_header_t) + ALIGN_SIZE(prv_objectSize(id));
+        slabP = (memory_header_t *)memory_alloc(contextP, sizeof(memory_header_t) + LWM2M_POOL_SLAB_COUNT * step);
+        if (slabP == NULL) return NULL;
+        slabP->nextP = poolP->slabList;
+        poolP->slabList = slabP;
+
+        objectP = (uint8_t *)(slabP + 1);
+        for (i = 0 ; i < LWM2M_POOL_SLAB_COUNT ; i++)
+        {
+            ((memory_header_t *)objectP)->nextP = poolP->freeList;
+            poolP->freeList = objectP;
+            objectP += step;
+        }
+    }
+
+    headerP = (memory_header_t *)poolP->freeList;
+    poolP->freeList = headerP->nextP;
+    headerP->poolP = poolP;
+
+    return headerP + 1;
+}
+
+void memory_poolFree(void * objectP)
+{
+    memory_header_t * headerP;
+    lwm2m_pool_t * poolP;
+
+    if (objectP == NULL) return;
+
+    headerP = (memory_header_t *)objectP - 1;
+    poolP = headerP->poolP;
+    headerP->nextP = poolP->freeList;
+    poolP->freeList = headerP;
+}
+
+void * memory_arenaAlloc(lwm2m_context_t * contextP,
+                         size_t size)
+{
+    arena_chunk_t * chunkP = (arena_chunk_t *)contextP->arena.chunkList;
+    uint8_t * result;
+
+    size = ALIGN_SIZE(size);
+    if (chunkP == NULL || chunkP->size - chunkP->used < size)
+    {
+        size_t chunkSize;
+
+        chunkSize = size > LWM2M_ARENA_CHUNK_SIZE ? size : LWM2M_ARENA_CHUNK_SIZE;
+        chunkP = (arena_chunk_t *)memory_alloc(contextP, CHUNK_HEADER + chunkSize);
+        if (chunkP == NULL) return NULL;
+        chunkP->nextP = contextP->arena.chunkList;
+        chunkP->size = chunkSize;
+        chunkP->used = 0;
+        contextP->arena.chunkList = chunkP;
+    }
+
+    result = (uint8_t *)chunkP + CHUNK_HEADER + chunkP->used;
+    chunkP->used += size;
+
+    return result;
+}
+
+bool memory_arenaOwns(lwm2m_context_t * contextP,
+                      void * ptr)
+{
+    arena_chunk_t * chunkP;
+
+    for (chunkP = (arena_chunk_t *)contextP->arena.chunkList ; chunkP != NULL ; chunkP = (arena_chunk_t *)chunkP->nextP)
+    {
+        if ((uint8_t *)ptr >= (uint8_t *)chunkP + CHUNK_HEADER
+         && (uint8_t *)ptr < (uint8_t *)chunkP + CHUNK_HEADER + chunkP->size)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void memory_arenaReset(lwm2m_context_t * contextP)
+{
+    arena_chunk_t * chunkP = (arena_chunk_t *)contextP->arena.chunkList;
+    size_t total;
+
+    if (chunkP == NULL) return;
+    if (chunkP->nextP == NULL)
+    {
+        chunkP->used = 0;
+        return;
+    }
+
+    total = 0;
+    while (chunkP != NULL)
+    {
+        arena_chunk_t * nextP = (arena_chunk_t *)chunkP->nextP;
+
+        total += chunkP->size;
+        memory_free(contextP, chunkP);
+        chunkP = nextP;
+    }
+
+    chunkP = (arena_chunk_t *)memory_alloc(contextP, CHUNK_HEADER + total);
+    if (chunkP != NULL)
+    {
+        chunkP->nextP = NULL;
+        chunkP->size = total;
+        chunkP->used = 0;
+    }
+    contextP->arena.chunkList = chunkP;
+}
+
+// all the pooled objects must have been released
+void memory_clear(lwm2m_context_t * contextP)
+{
+    int i;
+
+    for (i = 0 ; i < LWM2M_POOL_COUNT ; i++)
+    {
+        while (contextP->pools[i].slabList != NULL)
+        {
+            memory_header_t * slabP = (memory_header_t *)contextP->pools[i].slabList;
+
+            contextP->pools[i].slabList = slabP->nextP;
+            memory_free(contextP, slabP);
+        }
+        contextP->pools[i].freeList = NULL;
+    }
+
+    while (contextP->arena.chunkList != NULL)
+    {
+        arena_chunk_t * chunkP = (arena_chunk_t *)contextP->arena.chunkList;
+
+        contextP->arena.chunkList = chunkP->nextP;
+        memory_free(contextP, chunkP);
+    }
+}
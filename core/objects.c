@@ -255,7 +255,7 @@ uint8_t object_write(lwm2m_context_t * contextP,
     }
     else
     {
-        size = lwm2m_data_parse(uriP, buffer, length, format, &dataP);
+        size = data_parse(contextP, uriP, buffer, length, format, &dataP);
         if (size == 0)
         {
             result = COAP_406_NOT_ACCEPTABLE;
@@ -264,7 +264,7 @@ uint8_t object_write(lwm2m_context_t * contextP,
     if (result == NO_ERROR)
     {
         result = targetP->writeFunc(uriP->instanceId, size, dataP, targetP);
-        lwm2m_data_free(size, dataP);
+        data_free(contextP, size, dataP);
     }
 
     LOG_ARG("result: %u.%2u", (result & 0xFF) >> 5, (result & 0x1F));
@@ -310,7 +310,7 @@ uint8_t object_create(lwm2m_context_t * contextP,
     if (NULL == targetP) return COAP_404_NOT_FOUND;
     if (NULL == targetP->createFunc) return COAP_405_METHOD_NOT_ALLOWED;
 
-    size = lwm2m_data_parse(uriP, buffer, length, format, &dataP);
+    size = data_parse(contextP, uriP, buffer, length, format, &dataP);
     if (size <= 0) return COAP_400_BAD_REQUEST;
 
     switch (dataP[0].type)
@@ -347,7 +347,7 @@ uint8_t object_create(lwm2m_context_t * contextP,
     }
 
 exit:
-    lwm2m_data_free(size, dataP);
+    data_free(contextP, size, dataP);
 
     LOG_ARG("result: %u.%2u", (result & 0xFF) >> 5, (result & 0x1F));
 
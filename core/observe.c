@@ -52,22 +52,110 @@
 
 
 #ifdef LWM2M_CLIENT_MODE
+/*
+ * The observed items are indexed by their exact URI. A change of a resource
+ * is matched by looking up the resource, its instance and its object, which
+ * are the levels of the URI tree an observation can be attached to.
+ * The watchers are indexed by the MID of their last notification, which is
+ * the one a reset from the server refers to.
+ */
+
+typedef struct
+{
+    uint16_t mid;
+    void *   sessionH;
+    lwm2m_context_t * contextP;
+} watcher_key_t;
+
+static size_t prv_uriHash(lwm2m_uri_t * uriP)
+{
+    uint16_t key[3];
+
+    key[0] = uriP->objectId;
+    key[1] = LWM2M_URI_IS_SET_INSTANCE(uriP) ? uriP->instanceId : LWM2M_MAX_ID;
+    key[2] = LWM2M_URI_IS_SET_RESOURCE(uriP) ? uriP->resourceId : LWM2M_MAX_ID;
+
+    return index_hashBuffer((uint8_t *)key, sizeof(key));
+}
+
+static size_t prv_observedHash(void * itemP)
+{
+    return prv_uriHash(&(((lwm2m_observed_t *)itemP)->uri));
+}
+
+static bool prv_observedMatch(void * itemP,
+                              void * keyP)
+{
+    lwm2m_uri_t * targetP = &(((lwm2m_observed_t *)itemP)->uri);
+    lwm2m_uri_t * uriP = (lwm2m_uri_t *)keyP;
+
+    return (targetP->objectId == uriP->objectId
+         && (targetP->flag & LWM2M_URI_MASK_ID) == (uriP->flag & LWM2M_URI_MASK_ID)
+         && (!LWM2M_URI_IS_SET_INSTANCE(uriP) || targetP->instanceId == uriP->instanceId)
+         && (!LWM2M_URI_IS_SET_RESOURCE(uriP) || targetP->resourceId == uriP->resourceId));
+}
+
+static size_t prv_watcherHash(void * itemP)
+{
+    return index_hashInt(((lwm2m_watcher_t *)itemP)->lastMid);
+}
+
+static bool prv_watcherMatch(void * itemP,
+                             void * keyP)
+{
+    lwm2m_watcher_t * watcherP = (lwm2m_watcher_t *)itemP;
+    watcher_key_t * watcherKeyP = (watcher_key_t *)keyP;
+
+    return (watcherP->lastMid == watcherKeyP->mid
+         && lwm2m_session_is_equal(watcherP->server->sessionH, watcherKeyP->sessionH, watcherKeyP->contextP->userData));
+}
+
 static lwm2m_observed_t * prv_findObserved(lwm2m_context_t * contextP,
                                            lwm2m_uri_t * uriP)
 {
-    lwm2m_observed_t * targetP;
+    return (lwm2m_observed_t *)index_find(&contextP->observedIndex,
+                                          prv_uriHash(uriP),
+                                          prv_observedMatch,
+                                          uriP);
+}
 
-    targetP = contextP->observedList;
-    while (targetP != NULL
-        && (targetP->uri.objectId != uriP->objectId
-         || targetP->uri.flag != uriP->flag
-         || (LWM2M_URI_IS_SET_INSTANCE(uriP) && targetP->uri.instanceId != uriP->instanceId)
-         || (LWM2M_URI_IS_SET_RESOURCE(uriP) && targetP->uri.resourceId != uriP->resourceId)))
+static void prv_observedTimer(lwm2m_context_t * contextP, void * itemP, time_t currentTime);
+
+// returns the earliest time a watcher of observedP has to be checked or -1 if none has to
+static time_t prv_nextDeadline(lwm2m_observed_t * observedP)
+{
+    lwm2m_watcher_t * watcherP;
+    time_t deadline = -1;
+
+    for (watcherP = observedP->watcherList ; watcherP != NULL ; watcherP = watcherP->next)
     {
-        targetP = targetP->next;
+        time_t watcherDeadline = -1;
+
+        if (watcherP->active == false) continue;
+
+        if (watcherP->update == true)
+        {
+            watcherDeadline = 0;
+            if (watcherP->parameters != NULL
+             && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MIN_PERIOD) != 0)
+            {
+                watcherDeadline = watcherP->lastTime + watcherP->parameters->minPeriod;
+            }
+        }
+        if (watcherP->parameters != NULL
+         && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0
+         && (watcherDeadline < 0 || watcherP->lastTime + watcherP->parameters->maxPeriod < watcherDeadline))
+        {
+            watcherDeadline = watcherP->lastTime + watcherP->parameters->maxPeriod;
+        }
+
+        if (watcherDeadline >= 0 && (deadline < 0 || watcherDeadline < deadline))
+        {
+            deadline = watcherDeadline;
+        }
     }
 
-    return targetP;
+    return deadline;
 }
 
 static void prv_unlinkObserved(lwm2m_context_t * contextP,
@@ -94,6 +182,57 @@ static void prv_unlinkObserved(lwm2m_context_t * contextP,
     }
 }
 
+// frees observedP with its watchers
+static void prv_dropObserved(lwm2m_context_t * contextP,
+                             lwm2m_observed_t * observedP)
+{
+    while (observedP->watcherList != NULL)
+    {
+        lwm2m_watcher_t * watcherP = observedP->watcherList;
+
+        observedP->watcherList = watcherP->next;
+        index_remove(&contextP->watcherMidIndex, watcherP, prv_watcherHash);
+        if (watcherP->parameters != NULL) lwm2m_free(watcherP->parameters);
+        memory_poolFree(watcherP);
+    }
+
+    timer_cancel(contextP, &(observedP->timer));
+    index_remove(&contextP->observedIndex, observedP, prv_observedHash);
+    prv_unlinkObserved(contextP, observedP);
+    lwm2m_free(observedP);
+}
+
+// an observation without its timer would not notify anymore, it is dropped if the timer can not be scheduled.
+// returns -1 in this case.
+static int prv_scheduleObservedAt(lwm2m_context_t * contextP,
+                                  lwm2m_observed_t * observedP,
+                                  time_t deadline)
+{
+    if (0 != timer_schedule(contextP, &(observedP->timer), deadline))
+    {
+        LOG("Dropping an observation which can not be scheduled");
+        prv_dropObserved(contextP, observedP);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int prv_scheduleObserved(lwm2m_context_t * contextP,
+                                lwm2m_observed_t * observedP)
+{
+    time_t deadline;
+
+    deadline = prv_nextDeadline(observedP);
+    if (deadline < 0)
+    {
+        timer_cancel(contextP, &(observedP->timer));
+        return 0;
+    }
+
+    return prv_scheduleObservedAt(contextP, observedP, deadline);
+}
+
 static lwm2m_watcher_t * prv_findWatcher(lwm2m_observed_t * observedP,
                                          lwm2m_server_t * serverP)
 {
@@ -127,6 +266,12 @@ static lwm2m_watcher_t * prv_getWatcher(lwm2m_context_t * contextP,
         allocatedObserver = true;
         memset(observedP, 0, sizeof(lwm2m_observed_t));
         memcpy(&(observedP->uri), uriP, sizeof(lwm2m_uri_t));
+        timer_init(&(observedP->timer), prv_observedTimer, observedP);
+        if (0 != index_insert(contextP, &contextP->observedIndex, observedP, prv_observedHash))
+        {
+            lwm2m_free(observedP);
+            return NULL;
+        }
         observedP->next = contextP->observedList;
         contextP->observedList = observedP;
     }
@@ -134,18 +279,25 @@ static lwm2m_watcher_t * prv_getWatcher(lwm2m_context_t * contextP,
     watcherP = prv_findWatcher(observedP, serverP);
     if (watcherP == NULL)
     {
-        watcherP = (lwm2m_watcher_t *)lwm2m_malloc(sizeof(lwm2m_watcher_t));
+        // the watcher is indexed by MID once it sent a notification
+        watcherP = (lwm2m_watcher_t *)memory_poolAlloc(contextP, LWM2M_POOL_WATCHER);
+        if (watcherP != NULL)
+        {
+            memset(watcherP, 0, sizeof(lwm2m_watcher_t));
+        }
         if (watcherP == NULL)
         {
             if (allocatedObserver == true)
             {
+                index_remove(&contextP->observedIndex, observedP, prv_observedHash);
+                prv_unlinkObserved(contextP, observedP);
                 lwm2m_free(observedP);
             }
             return NULL;
         }
-        memset(watcherP, 0, sizeof(lwm2m_watcher_t));
         watcherP->active = false;
         watcherP->server = serverP;
+        watcherP->observed = observedP;
         watcherP->next = observedP->watcherList;
         observedP->watcherList = watcherP;
     }
@@ -153,6 +305,29 @@ static lwm2m_watcher_t * prv_getWatcher(lwm2m_context_t * contextP,
     return watcherP;
 }
 
+static void prv_removeWatcher(lwm2m_context_t * contextP,
+                              lwm2m_watcher_t * watcherP)
+{
+    lwm2m_observed_t * observedP = watcherP->observed;
+    lwm2m_watcher_t ** linkP;
+
+    linkP = &(observedP->watcherList);
+    while (*linkP != watcherP) linkP = &((*linkP)->next);
+    *linkP = watcherP->next;
+
+    index_remove(&contextP->watcherMidIndex, watcherP, prv_watcherHash);
+    if (watcherP->parameters != NULL) lwm2m_free(watcherP->parameters);
+    memory_poolFree(watcherP);
+
+    if (observedP->watcherList == NULL)
+    {
+        timer_cancel(contextP, &(observedP->timer));
+        index_remove(&contextP->observedIndex, observedP, prv_observedHash);
+        prv_unlinkObserved(contextP, observedP);
+        lwm2m_free(observedP);
+    }
+}
+
 uint8_t observe_handleRequest(lwm2m_context_t * contextP,
                               lwm2m_uri_t * uriP,
                               lwm2m_server_t * serverP,
@@ -207,12 +382,22 @@ uint8_t observe_handleRequest(lwm2m_context_t * contextP,
         }
 
         coap_set_header_observe(response, watcherP->counter++);
+        if (0 != prv_scheduleObserved(contextP, prv_findObserved(contextP, uriP))) return COAP_500_INTERNAL_SERVER_ERROR;
 
         return COAP_205_CONTENT;
 
     case 1:
         // cancellation
-        observe_cancel(contextP, LWM2M_MAX_ID, serverP->sessionH);
+        {
+            lwm2m_observed_t * observedP;
+
+            observedP = prv_findObserved(contextP, uriP);
+            if (observedP != NULL)
+            {
+                watcherP = prv_findWatcher(observedP, serverP);
+                if (watcherP != NULL) prv_removeWatcher(contextP, watcherP);
+            }
+        }
         return COAP_205_CONTENT;
 
     default:
@@ -224,50 +409,18 @@ void observe_cancel(lwm2m_context_t * contextP,
                     uint16_t mid,
                     void * fromSessionH)
 {
-    lwm2m_observed_t * observedP;
+    lwm2m_watcher_t * watcherP;
+    watcher_key_t key;
 
     LOG_ARG("mid: %d", mid);
 
-    for (observedP = contextP->observedList;
-         observedP != NULL;
-         observedP = observedP->next)
+    key.mid = mid;
+    key.sessionH = fromSessionH;
+    key.contextP = contextP;
+    watcherP = (lwm2m_watcher_t *)index_find(&contextP->watcherMidIndex, index_hashInt(mid), prv_watcherMatch, &key);
+    if (watcherP != NULL)
     {
-        lwm2m_watcher_t * targetP = NULL;
-
-        if ((LWM2M_MAX_ID == mid || observedP->watcherList->lastMid == mid)
-         && lwm2m_session_is_equal(observedP->watcherList->server->sessionH, fromSessionH, contextP->userData))
-        {
-            targetP = observedP->watcherList;
-            observedP->watcherList = observedP->watcherList->next;
-        }
-        else
-        {
-            lwm2m_watcher_t * parentP;
-
-            parentP = observedP->watcherList;
-            while (parentP->next != NULL
-                && (parentP->next->lastMid != mid
-                 || lwm2m_session_is_equal(parentP->next->server->sessionH, fromSessionH, contextP->userData)))
-            {
-                parentP = parentP->next;
-            }
-            if (parentP->next != NULL)
-            {
-                targetP = parentP->next;
-                parentP->next = parentP->next->next;
-            }
-        }
-        if (targetP != NULL)
-        {
-            if (targetP->parameters != NULL) lwm2m_free(targetP->parameters);
-            lwm2m_free(targetP);
-            if (observedP->watcherList == NULL)
-            {
-                prv_unlinkObserved(contextP, observedP);
-                lwm2m_free(observedP);
-            }
-            return;
-        }
+        prv_removeWatcher(contextP, watcherP);
     }
 }
 
@@ -286,19 +439,9 @@ void observe_clear(lwm2m_context_t * contextP,
                 || observedP->uri.instanceId == uriP->instanceId))
         {
             lwm2m_observed_t * nextP;
-            lwm2m_watcher_t * watcherP;
 
             nextP = observedP->next;
-
-            for (watcherP = observedP->watcherList; watcherP != NULL; watcherP = watcherP->next)
-            {
-                if (watcherP->parameters != NULL) lwm2m_free(watcherP->parameters);
-            }
-            LWM2M_LIST_FREE(observedP->watcherList);
-
-            prv_unlinkObserved(contextP, observedP);
-            lwm2m_free(observedP);
-
+            prv_dropObserved(contextP, observedP);
             observedP = nextP;
         }
         else
@@ -406,6 +549,9 @@ uint8_t observe_setParameters(lwm2m_context_t * contextP,
     LOG_ARG("Final toSet: %08X, minPeriod: %d, maxPeriod: %d, greaterThan: %f, lessThan: %f, step: %f",
             watcherP->parameters->toSet, watcherP->parameters->minPeriod, watcherP->parameters->maxPeriod, watcherP->parameters->greaterThan, watcherP->parameters->lessThan, watcherP->parameters->step);
 
+    // the periods may have changed
+    if (0 != prv_scheduleObserved(contextP, prv_findObserved(contextP, uriP))) return COAP_500_INTERNAL_SERVER_ERROR;
+
     return COAP_204_CHANGED;
 }
 
@@ -415,335 +561,368 @@ lwm2m_observed_t * observe_findByUri(lwm2m_context_t * contextP,
     lwm2m_observed_t * targetP;
 
     LOG_URI(uriP);
-    targetP = contextP->observedList;
-    while (targetP != NULL)
+    targetP = prv_findObserved(contextP, uriP);
+    if (targetP != NULL)
     {
-        if (targetP->uri.objectId == uriP->objectId)
-        {
-            if ((!LWM2M_URI_IS_SET_INSTANCE(uriP) && !LWM2M_URI_IS_SET_INSTANCE(&(targetP->uri)))
-             || (LWM2M_URI_IS_SET_INSTANCE(uriP) && LWM2M_URI_IS_SET_INSTANCE(&(targetP->uri)) && (uriP->instanceId == targetP->uri.instanceId)))
-             {
-                 if ((!LWM2M_URI_IS_SET_RESOURCE(uriP) && !LWM2M_URI_IS_SET_RESOURCE(&(targetP->uri)))
-                     || (LWM2M_URI_IS_SET_RESOURCE(uriP) && LWM2M_URI_IS_SET_RESOURCE(&(targetP->uri)) && (uriP->resourceId == targetP->uri.resourceId)))
-                 {
-                     LOG_ARG("Found one with%s observers.", targetP->watcherList ? "" : " no");
-                     LOG_URI(&(targetP->uri));
-                     return targetP;
-                 }
-             }
-        }
-        targetP = targetP->next;
+        LOG_ARG("Found one with%s observers.", targetP->watcherList ? "" : " no");
+        return targetP;
     }
 
     LOG("Found nothing");
     return NULL;
 }
 
+static void prv_tagObserved(lwm2m_context_t * contextP,
+                            lwm2m_observed_t * targetP)
+{
+    lwm2m_watcher_t * watcherP;
+
+    LOG("Found an observation");
+    LOG_URI(&(targetP->uri));
+
+    for (watcherP = targetP->watcherList ; watcherP != NULL ; watcherP = watcherP->next)
+    {
+        if (watcherP->active == true)
+        {
+            LOG("Tagging a watcher");
+            watcherP->update = true;
+        }
+    }
+    // checked by the next lwm2m_step(), targetP may be dropped
+    (void)prv_scheduleObserved(contextP, targetP);
+}
+
 void lwm2m_resource_value_changed(lwm2m_context_t * contextP,
                                   lwm2m_uri_t * uriP)
 {
     lwm2m_observed_t * targetP;
 
     LOG_URI(uriP);
+    if (LWM2M_URI_IS_SET_RESOURCE(uriP))
+    {
+        lwm2m_uri_t uri;
+
+        // the resource, its instance and its object
+        memcpy(&uri, uriP, sizeof(lwm2m_uri_t));
+        targetP = prv_findObserved(contextP, &uri);
+        if (targetP != NULL) prv_tagObserved(contextP, targetP);
+        uri.flag &= ~LWM2M_URI_FLAG_RESOURCE_ID;
+        targetP = prv_findObserved(contextP, &uri);
+        if (targetP != NULL) prv_tagObserved(contextP, targetP);
+        uri.flag &= ~LWM2M_URI_FLAG_INSTANCE_ID;
+        targetP = prv_findObserved(contextP, &uri);
+        if (targetP != NULL) prv_tagObserved(contextP, targetP);
+        return;
+    }
+
+    // the items below an instance or an object are not indexed
     targetP = contextP->observedList;
     while (targetP != NULL)
     {
-        if (targetP->uri.objectId == uriP->objectId)
-        {
-            if (!LWM2M_URI_IS_SET_INSTANCE(uriP)
-             || (targetP->uri.flag & LWM2M_URI_FLAG_INSTANCE_ID) == 0
-             || uriP->instanceId == targetP->uri.instanceId)
-            {
-                if (!LWM2M_URI_IS_SET_RESOURCE(uriP)
-                 || (targetP->uri.flag & LWM2M_URI_FLAG_RESOURCE_ID) == 0
-                 || uriP->resourceId == targetP->uri.resourceId)
-                {
-                    lwm2m_watcher_t * watcherP;
-
-                    LOG("Found an observation");
-                    LOG_URI(&(targetP->uri));
+        lwm2m_observed_t * nextP = targetP->next;
 
-                    for (watcherP = targetP->watcherList ; watcherP != NULL ; watcherP = watcherP->next)
-                    {
-                        if (watcherP->active == true)
-                        {
-                            LOG("Tagging a watcher");
-                            watcherP->update = true;
-                        }
-                    }
-                }
-            }
+        if (targetP->uri.objectId == uriP->objectId
+         && (!LWM2M_URI_IS_SET_INSTANCE(uriP)
+          || (targetP->uri.flag & LWM2M_URI_FLAG_INSTANCE_ID) == 0
+          || uriP->instanceId == targetP->uri.instanceId))
+        {
+            prv_tagObserved(contextP, targetP);
         }
-        targetP = targetP->next;
+        targetP = nextP;
     }
 }
-
-void observe_step(lwm2m_context_t * contextP,
-                  time_t currentTime,
-                  time_t * timeoutP)
+// runs when a watcher was tagged by lwm2m_resource_value_changed() or reached its minimal or maximal period.
+// The value is only read in these cases.
+static void prv_observedTimer(lwm2m_context_t * contextP,
+                              void * itemP,
+                              time_t currentTime)
 {
-    lwm2m_observed_t * targetP;
+    lwm2m_observed_t * targetP = (lwm2m_observed_t *)itemP;
+    lwm2m_watcher_t * watcherP;
+    uint8_t * buffer = NULL;
+    size_t length = 0;
+    lwm2m_data_t * dataP = NULL;
+    int size = 0;
+    double floatValue = 0;
+    int64_t integerValue = 0;
+    bool storeValue = false;
+    notify_template_t notifyTemplate;
+    time_t deadline;
+
+    LOG_URI(&(targetP->uri));
+    deadline = prv_nextDeadline(targetP);
+    if (deadline < 0) return;
+    if (deadline > currentTime)
+    {
+        (void)prv_scheduleObservedAt(contextP, targetP, deadline);
+        return;
+    }
 
-    LOG("Entering");
-    for (targetP = contextP->observedList ; targetP != NULL ; targetP = targetP->next)
+    if (LWM2M_URI_IS_SET_RESOURCE(&targetP->uri))
     {
-        lwm2m_watcher_t * watcherP;
-        uint8_t * buffer = NULL;
-        size_t length = 0;
-        lwm2m_data_t * dataP = NULL;
-        int size = 0;
-        double floatValue = 0;
-        int64_t integerValue = 0;
-        bool storeValue = false;
-        coap_packet_t message[1];
-        time_t interval;
-
-        LOG_URI(&(targetP->uri));
-        if (LWM2M_URI_IS_SET_RESOURCE(&targetP->uri))
+        if (COAP_205_CONTENT != object_readData(contextP, &targetP->uri, &size, &dataP))
         {
-            if (COAP_205_CONTENT != object_readData(contextP, &targetP->uri, &size, &dataP)) continue;
-            switch (dataP->type)
+            // try again later
+            (void)prv_scheduleObservedAt(contextP, targetP, currentTime + 1);
+            return;
+        }
+        switch (dataP->type)
+        {
+        case LWM2M_TYPE_INTEGER:
+            if (1 != lwm2m_data_decode_int(dataP, &integerValue))
             {
-            case LWM2M_TYPE_INTEGER:
-                if (1 != lwm2m_data_decode_int(dataP, &integerValue))
-                {
-                    lwm2m_data_free(size, dataP);
-                    continue;
-                }
-                storeValue = true;
-                break;
-            case LWM2M_TYPE_FLOAT:
-                if (1 != lwm2m_data_decode_float(dataP, &floatValue))
-                {
-                    lwm2m_data_free(size, dataP);
-                    continue;
-                }
-                storeValue = true;
-                break;
-            default:
-                break;
+                lwm2m_data_free(size, dataP);
+                (void)prv_scheduleObservedAt(contextP, targetP, currentTime + 1);
+                return;
+            }
+            storeValue = true;
+            break;
+        case LWM2M_TYPE_FLOAT:
+            if (1 != lwm2m_data_decode_float(dataP, &floatValue))
+            {
+                lwm2m_data_free(size, dataP);
+                (void)prv_scheduleObservedAt(contextP, targetP, currentTime + 1);
+                return;
             }
+            storeValue = true;
+            break;
+        default:
+            break;
         }
-        for (watcherP = targetP->watcherList ; watcherP != NULL ; watcherP = watcherP->next)
+    }
+    memset(&notifyTemplate, 0, sizeof(notify_template_t));
+    for (watcherP = targetP->watcherList ; watcherP != NULL ; watcherP = watcherP->next)
+    {
+        if (watcherP->active == true)
         {
-            if (watcherP->active == true)
+            bool notify = false;
+            bool minPeriodPending = false;
+
+            if (watcherP->update == true)
             {
-                bool notify = false;
+                // value changed, should we notify the server ?
 
-                if (watcherP->update == true)
+                if (watcherP->parameters == NULL || watcherP->parameters->toSet == 0)
                 {
-                    // value changed, should we notify the server ?
-
-                    if (watcherP->parameters == NULL || watcherP->parameters->toSet == 0)
-                    {
-                        // no conditions
-                        notify = true;
-                        LOG("Notify with no conditions");
-                        LOG_URI(&(targetP->uri));
-                    }
+                    // no conditions
+                    notify = true;
+                    LOG("Notify with no conditions");
+                    LOG_URI(&(targetP->uri));
+                }
 
-                    if (notify == false
-                     && watcherP->parameters != NULL
-                     && (watcherP->parameters->toSet & ATTR_FLAG_NUMERIC) != 0)
+                if (notify == false
+                 && watcherP->parameters != NULL
+                 && (watcherP->parameters->toSet & ATTR_FLAG_NUMERIC) != 0)
+                {
+                    if ((watcherP->parameters->toSet & LWM2M_ATTR_FLAG_LESS_THAN) != 0)
                     {
-                        if ((watcherP->parameters->toSet & LWM2M_ATTR_FLAG_LESS_THAN) != 0)
+                        LOG("Checking lower threshold");
+                        // Did we cross the lower threshold ?
+                        switch (dataP->type)
                         {
-                            LOG("Checking lower threshold");
-                            // Did we cross the lower threshold ?
-                            switch (dataP->type)
+                        case LWM2M_TYPE_INTEGER:
+                            if ((integerValue <= watcherP->parameters->lessThan
+                              && watcherP->lastValue.asInteger > watcherP->parameters->lessThan)
+                             || (integerValue >= watcherP->parameters->lessThan
+                              && watcherP->lastValue.asInteger < watcherP->parameters->lessThan))
                             {
-                            case LWM2M_TYPE_INTEGER:
-                                if ((integerValue <= watcherP->parameters->lessThan
-                                  && watcherP->lastValue.asInteger > watcherP->parameters->lessThan)
-                                 || (integerValue >= watcherP->parameters->lessThan
-                                  && watcherP->lastValue.asInteger < watcherP->parameters->lessThan))
-                                {
-                                    LOG("Notify on lower threshold crossing");
-                                    notify = true;
-                                }
-                                break;
-                            case LWM2M_TYPE_FLOAT:
-                                if ((floatValue <= watcherP->parameters->lessThan
-                                  && watcherP->lastValue.asFloat > watcherP->parameters->lessThan)
-                                 || (floatValue >= watcherP->parameters->lessThan
-                                  && watcherP->lastValue.asFloat < watcherP->parameters->lessThan))
-                                {
-                                    LOG("Notify on lower threshold crossing");
-                                    notify = true;
-                                }
-                                break;
-                            default:
-                                break;
+                                LOG("Notify on lower threshold crossing");
+                                notify = true;
                             }
-                        }
-                        if ((watcherP->parameters->toSet & LWM2M_ATTR_FLAG_GREATER_THAN) != 0)
-                        {
-                            LOG("Checking upper threshold");
-                            // Did we cross the upper threshold ?
-                            switch (dataP->type)
+                            break;
+                        case LWM2M_TYPE_FLOAT:
+                            if ((floatValue <= watcherP->parameters->lessThan
+                              && watcherP->lastValue.asFloat > watcherP->parameters->lessThan)
+                             || (floatValue >= watcherP->parameters->lessThan
+                              && watcherP->lastValue.asFloat < watcherP->parameters->lessThan))
                             {
-                            case LWM2M_TYPE_INTEGER:
-                                if ((integerValue <= watcherP->parameters->greaterThan
-                                  && watcherP->lastValue.asInteger > watcherP->parameters->greaterThan)
-                                 || (integerValue >= watcherP->parameters->greaterThan
-                                  && watcherP->lastValue.asInteger < watcherP->parameters->greaterThan))
-                                {
-                                    LOG("Notify on lower upper crossing");
-                                    notify = true;
-                                }
-                                break;
-                            case LWM2M_TYPE_FLOAT:
-                                if ((floatValue <= watcherP->parameters->greaterThan
-                                  && watcherP->lastValue.asFloat > watcherP->parameters->greaterThan)
-                                 || (floatValue >= watcherP->parameters->greaterThan
-                                  && watcherP->lastValue.asFloat < watcherP->parameters->greaterThan))
-                                {
-                                    LOG("Notify on lower upper crossing");
-                                    notify = true;
-                                }
-                                break;
-                            default:
-                                break;
+                                LOG("Notify on lower threshold crossing");
+                                notify = true;
                             }
+                            break;
+                        default:
+                            break;
                         }
-                        if ((watcherP->parameters->toSet & LWM2M_ATTR_FLAG_STEP) != 0)
+                    }
+                    if ((watcherP->parameters->toSet & LWM2M_ATTR_FLAG_GREATER_THAN) != 0)
+                    {
+                        LOG("Checking upper threshold");
+                        // Did we cross the upper threshold ?
+                        switch (dataP->type)
                         {
-                            LOG("Checking step");
-
-                            switch (dataP->type)
+                        case LWM2M_TYPE_INTEGER:
+                            if ((integerValue <= watcherP->parameters->greaterThan
+                              && watcherP->lastValue.asInteger > watcherP->parameters->greaterThan)
+                             || (integerValue >= watcherP->parameters->greaterThan
+                              && watcherP->lastValue.asInteger < watcherP->parameters->greaterThan))
                             {
-                            case LWM2M_TYPE_INTEGER:
-                            {
-                                int64_t diff;
-
-                                diff = integerValue - watcherP->lastValue.asInteger;
-                                if ((diff < 0 && (0 - diff) >= watcherP->parameters->step)
-                                 || (diff >= 0 && diff >= watcherP->parameters->step))
-                                {
-                                    LOG("Notify on step condition");
-                                    notify = true;
-                                }
+                                LOG("Notify on lower upper crossing");
+                                notify = true;
                             }
-                                break;
-                            case LWM2M_TYPE_FLOAT:
+                            break;
+                        case LWM2M_TYPE_FLOAT:
+                            if ((floatValue <= watcherP->parameters->greaterThan
+                              && watcherP->lastValue.asFloat > watcherP->parameters->greaterThan)
+                             || (floatValue >= watcherP->parameters->greaterThan
+                              && watcherP->lastValue.asFloat < watcherP->parameters->greaterThan))
                             {
-                                double diff;
-
-                                diff = floatValue - watcherP->lastValue.asFloat;
-                                if ((diff < 0 && (0 - diff) >= watcherP->parameters->step)
-                                 || (diff >= 0 && diff >= watcherP->parameters->step))
-                                {
-                                    LOG("Notify on step condition");
-                                    notify = true;
-                                }
-                            }
-                                break;
-                            default:
-                                break;
+                                LOG("Notify on lower upper crossing");
+                                notify = true;
                             }
+                            break;
+                        default:
+                            break;
                         }
                     }
-
-                    if (watcherP->parameters != NULL
-                     && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MIN_PERIOD) != 0)
+                    if ((watcherP->parameters->toSet & LWM2M_ATTR_FLAG_STEP) != 0)
                     {
-                        LOG_ARG("Checking minimal period (%d s)", watcherP->parameters->minPeriod);
+                        LOG("Checking step");
 
-                        if (watcherP->lastTime + watcherP->parameters->minPeriod > currentTime)
+                        switch (dataP->type)
+                        {
+                        case LWM2M_TYPE_INTEGER:
                         {
-                            // Minimum Period did not elapse yet
-                            interval = watcherP->lastTime + watcherP->parameters->minPeriod - currentTime;
-                            if (*timeoutP > interval) *timeoutP = interval;
-                            notify = false;
+                            int64_t diff;
+
+                            diff = integerValue - watcherP->lastValue.asInteger;
+                            if ((diff < 0 && (0 - diff) >= watcherP->parameters->step)
+                             || (diff >= 0 && diff >= watcherP->parameters->step))
+                            {
+                                LOG("Notify on step condition");
+                                notify = true;
+                            }
                         }
-                        else
+                            break;
+                        case LWM2M_TYPE_FLOAT:
                         {
-                            LOG("Notify on minimal period");
-                            notify = true;
+                            double diff;
+
+                            diff = floatValue - watcherP->lastValue.asFloat;
+                            if ((diff < 0 && (0 - diff) >= watcherP->parameters->step)
+                             || (diff >= 0 && diff >= watcherP->parameters->step))
+                            {
+                                LOG("Notify on step condition");
+                                notify = true;
+                            }
+                        }
+                            break;
+                        default:
+                            break;
                         }
                     }
                 }
 
-                // Is the Maximum Period reached ?
-                if (notify == false
-                 && watcherP->parameters != NULL
-                 && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0)
+                if (watcherP->parameters != NULL
+                 && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MIN_PERIOD) != 0)
                 {
-                    LOG_ARG("Checking maximal period (%d s)", watcherP->parameters->minPeriod);
+                    LOG_ARG("Checking minimal period (%d s)", watcherP->parameters->minPeriod);
 
-                    if (watcherP->lastTime + watcherP->parameters->maxPeriod <= currentTime)
+                    if (watcherP->lastTime + watcherP->parameters->minPeriod > currentTime)
                     {
-                        LOG("Notify on maximal period");
+                        // Minimum Period did not elapse yet, the watcher stays tagged
+                        notify = false;
+                        minPeriodPending = true;
+                    }
+                    else
+                    {
+                        LOG("Notify on minimal period");
                         notify = true;
                     }
                 }
+            }
+
+            // Is the Maximum Period reached ?
+            if (notify == false
+             && watcherP->parameters != NULL
+             && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0)
+            {
+                LOG_ARG("Checking maximal period (%d s)", watcherP->parameters->minPeriod);
 
-                if (notify == true)
+                if (watcherP->lastTime + watcherP->parameters->maxPeriod <= currentTime)
                 {
-                    if (buffer == NULL)
-                    {
-                        if (dataP != NULL)
-                        {
-                            int res;
+                    LOG("Notify on maximal period");
+                    notify = true;
+                }
+            }
 
-                            res = lwm2m_data_serialize(&targetP->uri, size, dataP, &(watcherP->format), &buffer);
-                            if (res < 0)
-                            {
-                                break;
-                            }
-                            else
-                            {
-                                length = (size_t)res;
-                            }
+            if (notify == true)
+            {
+                // watchers asking for another format get their own template
+                if (buffer == NULL || watcherP->format != notifyTemplate.format)
+                {
+                    if (buffer != NULL)
+                    {
+                        lwm2m_free(buffer);
+                        buffer = NULL;
+                    }
+                    if (dataP != NULL)
+                    {
+                        int res;
 
+                        res = lwm2m_data_serialize(&targetP->uri, size, dataP, &(watcherP->format), &buffer);
+                        if (res < 0)
+                        {
+                            break;
                         }
                         else
                         {
-                            if (COAP_205_CONTENT != object_read(contextP, &targetP->uri, &(watcherP->format), &buffer, &length))
-                            {
-                                buffer = NULL;
-                                break;
-                            }
+                            length = (size_t)res;
                         }
-                        coap_init_message(message, COAP_TYPE_NON, COAP_205_CONTENT, 0);
-                        coap_set_header_content_type(message, watcherP->format);
-                        coap_set_payload(message, buffer, length);
-                    }
-                    watcherP->lastTime = currentTime;
-                    watcherP->lastMid = contextP->nextMID++;
-                    message->mid = watcherP->lastMid;
-                    coap_set_header_token(message, watcherP->token, watcherP->tokenLen);
-                    coap_set_header_observe(message, watcherP->counter++);
-                    (void)message_send(contextP, message, watcherP->server->sessionH);
-                    watcherP->update = false;
-                }
 
-                // Store this value
-                if (notify == true && storeValue == true)
-                {
-                    switch (dataP->type)
+                    }
+                    else
+                    {
+                        if (COAP_205_CONTENT != object_read(contextP, &targetP->uri, &(watcherP->format), &buffer, &length))
+                        {
+                            buffer = NULL;
+                            break;
+                        }
+                    }
+                    if (COAP_NO_ERROR != message_initNotify(&notifyTemplate, COAP_205_CONTENT, watcherP->format, buffer, length))
                     {
-                    case LWM2M_TYPE_INTEGER:
-                        watcherP->lastValue.asInteger = integerValue;
-                        break;
-                    case LWM2M_TYPE_FLOAT:
-                        watcherP->lastValue.asFloat = floatValue;
-                        break;
-                    default:
                         break;
                     }
                 }
+                watcherP->lastTime = currentTime;
+                // a reset to this notification cancels the watcher
+                index_remove(&contextP->watcherMidIndex, watcherP, prv_watcherHash);
+                watcherP->lastMid = contextP->nextMID++;
+                (void)index_insert(contextP, &contextP->watcherMidIndex, watcherP, prv_watcherHash);
+                (void)message_sendNotify(contextP, &notifyTemplate, watcherP->lastMid, watcherP->token, watcherP->tokenLen, watcherP->counter++, watcherP->server->sessionH);
+                watcherP->update = false;
+            }
+            else if (minPeriodPending == false)
+            {
+                // the change does not meet the conditions
+                watcherP->update = false;
+            }
 
-                if (watcherP->parameters != NULL && (watcherP->parameters->toSet & LWM2M_ATTR_FLAG_MAX_PERIOD) != 0)
+            // Store this value
+            if (notify == true && storeValue == true)
+            {
+                switch (dataP->type)
                 {
-                    // update timers
-                    interval = watcherP->lastTime + watcherP->parameters->maxPeriod - currentTime;
-                    if (*timeoutP > interval) *timeoutP = interval;
+                case LWM2M_TYPE_INTEGER:
+                    watcherP->lastValue.asInteger = integerValue;
+                    break;
+                case LWM2M_TYPE_FLOAT:
+                    watcherP->lastValue.asFloat = floatValue;
+                    break;
+                default:
+                    break;
                 }
             }
         }
-        if (dataP != NULL) lwm2m_data_free(size, dataP);
-        if (buffer != NULL) lwm2m_free(buffer);
+    }
+    message_clearNotify(&notifyTemplate);
+    if (dataP != NULL) lwm2m_data_free(size, dataP);
+    if (buffer != NULL) lwm2m_free(buffer);
+
+    // a watcher still due could not be notified
+    deadline = prv_nextDeadline(targetP);
+    if (deadline >= 0)
+    {
+        (void)prv_scheduleObservedAt(contextP, targetP, (deadline > currentTime) ? deadline : currentTime + 1);
     }
 }
 
@@ -784,7 +963,7 @@ void observe_remove(lwm2m_observation_t * observationP)
 {
     LOG("Entering");
     observationP->clientP->observationList = (lwm2m_observation_t *) LWM2M_LIST_RM(observationP->clientP->observationList, observationP->id, NULL);
-    lwm2m_free(observationP);
+    memory_poolFree(observationP);
 }
 
 static void prv_obsRequestCallback(lwm2m_transaction_t * transacP,
@@ -898,7 +1077,7 @@ int lwm2m_observe(lwm2m_context_t * contextP,
 
     if (!LWM2M_URI_IS_SET_INSTANCE(uriP) && LWM2M_URI_IS_SET_RESOURCE(uriP)) return COAP_400_BAD_REQUEST;
 
-    clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, clientID);
+    clientP = registration_findClient(contextP, clientID);
     if (clientP == NULL) return COAP_404_NOT_FOUND;
 
     for (observationP = clientP->observationList; observationP != NULL; observationP = observationP->next)
@@ -914,7 +1093,7 @@ int lwm2m_observe(lwm2m_context_t * contextP,
     }
     if (observationP == NULL)
     {
-        observationP = (lwm2m_observation_t *)lwm2m_malloc(sizeof(lwm2m_observation_t));
+        observationP = (lwm2m_observation_t *)memory_poolAlloc(contextP, LWM2M_POOL_OBSERVATION);
         if (observationP == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
         memset(observationP, 0, sizeof(lwm2m_observation_t));
 
@@ -933,11 +1112,11 @@ int lwm2m_observe(lwm2m_context_t * contextP,
     token[2] = observationP->id >> 8;
     token[3] = observationP->id & 0xFF;
 
-    transactionP = transaction_new(clientP->sessionH, COAP_GET, clientP->altPath, uriP, contextP->nextMID++, 4, token);
+    transactionP = transaction_new(contextP, clientP->sessionH, COAP_GET, clientP->altPath, uriP, contextP->nextMID++, 4, token);
     if (transactionP == NULL)
     {
         observationP->clientP->observationList = (lwm2m_observation_t *)LWM2M_LIST_RM(observationP->clientP->observationList, observationP->id, NULL);
-        lwm2m_free(observationP);
+        memory_poolFree(observationP);
         return COAP_500_INTERNAL_SERVER_ERROR;
     }
 
@@ -954,7 +1133,7 @@ int lwm2m_observe(lwm2m_context_t * contextP,
     transactionP->callback = prv_obsRequestCallback;
     transactionP->userData = (void *)observationP;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transactionP);
+    transaction_add(contextP, transactionP);
 
     return transaction_send(contextP, transactionP);
 }
@@ -971,7 +1150,7 @@ int lwm2m_observe_cancel(lwm2m_context_t * contextP,
     LOG_ARG("clientID: %d", clientID);
     LOG_URI(uriP);
 
-    clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, clientID);
+    clientP = registration_findClient(contextP, clientID);
     if (clientP == NULL) return COAP_404_NOT_FOUND;
 
     observationP = prv_findObservationByURI(clientP, uriP);
@@ -990,7 +1169,7 @@ int lwm2m_observe_cancel(lwm2m_context_t * contextP,
         token[2] = observationP->id >> 8;
         token[3] = observationP->id & 0xFF;
 
-        transactionP = transaction_new(clientP->sessionH, COAP_GET, clientP->altPath, uriP, contextP->nextMID++, 4, token);
+        transactionP = transaction_new(contextP, clientP->sessionH, COAP_GET, clientP->altPath, uriP, contextP->nextMID++, 4, token);
         if (transactionP == NULL)
         {
             return COAP_500_INTERNAL_SERVER_ERROR;
@@ -998,7 +1177,7 @@ int lwm2m_observe_cancel(lwm2m_context_t * contextP,
         cancelP = (cancellation_data_t *)lwm2m_malloc(sizeof(cancellation_data_t));
         if (cancelP == NULL)
         {
-            lwm2m_free(transactionP);
+            transaction_free(contextP, transactionP);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
 
@@ -1011,7 +1190,7 @@ int lwm2m_observe_cancel(lwm2m_context_t * contextP,
         transactionP->callback = prv_obsCancelRequestCallback;
         transactionP->userData = (void *)cancelP;
 
-        contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transactionP);
+        transaction_add(contextP, transactionP);
 
         return transaction_send(contextP, transactionP);
     }
@@ -1050,7 +1229,7 @@ bool observe_handleNotify(lwm2m_context_t * contextP,
     clientID = (tokenP[0] << 8) | tokenP[1];
     obsID = (tokenP[2] << 8) | tokenP[3];
 
-    clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, clientID);
+    clientP = registration_findClient(contextP, clientID);
     if (clientP == NULL) return false;
 
     observationP = (lwm2m_observation_t *)lwm2m_list_find((lwm2m_list_t *)clientP->observationList, obsID);
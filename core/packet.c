@@ -197,16 +197,27 @@ static uint8_t handle_request(lwm2m_context_t * contextP,
  * Erbium is Copyright (c) 2013, Institute for Pervasive Computing, ETH Zurich
  * All rights reserved.
  */
-void lwm2m_handle_packet(lwm2m_context_t * contextP,
-                         uint8_t * buffer,
-                         int length,
-                         void * fromSessionH)
+void lwm2m_handle_packet_with_workspace(lwm2m_context_t * contextP,
+                                        lwm2m_packet_workspace_t * workspaceP,
+                                        uint8_t * buffer,
+                                        int length,
+                                        void * fromSessionH)
 {
     uint8_t coap_error_code = NO_ERROR;
-    static coap_packet_t message[1];
-    static coap_packet_t response[1];
+    coap_packet_t * message = &workspaceP->message;
+    coap_packet_t * response = &workspaceP->response;
 
     LOG("Entering");
+#ifdef LWM2M_WITH_SEND_QUEUE
+    sendqueue_hold(contextP);
+#endif
+    if (dedup_check(contextP, buffer, (size_t)length, fromSessionH))
+    {
+#ifdef LWM2M_WITH_SEND_QUEUE
+        sendqueue_release(contextP);
+#endif
+        return;
+    }
     coap_error_code = coap_parse_message(message, buffer, (uint16_t)length);
     if (coap_error_code == NO_ERROR)
     {
@@ -219,6 +230,7 @@ void lwm2m_handle_packet(lwm2m_context_t * contextP,
             uint16_t block_size = REST_MAX_CHUNK_SIZE;
             uint32_t block_offset = 0;
             int64_t new_offset = 0;
+            bool cached = false;
 
             /* prepare response */
             if (message->type == COAP_TYPE_CON)
@@ -275,8 +287,12 @@ void lwm2m_handle_packet(lwm2m_context_t * contextP,
                     coap_get_header_block1(message, &block1_num, &block1_more, &block1_size, NULL);
                     LOG_ARG("Blockwise: block1 request NUM %u (SZX %u/ SZX Max%u) MORE %u", block1_num, block1_size, REST_MAX_CHUNK_SIZE, block1_more);
 
-                    // handle block 1
-                    coap_error_code = coap_block1_handler(&serverP->block1Data, message->mid, message->payload, message->payload_len, block1_size, block1_num, block1_more, &complete_buffer, &complete_buffer_size);
+                    // handle block 1, streamed or reassembled
+                    coap_error_code = coap_block1_stream(contextP, serverP, message);
+                    if (coap_error_code == NO_ERROR)
+                    {
+                        coap_error_code = coap_block1_handler(contextP, &serverP->block1Data, message, &complete_buffer, &complete_buffer_size);
+                    }
 
                     // if payload is complete, replace it in the coap message.
                     if (coap_error_code == NO_ERROR)
@@ -289,17 +305,32 @@ void lwm2m_handle_packet(lwm2m_context_t * contextP,
                         block1_size = MIN(block1_size, REST_MAX_CHUNK_SIZE);
                         coap_set_header_block1(response,block1_num, block1_more,block1_size);
                     }
+                    else if (coap_error_code == COAP_413_ENTITY_TOO_LARGE)
+                    {
+                        // tell the peer the size we can accept
+                        coap_set_header_size1(response, MAX_BLOCK1_SIZE - 1);
+                    }
                 }
 #else
                 coap_error_code = COAP_501_NOT_IMPLEMENTED;
 #endif
             }
-            if (coap_error_code == NO_ERROR)
+            /* the following blocks of a response are sliced from the cached body */
+            if (coap_error_code == NO_ERROR
+             && block_offset > 0
+             && block2_load(contextP, fromSessionH, message, response))
+            {
+                cached = true;
+            }
+            else if (coap_error_code == NO_ERROR)
             {
                 coap_error_code = handle_request(contextP, fromSessionH, message, response);
             }
             if (coap_error_code==NO_ERROR)
             {
+                /* the body belongs to the cache or is freed once sent */
+                uint8_t * body = cached ? NULL : response->payload;
+
                 if ( IS_OPTION(message, COAP_OPTION_BLOCK2) )
                 {
                     /* unchanged new_offset indicates that resource is unaware of blockwise transfer */
@@ -315,6 +346,10 @@ void lwm2m_handle_packet(lwm2m_context_t * contextP,
                         }
                         else
                         {
+                            if (!cached && response->payload_len > block_size)
+                            {
+                                block2_store(contextP, fromSessionH, message, response);
+                            }
                             coap_set_header_block2(response, block_num, response->payload_len - block_offset > block_size, block_size);
                             coap_set_payload(response, response->payload+block_offset, MIN(response->payload_len - block_offset, block_size));
                         } /* if (valid offset) */
@@ -337,7 +372,7 @@ void lwm2m_handle_packet(lwm2m_context_t * contextP,
 
                 coap_error_code = message_send(contextP, response, fromSessionH);
 
-                lwm2m_free(response->payload);
+                if (body != NULL) lwm2m_free(body);
                 response->payload = NULL;
                 response->payload_len = 0;
             }
@@ -393,6 +428,7 @@ void lwm2m_handle_packet(lwm2m_context_t * contextP,
     else
     {
         LOG_ARG("Message parsing failed %u.%2u", coap_error_code >> 5, coap_error_code & 0x1F);
+        coap_free_header(message);
     }
 
     if (coap_error_code != NO_ERROR && coap_error_code != COAP_IGNORE)
@@ -409,35 +445,208 @@ void lwm2m_handle_packet(lwm2m_context_t * contextP,
         coap_set_payload(message, coap_error_message, strlen(coap_error_message));
         message_send(contextP, message, fromSessionH);
     }
+
+    // only the ACK to this request is kept for its duplicates
+    contextP->dedup.pending = false;
+    // the data trees parsed while handling the packet are released at once
+    memory_arenaReset(contextP);
+#ifdef LWM2M_WITH_SEND_QUEUE
+    sendqueue_release(contextP);
+#endif
 }
 
 
+void lwm2m_handle_packet(lwm2m_context_t * contextP,
+                         uint8_t * buffer,
+                         int length,
+                         void * fromSessionH)
+{
+    static lwm2m_packet_workspace_t workspace;
+
+    lwm2m_handle_packet_with_workspace(contextP, &workspace, buffer, length, fromSessionH);
+}
+
+lwm2m_packet_workspace_t * lwm2m_packet_workspace_new(void)
+{
+    lwm2m_packet_workspace_t * workspaceP;
+
+    workspaceP = (lwm2m_packet_workspace_t *)lwm2m_malloc(sizeof(lwm2m_packet_workspace_t));
+    if (workspaceP != NULL)
+    {
+        memset(workspaceP, 0, sizeof(lwm2m_packet_workspace_t));
+    }
+
+    return workspaceP;
+}
+
+void lwm2m_packet_workspace_free(lwm2m_packet_workspace_t * workspaceP)
+{
+    lwm2m_free(workspaceP);
+}
+
 uint8_t message_send(lwm2m_context_t * contextP,
                      coap_packet_t * message,
                      void * sessionH)
 {
     uint8_t result = COAP_500_INTERNAL_SERVER_ERROR;
+    uint8_t buffer[LWM2M_SEND_BUFFER_SIZE];
     uint8_t * pktBuffer;
     size_t pktBufferLen = 0;
     size_t allocLen;
 
     LOG("Entering");
+    // upper bound computed from the options lengths
     allocLen = coap_serialize_get_size(message);
     LOG_ARG("Size to allocate: %d", allocLen);
     if (allocLen == 0) return COAP_500_INTERNAL_SERVER_ERROR;
 
-    pktBuffer = (uint8_t *)lwm2m_malloc(allocLen);
-    if (pktBuffer != NULL)
+#ifdef LWM2M_WITH_GATHER_SEND
+    if (allocLen - message->payload_len <= LWM2M_SEND_BUFFER_SIZE)
+    {
+        // the payload is sent from where it is
+        pktBufferLen = coap_serialize_header(message, buffer);
+        LOG_ARG("coap_serialize_header() returned %d", pktBufferLen);
+        if (0 == pktBufferLen) return COAP_500_INTERNAL_SERVER_ERROR;
+        if (message->type == COAP_TYPE_ACK)
+        {
+            dedup_store(contextP, sessionH, message->mid, buffer, pktBufferLen, message->payload, message->payload_len);
+        }
+
+#ifdef LWM2M_WITH_SEND_QUEUE
+        if (sendqueue_push(contextP, sessionH, buffer, pktBufferLen, message->payload, message->payload_len)) return COAP_NO_ERROR;
+#endif
+        return lwm2m_buffer_send_gather(sessionH, buffer, pktBufferLen, message->payload, message->payload_len, contextP->userData);
+    }
+#endif
+
+    if (allocLen <= LWM2M_SEND_BUFFER_SIZE)
     {
-        pktBufferLen = coap_serialize_message(message, pktBuffer);
-        LOG_ARG("coap_serialize_message() returned %d", pktBufferLen);
-        if (0 != pktBufferLen)
+        pktBuffer = buffer;
+    }
+    else
+    {
+        pktBuffer = (uint8_t *)lwm2m_malloc(allocLen);
+        if (pktBuffer == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+
+    pktBufferLen = coap_serialize_message(message, pktBuffer);
+    LOG_ARG("coap_serialize_message() returned %d", pktBufferLen);
+    if (0 != pktBufferLen)
+    {
+        if (message->type == COAP_TYPE_ACK)
         {
-            result = lwm2m_buffer_send(sessionH, pktBuffer, pktBufferLen, contextP->userData);
+            dedup_store(contextP, sessionH, message->mid, pktBuffer, pktBufferLen, NULL, 0);
         }
-        lwm2m_free(pktBuffer);
+#ifdef LWM2M_WITH_SEND_QUEUE
+        if (sendqueue_push(contextP, sessionH, pktBuffer, pktBufferLen, NULL, 0))
+        {
+            result = COAP_NO_ERROR;
+        }
+        else
+#endif
+        result = lwm2m_buffer_send(sessionH, pktBuffer, pktBufferLen, contextP->userData);
     }
 
+    if (pktBuffer != buffer) lwm2m_free(pktBuffer);
+
     return result;
 }
 
+uint8_t message_initNotify(notify_template_t * templateP,
+                           uint8_t code,
+                           lwm2m_media_type_t format,
+                           uint8_t * payload,
+                           size_t payloadLength)
+{
+    coap_packet_t message[1];
+    uint8_t buffer[COAP_MAX_HEADER_SIZE];
+    size_t length;
+
+    message_clearNotify(templateP);
+
+    coap_init_message(message, COAP_TYPE_NON, code, 0);
+    coap_set_header_content_type(message, format);
+    // the largest value reserves the three bytes patched by message_sendNotify()
+    coap_set_header_observe(message, 0xFFFFFF);
+    coap_set_payload(message, payload, payloadLength);
+
+    length = coap_serialize_header(message, buffer);
+    if (length <= COAP_HEADER_LEN
+     || length - COAP_HEADER_LEN > LWM2M_NOTIFY_HEADER_SIZE - COAP_HEADER_LEN - COAP_TOKEN_LEN)
+    {
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+
+    templateP->firstByte = buffer[0];
+    templateP->code = buffer[1];
+    templateP->optionsLength = length - COAP_HEADER_LEN;
+    memcpy(templateP->header + COAP_HEADER_LEN + COAP_TOKEN_LEN, buffer + COAP_HEADER_LEN, templateP->optionsLength);
+    templateP->format = format;
+    templateP->payload = payload;
+    templateP->payloadLength = payloadLength;
+
+    return COAP_NO_ERROR;
+}
+
+uint8_t message_sendNotify(lwm2m_context_t * contextP,
+                           notify_template_t * templateP,
+                           uint16_t mid,
+                           uint8_t * token,
+                           size_t tokenLen,
+                           uint32_t counter,
+                           void * sessionH)
+{
+    uint8_t * headerP;
+    uint8_t * optionsP;
+    size_t headerLength;
+
+    if (tokenLen > COAP_TOKEN_LEN) return COAP_500_INTERNAL_SERVER_ERROR;
+
+    // the header and token are written right before the options
+    optionsP = templateP->header + COAP_HEADER_LEN + COAP_TOKEN_LEN;
+    headerP = optionsP - tokenLen - COAP_HEADER_LEN;
+    headerLength = COAP_HEADER_LEN + tokenLen + templateP->optionsLength;
+
+    headerP[0] = templateP->firstByte | (uint8_t)tokenLen;
+    headerP[1] = templateP->code;
+    headerP[2] = (uint8_t)(mid >> 8);
+    headerP[3] = (uint8_t)mid;
+    memcpy(headerP + COAP_HEADER_LEN, token, tokenLen);
+
+    // the Observe option comes first, its value follows the option byte
+    optionsP[1] = (uint8_t)(counter >> 16);
+    optionsP[2] = (uint8_t)(counter >> 8);
+    optionsP[3] = (uint8_t)counter;
+
+#ifdef LWM2M_WITH_SEND_QUEUE
+    if (sendqueue_push(contextP, sessionH, headerP, headerLength, templateP->payload, templateP->payloadLength)) return COAP_NO_ERROR;
+#endif
+#ifdef LWM2M_WITH_GATHER_SEND
+    return lwm2m_buffer_send_gather(sessionH, headerP, headerLength, templateP->payload, templateP->payloadLength, contextP->userData);
+#else
+    if (templateP->payloadLength == 0)
+    {
+        return lwm2m_buffer_send(sessionH, headerP, headerLength, contextP->userData);
+    }
+
+    // the payload is copied once, each header is copied in front of it
+    if (templateP->buffer == NULL)
+    {
+        templateP->buffer = (uint8_t *)lwm2m_malloc(LWM2M_NOTIFY_HEADER_SIZE + templateP->payloadLength);
+        if (templateP->buffer == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
+        memcpy(templateP->buffer + LWM2M_NOTIFY_HEADER_SIZE, templateP->payload, templateP->payloadLength);
+    }
+    memcpy(templateP->buffer + LWM2M_NOTIFY_HEADER_SIZE - headerLength, headerP, headerLength);
+
+    return lwm2m_buffer_send(sessionH, templateP->buffer + LWM2M_NOTIFY_HEADER_SIZE - headerLength, headerLength + templateP->payloadLength, contextP->userData);
+#endif
+}
+
+void message_clearNotify(notify_template_t * templateP)
+{
+    if (templateP->buffer != NULL)
+    {
+        lwm2m_free(templateP->buffer);
+        templateP->buffer = NULL;
+    }
+}
@@ -0,0 +1,373 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Retransmission timeout of the peers, after CoAP Simple Congestion
+ * Control/Advanced (draft-ietf-core-cocoa).
+ *
+ * Two estimators follow the round-trip time of a peer as in RFC 6298. The
+ * strong one is fed by exchanges acknowledged without retransmission, the weak
+ * one by exchanges acknowledged after one or two retransmissions, measured
+ * from the first transmission. Each new estimate is blended into the overall
+ * retransmission timeout. An overall timeout not updated for a while is aged
+ * back toward the default one.
+ *
+ * Like RFC 7252 NSTART, the number of outstanding confirmable messages to a
+ * peer is bounded. The transactions beyond it are queued by the peer and sent
+ * in order as the outstanding ones complete.
+ *
+ * lwm2m_gettime() has a one second resolution: samples are whole seconds and
+ * the clock granularity bounds the variance term from below, so the timeout
+ * never drops under one second. For the same reason the CoCoA rules for
+ * timeouts under one second do not apply.
+ */
+
+#include "internals.h"
+
+// the peers idle for longer are forgotten, they would have aged to the default timeout anyway
+#ifndef LWM2M_PEER_IDLE_TIME
+#define LWM2M_PEER_IDLE_TIME 300
+#endif
+
+// outstanding confirmable messages per peer
+#ifndef LWM2M_NSTART
+#define LWM2M_NSTART 1
+#endif
+
+#define PEER_DEFAULT_RTO  (COAP_RESPONSE_TIMEOUT * 1000)
+#define PEER_MAX_RTO      60000
+#define PEER_GRANULARITY  1000
+// the weak estimator only uses exchanges with at most this many retransmissions
+#define PEER_MAX_WEAK_RETRANSMISSIONS 2
+
+static size_t prv_peerHash(void * itemP)
+{
+    void * sessionH = ((lwm2m_peer_t *)itemP)->sessionH;
+
+    return index_hashBuffer((uint8_t *)&sessionH, sizeof(void *));
+}
+
+static bool prv_peerMatch(void * itemP,
+                          void * keyP)
+{
+    // the hash is computed on the handle, lwm2m_session_is_equal() can not be used
+    return ((lwm2m_peer_t *)itemP)->sessionH == keyP;
+}
+
+static lwm2m_peer_t * prv_findPeer(lwm2m_context_t * contextP,
+                                   void * sessionH)
+{
+    return (lwm2m_peer_t *)index_find(&contextP->peerIndex,
+                                      index_hashBuffer((uint8_t *)&sessionH, sizeof(void *)),
+                                      prv_peerMatch, sessionH);
+}
+
+static void prv_peerTimer(lwm2m_context_t * contextP,
+                          void * itemP,
+                          time_t currentTime)
+{
+    lwm2m_peer_t * peerP = (lwm2m_peer_t *)itemP;
+
+    if (peerP->transactionCount == 0
+     && peerP->lastTime + LWM2M_PEER_IDLE_TIME <= currentTime)
+    {
+        index_remove(&contextP->peerIndex, peerP, prv_peerHash);
+        memory_poolFree(peerP);
+        return;
+    }
+
+    if (0 != timer_schedule(contextP, &(peerP->timer),
+                            (peerP->transactionCount == 0 ? peerP->lastTime : currentTime) + LWM2M_PEER_IDLE_TIME))
+    {
+        // an idle peer goes now, a busy one is scheduled again by the next peer_acquire()
+        if (peerP->transactionCount == 0)
+        {
+            index_remove(&contextP->peerIndex, peerP, prv_peerHash);
+            memory_poolFree(peerP);
+        }
+    }
+}
+
+// returns the new estimate of the timeout.
+static uint32_t prv_estimate(lwm2m_rtt_estimator_t * estimatorP,
+                             uint32_t samples,
+                             uint32_t rtt,
+                             uint32_t k)
+{
+    uint32_t variance;
+
+    if (samples == 0)
+    {
+        estimatorP->srtt = rtt;
+        estimatorP->rttvar = rtt / 2;
+    }
+    else
+    {
+        uint32_t delta;
+
+        delta = (estimatorP->srtt > rtt) ? estimatorP->srtt - rtt : rtt - estimatorP->srtt;
+        estimatorP->rttvar = (3 * estimatorP->rttvar + delta) / 4;
+        estimatorP->srtt = (7 * estimatorP->srtt + rtt) / 8;
+    }
+
+    variance = k * estimatorP->rttvar;
+    if (variance < PEER_GRANULARITY) variance = PEER_GRANULARITY;
+
+    return estimatorP->srtt + variance;
+}
+
+lwm2m_peer_t * peer_acquire(lwm2m_context_t * contextP,
+                            void * sessionH,
+                            time_t currentTime)
+{
+    lwm2m_peer_t * peerP;
+
+    peerP = prv_findPeer(contextP, sessionH);
+    if (peerP == NULL)
+    {
+        peerP = (lwm2m_peer_t *)memory_poolAlloc(contextP, LWM2M_POOL_PEER);
+        if (peerP == NULL) return NULL;
+        memset(peerP, 0, sizeof(lwm2m_peer_t));
+        peerP->sessionH = sessionH;
+        peerP->stats.rto = PEER_DEFAULT_RTO;
+        peerP->stats.strongRto = PEER_DEFAULT_RTO;
+        peerP->stats.weakRto = PEER_DEFAULT_RTO;
+        peerP->rtoTime = currentTime;
+        timer_init(&(peerP->timer), prv_peerTimer, peerP);
+
+        if (0 != index_insert(contextP, &contextP->peerIndex, peerP, prv_peerHash)
+         || 0 != timer_schedule(contextP, &(peerP->timer), currentTime + LWM2M_PEER_IDLE_TIME))
+        {
+            index_remove(&contextP->peerIndex, peerP, prv_peerHash);
+            memory_poolFree(peerP);
+            return NULL;
+        }
+    }
+    else if (peerP->timer.position == 0
+          && 0 != timer_schedule(contextP, &(peerP->timer), currentTime + LWM2M_PEER_IDLE_TIME))
+    {
+        // the peer lost its timer in prv_peerTimer()
+        return NULL;
+    }
+
+    peerP->lastTime = currentTime;
+    peerP->transactionCount++;
+
+    return peerP;
+}
+
+void peer_release(lwm2m_peer_t * peerP)
+{
+    // the timer forgets the peer later on
+    peerP->transactionCount--;
+}
+
+uint32_t peer_getRto(lwm2m_peer_t * peerP,
+                     time_t currentTime)
+{
+    if (peerP == NULL) return PEER_DEFAULT_RTO;
+
+    // a large timeout not updated for four times its value is aged
+    if (peerP->stats.rto > 3000
+     && (currentTime - peerP->rtoTime) * 1000 > 4 * (time_t)peerP->stats.rto)
+    {
+        peerP->stats.rto = 1000 + peerP->stats.rto / 2;
+        peerP->rtoTime = currentTime;
+    }
+
+    return peerP->stats.rto;
+}
+
+uint32_t peer_initialTimeout(uint32_t rto)
+{
+    uint32_t range;
+
+    // between RTO and RTO * COAP_ACK_RANDOM_FACTOR
+    range = (uint32_t)(rto * (COAP_ACK_RANDOM_FACTOR - 1));
+
+    return rto + (uint32_t)rand() % (range + 1);
+}
+
+uint32_t peer_nextTimeout(uint32_t rto,
+                          uint32_t timeout)
+{
+    // variable backoff factor: large timeouts grow slower
+    if (rto > 3000) timeout += timeout / 2;
+    else timeout *= 2;
+
+    return (timeout > PEER_MAX_RTO) ? PEER_MAX_RTO : timeout;
+}
+
+void peer_addSample(lwm2m_peer_t * peerP,
+                    time_t currentTime,
+                    time_t rtt,
+                    int retransmissions)
+{
+    uint32_t sample;
+    uint32_t rto;
+
+    if (rtt < 0 || retransmissions < 0) return;
+    sample = (uint32_t)rtt * 1000;
+
+    if (retransmissions == 0)
+    {
+        peerP->stats.strongRto = prv_estimate(&(peerP->strong), peerP->stats.strongSamples, sample, 4);
+        peerP->stats.strongSamples++;
+        rto = (peerP->stats.strongRto + peerP->stats.rto) / 2;
+    }
+    else if (retransmissions <= PEER_MAX_WEAK_RETRANSMISSIONS)
+    {
+        peerP->stats.weakRto = prv_estimate(&(peerP->weak), peerP->stats.weakSamples, sample, 1);
+        peerP->stats.weakSamples++;
+        rto = (peerP->stats.weakRto + 3 * peerP->stats.rto) / 4;
+    }
+    else
+    {
+        // the sample can not be matched to a transmission
+        return;
+    }
+
+    peerP->stats.rto = (rto > PEER_MAX_RTO) ? PEER_MAX_RTO : rto;
+    peerP->rtoTime = currentTime;
+    peerP->lastTime = currentTime;
+}
+
+bool peer_startExchange(lwm2m_peer_t * peerP,
+                        lwm2m_transaction_t * transacP,
+                        time_t currentTime)
+{
+    if (transacP->in_flight) return true;
+
+    // a transaction leaving the queue was unlinked by peer_endExchange()
+    if (!transacP->urgent
+     && (peerP->stats.inFlight >= LWM2M_NSTART
+      || (peerP->queueHead != NULL && !transacP->queued)))
+    {
+        if (!transacP->queued)
+        {
+            transacP->queued = true;
+            transacP->queue_time = currentTime;
+            transacP->queue_next = NULL;
+            if (peerP->queueTail == NULL) peerP->queueHead = transacP;
+            else peerP->queueTail->queue_next = transacP;
+            peerP->queueTail = transacP;
+
+            peerP->stats.queued++;
+            peerP->stats.queueDepth++;
+            if (peerP->stats.queueDepth > peerP->stats.maxQueueDepth)
+            {
+                peerP->stats.maxQueueDepth = peerP->stats.queueDepth;
+            }
+        }
+        return false;
+    }
+
+    if (transacP->queued)
+    {
+        uint32_t waitTime;
+
+        transacP->queued = false;
+        waitTime = (currentTime > transacP->queue_time) ? (uint32_t)(currentTime - transacP->queue_time) : 0;
+        peerP->stats.totalWaitTime += waitTime;
+        if (waitTime > peerP->stats.maxWaitTime) peerP->stats.maxWaitTime = waitTime;
+    }
+    transacP->in_flight = true;
+    peerP->stats.inFlight++;
+
+    return true;
+}
+
+lwm2m_transaction_t * peer_endExchange(lwm2m_peer_t * peerP,
+                                       lwm2m_transaction_t * transacP)
+{
+    lwm2m_transaction_t * nextP;
+
+    if (transacP->queued)
+    {
+        peer_unqueue(peerP, transacP);
+        return NULL;
+    }
+    if (!transacP->in_flight) return NULL;
+
+    transacP->in_flight = false;
+    peerP->stats.inFlight--;
+
+    // the head leaves the queue, it stays flagged until it is sent
+    if (peerP->stats.inFlight >= LWM2M_NSTART) return NULL;
+    nextP = peerP->queueHead;
+    if (nextP != NULL)
+    {
+        peerP->queueHead = nextP->queue_next;
+        if (peerP->queueHead == NULL) peerP->queueTail = NULL;
+        nextP->queue_next = NULL;
+        peerP->stats.queueDepth--;
+    }
+
+    return nextP;
+}
+
+void peer_unqueue(lwm2m_peer_t * peerP,
+                  lwm2m_transaction_t * transacP)
+{
+    lwm2m_transaction_t * prevP = NULL;
+    lwm2m_transaction_t * targetP = peerP->queueHead;
+
+    while (targetP != NULL && targetP != transacP)
+    {
+        prevP = targetP;
+        targetP = targetP->queue_next;
+    }
+    transacP->queued = false;
+    if (targetP == NULL) return;
+
+    if (prevP == NULL) peerP->queueHead = transacP->queue_next;
+    else prevP->queue_next = transacP->queue_next;
+    if (peerP->queueTail == transacP) peerP->queueTail = prevP;
+    transacP->queue_next = NULL;
+    peerP->stats.queueDepth--;
+}
+
+void peer_clear(lwm2m_context_t * contextP)
+{
+    size_t i;
+
+    for (i = 0 ; i < contextP->peerIndex.size ; i++)
+    {
+        lwm2m_peer_t * peerP = (lwm2m_peer_t *)contextP->peerIndex.slots[i];
+
+        if (peerP != NULL)
+        {
+            timer_cancel(contextP, &(peerP->timer));
+            memory_poolFree(peerP);
+        }
+    }
+    index_clear(contextP, &contextP->peerIndex);
+}
+
+int lwm2m_peer_get_stats(lwm2m_context_t * contextP,
+                         void * sessionH,
+                         lwm2m_peer_stats_t * statsP)
+{
+    lwm2m_peer_t * peerP;
+
+    peerP = prv_findPeer(contextP, sessionH);
+    if (peerP == NULL) return -1;
+
+    *statsP = peerP->stats;
+
+    return 0;
+}
@@ -271,7 +271,7 @@ static uint8_t prv_register(lwm2m_context_t * contextP,
         return COAP_503_SERVICE_UNAVAILABLE;
     }
 
-    transaction = transaction_new(server->sessionH, COAP_POST, NULL, NULL, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, server->sessionH, COAP_POST, NULL, NULL, contextP->nextMID++, 4, NULL);
     if (transaction == NULL)
     {
         lwm2m_free(payload);
@@ -287,7 +287,7 @@ static uint8_t prv_register(lwm2m_context_t * contextP,
     transaction->callback = prv_handleRegistrationReply;
     transaction->userData = (void *) server;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
     if (transaction_send(contextP, transaction) != 0)
     {
         lwm2m_free(payload);
@@ -336,7 +336,7 @@ static int prv_updateRegistration(lwm2m_context_t * contextP,
     uint8_t * payload = NULL;
     int payload_length;
 
-    transaction = transaction_new(server->sessionH, COAP_POST, NULL, NULL, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, server->sessionH, COAP_POST, NULL, NULL, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
 
     coap_set_header_uri_path(transaction->message, server->location);
@@ -350,7 +350,7 @@ static int prv_updateRegistration(lwm2m_context_t * contextP,
         payload_length = object_getRegisterPayload(contextP, payload, payload_length);
         if(payload_length == 0)
         {
-            transaction_free(transaction);
+            transaction_free(contextP, transaction);
             lwm2m_free(payload);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
@@ -360,7 +360,7 @@ static int prv_updateRegistration(lwm2m_context_t * contextP,
     transaction->callback = prv_handleRegistrationUpdateReply;
     transaction->userData = (void *) server;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
 
     if (transaction_send(contextP, transaction) == 0)
     {
@@ -562,15 +562,17 @@ void registration_deregister(lwm2m_context_t * contextP,
         return;
     }
 
-    transaction = transaction_new(serverP->sessionH, COAP_DELETE, NULL, NULL, contextP->nextMID++, 4, NULL);
+    transaction = transaction_new(contextP, serverP->sessionH, COAP_DELETE, NULL, NULL, contextP->nextMID++, 4, NULL);
     if (transaction == NULL) return;
 
     coap_set_header_uri_path(transaction->message, serverP->location);
 
     transaction->callback = prv_handleDeregistrationReply;
     transaction->userData = (void *) contextP;
+    // lwm2m_close() frees the transactions right after, the Deregister can not wait for an Update
+    transaction->urgent = true;
 
-    contextP->transactionList = (lwm2m_transaction_t *)LWM2M_LIST_ADD(contextP->transactionList, transaction);
+    transaction_add(contextP, transaction);
     if (transaction_send(contextP, transaction) == 0)
     {
         serverP->status = STATE_DEREG_PENDING;
@@ -970,18 +972,126 @@ error:
     return NULL;
 }
 
+static size_t prv_clientIdHash(void * itemP)
+{
+    return index_hashInt(((lwm2m_client_t *)itemP)->internalID);
+}
+
+static bool prv_clientIdMatch(void * itemP,
+                              void * keyP)
+{
+    return ((lwm2m_client_t *)itemP)->internalID == *(uint16_t *)keyP;
+}
+
+static size_t prv_clientNameHash(void * itemP)
+{
+    char * name = ((lwm2m_client_t *)itemP)->name;
+
+    return index_hashBuffer((uint8_t *)name, strlen(name));
+}
+
+static bool prv_clientNameMatch(void * itemP,
+                                void * keyP)
+{
+    return strcmp(((lwm2m_client_t *)itemP)->name, (char *)keyP) == 0;
+}
+
 static lwm2m_client_t * prv_getClientByName(lwm2m_context_t * contextP,
                                             char * name)
 {
-    lwm2m_client_t * targetP;
+    return (lwm2m_client_t *)index_find(&contextP->clientNameIndex,
+                                        index_hashBuffer((uint8_t *)name, strlen(name)),
+                                        prv_clientNameMatch, name);
+}
+
+lwm2m_client_t * registration_findClient(lwm2m_context_t * contextP,
+                                         uint16_t clientID)
+{
+    return (lwm2m_client_t *)index_find(&contextP->clientIndex,
+                                        index_hashInt(clientID),
+                                        prv_clientIdMatch, &clientID);
+}
 
-    targetP = contextP->clientList;
-    while (targetP != NULL && strcmp(name, targetP->name) != 0)
+lwm2m_client_t * lwm2m_get_client(lwm2m_context_t * contextP,
+                                  uint16_t clientID)
+{
+    return registration_findClient(contextP, clientID);
+}
+
+static void prv_removeClient(lwm2m_context_t * contextP,
+                             lwm2m_client_t * clientP)
+{
+    timer_cancel(contextP, &clientP->lifetimeTimer);
+    index_remove(&contextP->clientIndex, clientP, prv_clientIdHash);
+    index_remove(&contextP->clientNameIndex, clientP, prv_clientNameHash);
+    if (clientP->prev == NULL) contextP->clientList = clientP->next;
+    else clientP->prev->next = clientP->next;
+    if (clientP->next != NULL) clientP->next->prev = clientP->prev;
+    clientP->next = NULL;
+    clientP->prev = NULL;
+}
+
+static void prv_lifetimeExpired(lwm2m_context_t * contextP,
+                                void * itemP,
+                                time_t currentTime)
+{
+    lwm2m_client_t * clientP = (lwm2m_client_t *)itemP;
+
+    (void)currentTime;
+
+    LOG_ARG("Client %d lifetime expired", clientP->internalID);
+    prv_removeClient(contextP, clientP);
+    if (contextP->monitorCallback != NULL)
     {
-        targetP = targetP->next;
+        contextP->monitorCallback(clientP->internalID, NULL, COAP_202_DELETED, LWM2M_CONTENT_TEXT, NULL, 0, contextP->monitorUserData);
+    }
+    registration_freeClient(clientP);
+}
+
+// clientP->name must be set
+static int prv_addClient(lwm2m_context_t * contextP,
+                         lwm2m_client_t * clientP)
+{
+    timer_init(&clientP->lifetimeTimer, prv_lifetimeExpired, clientP);
+    if (0 != index_insert(contextP, &contextP->clientIndex, clientP, prv_clientIdHash)) return -1;
+    if (0 != index_insert(contextP, &contextP->clientNameIndex, clientP, prv_clientNameHash))
+    {
+        index_remove(&contextP->clientIndex, clientP, prv_clientIdHash);
+        return -1;
     }
+    // lookups go through the indexes, the list is not kept sorted
+    clientP->prev = NULL;
+    clientP->next = contextP->clientList;
+    if (clientP->next != NULL) clientP->next->prev = clientP;
+    contextP->clientList = clientP;
 
-    return targetP;
+    return 0;
+}
+
+// returns -1 if all the IDs are in use
+static int prv_newClientID(lwm2m_context_t * contextP,
+                           uint16_t * idP)
+{
+    uint32_t count;
+
+    for (count = 0 ; count <= 0xFFFF ; count++)
+    {
+        uint16_t id = contextP->nextClientID++;
+
+        if (registration_findClient(contextP, id) == NULL)
+        {
+            *idP = id;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void registration_clearClientIndex(lwm2m_context_t * contextP)
+{
+    index_clear(contextP, &contextP->clientIndex);
+    index_clear(contextP, &contextP->clientNameIndex);
 }
 
 void registration_freeClient(lwm2m_client_t * clientP)
@@ -997,9 +1107,9 @@ void registration_freeClient(lwm2m_client_t * clientP)
 
         targetP = clientP->observationList;
         clientP->observationList = clientP->observationList->next;
-        lwm2m_free(targetP);
+        memory_poolFree(targetP);
     }
-    lwm2m_free(clientP);
+    memory_poolFree(clientP);
 }
 
 static int prv_getLocationString(uint16_t id,
@@ -1105,15 +1215,26 @@ uint8_t registration_handleRequest(lwm2m_context_t * contextP,
             if (clientP != NULL)
             {
                 // we reset this registration
+                // the new name is identical so the client stays at the same place in the name index
                 lwm2m_free(clientP->name);
                 if (clientP->msisdn != NULL) lwm2m_free(clientP->msisdn);
                 if (clientP->altPath != NULL) lwm2m_free(clientP->altPath);
                 prv_freeClientObjectList(clientP->objectList);
                 clientP->objectList = NULL;
+                clientP->name = name;
             }
             else
             {
-                clientP = (lwm2m_client_t *)lwm2m_malloc(sizeof(lwm2m_client_t));
+                uint16_t clientID;
+
+                if (0 != prv_newClientID(contextP, &clientID))
+                {
+                    clientP = NULL;
+                }
+                else
+                {
+                    clientP = (lwm2m_client_t *)memory_poolAlloc(contextP, LWM2M_POOL_CLIENT);
+                }
                 if (clientP == NULL)
                 {
                     lwm2m_free(name);
@@ -1123,10 +1244,17 @@ uint8_t registration_handleRequest(lwm2m_context_t * contextP,
                     return COAP_500_INTERNAL_SERVER_ERROR;
                 }
                 memset(clientP, 0, sizeof(lwm2m_client_t));
-                clientP->internalID = lwm2m_list_newId((lwm2m_list_t *)contextP->clientList);
-                contextP->clientList = (lwm2m_client_t *)LWM2M_LIST_ADD(contextP->clientList, clientP);
+                clientP->internalID = clientID;
+                clientP->name = name;
+                if (0 != prv_addClient(contextP, clientP))
+                {
+                    clientP->altPath = altPath;
+                    clientP->msisdn = msisdn;
+                    clientP->objectList = objects;
+                    registration_freeClient(clientP);
+                    return COAP_500_INTERNAL_SERVER_ERROR;
+                }
             }
-            clientP->name = name;
             clientP->binding = binding;
             clientP->msisdn = msisdn;
             clientP->altPath = altPath;
@@ -1136,13 +1264,21 @@ uint8_t registration_handleRequest(lwm2m_context_t * contextP,
             clientP->objectList = objects;
             clientP->sessionH = fromSessionH;
 
+            if (0 != timer_schedule(contextP, &clientP->lifetimeTimer, clientP->endOfLife))
+            {
+                prv_removeClient(contextP, clientP);
+                registration_freeClient(clientP);
+                return COAP_500_INTERNAL_SERVER_ERROR;
+            }
             if (prv_getLocationString(clientP->internalID, location) == 0)
             {
+                prv_removeClient(contextP, clientP);
                 registration_freeClient(clientP);
                 return COAP_500_INTERNAL_SERVER_ERROR;
             }
             if (coap_set_header_location_path(response, location) == 0)
             {
+                prv_removeClient(contextP, clientP);
                 registration_freeClient(clientP);
                 return COAP_500_INTERNAL_SERVER_ERROR;
             }
@@ -1155,7 +1291,7 @@ uint8_t registration_handleRequest(lwm2m_context_t * contextP,
             break;
 
         case LWM2M_URI_FLAG_OBJECT_ID:
-            clientP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)contextP->clientList, uriP->objectId);
+            clientP = registration_findClient(contextP, uriP->objectId);
             if (clientP == NULL) return COAP_404_NOT_FOUND;
 
             // Endpoint client name MUST NOT be present
@@ -1229,6 +1365,8 @@ uint8_t registration_handleRequest(lwm2m_context_t * contextP,
             }
 
             clientP->endOfLife = tv_sec + clientP->lifetime;
+            // the client is registered so its timer is already scheduled and only moves
+            (void)timer_schedule(contextP, &clientP->lifetimeTimer, clientP->endOfLife);
 
             if (contextP->monitorCallback != NULL)
             {
@@ -1249,8 +1387,9 @@ uint8_t registration_handleRequest(lwm2m_context_t * contextP,
 
         if ((uriP->flag & LWM2M_URI_MASK_ID) != LWM2M_URI_FLAG_OBJECT_ID) return COAP_400_BAD_REQUEST;
 
-        contextP->clientList = (lwm2m_client_t *)LWM2M_LIST_RM(contextP->clientList, uriP->objectId, &clientP);
+        clientP = registration_findClient(contextP, uriP->objectId);
         if (clientP == NULL) return COAP_400_BAD_REQUEST;
+        prv_removeClient(contextP, clientP);
         if (contextP->monitorCallback != NULL)
         {
             contextP->monitorCallback(clientP->internalID, NULL, COAP_202_DELETED, LWM2M_CONTENT_TEXT, NULL, 0, contextP->monitorUserData);
@@ -1344,39 +1483,6 @@ void registration_step(lwm2m_context_t * contextP,
     }
 
 #endif
-#ifdef LWM2M_SERVER_MODE
-    lwm2m_client_t * clientP;
-
-    LOG("Entering");
-    // monitor clients lifetime
-    clientP = contextP->clientList;
-    while (clientP != NULL)
-    {
-        lwm2m_client_t * nextP = clientP->next;
-
-        if (clientP->endOfLife <= currentTime)
-        {
-            contextP->clientList = (lwm2m_client_t *)LWM2M_LIST_RM(contextP->clientList, clientP->internalID, NULL);
-            if (contextP->monitorCallback != NULL)
-            {
-                contextP->monitorCallback(clientP->internalID, NULL, COAP_202_DELETED, LWM2M_CONTENT_TEXT, NULL, 0, contextP->monitorUserData);
-            }
-            registration_freeClient(clientP);
-        }
-        else
-        {
-            time_t interval;
-
-            interval = clientP->endOfLife - currentTime;
-
-            if (*timeoutP > interval)
-            {
-                *timeoutP = interval;
-            }
-        }
-        clientP = nextP;
-    }
-#endif
 
 }
 
@@ -0,0 +1,254 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Outgoing datagrams of a context.
+ *
+ * While the queue is held, the datagrams are copied back to back in a single
+ * buffer instead of being sent. When the last hold is released, they are
+ * handed to lwm2m_buffer_send_batch() in one call. The payload given to
+ * sendqueue_pushGather() is not copied, only referenced until the flush. Acknowledgements and
+ * resets are kept ahead of the other datagrams so that a peer receives the
+ * answer to its message before the requests the core or the user callbacks
+ * sent while handling it.
+ *
+ * The buffers are kept between flushes and only grow.
+ */
+
+#include "internals.h"
+
+#ifdef LWM2M_WITH_SEND_QUEUE
+
+#ifndef LWM2M_SEND_QUEUE_MIN_COUNT
+#define LWM2M_SEND_QUEUE_MIN_COUNT 8
+#endif
+
+#ifndef LWM2M_SEND_QUEUE_MIN_DATA
+#define LWM2M_SEND_QUEUE_MIN_DATA 1024
+#endif
+
+#define ENTRY_SIZE  (sizeof(void *) + 2 * sizeof(uint8_t *) + 3 * sizeof(size_t))
+
+static int prv_grow(lwm2m_context_t * contextP)
+{
+    lwm2m_send_queue_t * queueP = &(contextP->sendQueue);
+    size_t size;
+    uint8_t * blockP;
+    void ** sessions;
+    uint8_t ** payloads;
+    size_t * offsets;
+    size_t * lengths;
+    size_t * payloadLengths;
+
+    size = (queueP->size == 0) ? LWM2M_SEND_QUEUE_MIN_COUNT : queueP->size * 2;
+    // the arrays share one block starting with sessions
+    blockP = (uint8_t *)memory_alloc(contextP, size * ENTRY_SIZE);
+    if (blockP == NULL) return -1;
+
+    sessions = (void **)blockP;
+    payloads = (uint8_t **)(blockP + size * (sizeof(void *) + sizeof(uint8_t *)));
+    offsets = (size_t *)(blockP + size * (sizeof(void *) + 2 * sizeof(uint8_t *)));
+    lengths = offsets + size;
+    payloadLengths = lengths + size;
+
+    if (queueP->count != 0)
+    {
+        memcpy(sessions, queueP->sessions, queueP->count * sizeof(void *));
+        memcpy(payloads, queueP->payloads, queueP->count * sizeof(uint8_t *));
+        memcpy(offsets, queueP->offsets, queueP->count * sizeof(size_t));
+        memcpy(lengths, queueP->lengths, queueP->count * sizeof(size_t));
+        memcpy(payloadLengths, queueP->payloadLengths, queueP->count * sizeof(size_t));
+    }
+    if (queueP->sessions != NULL) memory_free(contextP, queueP->sessions);
+
+    queueP->sessions = sessions;
+    queueP->buffers = (uint8_t **)(blockP + size * sizeof(void *));
+    queueP->payloads = payloads;
+    queueP->offsets = offsets;
+    queueP->lengths = lengths;
+    queueP->payloadLengths = payloadLengths;
+    queueP->size = size;
+
+    return 0;
+}
+
+static int prv_growData(lwm2m_context_t * contextP,
+                        size_t length)
+{
+    lwm2m_send_queue_t * queueP = &(contextP->sendQueue);
+    size_t size;
+    uint8_t * dataP;
+
+    size = (queueP->dataSize == 0) ? LWM2M_SEND_QUEUE_MIN_DATA : queueP->dataSize;
+    while (size < queueP->dataLength + length) size *= 2;
+
+    dataP = (uint8_t *)memory_alloc(contextP, size);
+    if (dataP == NULL) return -1;
+
+    if (queueP->data != NULL)
+    {
+        memcpy(dataP, queueP->data, queueP->dataLength);
+        memory_free(contextP, queueP->data);
+    }
+    queueP->data = dataP;
+    queueP->dataSize = size;
+
+    return 0;
+}
+
+static bool prv_isAcknowledgement(uint8_t * header)
+{
+    uint8_t type;
+
+    type = (header[0] & 0x30) >> 4;
+
+    return (type == COAP_TYPE_ACK || type == COAP_TYPE_RST);
+}
+
+void sendqueue_hold(lwm2m_context_t * contextP)
+{
+    contextP->sendQueue.holdCount++;
+}
+
+void sendqueue_release(lwm2m_context_t * contextP)
+{
+    lwm2m_send_queue_t * queueP = &(contextP->sendQueue);
+    size_t i;
+
+    if (queueP->holdCount == 0) return;
+    queueP->holdCount--;
+    if (queueP->holdCount != 0) return;
+
+    // sendqueue_forget() may have emptied the queue, its data is dropped all the same
+    if (queueP->count != 0)
+    {
+        for (i = 0 ; i < queueP->count ; i++)
+        {
+            queueP->buffers[i] = queueP->data + queueP->offsets[i];
+        }
+
+        LOG_ARG("Sending %d datagrams", queueP->count);
+        (void)lwm2m_buffer_send_batch(queueP->sessions, queueP->buffers, queueP->lengths, queueP->payloads, queueP->payloadLengths, queueP->count, contextP->userData);
+    }
+
+    queueP->count = 0;
+    queueP->ackCount = 0;
+    queueP->dataLength = 0;
+}
+
+static bool prv_push(lwm2m_context_t * contextP,
+                     void * sessionH,
+                     uint8_t * header,
+                     size_t headerLength,
+                     uint8_t * copiedPayload,
+                     size_t copiedLength,
+                     uint8_t * payload,
+                     size_t payloadLength)
+{
+    lwm2m_send_queue_t * queueP = &(contextP->sendQueue);
+    size_t length;
+    size_t index;
+
+    if (queueP->holdCount == 0 || headerLength == 0) return false;
+
+    length = headerLength + copiedLength;
+    if (queueP->count == queueP->size && prv_grow(contextP) != 0) return false;
+    if (queueP->dataLength + length > queueP->dataSize && prv_growData(contextP, length) != 0) return false;
+
+    memcpy(queueP->data + queueP->dataLength, header, headerLength);
+    if (copiedLength != 0) memcpy(queueP->data + queueP->dataLength + headerLength, copiedPayload, copiedLength);
+
+    index = queueP->count;
+    if (prv_isAcknowledgement(header))
+    {
+        index = queueP->ackCount;
+        memmove(queueP->sessions + index + 1, queueP->sessions + index, (queueP->count - index) * sizeof(void *));
+        memmove(queueP->payloads + index + 1, queueP->payloads + index, (queueP->count - index) * sizeof(uint8_t *));
+        memmove(queueP->offsets + index + 1, queueP->offsets + index, (queueP->count - index) * sizeof(size_t));
+        memmove(queueP->lengths + index + 1, queueP->lengths + index, (queueP->count - index) * sizeof(size_t));
+        memmove(queueP->payloadLengths + index + 1, queueP->payloadLengths + index, (queueP->count - index) * sizeof(size_t));
+        queueP->ackCount++;
+    }
+    queueP->sessions[index] = sessionH;
+    queueP->payloads[index] = (payloadLength != 0) ? payload : NULL;
+    queueP->offsets[index] = queueP->dataLength;
+    queueP->lengths[index] = length;
+    queueP->payloadLengths[index] = payloadLength;
+    queueP->count++;
+    queueP->dataLength += length;
+
+    return true;
+}
+
+bool sendqueue_push(lwm2m_context_t * contextP,
+                    void * sessionH,
+                    uint8_t * header,
+                    size_t headerLength,
+                    uint8_t * payload,
+                    size_t payloadLength)
+{
+    return prv_push(contextP, sessionH, header, headerLength, payload, payloadLength, NULL, 0);
+}
+
+bool sendqueue_pushGather(lwm2m_context_t * contextP,
+                          void * sessionH,
+                          uint8_t * header,
+                          size_t headerLength,
+                          uint8_t * payload,
+                          size_t payloadLength)
+{
+    return prv_push(contextP, sessionH, header, headerLength, NULL, 0, payload, payloadLength);
+}
+
+void sendqueue_forget(lwm2m_context_t * contextP,
+                      void * sessionH,
+                      uint8_t * payload)
+{
+    lwm2m_send_queue_t * queueP = &(contextP->sendQueue);
+    size_t i;
+    size_t count;
+
+    // the header stays in data until the flush, only the entry goes
+    count = 0;
+    for (i = 0 ; i < queueP->count ; i++)
+    {
+        if (queueP->payloads[i] == payload
+         && queueP->sessions[i] == sessionH)
+        {
+            if (i < queueP->ackCount) queueP->ackCount--;
+            continue;
+        }
+        queueP->sessions[count] = queueP->sessions[i];
+        queueP->payloads[count] = queueP->payloads[i];
+        queueP->offsets[count] = queueP->offsets[i];
+        queueP->lengths[count] = queueP->lengths[i];
+        queueP->payloadLengths[count] = queueP->payloadLengths[i];
+        count++;
+    }
+    queueP->count = count;
+}
+
+void sendqueue_clear(lwm2m_context_t * contextP)
+{
+    lwm2m_send_queue_t * queueP = &(contextP->sendQueue);
+
+    if (queueP->sessions != NULL) memory_free(contextP, queueP->sessions);
+    if (queueP->data != NULL) memory_free(contextP, queueP->data);
+    memset(queueP, 0, sizeof(lwm2m_send_queue_t));
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Intel Corporation and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Deadline scheduler of the context.
+ *
+ * Timers are embedded in the items they belong to and referenced by a binary
+ * min-heap ordered on their deadline. Each timer remembers its position in the
+ * heap so that it can be moved or cancelled without searching. timer_step()
+ * only visits the timers which are due.
+ */
+
+#include "internals.h"
+
+#define TIMER_MIN_SIZE  16
+
+// position is stored one-based so that a zeroed timer is not scheduled
+static void prv_set(lwm2m_timer_t ** heap,
+                    size_t i,
+                    lwm2m_timer_t * timerP)
+{
+    heap[i] = timerP;
+    timerP->position = i + 1;
+}
+
+static void prv_siftUp(lwm2m_timer_t ** heap,
+                       size_t i)
+{
+    lwm2m_timer_t * timerP = heap[i];
+
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+
+        if (heap[parent]->deadline <= timerP->deadline) break;
+        prv_set(heap, i, heap[parent]);
+        i = parent;
+    }
+    prv_set(heap, i, timerP);
+}
+
+static void prv_siftDown(lwm2m_timer_t ** heap,
+                         size_t count,
+                         size_t i)
+{
+    lwm2m_timer_t * timerP = heap[i];
+
+    while (2 * i + 1 < count)
+    {
+        size_t child = 2 * i + 1;
+
+        if (child + 1 < count
+         && heap[child + 1]->deadline < heap[child]->deadline)
+        {
+            child++;
+        }
+        if (timerP->deadline <= heap[child]->deadline) break;
+        prv_set(heap, i, heap[child]);
+        i = child;
+    }
+    prv_set(heap, i, timerP);
+}
+
+void timer_init(lwm2m_timer_t * timerP,
+                lwm2m_timer_callback_t callback,
+                void * itemP)
+{
+    memset(timerP, 0, sizeof(lwm2m_timer_t));
+    timerP->callback = callback;
+    timerP->itemP = itemP;
+}
+
+int timer_schedule(lwm2m_context_t * contextP,
+                   lwm2m_timer_t * timerP,
+                   time_t deadline)
+{
+    lwm2m_scheduler_t * schedulerP = &contextP->scheduler;
+    size_t i;
+
+    if (timerP->position != 0)
+    {
+        time_t previous = timerP->deadline;
+
+        i = timerP->position - 1;
+        timerP->deadline = deadline;
+        if (deadline < previous)
+        {
+            prv_siftUp(schedulerP->heap, i);
+        }
+        else
+        {
+            prv_siftDown(schedulerP->heap, schedulerP->count, i);
+        }
+        return 0;
+    }
+
+    if (schedulerP->count == schedulerP->size)
+    {
+        lwm2m_timer_t ** newHeap;
+        size_t newSize;
+
+        newSize = schedulerP->size == 0 ? TIMER_MIN_SIZE : schedulerP->size * 2;
+        newHeap = (lwm2m_timer_t **)memory_alloc(contextP, newSize * sizeof(lwm2m_timer_t *));
+        if (newHeap == NULL) return -1;
+        if (schedulerP->heap != NULL)
+        {
+            memcpy(newHeap, schedulerP->heap, schedulerP->count * sizeof(lwm2m_timer_t *));
+            memory_free(contextP, schedulerP->heap);
+        }
+        schedulerP->heap = newHeap;
+        schedulerP->size = newSize;
+    }
+
+    timerP->deadline = deadline;
+    i = schedulerP->count++;
+    prv_set(schedulerP->heap, i, timerP);
+    prv_siftUp(schedulerP->heap, i);
+
+    return 0;
+}
+
+void timer_cancel(lwm2m_context_t * contextP,
+                  lwm2m_timer_t * timerP)
+{
+    lwm2m_scheduler_t * schedulerP = &contextP->scheduler;
+    lwm2m_timer_t * lastP;
+    size_t i;
+
+    if (timerP->position == 0) return;
+
+    i = timerP->position - 1;
+    timerP->position = 0;
+    schedulerP->count--;
+    if (i == schedulerP->count) return;
+
+    // move the last timer in the hole and restore the heap order around it
+    lastP = schedulerP->heap[schedulerP->count];
+    prv_set(schedulerP->heap, i, lastP);
+    if (i > 0 && schedulerP->heap[(i - 1) / 2]->deadline > lastP->deadline)
+    {
+        prv_siftUp(schedulerP->heap, i);
+    }
+    else
+    {
+        prv_siftDown(schedulerP->heap, schedulerP->count, i);
+    }
+}
+
+void timer_step(lwm2m_context_t * contextP,
+                time_t currentTime,
+                time_t * timeoutP)
+{
+    lwm2m_scheduler_t * schedulerP = &contextP->scheduler;
+
+    LOG("Entering");
+    // callbacks may schedule or cancel any timer, so always restart from the heap top
+    while (schedulerP->count > 0
+        && schedulerP->heap[0]->deadline <= currentTime)
+    {
+        lwm2m_timer_t * timerP = schedulerP->heap[0];
+
+        timer_cancel(contextP, timerP);
+        timerP->callback(contextP, timerP->itemP, currentTime);
+    }
+
+    if (schedulerP->count > 0)
+    {
+        time_t interval;
+
+        interval = schedulerP->heap[0]->deadline - currentTime;
+        if (*timeoutP > interval)
+        {
+            *timeoutP = interval;
+        }
+    }
+}
+
+// the timers may already be freed at this point so they are not accessed
+void timer_clear(lwm2m_context_t * contextP)
+{
+    lwm2m_scheduler_t * schedulerP = &contextP->scheduler;
+
+    if (schedulerP->heap != NULL) memory_free(contextP, schedulerP->heap);
+    memset(schedulerP, 0, sizeof(lwm2m_scheduler_t));
+}
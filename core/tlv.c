@@ -301,63 +301,139 @@ int lwm2m_decode_TLV(const uint8_t * buffer,
 }
 
 
-int tlv_parse(uint8_t * buffer,
-              size_t bufferLen,
-              lwm2m_data_t ** dataP)
+// Returns the number of records at the first level of buffer.
+// If totalP is not nil, the number of records at all levels is added to it.
+static int prv_countRecords(uint8_t * buffer,
+                            size_t bufferLen,
+                            size_t * totalP)
 {
     lwm2m_data_type_t type;
     uint16_t id;
     size_t dataIndex;
     size_t dataLen;
-    int index = 0;
+    size_t index = 0;
     int result;
-    int size = 0;
+    int count = 0;
 
-    LOG_ARG("bufferLen: %d", bufferLen);
+    while (0 != (result = lwm2m_decode_TLV(buffer + index, bufferLen - index, &type, &id, &dataIndex, &dataLen)))
+    {
+        count++;
+        if (totalP != NULL
+         && (type == LWM2M_TYPE_OBJECT_INSTANCE || type == LWM2M_TYPE_MULTIPLE_RESOURCE))
+        {
+            (void)prv_countRecords(buffer + index + dataIndex, dataLen, totalP);
+        }
+        index += result;
+    }
 
-    *dataP = NULL;
+    if (totalP != NULL) *totalP += count;
+
+    return count;
+}
+
+// Fills the size records of dataP from buffer.
+// If contextP is nil, children arrays and values are allocated on the heap. Otherwise children
+// arrays are taken from *freePP and values point into buffer.
+static bool prv_fillRecords(lwm2m_context_t * contextP,
+                            uint8_t * buffer,
+                            size_t bufferLen,
+                            int size,
+                            lwm2m_data_t * dataP,
+                            lwm2m_data_t ** freePP)
+{
+    lwm2m_data_type_t type;
+    uint16_t id;
+    size_t dataIndex;
+    size_t dataLen;
+    size_t index = 0;
+    int result;
+    int i;
 
-    while (0 != (result = lwm2m_decode_TLV((uint8_t*)buffer + index, bufferLen - index, &type, &id, &dataIndex, &dataLen)))
+    for (i = 0 ; i < size ; i++)
     {
-        lwm2m_data_t * newTlvP;
+        result = lwm2m_decode_TLV(buffer + index, bufferLen - index, &type, &id, &dataIndex, &dataLen);
+        if (result == 0) return false;
 
-        newTlvP = lwm2m_data_new(size + 1);
-        if (size >= 1)
+        dataP[i].id = id;
+        if (type == LWM2M_TYPE_OBJECT_INSTANCE || type == LWM2M_TYPE_MULTIPLE_RESOURCE)
         {
-            if (newTlvP == NULL)
+            int count;
+
+            dataP[i].type = type;
+            count = prv_countRecords(buffer + index + dataIndex, dataLen, NULL);
+            if (count == 0) return false;
+
+            if (contextP == NULL)
             {
-                lwm2m_data_free(size, *dataP);
-                return 0;
+                dataP[i].value.asChildren.array = lwm2m_data_new(count);
+                if (dataP[i].value.asChildren.array == NULL) return false;
             }
             else
             {
-                memcpy(newTlvP, *dataP, size * sizeof(lwm2m_data_t));
-                lwm2m_free(*dataP);
+                dataP[i].value.asChildren.array = *freePP;
+                *freePP += count;
             }
-        }
-        *dataP = newTlvP;
+            dataP[i].value.asChildren.count = count;
 
-        (*dataP)[size].type = type;
-        (*dataP)[size].id = id;
-        if (type == LWM2M_TYPE_OBJECT_INSTANCE || type == LWM2M_TYPE_MULTIPLE_RESOURCE)
-        {
-            (*dataP)[size].value.asChildren.count = tlv_parse(buffer + index + dataIndex,
-                                                          dataLen,
-                                                          &((*dataP)[size].value.asChildren.array));
-            if ((*dataP)[size].value.asChildren.count == 0)
+            if (!prv_fillRecords(contextP, buffer + index + dataIndex, dataLen, count, dataP[i].value.asChildren.array, freePP))
             {
-                lwm2m_data_free(size + 1, *dataP);
-                return 0;
+                return false;
             }
         }
+        else if (contextP == NULL)
+        {
+            lwm2m_data_encode_opaque(buffer + index + dataIndex, dataLen, dataP + i);
+        }
         else
         {
-            lwm2m_data_encode_opaque(buffer + index + dataIndex, dataLen, (*dataP) + size);
+            dataP[i].type = LWM2M_TYPE_OPAQUE;
+            dataP[i].value.asBuffer.length = dataLen;
+            dataP[i].value.asBuffer.buffer = dataLen > 0 ? buffer + index + dataIndex : NULL;
         }
-        size++;
         index += result;
     }
 
+    return true;
+}
+
+// Parses in two passes: the records are counted before the arrays are allocated with their final size.
+// If contextP is not nil, the whole tree is one allocation in the context arena and the values
+// point into buffer.
+int tlv_parse(lwm2m_context_t * contextP,
+              uint8_t * buffer,
+              size_t bufferLen,
+              lwm2m_data_t ** dataP)
+{
+    lwm2m_data_t * freeP = NULL;
+    size_t total = 0;
+    int size;
+
+    LOG_ARG("bufferLen: %d", bufferLen);
+
+    *dataP = NULL;
+
+    if (contextP == NULL)
+    {
+        size = prv_countRecords(buffer, bufferLen, NULL);
+        if (size == 0) return 0;
+        *dataP = lwm2m_data_new(size);
+    }
+    else
+    {
+        size = prv_countRecords(buffer, bufferLen, &total);
+        if (size == 0) return 0;
+        *dataP = data_new(contextP, total);
+        if (*dataP != NULL) freeP = *dataP + size;
+    }
+    if (*dataP == NULL) return 0;
+
+    if (!prv_fillRecords(contextP, buffer, bufferLen, size, *dataP, &freeP))
+    {
+        data_free(contextP, size, *dataP);
+        *dataP = NULL;
+        return 0;
+    }
+
     return size;
 }
 
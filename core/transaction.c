@@ -107,12 +107,11 @@ Contains code snippets which are:
 #include "internals.h"
 
 
-/*
- * Modulo mask (+1 and +0.5 for rounding) for a random number to get the tick number for the random
- * retransmission time between COAP_RESPONSE_TIMEOUT and COAP_RESPONSE_TIMEOUT*COAP_RESPONSE_RANDOM_FACTOR.
- */
-#define COAP_RESPONSE_TIMEOUT_TICKS         (CLOCK_SECOND * COAP_RESPONSE_TIMEOUT)
-#define COAP_RESPONSE_TIMEOUT_BACKOFF_MASK  ((CLOCK_SECOND * COAP_RESPONSE_TIMEOUT * (COAP_RESPONSE_RANDOM_FACTOR - 1)) + 1.5)
+// rounded up to the resolution of lwm2m_gettime()
+static time_t prv_toSeconds(uint32_t milliseconds)
+{
+    return (time_t)((milliseconds + 999) / 1000);
+}
 
 static int prv_checkFinished(lwm2m_transaction_t * transacP,
                              coap_packet_t * receivedMessage)
@@ -141,7 +140,299 @@ static int prv_checkFinished(lwm2m_transaction_t * transacP,
     return 0;
 }
 
-lwm2m_transaction_t * transaction_new(void * sessionH,
+// transactions are indexed on their MID and, for requests, on their token.
+// Session handles can only be compared by lwm2m_session_is_equal() so they are
+// checked when matching and not part of the hash.
+typedef struct
+{
+    lwm2m_context_t * contextP;
+    void * sessionH;
+    coap_packet_t * message;
+} transaction_key_t;
+
+static size_t prv_midHash(void * itemP)
+{
+    return index_hashInt(((lwm2m_transaction_t *)itemP)->mID);
+}
+
+static bool prv_midMatch(void * itemP,
+                         void * keyP)
+{
+    lwm2m_transaction_t * transacP = (lwm2m_transaction_t *)itemP;
+    transaction_key_t * key = (transaction_key_t *)keyP;
+
+    return transacP->mID == key->message->mid
+        && !transacP->ack_received
+        && lwm2m_session_is_equal(key->sessionH, transacP->peerH, key->contextP->userData);
+}
+
+static size_t prv_tokenHash(void * itemP)
+{
+    coap_packet_t * message = (coap_packet_t *)((lwm2m_transaction_t *)itemP)->message;
+
+    return index_hashBuffer(message->token, message->token_len);
+}
+
+static bool prv_tokenMatch(void * itemP,
+                           void * keyP)
+{
+    lwm2m_transaction_t * transacP = (lwm2m_transaction_t *)itemP;
+    transaction_key_t * key = (transaction_key_t *)keyP;
+    coap_packet_t * message = (coap_packet_t *)transacP->message;
+
+    return message->token_len == key->message->token_len
+        && 0 == memcmp(message->token, key->message->token, message->token_len)
+        && lwm2m_session_is_equal(key->sessionH, transacP->peerH, key->contextP->userData);
+}
+
+static bool prv_hasToken(lwm2m_transaction_t * transacP)
+{
+    coap_packet_t * message = (coap_packet_t *)transacP->message;
+
+    // only requests are finished by a response carrying their token
+    return COAP_DELETE >= message->code && IS_OPTION(message, COAP_OPTION_TOKEN);
+}
+
+static int prv_addToIndexes(lwm2m_context_t * contextP,
+                            lwm2m_transaction_t * transacP)
+{
+    if (0 != index_insert(contextP, &contextP->transactionMidIndex, transacP, prv_midHash)) return -1;
+    if (prv_hasToken(transacP)
+     && 0 != index_insert(contextP, &contextP->transactionTokenIndex, transacP, prv_tokenHash))
+    {
+        index_remove(&contextP->transactionMidIndex, transacP, prv_midHash);
+        return -1;
+    }
+
+    return 0;
+}
+
+// sets the block of the payload at block1_offset. returns false on error.
+static bool prv_setBlock1(lwm2m_transaction_t * transacP)
+{
+    coap_packet_t * message = (coap_packet_t *)transacP->message;
+    const uint8_t * payload;
+    size_t length;
+
+    length = transacP->block1_len - transacP->block1_offset;
+    if (length > transacP->block1_size) length = transacP->block1_size;
+
+    if (transacP->block1_reader != NULL)
+    {
+        payload = transacP->block1_reader(transacP->block1_offset, length, transacP->block1_buffer, transacP->block1_reader_data);
+        if (payload == NULL) return false;
+    }
+    else
+    {
+        payload = transacP->block1_buffer + transacP->block1_offset;
+    }
+
+    // a payload fitting in one block is sent as is
+    if (transacP->block1_len > transacP->block1_size)
+    {
+        coap_set_header_block1(message,
+                               (uint32_t)(transacP->block1_offset / transacP->block1_size),
+                               transacP->block1_offset + length < transacP->block1_len,
+                               transacP->block1_size);
+        if (transacP->block1_offset == 0) coap_set_header_size1(message, (uint32_t)transacP->block1_len);
+    }
+    coap_set_payload(message, payload, length);
+
+    return true;
+}
+
+// sends the request again with a new message, asking for the block num of
+// size bytes of the response or carrying the block of the payload at
+// block1_offset. returns false on error.
+static bool prv_requestAgain(lwm2m_context_t * contextP,
+                             lwm2m_transaction_t * transacP,
+                             uint16_t option,
+                             uint32_t num,
+                             uint16_t size)
+{
+    lwm2m_transaction_t * nextP = NULL;
+    uint8_t * buffer = transacP->buffer;
+
+    // the serialization released the options of the request, they are parsed back from the datagram
+    if (NO_ERROR != coap_parse_message(transacP->message, buffer, transacP->buffer_len)) return false;
+    if (option == COAP_OPTION_BLOCK2)
+    {
+        coap_set_header_block2(transacP->message, num, 0, size);
+    }
+    else if (!prv_setBlock1(transacP))
+    {
+        return false;
+    }
+
+    if (transacP->peerP != NULL) nextP = peer_endExchange(transacP->peerP, transacP);
+    timer_cancel(contextP, &transacP->timer);
+    index_remove(&contextP->transactionMidIndex, transacP, prv_midHash);
+    if (prv_hasToken(transacP))
+    {
+        index_remove(&contextP->transactionTokenIndex, transacP, prv_tokenHash);
+    }
+
+    // the token is kept, the request is serialized again by transaction_send()
+    transacP->mID = contextP->nextMID++;
+    ((coap_packet_t *)transacP->message)->mid = transacP->mID;
+    transacP->buffer = NULL;
+    transacP->payload = NULL;
+    transacP->payload_len = 0;
+    transacP->ack_received = false;
+    transacP->retrans_counter = 0;
+
+    // the queued message was there first
+    if (nextP != NULL) (void)transaction_send(contextP, nextP);
+    (void)transaction_send(contextP, transacP);
+    memory_free(contextP, buffer);
+
+    return true;
+}
+
+static void prv_failBlock(coap_packet_t * message,
+                           uint8_t code)
+{
+    message->code = code;
+    message->payload = NULL;
+    message->payload_len = 0;
+}
+
+// accumulates the body of a response sent by blocks. returns true if the next
+// block was requested, otherwise message holds the whole response.
+static bool prv_handleBlock2(lwm2m_context_t * contextP,
+                             lwm2m_transaction_t * transacP,
+                             coap_packet_t * message)
+{
+    coap_packet_t * request = (coap_packet_t *)transacP->message;
+    const uint8_t * etag = NULL;
+    int etagLen;
+    uint32_t num;
+    uint8_t more;
+    uint16_t size;
+    uint32_t offset;
+    size_t length;
+
+    // notifications are not followed
+    if (request->code != COAP_GET
+     || IS_OPTION(request, COAP_OPTION_OBSERVE)
+     || message->code != COAP_205_CONTENT
+     || !coap_get_header_block2(message, &num, &more, &size, &offset)
+     || (offset == 0 && !more))
+    {
+        return false;
+    }
+
+    etagLen = coap_get_header_etag(message, &etag);
+    if (offset == 0)
+    {
+        transacP->block2_len = 0;
+        transacP->block2_etag_len = (uint8_t)etagLen;
+        if (etagLen > 0) memcpy(transacP->block2_etag, etag, etagLen);
+    }
+    else if (offset != transacP->block2_len
+          || etagLen != transacP->block2_etag_len
+          || (etagLen > 0 && memcmp(etag, transacP->block2_etag, etagLen) != 0))
+    {
+        // a block is missing or the resource changed in between
+        LOG_ARG("Blockwise: unexpected block %u", num);
+        prv_failBlock(message, COAP_408_REQ_ENTITY_INCOMPLETE);
+        return false;
+    }
+
+    length = offset + message->payload_len;
+    if (length > MAX_BLOCK2_SIZE)
+    {
+        prv_failBlock(message, COAP_413_ENTITY_TOO_LARGE);
+        return false;
+    }
+    if (length > transacP->block2_size)
+    {
+        uint8_t * bufferP;
+        size_t bufferSize;
+
+        bufferSize = 2 * transacP->block2_size;
+        if (bufferSize < length) bufferSize = length;
+        if (bufferSize > MAX_BLOCK2_SIZE) bufferSize = MAX_BLOCK2_SIZE;
+        bufferP = (uint8_t *)memory_alloc(contextP, bufferSize);
+        if (bufferP == NULL)
+        {
+            prv_failBlock(message, COAP_500_INTERNAL_SERVER_ERROR);
+            return false;
+        }
+        if (transacP->block2_buffer != NULL)
+        {
+            memcpy(bufferP, transacP->block2_buffer, transacP->block2_len);
+            memory_free(contextP, transacP->block2_buffer);
+        }
+        transacP->block2_buffer = bufferP;
+        transacP->block2_size = bufferSize;
+    }
+    memcpy(transacP->block2_buffer + offset, message->payload, message->payload_len);
+    transacP->block2_len = length;
+
+    if (more)
+    {
+        LOG_ARG("Blockwise: requesting block %u of %u bytes", num + 1, size);
+        if (prv_requestAgain(contextP, transacP, COAP_OPTION_BLOCK2, num + 1, size)) return true;
+        prv_failBlock(message, COAP_500_INTERNAL_SERVER_ERROR);
+        return false;
+    }
+
+    message->payload = transacP->block2_buffer;
+    message->payload_len = (uint16_t)transacP->block2_len;
+
+    return false;
+}
+
+// sends the next block of the payload once the peer asks for it. returns true
+// if a block was sent, otherwise message is the response to the request.
+static bool prv_handleBlock1(lwm2m_context_t * contextP,
+                             lwm2m_transaction_t * transacP,
+                             coap_packet_t * message)
+{
+    uint32_t num;
+    uint16_t size;
+
+    if (transacP->block1_len <= transacP->block1_size
+     || (message->code != COAP_231_CONTINUE && message->code != COAP_413_ENTITY_TOO_LARGE))
+    {
+        return false;
+    }
+    if (!coap_get_header_block1(message, &num, NULL, &size, NULL)) size = transacP->block1_size;
+
+    if (message->code == COAP_413_ENTITY_TOO_LARGE)
+    {
+        // the transfer restarts if the peer asks for smaller blocks
+        if (size >= transacP->block1_size) return false;
+        transacP->block1_offset = 0;
+    }
+    else
+    {
+        transacP->block1_offset += transacP->block1_size;
+        if (transacP->block1_offset >= transacP->block1_len) return false;
+    }
+    // the offset reached is a multiple of any smaller block size
+    if (size < transacP->block1_size) transacP->block1_size = size;
+
+    LOG_ARG("Blockwise: sending %u bytes at %u", transacP->block1_size, transacP->block1_offset);
+    if (prv_requestAgain(contextP, transacP, COAP_OPTION_BLOCK1, 0, 0)) return true;
+    prv_failBlock(message, COAP_500_INTERNAL_SERVER_ERROR);
+
+    return false;
+}
+
+static void prv_timerCallback(lwm2m_context_t * contextP,
+                              void * itemP,
+                              time_t currentTime)
+{
+    (void)currentTime;
+
+    // retransmits, or reports the timeout and removes the transaction
+    (void)transaction_send(contextP, (lwm2m_transaction_t *)itemP);
+}
+
+lwm2m_transaction_t * transaction_new(lwm2m_context_t * contextP,
+                                      void * sessionH,
                                       coap_method_t method,
                                       char * altPath,
                                       lwm2m_uri_t * uriP,
@@ -159,12 +450,12 @@ lwm2m_transaction_t * transaction_new(void * sessionH,
     // no transactions without peer
     if (NULL == sessionH) return NULL;
 
-    transacP = (lwm2m_transaction_t *)lwm2m_malloc(sizeof(lwm2m_transaction_t));
+    transacP = (lwm2m_transaction_t *)memory_poolAlloc(contextP, LWM2M_POOL_TRANSACTION);
 
     if (NULL == transacP) return NULL;
     memset(transacP, 0, sizeof(lwm2m_transaction_t));
 
-    transacP->message = lwm2m_malloc(sizeof(coap_packet_t));
+    transacP->message = memory_poolAlloc(contextP, LWM2M_POOL_PACKET);
     if (NULL == transacP->message) goto error;
 
     coap_init_message(transacP->message, COAP_TYPE_CON, method, mID);
@@ -172,6 +463,7 @@ lwm2m_transaction_t * transaction_new(void * sessionH,
     transacP->peerH = sessionH;
 
     transacP->mID = mID;
+    timer_init(&transacP->timer, prv_timerCallback, transacP);
 
     if (altPath != NULL)
     {
@@ -237,29 +529,83 @@ lwm2m_transaction_t * transaction_new(void * sessionH,
 
 error:
     LOG("Exiting on failure");
-    lwm2m_free(transacP);
+    transaction_free(contextP, transacP);
     return NULL;
 }
 
-void transaction_free(lwm2m_transaction_t * transacP)
+int transaction_setBlock1(lwm2m_context_t * contextP,
+                          lwm2m_transaction_t * transacP,
+                          uint16_t blockSize,
+                          size_t length,
+                          uint8_t * buffer,
+                          lwm2m_block_reader_t reader,
+                          void * readerData)
+{
+    // without reader the payload is copied, the following blocks are sent once the caller returned
+    transacP->block1_buffer = (uint8_t *)memory_alloc(contextP, reader == NULL ? length : blockSize);
+    if (transacP->block1_buffer == NULL) return -1;
+    if (reader == NULL) memcpy(transacP->block1_buffer, buffer, length);
+
+    transacP->block1_reader = reader;
+    transacP->block1_reader_data = readerData;
+    transacP->block1_len = length;
+    transacP->block1_offset = 0;
+    transacP->block1_size = blockSize;
+
+    return prv_setBlock1(transacP) ? 0 : -1;
+}
+
+void transaction_free(lwm2m_context_t * contextP,
+                      lwm2m_transaction_t * transacP)
 {
     LOG("Entering");
     if (transacP->message)
     {
        coap_free_header(transacP->message);
-       lwm2m_free(transacP->message);
+       memory_poolFree(transacP->message);
     }
 
-    if (transacP->buffer) lwm2m_free(transacP->buffer);
-    lwm2m_free(transacP);
+#ifdef LWM2M_WITH_SEND_QUEUE
+    // the storage of the payload may go with the transaction
+    if (transacP->payload != NULL) sendqueue_forget(contextP, transacP->peerH, transacP->payload);
+#endif
+    if (transacP->buffer) memory_free(contextP, transacP->buffer);
+    if (transacP->block2_buffer) memory_free(contextP, transacP->block2_buffer);
+    if (transacP->block1_buffer) memory_free(contextP, transacP->block1_buffer);
+    if (transacP->peerP != NULL) peer_release(transacP->peerP);
+    memory_poolFree(transacP);
+}
+
+void transaction_add(lwm2m_context_t * contextP,
+                     lwm2m_transaction_t * transacP)
+{
+    // the transactions are found through the indexes, the list is not sorted
+    transacP->prev = NULL;
+    transacP->next = contextP->transactionList;
+    if (transacP->next != NULL) transacP->next->prev = transacP;
+    contextP->transactionList = transacP;
 }
 
 void transaction_remove(lwm2m_context_t * contextP,
                         lwm2m_transaction_t * transacP)
 {
+    lwm2m_transaction_t * nextP = NULL;
+
     LOG("Entering");
-    contextP->transactionList = (lwm2m_transaction_t *) LWM2M_LIST_RM(contextP->transactionList, transacP->mID, NULL);
-    transaction_free(transacP);
+    if (transacP->peerP != NULL) nextP = peer_endExchange(transacP->peerP, transacP);
+    timer_cancel(contextP, &transacP->timer);
+    index_remove(&contextP->transactionMidIndex, transacP, prv_midHash);
+    if (prv_hasToken(transacP))
+    {
+        index_remove(&contextP->transactionTokenIndex, transacP, prv_tokenHash);
+    }
+    if (transacP->prev != NULL) transacP->prev->next = transacP->next;
+    else if (contextP->transactionList == transacP) contextP->transactionList = transacP->next;
+    if (transacP->next != NULL) transacP->next->prev = transacP->prev;
+    transaction_free(contextP, transacP);
+
+    // the peer can take one more message
+    if (nextP != NULL) (void)transaction_send(contextP, nextP);
 }
 
 bool transaction_handleResponse(lwm2m_context_t * contextP,
@@ -269,77 +615,112 @@ bool transaction_handleResponse(lwm2m_context_t * contextP,
 {
     bool found = false;
     bool reset = false;
-    lwm2m_transaction_t * transacP;
+    lwm2m_transaction_t * transacP = NULL;
+    transaction_key_t key;
 
     LOG("Entering");
-    transacP = contextP->transactionList;
+    key.contextP = contextP;
+    key.sessionH = fromSessionH;
+    key.message = message;
 
-    while (NULL != transacP)
+    if ((COAP_TYPE_ACK == message->type) || (COAP_TYPE_RST == message->type))
     {
-        if (lwm2m_session_is_equal(fromSessionH, transacP->peerH, contextP->userData) == true)
+        transacP = (lwm2m_transaction_t *)index_find(&contextP->transactionMidIndex,
+                                                     index_hashInt(message->mid),
+                                                     prv_midMatch, &key);
+        if (NULL != transacP)
         {
-            if (!transacP->ack_received)
+            found = true;
+            if (!transacP->ack_received && transacP->peerP != NULL)
             {
-                if ((COAP_TYPE_ACK == message->type) || (COAP_TYPE_RST == message->type))
+                time_t tv_sec = lwm2m_gettime();
+
+                // retrans_counter is 2 once the first transmission is sent
+                if (0 <= tv_sec)
                 {
-                    if (transacP->mID == message->mid)
-	                {
-    	                found = true;
-        	            transacP->ack_received = true;
-            	        reset = COAP_TYPE_RST == message->type;
-            	    }
+                    peer_addSample(transacP->peerP, tv_sec, tv_sec - transacP->first_time, transacP->retrans_counter - 2);
                 }
             }
+            transacP->ack_received = true;
+            reset = COAP_TYPE_RST == message->type;
+        }
+    }
+    if (NULL == transacP && 0 != message->token_len)
+    {
+        transacP = (lwm2m_transaction_t *)index_find(&contextP->transactionTokenIndex,
+                                                     index_hashBuffer(message->token, message->token_len),
+                                                     prv_tokenMatch, &key);
+    }
+    if (NULL == transacP) return false;
 
-            if (reset || prv_checkFinished(transacP, message))
+    if (reset || prv_checkFinished(transacP, message))
+    {
+        // HACK: If a message is sent from the monitor callback,
+        // it will arrive before the registration ACK.
+        // So we resend transaction that were denied for authentication reason.
+        if (!reset)
+        {
+            if (COAP_TYPE_CON == message->type && NULL != response)
             {
-                // HACK: If a message is sent from the monitor callback,
-                // it will arrive before the registration ACK.
-                // So we resend transaction that were denied for authentication reason.
-                if (!reset)
-                {
-                    if (COAP_TYPE_CON == message->type && NULL != response)
-                    {
-                        coap_init_message(response, COAP_TYPE_ACK, 0, message->mid);
-                        message_send(contextP, response, fromSessionH);
-                    }
-                
-	                if ((COAP_401_UNAUTHORIZED == message->code) && (COAP_MAX_RETRANSMIT > transacP->retrans_counter))
-    	            {
-        	            transacP->ack_received = false;
-            	        transacP->retrans_time += COAP_RESPONSE_TIMEOUT;
-                	    return true;
-                	}
-				}       
-                if (transacP->callback != NULL)
-                {
-                    transacP->callback(transacP, message);
-                }
-                transaction_remove(contextP, transacP);
-                return true;
+                coap_init_message(response, COAP_TYPE_ACK, 0, message->mid);
+                message_send(contextP, response, fromSessionH);
             }
-            // if we found our guy, exit
-            if (found)
+
+            if ((COAP_401_UNAUTHORIZED == message->code) && (COAP_MAX_RETRANSMIT > transacP->retrans_counter))
             {
-                time_t tv_sec = lwm2m_gettime();
-                if (0 <= tv_sec)
-                {
-                    transacP->retrans_time = tv_sec;
-                }
-                if (transacP->response_timeout)
-                {
-                    transacP->retrans_time += transacP->response_timeout;
-                }
-                else
-                {
-                    transacP->retrans_time += COAP_RESPONSE_TIMEOUT * transacP->retrans_counter;
-                }
-                return true;
+                transacP->ack_received = false;
+                transacP->retrans_time += COAP_RESPONSE_TIMEOUT;
+                // if it can not be sent again, the response is reported
+                if (0 == timer_schedule(contextP, &transacP->timer, transacP->retrans_time)) return true;
+            }
+            else
+            {
+                // a response sent by blocks is reported once complete, as is the response to a payload sent by blocks
+                if (prv_handleBlock2(contextP, transacP, message)) return true;
+                if (prv_handleBlock1(contextP, transacP, message)) return true;
             }
         }
+        if (transacP->callback != NULL)
+        {
+            transacP->callback(transacP, message);
+        }
+        transaction_remove(contextP, transacP);
+        return true;
+    }
 
-        transacP = transacP->next;
+    // we only got the ACK, keep on waiting for the response
+    if (found)
+    {
+        lwm2m_transaction_t * nextP = NULL;
+        time_t tv_sec = lwm2m_gettime();
+
+        // the message is not outstanding anymore
+        if (transacP->peerP != NULL) nextP = peer_endExchange(transacP->peerP, transacP);
+        if (0 <= tv_sec)
+        {
+            transacP->retrans_time = tv_sec;
+        }
+        if (transacP->response_timeout)
+        {
+            transacP->retrans_time += transacP->response_timeout;
+        }
+        else
+        {
+            transacP->retrans_time += COAP_RESPONSE_TIMEOUT * transacP->retrans_counter;
+        }
+        if (0 != timer_schedule(contextP, &transacP->timer, transacP->retrans_time))
+        {
+            // without its timer the transaction would never time out, it does now
+            if (transacP->callback != NULL)
+            {
+                transacP->callback(transacP, NULL);
+            }
+            transaction_remove(contextP, transacP);
+        }
+        if (nextP != NULL) (void)transaction_send(contextP, nextP);
+        return true;
     }
+
     return false;
 }
 
@@ -358,35 +739,78 @@ int transaction_send(lwm2m_context_t * contextP,
            return COAP_500_INTERNAL_SERVER_ERROR;
         }
 
-        transacP->buffer = (uint8_t*)lwm2m_malloc(transacP->buffer_len);
+#ifdef LWM2M_WITH_GATHER_SEND
+        {
+            coap_packet_t * message = (coap_packet_t *)transacP->message;
+
+            // a block returned by the reader from its storage is not copied
+            if (transacP->block1_reader != NULL
+             && message->payload_len != 0
+             && message->payload != transacP->block1_buffer)
+            {
+                transacP->payload = message->payload;
+                transacP->payload_len = message->payload_len;
+                transacP->buffer_len -= message->payload_len;
+            }
+        }
+#endif
+
+        transacP->buffer = (uint8_t*)memory_alloc(contextP, transacP->buffer_len);
         if (transacP->buffer == NULL)
         {
            transaction_remove(contextP, transacP);
            return COAP_500_INTERNAL_SERVER_ERROR;
         }
 
-        transacP->buffer_len = coap_serialize_message(transacP->message, transacP->buffer);
+        if (transacP->payload != NULL)
+        {
+            transacP->buffer_len = coap_serialize_header(transacP->message, transacP->buffer);
+        }
+        else
+        {
+            transacP->buffer_len = coap_serialize_message(transacP->message, transacP->buffer);
+        }
         if (transacP->buffer_len == 0)
         {
-            lwm2m_free(transacP->buffer);
+            memory_free(contextP, transacP->buffer);
             transacP->buffer = NULL;
             transaction_remove(contextP, transacP);
             return COAP_500_INTERNAL_SERVER_ERROR;
         }
+
+        // the message is final once serialized
+        if (0 != prv_addToIndexes(contextP, transacP))
+        {
+            transaction_remove(contextP, transacP);
+            return COAP_500_INTERNAL_SERVER_ERROR;
+        }
     }
 
     if (!transacP->ack_received)
     {
-        long unsigned timeout;
+        long unsigned timeout = 0;
 
         if (0 == transacP->retrans_counter)
         {
             time_t tv_sec = lwm2m_gettime();
             if (0 <= tv_sec)
             {
-                transacP->retrans_time = tv_sec + COAP_RESPONSE_TIMEOUT;
+                // the first timeout is drawn from the retransmission timeout of the peer
+                if (transacP->peerP == NULL)
+                {
+                    transacP->peerP = peer_acquire(contextP, transacP->peerH, tv_sec);
+                }
+                if (transacP->peerP != NULL
+                 && !peer_startExchange(transacP->peerP, transacP, tv_sec))
+                {
+                    // sent once an outstanding message to the peer completes
+                    return 0;
+                }
+                transacP->rto = peer_getRto(transacP->peerP, tv_sec);
+                transacP->timeout = peer_initialTimeout(transacP->rto);
+                transacP->first_time = tv_sec;
+                transacP->retrans_time = tv_sec + prv_toSeconds(transacP->timeout);
                 transacP->retrans_counter = 1;
-                timeout = 0;
             }
             else
             {
@@ -395,13 +819,46 @@ int transaction_send(lwm2m_context_t * contextP,
         }
         else
         {
-            timeout = COAP_RESPONSE_TIMEOUT << (transacP->retrans_counter - 1);
+            transacP->timeout = peer_nextTimeout(transacP->rto, transacP->timeout);
+            timeout = prv_toSeconds(transacP->timeout);
         }
 
-        if (COAP_MAX_RETRANSMIT + 1 >= transacP->retrans_counter)
+        if (!maxRetriesReached && COAP_MAX_RETRANSMIT + 1 >= transacP->retrans_counter)
         {
-            (void)lwm2m_buffer_send(transacP->peerH, transacP->buffer, transacP->buffer_len, contextP->userData);
+            bool queued = false;
+
+#ifdef LWM2M_WITH_SEND_QUEUE
+            // the payload is sent from the storage of the reader, see transaction_free()
+            if (transacP->payload != NULL)
+            {
+                queued = sendqueue_pushGather(contextP, transacP->peerH, transacP->buffer, transacP->buffer_len, transacP->payload, transacP->payload_len);
+            }
+            else
+            {
+                queued = sendqueue_push(contextP, transacP->peerH, transacP->buffer, transacP->buffer_len, NULL, 0);
+            }
+#endif
+            if (!queued)
+            {
+#ifdef LWM2M_WITH_GATHER_SEND
+                if (transacP->payload != NULL)
+                {
+                    (void)lwm2m_buffer_send_gather(transacP->peerH, transacP->buffer, transacP->buffer_len, transacP->payload, transacP->payload_len, contextP->userData);
+                }
+                else
+                {
+                    (void)lwm2m_buffer_send(transacP->peerH, transacP->buffer, transacP->buffer_len, contextP->userData);
+                }
+#else
+                (void)lwm2m_buffer_send(transacP->peerH, transacP->buffer, transacP->buffer_len, contextP->userData);
+#endif
+            }
 
+            if (transacP->peerP != NULL)
+            {
+                if (transacP->retrans_counter == 1) transacP->peerP->stats.transmissions++;
+                else transacP->peerP->stats.retransmissions++;
+            }
             transacP->retrans_time += timeout;
             transacP->retrans_counter += 1;
         }
@@ -413,6 +870,10 @@ int transaction_send(lwm2m_context_t * contextP,
 
     if (transacP->ack_received || maxRetriesReached)
     {
+        if (!transacP->ack_received && transacP->peerP != NULL)
+        {
+            transacP->peerP->stats.failures++;
+        }
         if (transacP->callback)
         {
             transacP->callback(transacP, NULL);
@@ -421,51 +882,11 @@ int transaction_send(lwm2m_context_t * contextP,
         return -1;
     }
 
-    return 0;
-}
-
-void transaction_step(lwm2m_context_t * contextP,
-                      time_t currentTime,
-                      time_t * timeoutP)
-{
-    lwm2m_transaction_t * transacP;
-
-    LOG("Entering");
-    transacP = contextP->transactionList;
-    while (transacP != NULL)
+    if (0 != timer_schedule(contextP, &transacP->timer, transacP->retrans_time))
     {
-        // transaction_send() may remove transaction from the linked list
-        lwm2m_transaction_t * nextP = transacP->next;
-        int removed = 0;
-
-        if (transacP->retrans_time <= currentTime)
-        {
-            removed = transaction_send(contextP, transacP);
-        }
-
-        if (0 == removed)
-        {
-            time_t interval;
-
-            if (transacP->retrans_time > currentTime)
-            {
-                interval = transacP->retrans_time - currentTime;
-            }
-            else
-            {
-                interval = 1;
-            }
-
-            if (*timeoutP > interval)
-            {
-                *timeoutP = interval;
-            }
-        }
-        else
-        {
-            *timeoutP = 1;
-        }
-
-        transacP = nextP;
+        transaction_remove(contextP, transacP);
+        return COAP_500_INTERNAL_SERVER_ERROR;
     }
+
+    return 0;
 }
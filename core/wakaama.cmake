@@ -20,7 +20,14 @@ set(WAKAAMA_SOURCES
     ${WAKAAMA_SOURCES_DIR}/tlv.c
     ${WAKAAMA_SOURCES_DIR}/data.c
     ${WAKAAMA_SOURCES_DIR}/list.c
+    ${WAKAAMA_SOURCES_DIR}/index.c
+    ${WAKAAMA_SOURCES_DIR}/timer.c
+    ${WAKAAMA_SOURCES_DIR}/memory.c
     ${WAKAAMA_SOURCES_DIR}/packet.c
+    ${WAKAAMA_SOURCES_DIR}/sendqueue.c
+    ${WAKAAMA_SOURCES_DIR}/peer.c
+    ${WAKAAMA_SOURCES_DIR}/dedup.c
+    ${WAKAAMA_SOURCES_DIR}/block2.c
     ${WAKAAMA_SOURCES_DIR}/transaction.c
     ${WAKAAMA_SOURCES_DIR}/registration.c
     ${WAKAAMA_SOURCES_DIR}/bootstrap.c
@@ -0,0 +1,215 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Measures the number of CoAP requests per second a server answers.
+ *
+ * Several sockets, standing for as many peers, keep a window of confirmable
+ * GET requests on /rd in flight. Each response received is replaced by a new
+ * request. Windows are refilled when a socket got no response for a second.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define MAX_SOCKETS 256
+
+typedef struct
+{
+    int      sock;
+    uint16_t mid;
+    time_t   lastResponse;
+} peer_t;
+
+static void print_usage(void)
+{
+    fprintf(stdout, "Usage: coapbench [OPTION]\r\n");
+    fprintf(stdout, "Send confirmable requests to a CoAP server and count the responses.\r\n\n");
+    fprintf(stdout, "Options:\r\n");
+    fprintf(stdout, "  -h HOST\tSet the hostname of the server. Default: 127.0.0.1\r\n");
+    fprintf(stdout, "  -p PORT\tSet the port of the server. Default: 5683\r\n");
+    fprintf(stdout, "  -c COUNT\tSet the number of peers. Default: 16\r\n");
+    fprintf(stdout, "  -w COUNT\tSet the number of requests in flight per peer. Default: 8\r\n");
+    fprintf(stdout, "  -t SECONDS\tSet the duration of the measure. Default: 5\r\n");
+    fprintf(stdout, "\r\n");
+}
+
+static double prv_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int prv_send_request(peer_t * peerP)
+{
+    // CON GET /rd with a two-byte token
+    uint8_t packet[] = {0x42, 0x01, 0x00, 0x00, 0x00, 0x00, 0xB2, 'r', 'd'};
+
+    peerP->mid++;
+    packet[2] = peerP->mid >> 8;
+    packet[3] = peerP->mid & 0xFF;
+    packet[4] = packet[2];
+    packet[5] = packet[3];
+
+    return (send(peerP->sock, packet, sizeof(packet), 0) == sizeof(packet)) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    const char * host = "127.0.0.1";
+    const char * port = "5683";
+    int peerCount = 16;
+    int window = 8;
+    int duration = 5;
+    struct addrinfo hints;
+    struct addrinfo * servinfo = NULL;
+    peer_t peers[MAX_SOCKETS];
+    struct pollfd fds[MAX_SOCKETS];
+    unsigned long responses;
+    double start;
+    double elapsed;
+    int opt;
+    int i;
+
+    opt = 1;
+    while (opt < argc)
+    {
+        if (argv[opt] == NULL
+            || argv[opt][0] != '-'
+            || argv[opt][2] != 0
+            || opt + 1 >= argc)
+        {
+            print_usage();
+            return 0;
+        }
+        switch (argv[opt][1])
+        {
+        case 'h':
+            host = argv[opt + 1];
+            break;
+        case 'p':
+            port = argv[opt + 1];
+            break;
+        case 'c':
+            peerCount = atoi(argv[opt + 1]);
+            break;
+        case 'w':
+            window = atoi(argv[opt + 1]);
+            break;
+        case 't':
+            duration = atoi(argv[opt + 1]);
+            break;
+        default:
+            print_usage();
+            return 0;
+        }
+        opt += 2;
+    }
+    if (peerCount <= 0 || peerCount > MAX_SOCKETS || window <= 0 || duration <= 0)
+    {
+        print_usage();
+        return 0;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (0 != getaddrinfo(host, port, &hints, &servinfo) || servinfo == NULL)
+    {
+        fprintf(stderr, "Cannot resolve %s:%s\r\n", host, port);
+        return -1;
+    }
+
+    for (i = 0 ; i < peerCount ; i++)
+    {
+        peers[i].sock = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
+        if (peers[i].sock < 0
+         || connect(peers[i].sock, servinfo->ai_addr, servinfo->ai_addrlen) != 0)
+        {
+            fprintf(stderr, "Error opening socket: %d\r\n", errno);
+            return -1;
+        }
+        peers[i].mid = (uint16_t)(i << 10);
+        fds[i].fd = peers[i].sock;
+        fds[i].events = POLLIN;
+    }
+    freeaddrinfo(servinfo);
+
+    responses = 0;
+    start = prv_now();
+    for (i = 0 ; i < peerCount ; i++)
+    {
+        int j;
+
+        peers[i].lastResponse = time(NULL);
+        for (j = 0 ; j < window ; j++) prv_send_request(peers + i);
+    }
+
+    while ((elapsed = prv_now() - start) < duration)
+    {
+        time_t now;
+
+        if (poll(fds, peerCount, 100) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "Error in poll(): %d\r\n", errno);
+            return -1;
+        }
+
+        now = time(NULL);
+        for (i = 0 ; i < peerCount ; i++)
+        {
+            if (fds[i].revents & POLLIN)
+            {
+                uint8_t buffer[1500];
+
+                while (recv(peers[i].sock, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+                {
+                    responses++;
+                    peers[i].lastResponse = now;
+                    prv_send_request(peers + i);
+                }
+            }
+            else if (now - peers[i].lastResponse > 1)
+            {
+                int j;
+
+                // the window was lost
+                peers[i].lastResponse = now;
+                for (j = 0 ; j < window ; j++) prv_send_request(peers + i);
+            }
+        }
+    }
+
+    fprintf(stdout, "%lu responses in %.2f s: %.0f responses/s\r\n", responses, elapsed, responses / elapsed);
+
+    for (i = 0 ; i < peerCount ; i++)
+    {
+        close(peers[i].sock);
+    }
+
+    return 0;
+}
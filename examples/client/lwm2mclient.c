@@ -280,7 +280,11 @@ void lwm2m_close_connection(void * sessionH,
     if (targetP == app_data->connList)
     {
         app_data->connList = targetP->next;
+#ifdef WITH_TINYDTLS
+        connection_release(targetP);
+#else
         lwm2m_free(targetP);
+#endif
     }
     else
     {
@@ -298,7 +302,11 @@ void lwm2m_close_connection(void * sessionH,
         if (parentP != NULL)
         {
             parentP->next = targetP->next;
+#ifdef WITH_TINYDTLS
+            connection_release(targetP);
+#else
             lwm2m_free(targetP);
+#endif
         }
     }
 }
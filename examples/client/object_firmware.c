@@ -57,6 +57,7 @@ typedef struct
     uint8_t state;
     bool supported;
     uint8_t result;
+    size_t received;    // bytes of the package written so far
 } firmware_data_t;
 
 
@@ -175,6 +176,42 @@ static uint8_t prv_firmware_write(uint16_t instanceId,
     return result;
 }
 
+static uint8_t prv_firmware_write_stream(uint16_t instanceId,
+                                         uint16_t resourceId,
+                                         size_t offset,
+                                         uint8_t * buffer,
+                                         size_t length,
+                                         bool more,
+                                         lwm2m_object_t * objectP)
+{
+    firmware_data_t * data = (firmware_data_t*)(objectP->userData);
+
+    // this is a single instance object
+    if (instanceId != 0)
+    {
+        return COAP_404_NOT_FOUND;
+    }
+    if (resourceId != RES_M_PACKAGE)
+    {
+        return COAP_405_METHOD_NOT_ALLOWED;
+    }
+
+    // a new package starts at offset 0
+    if (offset == 0) data->received = 0;
+    if (offset != data->received) return COAP_408_REQ_ENTITY_INCOMPLETE;
+
+    // write the block of the firmware binary to flash here, at offset
+    (void)buffer;
+    data->received += length;
+
+    if (!more)
+    {
+        fprintf(stdout, "\n\t FIRMWARE PACKAGE RECEIVED: %u bytes\r\n\n", (unsigned int)data->received);
+    }
+
+    return COAP_204_CHANGED;
+}
+
 static uint8_t prv_firmware_execute(uint16_t instanceId,
                                     uint16_t resourceId,
                                     uint8_t * buffer,
@@ -267,6 +304,8 @@ lwm2m_object_t * get_object_firmware(void)
         firmwareObj->readFunc    = prv_firmware_read;
         firmwareObj->writeFunc   = prv_firmware_write;
         firmwareObj->executeFunc = prv_firmware_execute;
+        // the package is received by blocks, it does not have to fit in memory
+        firmwareObj->writeStreamFunc = prv_firmware_write_stream;
         firmwareObj->userData    = lwm2m_malloc(sizeof(firmware_data_t));
 
         /*
@@ -277,6 +316,7 @@ lwm2m_object_t * get_object_firmware(void)
             ((firmware_data_t*)firmwareObj->userData)->state = 1;
             ((firmware_data_t*)firmwareObj->userData)->supported = false;
             ((firmware_data_t*)firmwareObj->userData)->result = 0;
+            ((firmware_data_t*)firmwareObj->userData)->received = 0;
         }
         else
         {
@@ -0,0 +1,431 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "firmwarepush.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FWPUSH_DEFAULT_LIMIT 16
+
+// a push is waiting for a slot freed by another thread, it is tried again after this many seconds
+#define FWPUSH_SLOT_POLL 1
+
+/*
+ * The images are kept by path. An image modified in place while it is pushed
+ * is sent torn: a new version should be renamed over the old one, it is then
+ * mapped once the pushes of the old one completed.
+ */
+typedef struct _fwpush_image_t
+{
+    struct _fwpush_image_t * next;
+    char *          path;
+    const uint8_t * data;
+    size_t          length;
+    int             refCount;
+} fwpush_image_t;
+
+typedef struct _fwpush_job_t
+{
+    struct _fwpush_job_t * next;
+    fwpush_t *        pushP;
+    uint16_t          clientID;
+    fwpush_image_t *  imageP;   // NULL once the push completed
+    fwpush_progress_t progress;
+    time_t            retryTime;
+} fwpush_job_t;
+
+struct _fwpush_t
+{
+    lwm2m_context_t * lwm2mH;
+    fwpush_callback_t callback;
+    void *            userData;
+    fwpush_job_t *    jobList;  // pending pushes in their order of arrival
+};
+
+// shared by all the threads
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static fwpush_image_t * g_imageList = NULL;
+static int g_limit = FWPUSH_DEFAULT_LIMIT;
+static int g_sendingCount = 0;
+
+static fwpush_image_t * prv_acquireImage(const char * path)
+{
+    fwpush_image_t * imageP;
+    struct stat st;
+    void * data;
+    int fd;
+
+    pthread_mutex_lock(&g_lock);
+    for (imageP = g_imageList ; imageP != NULL ; imageP = imageP->next)
+    {
+        if (strcmp(imageP->path, path) == 0)
+        {
+            imageP->refCount++;
+            pthread_mutex_unlock(&g_lock);
+            return imageP;
+        }
+    }
+
+    // mapped under the lock so that two threads do not map the same image
+    fd = open(path, O_RDONLY);
+    if (fd < 0) goto error;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        goto error;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) goto error;
+    // the clients read the image at different offsets, all of it is needed soon
+    (void)madvise(data, (size_t)st.st_size, MADV_WILLNEED);
+
+    imageP = (fwpush_image_t *)malloc(sizeof(fwpush_image_t));
+    if (imageP == NULL)
+    {
+        munmap(data, (size_t)st.st_size);
+        goto error;
+    }
+    imageP->path = strdup(path);
+    if (imageP->path == NULL)
+    {
+        munmap(data, (size_t)st.st_size);
+        free(imageP);
+        goto error;
+    }
+    imageP->data = (const uint8_t *)data;
+    imageP->length = (size_t)st.st_size;
+    imageP->refCount = 1;
+    imageP->next = g_imageList;
+    g_imageList = imageP;
+    pthread_mutex_unlock(&g_lock);
+
+    return imageP;
+
+error:
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+static void prv_releaseImage(fwpush_image_t * imageP)
+{
+    fwpush_image_t ** imagePP;
+
+    pthread_mutex_lock(&g_lock);
+    imageP->refCount--;
+    if (imageP->refCount == 0)
+    {
+        for (imagePP = &g_imageList ; *imagePP != imageP ; imagePP = &((*imagePP)->next));
+        *imagePP = imageP->next;
+        munmap((void *)imageP->data, imageP->length);
+        free(imageP->path);
+        free(imageP);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static bool prv_acquireSlot(void)
+{
+    bool result;
+
+    pthread_mutex_lock(&g_lock);
+    result = (g_sendingCount < g_limit);
+    if (result) g_sendingCount++;
+    pthread_mutex_unlock(&g_lock);
+
+    return result;
+}
+
+static void prv_releaseSlot(void)
+{
+    pthread_mutex_lock(&g_lock);
+    g_sendingCount--;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void prv_notify(fwpush_job_t * jobP)
+{
+    if (jobP->pushP->callback != NULL)
+    {
+        jobP->pushP->callback(jobP->clientID, &(jobP->progress), jobP->pushP->userData);
+    }
+}
+
+static void prv_complete(fwpush_job_t * jobP,
+                         fwpush_state_t state)
+{
+    jobP->progress.state = state;
+    prv_releaseImage(jobP->imageP);
+    jobP->imageP = NULL;
+    prv_notify(jobP);
+}
+
+// retries the push later on, if it may. A client error would be the same again.
+static void prv_fail(fwpush_job_t * jobP,
+                     uint8_t status)
+{
+    jobP->progress.status = status;
+    if (jobP->progress.attempts >= FWPUSH_MAX_ATTEMPTS
+     || (status >= COAP_400_BAD_REQUEST && status < COAP_500_INTERNAL_SERVER_ERROR))
+    {
+        prv_complete(jobP, FWPUSH_FAILED);
+        return;
+    }
+
+    jobP->progress.state = FWPUSH_WAITING;
+    jobP->retryTime = lwm2m_gettime() + ((time_t)FWPUSH_RETRY_DELAY << (jobP->progress.attempts - 1));
+    prv_notify(jobP);
+}
+
+// the blocks are sent from the mapping, which stays valid until the push completes
+static const uint8_t * prv_reader(size_t offset,
+                                  size_t length,
+                                  uint8_t * buffer,
+                                  void * userData)
+{
+    fwpush_job_t * jobP = (fwpush_job_t *)userData;
+    size_t step;
+
+    (void)buffer;
+
+    if (jobP->imageP == NULL || offset + length > jobP->imageP->length) return NULL;
+
+    // the client acknowledged the blocks before the one read
+    step = jobP->progress.offset * 100 / FWPUSH_PROGRESS_STEP / jobP->progress.length;
+    jobP->progress.offset = offset;
+    if (offset * 100 / FWPUSH_PROGRESS_STEP / jobP->progress.length > step) prv_notify(jobP);
+
+    return jobP->imageP->data + offset;
+}
+
+static void prv_resultCallback(uint16_t clientID,
+                               lwm2m_uri_t * uriP,
+                               int status,
+                               lwm2m_media_type_t format,
+                               uint8_t * data,
+                               int dataLength,
+                               void * userData)
+{
+    fwpush_job_t * jobP = (fwpush_job_t *)userData;
+
+    (void)clientID;
+    (void)uriP;
+    (void)format;
+    (void)data;
+    (void)dataLength;
+
+    prv_releaseSlot();
+    if (status == COAP_204_CHANGED)
+    {
+        jobP->progress.status = (uint8_t)status;
+        jobP->progress.offset = jobP->progress.length;
+        prv_complete(jobP, FWPUSH_DONE);
+    }
+    else
+    {
+        prv_fail(jobP, (uint8_t)status);
+    }
+}
+
+// returns false if no slot is free
+static bool prv_send(fwpush_job_t * jobP)
+{
+    lwm2m_uri_t uri;
+    int result;
+
+    if (!prv_acquireSlot()) return false;
+
+    memset(&uri, 0, sizeof(lwm2m_uri_t));
+    uri.flag = LWM2M_URI_FLAG_OBJECT_ID | LWM2M_URI_FLAG_INSTANCE_ID | LWM2M_URI_FLAG_RESOURCE_ID;
+    uri.objectId = LWM2M_FIRMWARE_UPDATE_OBJECT_ID;
+    uri.instanceId = 0;
+    uri.resourceId = 0;
+
+    jobP->progress.state = FWPUSH_SENDING;
+    jobP->progress.offset = 0;
+    jobP->progress.attempts++;
+    result = lwm2m_dm_write_stream(jobP->pushP->lwm2mH, jobP->clientID, &uri, LWM2M_CONTENT_OPAQUE,
+                                   jobP->imageP->length, prv_reader, jobP,
+                                   prv_resultCallback, jobP);
+    if (result != COAP_NO_ERROR)
+    {
+        prv_releaseSlot();
+        prv_fail(jobP, (uint8_t)result);
+        return true;
+    }
+    prv_notify(jobP);
+
+    return true;
+}
+
+void fwpush_set_limit(int limit)
+{
+    pthread_mutex_lock(&g_lock);
+    g_limit = limit;
+    pthread_mutex_unlock(&g_lock);
+}
+
+fwpush_t * fwpush_new(lwm2m_context_t * lwm2mH,
+                      fwpush_callback_t callback,
+                      void * userData)
+{
+    fwpush_t * pushP;
+
+    pushP = (fwpush_t *)malloc(sizeof(fwpush_t));
+    if (pushP == NULL) return NULL;
+    memset(pushP, 0, sizeof(fwpush_t));
+    pushP->lwm2mH = lwm2mH;
+    pushP->callback = callback;
+    pushP->userData = userData;
+
+    return pushP;
+}
+
+void fwpush_free(fwpush_t * pushP)
+{
+    if (pushP == NULL) return;
+
+    while (pushP->jobList != NULL)
+    {
+        fwpush_job_t * jobP = pushP->jobList;
+
+        pushP->jobList = jobP->next;
+        // the transactions were freed without calling back
+        if (jobP->progress.state == FWPUSH_SENDING) prv_releaseSlot();
+        if (jobP->imageP != NULL) prv_releaseImage(jobP->imageP);
+        free(jobP);
+    }
+    free(pushP);
+}
+
+int fwpush_start(fwpush_t * pushP,
+                 uint16_t clientID,
+                 const char * path)
+{
+    fwpush_job_t ** jobPP;
+    fwpush_job_t * jobP;
+    fwpush_image_t * imageP;
+
+    for (jobPP = &(pushP->jobList) ; *jobPP != NULL ; jobPP = &((*jobPP)->next))
+    {
+        if ((*jobPP)->clientID == clientID) break;
+    }
+    // a push completed since the last step is replaced
+    if (*jobPP != NULL)
+    {
+        if ((*jobPP)->imageP != NULL) return COAP_412_PRECONDITION_FAILED;
+        jobP = *jobPP;
+        *jobPP = jobP->next;
+        free(jobP);
+    }
+
+    imageP = prv_acquireImage(path);
+    if (imageP == NULL) return COAP_404_NOT_FOUND;
+
+    jobP = (fwpush_job_t *)malloc(sizeof(fwpush_job_t));
+    if (jobP == NULL)
+    {
+        prv_releaseImage(imageP);
+        return COAP_500_INTERNAL_SERVER_ERROR;
+    }
+    memset(jobP, 0, sizeof(fwpush_job_t));
+    jobP->pushP = pushP;
+    jobP->clientID = clientID;
+    jobP->imageP = imageP;
+    jobP->progress.state = FWPUSH_QUEUED;
+    jobP->progress.length = imageP->length;
+
+    for (jobPP = &(pushP->jobList) ; *jobPP != NULL ; jobPP = &((*jobPP)->next));
+    *jobPP = jobP;
+
+    return COAP_NO_ERROR;
+}
+
+int fwpush_get_progress(fwpush_t * pushP,
+                        uint16_t clientID,
+                        fwpush_progress_t * progressP)
+{
+    fwpush_job_t * jobP;
+
+    for (jobP = pushP->jobList ; jobP != NULL ; jobP = jobP->next)
+    {
+        if (jobP->clientID == clientID && jobP->imageP != NULL)
+        {
+            *progressP = jobP->progress;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void fwpush_list(fwpush_t * pushP,
+                 fwpush_callback_t callback,
+                 void * userData)
+{
+    fwpush_job_t * jobP;
+
+    for (jobP = pushP->jobList ; jobP != NULL ; jobP = jobP->next)
+    {
+        if (jobP->imageP != NULL) callback(jobP->clientID, &(jobP->progress), userData);
+    }
+}
+
+void fwpush_step(fwpush_t * pushP,
+                 time_t * timeoutP)
+{
+    fwpush_job_t ** jobPP;
+    bool slotFree = true;
+    time_t currentTime;
+
+    currentTime = lwm2m_gettime();
+    jobPP = &(pushP->jobList);
+    while (*jobPP != NULL)
+    {
+        fwpush_job_t * jobP = *jobPP;
+
+        // the final state was reported, only the pending pushes are walked
+        if (jobP->imageP == NULL)
+        {
+            *jobPP = jobP->next;
+            free(jobP);
+            continue;
+        }
+        jobPP = &(jobP->next);
+
+        if (jobP->progress.state == FWPUSH_WAITING)
+        {
+            if (jobP->retryTime > currentTime)
+            {
+                if (jobP->retryTime - currentTime < *timeoutP) *timeoutP = jobP->retryTime - currentTime;
+                continue;
+            }
+            jobP->progress.state = FWPUSH_QUEUED;
+        }
+        if (jobP->progress.state != FWPUSH_QUEUED) continue;
+
+        // the pushes keep their order, the next ones wait for a slot as well
+        if (slotFree) slotFree = prv_send(jobP);
+        if (!slotFree && *timeoutP > FWPUSH_SLOT_POLL) *timeoutP = FWPUSH_SLOT_POLL;
+    }
+}
@@ -0,0 +1,99 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Firmware pushes to many clients.
+ *
+ * Each image file is mapped once, read-only, and shared by all the pushes of
+ * all the threads until the last of them completes. The image is written to
+ * /5/0/0 by Block1 with lwm2m_dm_write_stream(), the blocks being handed to
+ * the core straight from the mapping.
+ *
+ * At most fwpush_set_limit() pushes are sending at once over all the
+ * threads, the others wait in their order of arrival. The blocks to a client
+ * are sent one at a time, each once the previous one was acknowledged, at the
+ * pace of the retransmission timeout of the client. A push failed for another
+ * reason than a 4.xx client error is retried after a delay doubling at each
+ * attempt.
+ *
+ * A push is forgotten once its final state was reported to the callback.
+ *
+ * A fwpush_t is used by the thread owning its lwm2m_context_t only.
+ */
+
+#ifndef FIRMWAREPUSH_H_
+#define FIRMWAREPUSH_H_
+
+#include "liblwm2m.h"
+
+#ifndef FWPUSH_MAX_ATTEMPTS
+#define FWPUSH_MAX_ATTEMPTS 3
+#endif
+
+// seconds before the first retry
+#ifndef FWPUSH_RETRY_DELAY
+#define FWPUSH_RETRY_DELAY 10
+#endif
+
+// the progress is reported each time this percentage of the image is acknowledged
+#ifndef FWPUSH_PROGRESS_STEP
+#define FWPUSH_PROGRESS_STEP 10
+#endif
+
+typedef enum
+{
+    FWPUSH_QUEUED,      // waiting for a free slot
+    FWPUSH_SENDING,
+    FWPUSH_WAITING,     // waiting to be retried
+    FWPUSH_DONE,
+    FWPUSH_FAILED
+} fwpush_state_t;
+
+typedef struct
+{
+    fwpush_state_t state;
+    size_t         offset;      // bytes of the image acknowledged by the client
+    size_t         length;      // of the image
+    int            attempts;
+    uint8_t        status;      // CoAP code of the last attempt, 0 if there was none
+} fwpush_progress_t;
+
+// called when the state of the push to clientID changes or when its progress moves on
+typedef void (*fwpush_callback_t)(uint16_t clientID, fwpush_progress_t * progressP, void * userData);
+
+typedef struct _fwpush_t fwpush_t;
+
+// sets the number of pushes sending at once over all the threads. Default: 16
+void fwpush_set_limit(int limit);
+
+// returns a new set of pushes to the clients of lwm2mH or NULL.
+fwpush_t * fwpush_new(lwm2m_context_t * lwm2mH, fwpush_callback_t callback, void * userData);
+// releases the pushes and their images. Must be called after lwm2m_close(lwm2mH).
+void fwpush_free(fwpush_t * pushP);
+
+// queues the push of the image in path to clientID.
+// returns COAP_NO_ERROR, COAP_404_NOT_FOUND if the image can not be mapped or COAP_412_PRECONDITION_FAILED if a push to clientID is pending.
+int fwpush_start(fwpush_t * pushP, uint16_t clientID, const char * path);
+// returns -1 if no push to clientID is pending.
+int fwpush_get_progress(fwpush_t * pushP, uint16_t clientID, fwpush_progress_t * progressP);
+// calls callback for each pending push.
+void fwpush_list(fwpush_t * pushP, fwpush_callback_t callback, void * userData);
+
+// starts the pushes that may, forgets the completed ones and reduces timeoutP to the next retry.
+void fwpush_step(fwpush_t * pushP, time_t * timeoutP);
+
+#endif
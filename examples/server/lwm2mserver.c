@@ -72,10 +72,74 @@
 
 #include "commandline.h"
 #include "connection.h"
+#include "firmwarepush.h"
+#ifdef WITH_EVENTLOOP
+#include <pthread.h>
+#include "eventloop.h"
+#endif
 
 #define MAX_PACKET_SIZE 1024
 
-static int g_quit = 0;
+#ifdef WITH_EVENTLOOP
+#define MAX_SHARDS 64
+#define DIRECTORY_BUCKETS 4096
+#endif
+
+// connections without registered client are released after this many seconds of silence
+#define IDLE_CONNECTION_TIMEOUT 300
+
+static volatile int g_quit = 0;
+static bool g_quiet = false;
+
+typedef struct
+{
+    lwm2m_context_t * lwm2mH;
+    connection_table_t connTable;
+    command_desc_t *  commands;
+    int               sock;
+    fwpush_t *        pushP;
+#ifdef WITH_EVENTLOOP
+    int               index;
+    eventloop_t *     loopP;
+    pthread_t         thread;
+    int               commandFd[2];
+    // endpoint names by internalID, to update the directory on deregistration
+    char **           clientNames;
+    size_t            clientNameCount;
+#endif
+} server_data_t;
+
+#ifdef WITH_EVENTLOOP
+/*
+ * With several shards, each thread owns a lwm2m_context_t and a socket bound
+ * with SO_REUSEPORT to the common port. The kernel hashes each peer to one of
+ * the sockets, hence to one shard.
+ *
+ * Client numbers shown to the user are internalID * shard count + shard index.
+ * The directory maps endpoint names to client numbers. Commands read on stdin
+ * are routed to the shard owning the client and run by its thread.
+ */
+
+typedef struct _directory_entry_t
+{
+    struct _directory_entry_t * next;
+    int                         number;
+    char *                      name;
+} directory_entry_t;
+
+static int g_shardCount = 1;
+static __thread int g_shardIndex = 0;
+static server_data_t * g_shards = NULL;
+
+static pthread_mutex_t g_directoryLock = PTHREAD_MUTEX_INITIALIZER;
+static directory_entry_t * g_directory[DIRECTORY_BUCKETS];
+
+static pthread_mutex_t g_outputLock = PTHREAD_MUTEX_INITIALIZER;
+
+#define CLIENT_NUMBER(ID)   ((ID) * g_shardCount + g_shardIndex)
+#else
+#define CLIENT_NUMBER(ID)   (ID)
+#endif
 
 static void prv_print_error(uint8_t status)
 {
@@ -107,11 +171,13 @@ static char * prv_dump_binding(lwm2m_binding_t binding)
     }
 }
 
-static void prv_dump_client(lwm2m_client_t * targetP)
+static void prv_dump_client(lwm2m_context_t * lwm2mH,
+                            lwm2m_client_t * targetP)
 {
     lwm2m_client_object_t * objectP;
+    lwm2m_peer_stats_t stats;
 
-    fprintf(stdout, "Client #%d:\r\n", targetP->internalID);
+    fprintf(stdout, "Client #%d:\r\n", CLIENT_NUMBER(targetP->internalID));
     fprintf(stdout, "\tname: \"%s\"\r\n", targetP->name);
     fprintf(stdout, "\tbinding: \"%s\"\r\n", prv_dump_binding(targetP->binding));
     if (targetP->msisdn) fprintf(stdout, "\tmsisdn: \"%s\"\r\n", targetP->msisdn);
@@ -135,6 +201,14 @@ static void prv_dump_client(lwm2m_client_t * targetP)
         }
     }
     fprintf(stdout, "\r\n");
+    if (lwm2m_peer_get_stats(lwm2mH, targetP->sessionH, &stats) == 0)
+    {
+        fprintf(stdout, "\tretransmission timeout: %u ms\r\n", stats.rto);
+        fprintf(stdout, "\trequests: %u sent, %u retransmitted, %u failed, %u in flight\r\n",
+                stats.transmissions, stats.retransmissions, stats.failures, stats.inFlight);
+        fprintf(stdout, "\tqueue: %u waiting (%u max), %u queued, %u s waited (%u s max)\r\n",
+                stats.queueDepth, stats.maxQueueDepth, stats.queued, stats.totalWaitTime, stats.maxWaitTime);
+    }
 }
 
 static void prv_output_clients(char * buffer,
@@ -147,13 +221,17 @@ static void prv_output_clients(char * buffer,
 
     if (targetP == NULL)
     {
+#ifdef WITH_EVENTLOOP
+        // the other shards may have clients
+        if (g_shardCount > 1) return;
+#endif
         fprintf(stdout, "No client.\r\n");
         return;
     }
 
     for (targetP = lwm2mH->clientList ; targetP != NULL ; targetP = targetP->next)
     {
-        prv_dump_client(targetP);
+        prv_dump_client(lwm2mH, targetP);
     }
 }
 
@@ -188,7 +266,7 @@ static void prv_result_callback(uint16_t clientID,
                                 int dataLength,
                                 void * userData)
 {
-    fprintf(stdout, "\r\nClient #%d /%d", clientID, uriP->objectId);
+    fprintf(stdout, "\r\nClient #%d /%d", CLIENT_NUMBER(clientID), uriP->objectId);
     if (LWM2M_URI_IS_SET_INSTANCE(uriP))
         fprintf(stdout, "/%d", uriP->instanceId);
     else if (LWM2M_URI_IS_SET_RESOURCE(uriP))
@@ -213,7 +291,7 @@ static void prv_notify_callback(uint16_t clientID,
                                 int dataLength,
                                 void * userData)
 {
-    fprintf(stdout, "\r\nNotify from client #%d /%d", clientID, uriP->objectId);
+    fprintf(stdout, "\r\nNotify from client #%d /%d", CLIENT_NUMBER(clientID), uriP->objectId);
     if (LWM2M_URI_IS_SET_INSTANCE(uriP))
         fprintf(stdout, "/%d", uriP->instanceId);
     else if (LWM2M_URI_IS_SET_RESOURCE(uriP))
@@ -264,6 +342,130 @@ syntax_error:
     fprintf(stdout, "Syntax error !");
 }
 
+static void prv_block_client(char * buffer,
+                             void * user_data)
+{
+    lwm2m_context_t * lwm2mH = (lwm2m_context_t *) user_data;
+    uint16_t clientId;
+    char * end = NULL;
+    int result;
+    int nb;
+    int value;
+
+    result = prv_read_id(buffer, &clientId);
+    if (result != 1) goto syntax_error;
+
+    buffer = get_next_arg(buffer, &end);
+    if (buffer[0] == 0) goto syntax_error;
+
+    nb = sscanf(buffer, "%d", &value);
+    if (nb != 1) goto syntax_error;
+    if (value < 0 || value > 1024) goto syntax_error;
+
+    if (!check_end_of_args(end)) goto syntax_error;
+
+    result = lwm2m_set_client_block_size(lwm2mH, clientId, (uint16_t)value);
+
+    if (result == 0)
+    {
+        fprintf(stdout, "OK");
+    }
+    else
+    {
+        prv_print_error(result);
+    }
+    return;
+
+syntax_error:
+    fprintf(stdout, "Syntax error !");
+}
+
+static const char * prv_push_state(fwpush_state_t state)
+{
+    switch (state)
+    {
+    case FWPUSH_QUEUED:
+        return "queued";
+    case FWPUSH_SENDING:
+        return "sending";
+    case FWPUSH_WAITING:
+        return "waiting to retry";
+    case FWPUSH_DONE:
+        return "done";
+    case FWPUSH_FAILED:
+        return "failed";
+    default:
+        return "";
+    }
+}
+
+static void prv_dump_push(uint16_t clientID,
+                          fwpush_progress_t * progressP,
+                          void * userData)
+{
+    fprintf(stdout, "Client #%d firmware: %s, %u/%u bytes (%u%%), attempt %d",
+            CLIENT_NUMBER(clientID), prv_push_state(progressP->state),
+            (unsigned int)progressP->offset, (unsigned int)progressP->length,
+            (unsigned int)(progressP->offset * 100 / progressP->length), progressP->attempts);
+    if (progressP->status != 0)
+    {
+        fprintf(stdout, ", last status ");
+        print_status(stdout, progressP->status);
+    }
+    fprintf(stdout, "\r\n");
+}
+
+static void prv_push_callback(uint16_t clientID,
+                              fwpush_progress_t * progressP,
+                              void * userData)
+{
+    fprintf(stdout, "\r\n");
+    prv_dump_push(clientID, progressP, userData);
+    fprintf(stdout, "\r\n> ");
+    fflush(stdout);
+}
+
+static void prv_push_client(char * buffer,
+                            void * user_data)
+{
+    fwpush_t * pushP = (fwpush_t *) user_data;
+    uint16_t clientId;
+    char path[MAX_PACKET_SIZE];
+    char * end = NULL;
+    int result;
+
+    result = prv_read_id(buffer, &clientId);
+    if (result != 1) goto syntax_error;
+
+    buffer = get_next_arg(buffer, &end);
+    if (buffer[0] == 0) goto syntax_error;
+    memcpy(path, buffer, end - buffer);
+    path[end - buffer] = 0;
+
+    if (!check_end_of_args(end)) goto syntax_error;
+
+    result = fwpush_start(pushP, clientId, path);
+
+    if (result == 0)
+    {
+        fprintf(stdout, "OK");
+    }
+    else
+    {
+        prv_print_error(result);
+    }
+    return;
+
+syntax_error:
+    fprintf(stdout, "Syntax error !");
+}
+
+static void prv_output_pushes(char * buffer,
+                              void * user_data)
+{
+    fwpush_list((fwpush_t *) user_data, prv_dump_push, NULL);
+}
+
 static void prv_discover_client(char * buffer,
                                 void * user_data)
 {
@@ -737,6 +939,140 @@ syntax_error:
     fprintf(stdout, "Syntax error !");
 }
 
+#ifdef WITH_EVENTLOOP
+static unsigned int prv_directory_hash(const char * name,
+                                       size_t length)
+{
+    unsigned int hash = 5381;
+    size_t i;
+
+    for (i = 0 ; i < length ; i++)
+    {
+        hash = hash * 33 + (uint8_t)name[i];
+    }
+
+    return hash % DIRECTORY_BUCKETS;
+}
+
+// returns the number of the client registered with this endpoint name or -1
+static int prv_directory_find(const char * name,
+                              size_t length)
+{
+    directory_entry_t * entryP;
+    int number = -1;
+
+    pthread_mutex_lock(&g_directoryLock);
+    for (entryP = g_directory[prv_directory_hash(name, length)] ; entryP != NULL ; entryP = entryP->next)
+    {
+        if (strlen(entryP->name) == length
+         && strncmp(entryP->name, name, length) == 0)
+        {
+            number = entryP->number;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_directoryLock);
+
+    return number;
+}
+
+static void prv_directory_register(server_data_t * dataP,
+                                   lwm2m_client_t * clientP)
+{
+    directory_entry_t ** bucketP;
+    directory_entry_t * entryP;
+
+    if (g_shardCount == 1 || clientP == NULL || clientP->name == NULL) return;
+
+    // the name is needed again on deregistration
+    if (clientP->internalID >= dataP->clientNameCount)
+    {
+        size_t count;
+        char ** namesP;
+
+        count = clientP->internalID < 8 ? 16 : 2 * (size_t)clientP->internalID;
+        namesP = (char **)realloc(dataP->clientNames, count * sizeof(char *));
+        if (namesP == NULL) return;
+        memset(namesP + dataP->clientNameCount, 0, (count - dataP->clientNameCount) * sizeof(char *));
+        dataP->clientNames = namesP;
+        dataP->clientNameCount = count;
+    }
+    free(dataP->clientNames[clientP->internalID]);
+    dataP->clientNames[clientP->internalID] = strdup(clientP->name);
+
+    pthread_mutex_lock(&g_directoryLock);
+    bucketP = g_directory + prv_directory_hash(clientP->name, strlen(clientP->name));
+    entryP = *bucketP;
+    while (entryP != NULL && strcmp(entryP->name, clientP->name) != 0)
+    {
+        entryP = entryP->next;
+    }
+    if (entryP == NULL)
+    {
+        entryP = (directory_entry_t *)malloc(sizeof(directory_entry_t));
+        if (entryP != NULL)
+        {
+            entryP->name = strdup(clientP->name);
+            entryP->next = *bucketP;
+            *bucketP = entryP;
+        }
+    }
+    // the latest registration of an endpoint wins
+    if (entryP != NULL)
+    {
+        entryP->number = CLIENT_NUMBER(clientP->internalID);
+    }
+    pthread_mutex_unlock(&g_directoryLock);
+}
+
+static void prv_directory_deregister(server_data_t * dataP,
+                                     uint16_t clientID)
+{
+    directory_entry_t ** entryP;
+    char * name;
+
+    if (clientID >= dataP->clientNameCount || dataP->clientNames[clientID] == NULL) return;
+    name = dataP->clientNames[clientID];
+    dataP->clientNames[clientID] = NULL;
+
+    pthread_mutex_lock(&g_directoryLock);
+    entryP = g_directory + prv_directory_hash(name, strlen(name));
+    while (*entryP != NULL && strcmp((*entryP)->name, name) != 0)
+    {
+        entryP = &((*entryP)->next);
+    }
+    // the endpoint may have registered again through another shard
+    if (*entryP != NULL && (*entryP)->number == CLIENT_NUMBER(clientID))
+    {
+        directory_entry_t * oldP = *entryP;
+
+        *entryP = oldP->next;
+        free(oldP->name);
+        free(oldP);
+    }
+    pthread_mutex_unlock(&g_directoryLock);
+
+    free(name);
+}
+
+static void prv_directory_clear(void)
+{
+    int i;
+
+    for (i = 0 ; i < DIRECTORY_BUCKETS ; i++)
+    {
+        while (g_directory[i] != NULL)
+        {
+            directory_entry_t * entryP = g_directory[i];
+
+            g_directory[i] = entryP->next;
+            free(entryP->name);
+            free(entryP);
+        }
+    }
+}
+#endif
+
 static void prv_monitor_callback(uint16_t clientID,
                                  lwm2m_uri_t * uriP,
                                  int status,
@@ -745,29 +1081,35 @@ static void prv_monitor_callback(uint16_t clientID,
                                  int dataLength,
                                  void * userData)
 {
-    lwm2m_context_t * lwm2mH = (lwm2m_context_t *) userData;
+    server_data_t * dataP = (server_data_t *) userData;
     lwm2m_client_t * targetP;
 
     switch (status)
     {
     case COAP_201_CREATED:
-        fprintf(stdout, "\r\nNew client #%d registered.\r\n", clientID);
+        fprintf(stdout, "\r\nNew client #%d registered.\r\n", CLIENT_NUMBER(clientID));
 
-        targetP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)lwm2mH->clientList, clientID);
+        targetP = lwm2m_get_client(dataP->lwm2mH, clientID);
+#ifdef WITH_EVENTLOOP
+        prv_directory_register(dataP, targetP);
+#endif
 
-        prv_dump_client(targetP);
+        prv_dump_client(dataP->lwm2mH, targetP);
         break;
 
     case COAP_202_DELETED:
-        fprintf(stdout, "\r\nClient #%d unregistered.\r\n", clientID);
+        fprintf(stdout, "\r\nClient #%d unregistered.\r\n", CLIENT_NUMBER(clientID));
+#ifdef WITH_EVENTLOOP
+        prv_directory_deregister(dataP, clientID);
+#endif
         break;
 
     case COAP_204_CHANGED:
-        fprintf(stdout, "\r\nClient #%d updated.\r\n", clientID);
+        fprintf(stdout, "\r\nClient #%d updated.\r\n", CLIENT_NUMBER(clientID));
 
-        targetP = (lwm2m_client_t *)lwm2m_list_find((lwm2m_list_t *)lwm2mH->clientList, clientID);
+        targetP = lwm2m_get_client(dataP->lwm2mH, clientID);
 
-        prv_dump_client(targetP);
+        prv_dump_client(dataP->lwm2mH, targetP);
         break;
 
     default:
@@ -791,6 +1133,469 @@ void handle_sigint(int signum)
     g_quit = 2;
 }
 
+static bool prv_connection_in_use(connection_t * connP,
+                                  void * userData)
+{
+    lwm2m_context_t * lwm2mH = (lwm2m_context_t *)userData;
+    lwm2m_client_t * clientP;
+
+    for (clientP = lwm2mH->clientList ; clientP != NULL ; clientP = clientP->next)
+    {
+        if (clientP->sessionH == connP) return true;
+    }
+
+    return false;
+}
+
+static void prv_handle_datagram(int sock,
+                                uint8_t * buffer,
+                                size_t length,
+                                struct sockaddr_storage * addr,
+                                socklen_t addrLen,
+                                void * userData)
+{
+    server_data_t * dataP = (server_data_t *)userData;
+    connection_t * connP;
+
+    if (g_quiet == false)
+    {
+        char s[INET6_ADDRSTRLEN];
+        in_port_t port;
+
+        s[0] = 0;
+        if (AF_INET == addr->ss_family)
+        {
+            struct sockaddr_in *saddr = (struct sockaddr_in *)addr;
+            inet_ntop(saddr->sin_family, &saddr->sin_addr, s, INET6_ADDRSTRLEN);
+            port = saddr->sin_port;
+        }
+        else if (AF_INET6 == addr->ss_family)
+        {
+            struct sockaddr_in6 *saddr = (struct sockaddr_in6 *)addr;
+            inet_ntop(saddr->sin6_family, &saddr->sin6_addr, s, INET6_ADDRSTRLEN);
+            port = saddr->sin6_port;
+        }
+
+        fprintf(stderr, "%d bytes received from [%s]:%hu\r\n", (int)length, s, ntohs(port));
+        output_buffer(stderr, buffer, length, 0);
+    }
+
+    connP = connection_table_find(&(dataP->connTable), addr, addrLen);
+    if (connP == NULL)
+    {
+        connP = connection_table_new_incoming(&(dataP->connTable), sock, (struct sockaddr *)addr, addrLen);
+    }
+    if (connP != NULL)
+    {
+        lwm2m_handle_packet(dataP->lwm2mH, buffer, length, connP);
+    }
+}
+
+static void prv_handle_stdin(int fd,
+                             void * userData)
+{
+    server_data_t * dataP = (server_data_t *)userData;
+    uint8_t buffer[MAX_PACKET_SIZE];
+    int numBytes;
+
+    numBytes = read(fd, buffer, MAX_PACKET_SIZE - 1);
+
+    if (numBytes > 1)
+    {
+        buffer[numBytes] = 0;
+        handle_command(dataP->commands, (char*)buffer);
+        fprintf(stdout, "\r\n");
+    }
+    if (g_quit == 0)
+    {
+        fprintf(stdout, "> ");
+        fflush(stdout);
+    }
+    else
+    {
+        fprintf(stdout, "\r\n");
+    }
+}
+
+#ifdef WITH_EVENTLOOP
+static void prv_post_command(server_data_t * shardP,
+                             const char * command)
+{
+    // the socket pair keeps the commands apart
+    if (send(shardP->commandFd[0], command, strlen(command) + 1, 0) < 0)
+    {
+        fprintf(stderr, "Failed to forward the command: %d\r\n", errno);
+    }
+}
+
+// runs on the main thread for the commands taking a client
+static void prv_route_client_command(char * buffer,
+                                     void * user_data)
+{
+    char * name = (char *)user_data;
+    char command[MAX_PACKET_SIZE];
+    char * end;
+    char * numberEnd;
+    long number;
+
+    end = get_end_of_arg(buffer);
+    if (end == buffer)
+    {
+        fprintf(stdout, "Syntax error !");
+        return;
+    }
+
+    // a client number or an endpoint name
+    number = strtol(buffer, &numberEnd, 10);
+    if (numberEnd != end)
+    {
+        number = prv_directory_find(buffer, end - buffer);
+    }
+    if (number < 0 || number > LWM2M_MAX_ID * g_shardCount)
+    {
+        fprintf(stdout, "Unknown client.");
+        return;
+    }
+
+    snprintf(command, sizeof(command), "%s %ld%s", name, number / g_shardCount, end);
+    prv_post_command(g_shards + number % g_shardCount, command);
+}
+
+// runs on the main thread for the commands concerning all the clients
+static void prv_route_shards_command(char * buffer,
+                                     void * user_data)
+{
+    char * name = (char *)user_data;
+    char command[MAX_PACKET_SIZE];
+    int i;
+
+    snprintf(command, sizeof(command), "%s %s", name, buffer);
+    for (i = 0 ; i < g_shardCount ; i++)
+    {
+        prv_post_command(g_shards + i, command);
+    }
+}
+
+// runs on the shard thread
+static void prv_handle_shard_command(int fd,
+                                     void * userData)
+{
+    server_data_t * dataP = (server_data_t *)userData;
+    char buffer[MAX_PACKET_SIZE];
+    ssize_t numBytes;
+
+    numBytes = recv(fd, buffer, sizeof(buffer) - 1, 0);
+    if (numBytes <= 1 || g_quit != 0) return;
+    buffer[numBytes] = 0;
+
+    // keeps the output of a command in one piece
+    pthread_mutex_lock(&g_outputLock);
+    handle_command(dataP->commands, buffer);
+    fprintf(stdout, "\r\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&g_outputLock);
+}
+
+static int prv_run_loop(server_data_t * dataP)
+{
+    while (0 == g_quit)
+    {
+        time_t timeout = 60;
+        int result;
+
+        fwpush_step(dataP->pushP, &timeout);
+        result = lwm2m_step(dataP->lwm2mH, &timeout);
+        if (result != 0)
+        {
+            fprintf(stderr, "lwm2m_step() failed: 0x%X\r\n", result);
+            return -1;
+        }
+
+        connection_table_expire(&(dataP->connTable), IDLE_CONNECTION_TIMEOUT, prv_connection_in_use, dataP->lwm2mH);
+
+        if (eventloop_wait(dataP->loopP, timeout) < 0)
+        {
+            fprintf(stderr, "Error in epoll_wait(): %d\r\n", errno);
+        }
+    }
+
+    return 0;
+}
+
+static void * prv_shard_thread(void * arg)
+{
+    server_data_t * dataP = (server_data_t *)arg;
+
+    g_shardIndex = dataP->index;
+    if (prv_run_loop(dataP) != 0)
+    {
+        g_quit = 1;
+    }
+
+    return NULL;
+}
+
+static int prv_run_shards(command_desc_t * commands)
+{
+    server_data_t router;
+    command_desc_t * routeCommands;
+    sigset_t sigint;
+    int count;
+    int i;
+
+    // the main thread reads stdin and routes the commands to the shards
+    for (count = 0 ; commands[count].name != NULL ; count++);
+    routeCommands = (command_desc_t *)malloc((count + 1) * sizeof(command_desc_t));
+    if (routeCommands == NULL) return -1;
+    memcpy(routeCommands, commands, (count + 1) * sizeof(command_desc_t));
+    for (i = 0 ; i < count ; i++)
+    {
+        if (strcmp(routeCommands[i].name, "q") == 0) continue;
+
+        if (strcmp(routeCommands[i].name, "list") == 0
+         || strcmp(routeCommands[i].name, "pushes") == 0)
+        {
+            routeCommands[i].callback = prv_route_shards_command;
+        }
+        else
+        {
+            routeCommands[i].callback = prv_route_client_command;
+        }
+        routeCommands[i].userData = routeCommands[i].name;
+    }
+
+    memset(&router, 0, sizeof(router));
+    router.commands = routeCommands;
+    router.loopP = eventloop_new();
+    if (router.loopP == NULL
+     || eventloop_add_fd(router.loopP, STDIN_FILENO, prv_handle_stdin, &router) != 0)
+    {
+        fprintf(stderr, "Failed to create the event loop: %d\r\n", errno);
+        free(routeCommands);
+        return -1;
+    }
+
+    // SIGINT is handled by the main thread only
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint, NULL);
+    for (i = 0 ; i < g_shardCount ; i++)
+    {
+        if (pthread_create(&(g_shards[i].thread), NULL, prv_shard_thread, g_shards + i) != 0)
+        {
+            fprintf(stderr, "Failed to start shard %d\r\n", i);
+            g_quit = 1;
+            break;
+        }
+    }
+    count = i;
+    pthread_sigmask(SIG_UNBLOCK, &sigint, NULL);
+
+    while (0 == g_quit)
+    {
+        if (eventloop_wait(router.loopP, 1) < 0)
+        {
+            fprintf(stderr, "Error in epoll_wait(): %d\r\n", errno);
+        }
+    }
+
+    // wake the shards up so that they notice g_quit
+    for (i = 0 ; i < count ; i++)
+    {
+        prv_post_command(g_shards + i, "");
+        pthread_join(g_shards[i].thread, NULL);
+    }
+
+    eventloop_free(router.loopP);
+    free(routeCommands);
+
+    return 0;
+}
+#endif
+
+static int prv_run_select(server_data_t * dataP)
+{
+    fd_set readfds;
+    struct timeval tv;
+    int result;
+
+    while (0 == g_quit)
+    {
+        tv.tv_sec = 60;
+        tv.tv_usec = 0;
+
+        fwpush_step(dataP->pushP, &(tv.tv_sec));
+        result = lwm2m_step(dataP->lwm2mH, &(tv.tv_sec));
+        if (result != 0)
+        {
+            fprintf(stderr, "lwm2m_step() failed: 0x%X\r\n", result);
+            return -1;
+        }
+
+        connection_table_expire(&(dataP->connTable), IDLE_CONNECTION_TIMEOUT, prv_connection_in_use, dataP->lwm2mH);
+
+        FD_ZERO(&readfds);
+        FD_SET(dataP->sock, &readfds);
+        FD_SET(STDIN_FILENO, &readfds);
+
+        result = select(FD_SETSIZE, &readfds, 0, 0, &tv);
+
+        if ( result < 0 )
+        {
+            if (errno != EINTR)
+            {
+              fprintf(stderr, "Error in select(): %d\r\n", errno);
+            }
+        }
+        else if (result > 0)
+        {
+            if (FD_ISSET(dataP->sock, &readfds))
+            {
+                uint8_t buffer[MAX_PACKET_SIZE];
+                int numBytes;
+                struct sockaddr_storage addr;
+                socklen_t addrLen;
+
+                addrLen = sizeof(addr);
+                numBytes = recvfrom(dataP->sock, buffer, MAX_PACKET_SIZE, 0, (struct sockaddr *)&addr, &addrLen);
+
+                if (numBytes == -1)
+                {
+                    fprintf(stderr, "Error in recvfrom(): %d\r\n", errno);
+                }
+                else
+                {
+                    prv_handle_datagram(dataP->sock, buffer, numBytes, &addr, addrLen, dataP);
+                }
+            }
+            else if (FD_ISSET(STDIN_FILENO, &readfds))
+            {
+                prv_handle_stdin(STDIN_FILENO, dataP);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int prv_init_shard(server_data_t * dataP,
+                          int index,
+                          const char * localPort,
+                          int addressFamily,
+                          command_desc_t * commands,
+                          bool useEventLoop)
+{
+    int count;
+    int i;
+
+    memset(dataP, 0, sizeof(server_data_t));
+    dataP->sock = -1;
+
+#ifdef WITH_EVENTLOOP
+    dataP->index = index;
+    dataP->commandFd[0] = -1;
+    dataP->commandFd[1] = -1;
+    if (g_shardCount > 1)
+    {
+        dataP->sock = create_socket_shared(localPort, addressFamily);
+    }
+    else
+#endif
+    {
+        dataP->sock = create_socket(localPort, addressFamily);
+    }
+    if (dataP->sock < 0)
+    {
+        fprintf(stderr, "Error opening socket: %d\r\n", errno);
+        return -1;
+    }
+
+    dataP->lwm2mH = lwm2m_init(NULL);
+    if (NULL == dataP->lwm2mH)
+    {
+        fprintf(stderr, "lwm2m_init() failed\r\n");
+        return -1;
+    }
+    lwm2m_set_monitoring_callback(dataP->lwm2mH, prv_monitor_callback, dataP);
+    connection_table_init(&(dataP->connTable));
+
+    dataP->pushP = fwpush_new(dataP->lwm2mH, prv_push_callback, NULL);
+    if (NULL == dataP->pushP)
+    {
+        fprintf(stderr, "fwpush_new() failed\r\n");
+        return -1;
+    }
+
+    // each shard runs the commands on its own context
+    for (count = 0 ; commands[count].name != NULL ; count++);
+    dataP->commands = (command_desc_t *)malloc((count + 1) * sizeof(command_desc_t));
+    if (dataP->commands == NULL) return -1;
+    memcpy(dataP->commands, commands, (count + 1) * sizeof(command_desc_t));
+    for (i = 0 ; i < count ; i++)
+    {
+        if (commands[i].callback == prv_push_client
+         || commands[i].callback == prv_output_pushes)
+        {
+            dataP->commands[i].userData = (void *)dataP->pushP;
+        }
+        else
+        {
+            dataP->commands[i].userData = (void *)dataP->lwm2mH;
+        }
+    }
+
+#ifdef WITH_EVENTLOOP
+    if (useEventLoop)
+    {
+        dataP->loopP = eventloop_new();
+        if (dataP->loopP == NULL
+         || eventloop_add_socket(dataP->loopP, dataP->sock, prv_handle_datagram, dataP) != 0)
+        {
+            fprintf(stderr, "Failed to create the event loop: %d\r\n", errno);
+            return -1;
+        }
+        if (g_shardCount > 1)
+        {
+            if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, dataP->commandFd) != 0
+             || eventloop_add_fd(dataP->loopP, dataP->commandFd[1], prv_handle_shard_command, dataP) != 0)
+            {
+                fprintf(stderr, "Failed to create the command channel: %d\r\n", errno);
+                return -1;
+            }
+        }
+        else if (eventloop_add_fd(dataP->loopP, STDIN_FILENO, prv_handle_stdin, dataP) != 0)
+        {
+            fprintf(stderr, "Failed to create the event loop: %d\r\n", errno);
+            return -1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+static void prv_close_shard(server_data_t * dataP)
+{
+#ifdef WITH_EVENTLOOP
+    size_t i;
+
+    eventloop_free(dataP->loopP);
+    if (dataP->commandFd[0] >= 0) close(dataP->commandFd[0]);
+    if (dataP->commandFd[1] >= 0) close(dataP->commandFd[1]);
+    for (i = 0 ; i < dataP->clientNameCount ; i++)
+    {
+        free(dataP->clientNames[i]);
+    }
+    free(dataP->clientNames);
+#endif
+    if (dataP->lwm2mH != NULL) lwm2m_close(dataP->lwm2mH);
+    // the transactions reading the images are gone
+    fwpush_free(dataP->pushP);
+    if (dataP->sock >= 0) close(dataP->sock);
+    connection_table_free(&(dataP->connTable));
+    free(dataP->commands);
+}
+
 void print_usage(void)
 {
     fprintf(stderr, "Usage: lwm2mserver [OPTION]\r\n");
@@ -798,22 +1603,28 @@ void print_usage(void)
     fprintf(stdout, "Options:\r\n");
     fprintf(stdout, "  -4\t\tUse IPv4 connection. Default: IPv6 connection\r\n");
     fprintf(stdout, "  -l PORT\tSet the local UDP port of the Server. Default: "LWM2M_STANDARD_PORT_STR"\r\n");
+    fprintf(stdout, "  -q\t\tDo not dump the received datagrams\r\n");
+    fprintf(stdout, "  -f COUNT\tPush firmware to at most COUNT clients at once. Default: 16\r\n");
+#ifdef WITH_EVENTLOOP
+    fprintf(stdout, "  -S\t\tUse a select() loop reading one datagram at a time. Default: epoll loop reading datagrams by batches\r\n");
+    fprintf(stdout, "  -t COUNT\tRun COUNT threads, each with its own socket and LWM2M context. Default: 1\r\n");
+#endif
     fprintf(stdout, "\r\n");
 }
 
 
 int main(int argc, char *argv[])
 {
-    int sock;
-    fd_set readfds;
-    struct timeval tv;
     int result;
-    lwm2m_context_t * lwm2mH = NULL;
     int i;
-    connection_t * connList = NULL;
+    server_data_t * shards;
+    int shardCount = 1;
     int addressFamily = AF_INET6;
     int opt;
     const char * localPort = LWM2M_STANDARD_PORT_STR;
+#ifdef WITH_EVENTLOOP
+    bool useSelect = false;
+#endif
 
     command_desc_t commands[] =
     {
@@ -822,6 +1633,10 @@ int main(int argc, char *argv[])
                                             "   CLIENT#: client number as returned by command 'list'\r\n"
                                             "   URI: uri to read such as /3, /3/0/2, /1024/11, /1024/0/1\r\n"
                                             "Result will be displayed asynchronously.", prv_read_client, NULL},
+            {"block", "Set the block size of the reads from a client.", " block CLIENT# SIZE\r\n"
+                                            "   CLIENT#: client number as returned by command 'list'\r\n"
+                                            "   SIZE: 16, 32, 64, 128, 256, 512 or 1024, 0 to let the client choose\r\n"
+                                            "Responses sent by blocks are reassembled before being displayed.", prv_block_client, NULL},
             {"disc", "Discover resources of a client.", " disc CLIENT# URI\r\n"
                                             "   CLIENT#: client number as returned by command 'list'\r\n"
                                             "   URI: uri to discover such as /3, /3/0/2, /1024/11, /1024/0/1\r\n"
@@ -870,6 +1685,12 @@ int main(int argc, char *argv[])
                                             "   URI: uri on which to cancel an observe such as /3, /3/0/2, /1024/11\r\n"
                                             "Result will be displayed asynchronously.", prv_cancel_client, NULL},
 
+            {"push", "Push a firmware image to a client.", " push CLIENT# FILE\r\n"
+                                            "   CLIENT#: client number as returned by command 'list'\r\n"
+                                            "   FILE: image written to /5/0/0 by blocks\r\n"
+                                            "Progress will be displayed asynchronously.", prv_push_client, NULL},
+            {"pushes", "List the pending firmware pushes.", NULL, prv_output_pushes, NULL},
+
             {"q", "Quit the server.", NULL, prv_quit, NULL},
 
             COMMAND_END_LIST
@@ -899,6 +1720,37 @@ int main(int argc, char *argv[])
             }
             localPort = argv[opt];
             break;
+        case 'q':
+            g_quiet = true;
+            break;
+        case 'f':
+            opt++;
+            if (opt >= argc || atoi(argv[opt]) < 1)
+            {
+                print_usage();
+                return 0;
+            }
+            fwpush_set_limit(atoi(argv[opt]));
+            break;
+#ifdef WITH_EVENTLOOP
+        case 'S':
+            useSelect = true;
+            break;
+        case 't':
+            opt++;
+            if (opt >= argc)
+            {
+                print_usage();
+                return 0;
+            }
+            shardCount = atoi(argv[opt]);
+            if (shardCount < 1 || shardCount > MAX_SHARDS)
+            {
+                print_usage();
+                return 0;
+            }
+            break;
+#endif
         default:
             print_usage();
             return 0;
@@ -906,136 +1758,60 @@ int main(int argc, char *argv[])
         opt += 1;
     }
 
-    sock = create_socket(localPort, addressFamily);
-    if (sock < 0)
+#ifdef WITH_EVENTLOOP
+    if (shardCount > 1 && useSelect)
     {
-        fprintf(stderr, "Error opening socket: %d\r\n", errno);
-        return -1;
+        print_usage();
+        return 0;
     }
+    g_shardCount = shardCount;
+#endif
 
-    lwm2mH = lwm2m_init(NULL);
-    if (NULL == lwm2mH)
+    shards = (server_data_t *)calloc(shardCount, sizeof(server_data_t));
+    if (shards == NULL)
     {
-        fprintf(stderr, "lwm2m_init() failed\r\n");
+        fprintf(stderr, "Out of memory\r\n");
         return -1;
     }
+    for (i = 0 ; i < shardCount ; i++)
+    {
+#ifdef WITH_EVENTLOOP
+        result = prv_init_shard(shards + i, i, localPort, addressFamily, commands, !useSelect);
+#else
+        result = prv_init_shard(shards + i, i, localPort, addressFamily, commands, false);
+#endif
+        if (result != 0) return -1;
+    }
 
     signal(SIGINT, handle_sigint);
 
-    for (i = 0 ; commands[i].name != NULL ; i++)
-    {
-        commands[i].userData = (void *)lwm2mH;
-    }
     fprintf(stdout, "> "); fflush(stdout);
 
-    lwm2m_set_monitoring_callback(lwm2mH, prv_monitor_callback, lwm2mH);
-
-    while (0 == g_quit)
+#ifdef WITH_EVENTLOOP
+    g_shards = shards;
+    if (shardCount > 1)
     {
-        FD_ZERO(&readfds);
-        FD_SET(sock, &readfds);
-        FD_SET(STDIN_FILENO, &readfds);
-
-        tv.tv_sec = 60;
-        tv.tv_usec = 0;
-
-        result = lwm2m_step(lwm2mH, &(tv.tv_sec));
-        if (result != 0)
-        {
-            fprintf(stderr, "lwm2m_step() failed: 0x%X\r\n", result);
-            return -1;
-        }
-
-        result = select(FD_SETSIZE, &readfds, 0, 0, &tv);
-
-        if ( result < 0 )
-        {
-            if (errno != EINTR)
-            {
-              fprintf(stderr, "Error in select(): %d\r\n", errno);
-            }
-        }
-        else if (result > 0)
-        {
-            uint8_t buffer[MAX_PACKET_SIZE];
-            int numBytes;
-
-            if (FD_ISSET(sock, &readfds))
-            {
-                struct sockaddr_storage addr;
-                socklen_t addrLen;
-
-                addrLen = sizeof(addr);
-                numBytes = recvfrom(sock, buffer, MAX_PACKET_SIZE, 0, (struct sockaddr *)&addr, &addrLen);
-
-                if (numBytes == -1)
-                {
-                    fprintf(stderr, "Error in recvfrom(): %d\r\n", errno);
-                }
-                else
-                {
-                    char s[INET6_ADDRSTRLEN];
-                    in_port_t port;
-                    connection_t * connP;
-
-					s[0] = 0;
-                    if (AF_INET == addr.ss_family)
-                    {
-                        struct sockaddr_in *saddr = (struct sockaddr_in *)&addr;
-                        inet_ntop(saddr->sin_family, &saddr->sin_addr, s, INET6_ADDRSTRLEN);
-                        port = saddr->sin_port;
-                    }
-                    else if (AF_INET6 == addr.ss_family)
-                    {
-                        struct sockaddr_in6 *saddr = (struct sockaddr_in6 *)&addr;
-                        inet_ntop(saddr->sin6_family, &saddr->sin6_addr, s, INET6_ADDRSTRLEN);
-                        port = saddr->sin6_port;
-                    }
-
-                    fprintf(stderr, "%d bytes received from [%s]:%hu\r\n", numBytes, s, ntohs(port));
-                    output_buffer(stderr, buffer, numBytes, 0);
-
-                    connP = connection_find(connList, &addr, addrLen);
-                    if (connP == NULL)
-                    {
-                        connP = connection_new_incoming(connList, sock, (struct sockaddr *)&addr, addrLen);
-                        if (connP != NULL)
-                        {
-                            connList = connP;
-                        }
-                    }
-                    if (connP != NULL)
-                    {
-                        lwm2m_handle_packet(lwm2mH, buffer, numBytes, connP);
-                    }
-                }
-            }
-            else if (FD_ISSET(STDIN_FILENO, &readfds))
-            {
-                numBytes = read(STDIN_FILENO, buffer, MAX_PACKET_SIZE - 1);
-
-                if (numBytes > 1)
-                {
-                    buffer[numBytes] = 0;
-                    handle_command(commands, (char*)buffer);
-                    fprintf(stdout, "\r\n");
-                }
-                if (g_quit == 0)
-                {
-                    fprintf(stdout, "> ");
-                    fflush(stdout);
-                }
-                else
-                {
-                    fprintf(stdout, "\r\n");
-                }
-            }
-        }
+        result = prv_run_shards(commands);
+    }
+    else if (useSelect == false)
+    {
+        result = prv_run_loop(shards);
+    }
+    else
+#endif
+    {
+        result = prv_run_select(shards);
     }
 
-    lwm2m_close(lwm2mH);
-    close(sock);
-    connection_free(connList);
+    for (i = 0 ; i < shardCount ; i++)
+    {
+        prv_close_shard(shards + i);
+    }
+    free(shards);
+#ifdef WITH_EVENTLOOP
+    prv_directory_clear();
+#endif
+    if (result != 0) return -1;
 
 #ifdef MEMORY_TRACE
     if (g_quit == 1)
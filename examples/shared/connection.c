@@ -16,15 +16,26 @@
  *    
  *******************************************************************************/
 
+#ifdef WITH_EVENTLOOP
+// sendmmsg()
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/uio.h>
 #include "connection.h"
+#ifdef WITH_EVENTLOOP
+#include "eventloop.h"
+#endif
 
 // from commandline.c
 void output_buffer(FILE * stream, uint8_t * buffer, int length, int indent);
 
-int create_socket(const char * portStr, int addressFamily)
+static int prv_create_socket(const char * portStr,
+                             int addressFamily,
+                             bool reusePort)
 {
     int s = -1;
     struct addrinfo hints;
@@ -46,6 +57,17 @@ int create_socket(const char * portStr, int addressFamily)
         s = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
         if (s >= 0)
         {
+#ifdef SO_REUSEPORT
+            int on = 1;
+
+            if (reusePort
+             && -1 == setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)))
+            {
+                close(s);
+                s = -1;
+            }
+            else
+#endif
             if (-1 == bind(s, p->ai_addr, p->ai_addrlen))
             {
                 close(s);
@@ -59,6 +81,20 @@ int create_socket(const char * portStr, int addressFamily)
     return s;
 }
 
+int create_socket(const char * portStr, int addressFamily)
+{
+    return prv_create_socket(portStr, addressFamily, false);
+}
+
+int create_socket_shared(const char * portStr, int addressFamily)
+{
+#ifdef SO_REUSEPORT
+    return prv_create_socket(portStr, addressFamily, true);
+#else
+    return -1;
+#endif
+}
+
 connection_t * connection_find(connection_t * connList,
                                struct sockaddr_storage * addr,
                                size_t addrLen)
@@ -159,6 +195,91 @@ void connection_free(connection_t * connList)
     }
 }
 
+typedef struct
+{
+    connection_in_use_callback_t inUse;
+    void *                       userData;
+} expire_data_t;
+
+static bool prv_expire_callback(peertable_node_t * nodeP,
+                                void * userData)
+{
+    expire_data_t * dataP = (expire_data_t *)userData;
+    connection_t * connP = PEERTABLE_ENTRY(nodeP, connection_t, node);
+
+    if (dataP->inUse != NULL && dataP->inUse(connP, dataP->userData)) return false;
+
+    free(connP);
+    return true;
+}
+
+void connection_table_init(connection_table_t * tableP)
+{
+    peertable_init(tableP);
+}
+
+connection_t * connection_table_find(connection_table_t * tableP,
+                                     struct sockaddr_storage * addr,
+                                     size_t addrLen)
+{
+    peertable_node_t * nodeP;
+
+    nodeP = peertable_find(tableP, (struct sockaddr *)addr, addrLen);
+    if (nodeP == NULL) return NULL;
+
+    peertable_touch(tableP, nodeP, lwm2m_gettime());
+
+    return PEERTABLE_ENTRY(nodeP, connection_t, node);
+}
+
+connection_t * connection_table_new_incoming(connection_table_t * tableP,
+                                             int sock,
+                                             struct sockaddr * addr,
+                                             size_t addrLen)
+{
+    connection_t * connP;
+
+    connP = connection_new_incoming(NULL, sock, addr, addrLen);
+    if (connP == NULL) return NULL;
+
+    if (peertable_add(tableP, &(connP->node), addr, addrLen, lwm2m_gettime()) != 0)
+    {
+        free(connP);
+        return NULL;
+    }
+
+    return connP;
+}
+
+void connection_table_remove(connection_table_t * tableP,
+                             connection_t * connP)
+{
+    peertable_remove(tableP, &(connP->node));
+    free(connP);
+}
+
+int connection_table_expire(connection_table_t * tableP,
+                            time_t timeout,
+                            connection_in_use_callback_t inUse,
+                            void * userData)
+{
+    expire_data_t data;
+
+    data.inUse = inUse;
+    data.userData = userData;
+
+    return peertable_expire(tableP, lwm2m_gettime(), timeout, prv_expire_callback, &data);
+}
+
+void connection_table_free(connection_table_t * tableP)
+{
+    while (tableP->idleHead != NULL)
+    {
+        connection_table_remove(tableP, PEERTABLE_ENTRY(tableP->idleHead, connection_t, node));
+    }
+    peertable_clear(tableP);
+}
+
 int connection_send(connection_t *connP,
                     uint8_t * buffer,
                     size_t length)
@@ -190,6 +311,18 @@ int connection_send(connection_t *connP,
     output_buffer(stderr, buffer, length, 0);
 #endif
 
+#ifdef WITH_EVENTLOOP
+    {
+        struct iovec iov;
+        int queued;
+
+        iov.iov_base = buffer;
+        iov.iov_len = length;
+        queued = eventloop_send(connP->sock, (struct sockaddr *)&(connP->addr), connP->addrLen, &iov, 1);
+        if (queued != 0) return (queued < 0) ? -1 : 0;
+    }
+#endif
+
     offset = 0;
     while (offset != length)
     {
@@ -200,6 +333,140 @@ int connection_send(connection_t *connP,
     return 0;
 }
 
+int connection_send_gather(connection_t *connP,
+                           uint8_t * header,
+                           size_t headerLength,
+                           uint8_t * payload,
+                           size_t payloadLength)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+
+#ifdef WITH_LOGS
+    fprintf(stderr, "Sending %d + %d bytes\r\n", headerLength, payloadLength);
+
+    output_buffer(stderr, header, headerLength, 0);
+    if (payloadLength > 0) output_buffer(stderr, payload, payloadLength, 0);
+#endif
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = headerLength;
+    iov[1].iov_base = payload;
+    iov[1].iov_len = payloadLength;
+
+#ifdef WITH_EVENTLOOP
+    if (payloadLength > 0)
+    {
+        // the payload is not copied to the queue of the event loop, what it holds goes first
+        eventloop_flush();
+    }
+    else
+    {
+        int queued;
+
+        queued = eventloop_send(connP->sock, (struct sockaddr *)&(connP->addr), connP->addrLen, iov, 1);
+        if (queued != 0) return (queued < 0) ? -1 : 0;
+    }
+#endif
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &(connP->addr);
+    msg.msg_namelen = connP->addrLen;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (payloadLength > 0) ? 2 : 1;
+
+    // a datagram is sent in one piece
+    if (sendmsg(connP->sock, &msg, 0) != (ssize_t)(headerLength + payloadLength)) return -1;
+
+    return 0;
+}
+
+int connection_send_batch(connection_t ** connArray,
+                          uint8_t ** bufferArray,
+                          size_t * lengthArray,
+                          uint8_t ** payloadArray,
+                          size_t * payloadLengthArray,
+                          size_t count)
+{
+    int result = 0;
+    size_t i;
+
+#ifdef WITH_EVENTLOOP
+    bool direct = true;
+
+    // in a batch of the event loop, the datagrams are copied to its queue unless a payload must not be
+    if (eventloop_is_batching())
+    {
+        direct = false;
+        for (i = 0 ; i < count && !direct ; i++)
+        {
+            if (payloadArray[i] != NULL) direct = true;
+        }
+        if (direct) eventloop_flush();
+    }
+
+    // the datagrams are sent here by runs of the same socket
+    if (direct)
+    {
+        struct mmsghdr msg[EVENTLOOP_BATCH_SIZE];
+        struct iovec iov[2 * EVENTLOOP_BATCH_SIZE];
+
+#ifdef WITH_LOGS
+        fprintf(stderr, "Sending %lu datagrams\r\n", count);
+#endif
+
+        i = 0;
+        while (i < count)
+        {
+            unsigned int n;
+            int nbSent;
+
+            n = 0;
+            while (i + n < count
+                && n < EVENTLOOP_BATCH_SIZE
+                && connArray[i + n]->sock == connArray[i]->sock)
+            {
+                iov[2 * n].iov_base = bufferArray[i + n];
+                iov[2 * n].iov_len = lengthArray[i + n];
+                iov[2 * n + 1].iov_base = payloadArray[i + n];
+                iov[2 * n + 1].iov_len = payloadLengthArray[i + n];
+                memset(msg + n, 0, sizeof(struct mmsghdr));
+                msg[n].msg_hdr.msg_name = &(connArray[i + n]->addr);
+                msg[n].msg_hdr.msg_namelen = connArray[i + n]->addrLen;
+                msg[n].msg_hdr.msg_iov = iov + 2 * n;
+                msg[n].msg_hdr.msg_iovlen = (payloadArray[i + n] != NULL) ? 2 : 1;
+                n++;
+            }
+
+            nbSent = sendmmsg(connArray[i]->sock, msg, n, 0);
+            if (nbSent <= 0)
+            {
+                // skip the failing datagram
+                result = -1;
+                nbSent = 1;
+            }
+            i += nbSent;
+        }
+
+        return result;
+    }
+#endif
+
+    for (i = 0 ; i < count ; i++)
+    {
+        if (payloadArray[i] != NULL)
+        {
+            if (connection_send_gather(connArray[i], bufferArray[i], lengthArray[i], payloadArray[i], payloadLengthArray[i]) != 0) result = -1;
+        }
+        else
+        {
+            if (connection_send(connArray[i], bufferArray[i], lengthArray[i]) != 0) result = -1;
+        }
+    }
+
+    return result;
+}
+
 uint8_t lwm2m_buffer_send(void * sessionH,
                           uint8_t * buffer,
                           size_t length,
@@ -222,6 +489,47 @@ uint8_t lwm2m_buffer_send(void * sessionH,
     return COAP_NO_ERROR;
 }
 
+uint8_t lwm2m_buffer_send_gather(void * sessionH,
+                                 uint8_t * header,
+                                 size_t headerLength,
+                                 uint8_t * payload,
+                                 size_t payloadLength,
+                                 void * userdata)
+{
+    connection_t * connP = (connection_t*) sessionH;
+
+    if (connP == NULL)
+    {
+        fprintf(stderr, "#> failed sending %lu bytes, missing connection\r\n", headerLength + payloadLength);
+        return COAP_500_INTERNAL_SERVER_ERROR ;
+    }
+
+    if (-1 == connection_send_gather(connP, header, headerLength, payload, payloadLength))
+    {
+        fprintf(stderr, "#> failed sending %lu bytes\r\n", headerLength + payloadLength);
+        return COAP_500_INTERNAL_SERVER_ERROR ;
+    }
+
+    return COAP_NO_ERROR;
+}
+
+uint8_t lwm2m_buffer_send_batch(void ** sessionArray,
+                                uint8_t ** bufferArray,
+                                size_t * lengthArray,
+                                uint8_t ** payloadArray,
+                                size_t * payloadLengthArray,
+                                size_t count,
+                                void * userdata)
+{
+    if (-1 == connection_send_batch((connection_t **)sessionArray, bufferArray, lengthArray, payloadArray, payloadLengthArray, count))
+    {
+        fprintf(stderr, "#> failed sending some of %lu datagrams\r\n", count);
+        return COAP_500_INTERNAL_SERVER_ERROR ;
+    }
+
+    return COAP_NO_ERROR;
+}
+
 bool lwm2m_session_is_equal(void * session1,
                             void * session2,
                             void * userData)
@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <liblwm2m.h>
+#include "peertable.h"
 
 #define LWM2M_STANDARD_PORT_STR "5683"
 #define LWM2M_STANDARD_PORT      5683
@@ -40,9 +41,18 @@ typedef struct _connection_t
     int                     sock;
     struct sockaddr_in6     addr;
     size_t                  addrLen;
+    peertable_node_t        node;
 } connection_t;
 
+// connections of a server, indexed by peer address
+typedef peertable_t connection_table_t;
+
+// returns true if the idle connection is still needed
+typedef bool (*connection_in_use_callback_t)(connection_t * connP, void * userData);
+
 int create_socket(const char * portStr, int ai_family);
+// several sockets bound to the same port share the peers, each peer always reaching the same socket
+int create_socket_shared(const char * portStr, int ai_family);
 
 connection_t * connection_find(connection_t * connList, struct sockaddr_storage * addr, size_t addrLen);
 connection_t * connection_new_incoming(connection_t * connList, int sock, struct sockaddr * addr, size_t addrLen);
@@ -50,6 +60,18 @@ connection_t * connection_create(connection_t * connList, int sock, char * host,
 
 void connection_free(connection_t * connList);
 
+void connection_table_init(connection_table_t * tableP);
+connection_t * connection_table_find(connection_table_t * tableP, struct sockaddr_storage * addr, size_t addrLen);
+connection_t * connection_table_new_incoming(connection_table_t * tableP, int sock, struct sockaddr * addr, size_t addrLen);
+void connection_table_remove(connection_table_t * tableP, connection_t * connP);
+// releases the connections idle for more than timeout seconds unless inUse returns true for them.
+int connection_table_expire(connection_table_t * tableP, time_t timeout, connection_in_use_callback_t inUse, void * userData);
+void connection_table_free(connection_table_t * tableP);
+
 int connection_send(connection_t *connP, uint8_t * buffer, size_t length);
+int connection_send_gather(connection_t *connP, uint8_t * header, size_t headerLength, uint8_t * payload, size_t payloadLength);
+// sends count datagrams, with sendmmsg() when available. payloadArray[i], if not NULL, follows
+// bufferArray[i] and is not copied. returns -1 if any of them failed.
+int connection_send_batch(connection_t ** connArray, uint8_t ** bufferArray, size_t * lengthArray, uint8_t ** payloadArray, size_t * payloadLengthArray, size_t count);
 
 #endif
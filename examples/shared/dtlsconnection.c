@@ -28,6 +28,9 @@
 
 dtls_context_t * dtlsContext;
 
+// all the connections by peer address, for connection_find() and the tinydtls callbacks
+static peertable_t dtlsPeers;
+
 /********************* Security Obj Helpers **********************/
 char * security_get_uri(lwm2m_object_t * obj, int instanceId, char * uriBuffer, int bufferSize){
     int size = 1;
@@ -372,20 +375,13 @@ dtls_connection_t * connection_find(dtls_connection_t * connList,
                                const struct sockaddr_storage * addr,
                                size_t addrLen)
 {
-    dtls_connection_t * connP;
-
-    connP = connList;
-    while (connP != NULL)
-    {
+    peertable_node_t * nodeP;
 
-       if (sockaddr_cmp((struct sockaddr*) (&connP->addr),(struct sockaddr*) addr)) {
-            return connP;
-       }
+    // connList is only kept for compatibility, all connections are indexed
+    nodeP = peertable_find(&dtlsPeers, (const struct sockaddr *)addr, addrLen);
+    if (nodeP == NULL) return NULL;
 
-       connP = connP->next;
-    }
-
-    return connP;
+    return PEERTABLE_ENTRY(nodeP, dtls_connection_t, node);
 }
 
 dtls_connection_t * connection_new_incoming(dtls_connection_t * connList,
@@ -409,6 +405,13 @@ dtls_connection_t * connection_new_incoming(dtls_connection_t * connList,
         connP->dtlsSession->addr.sin6 = connP->addr;
         connP->dtlsSession->size = connP->addrLen;
         connP->lastSend = lwm2m_gettime();
+
+        if (peertable_add(&dtlsPeers, &(connP->node), addr, addrLen, connP->lastSend) != 0)
+        {
+            free(connP->dtlsSession);
+            free(connP);
+            connP = NULL;
+        }
     }
 
     return connP;
@@ -535,10 +538,17 @@ void connection_free(dtls_connection_t * connList)
         dtls_connection_t * nextP;
 
         nextP = connList->next;
-        free(connList);
+        connection_release(connList);
 
         connList = nextP;
     }
+    if (dtlsPeers.count == 0) peertable_clear(&dtlsPeers);
+}
+
+void connection_release(dtls_connection_t * connP)
+{
+    peertable_remove(&dtlsPeers, &(connP->node));
+    free(connP);
 }
 
 int connection_send(dtls_connection_t *connP, uint8_t * buffer, size_t length){
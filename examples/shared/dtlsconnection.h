@@ -32,6 +32,7 @@
 #include "tinydtls/tinydtls.h"
 #include "tinydtls/dtls.h"
 #include "liblwm2m.h"
+#include "peertable.h"
 
 #define LWM2M_STANDARD_PORT_STR "5683"
 #define LWM2M_STANDARD_PORT      5683
@@ -55,6 +56,7 @@ typedef struct _dtls_connection_t
     lwm2m_context_t * lwm2mH;
     dtls_context_t * dtlsContext;
     time_t lastSend; // last time a data was sent to the server (used for NAT timeouts)
+    peertable_node_t node;
 } dtls_connection_t;
 
 int create_socket(const char * portStr, int ai_family);
@@ -64,6 +66,8 @@ dtls_connection_t * connection_new_incoming(dtls_connection_t * connList, int so
 dtls_connection_t * connection_create(dtls_connection_t * connList, int sock, lwm2m_object_t * securityObj, int instanceId, lwm2m_context_t * lwm2mH, int addressFamily);
 
 void connection_free(dtls_connection_t * connList);
+// releases a connection removed from its list
+void connection_release(dtls_connection_t * connP);
 
 int connection_send(dtls_connection_t *connP, uint8_t * buffer, size_t length);
 int connection_handle_packet(dtls_connection_t *connP, uint8_t * buffer, size_t length);
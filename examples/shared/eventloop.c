@@ -0,0 +1,307 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "eventloop.h"
+
+#ifndef EVENTLOOP_PACKET_SIZE
+#define EVENTLOOP_PACKET_SIZE 1500
+#endif
+
+#ifndef EVENTLOOP_MAX_SOURCES
+#define EVENTLOOP_MAX_SOURCES 8
+#endif
+
+// number of batches read from a socket before giving the other sources a turn
+#ifndef EVENTLOOP_MAX_BATCHES
+#define EVENTLOOP_MAX_BATCHES 8
+#endif
+
+typedef struct
+{
+    int                           fd;
+    eventloop_datagram_callback_t datagramCallback;
+    eventloop_fd_callback_t       fdCallback;
+    void *                        userData;
+} eventloop_source_t;
+
+struct _eventloop_t
+{
+    int                     epollFd;
+    int                     sourceCount;
+    eventloop_source_t      sources[EVENTLOOP_MAX_SOURCES];
+    // receive batch
+    struct mmsghdr          rxMsg[EVENTLOOP_BATCH_SIZE];
+    struct iovec            rxIov[EVENTLOOP_BATCH_SIZE];
+    struct sockaddr_storage rxAddr[EVENTLOOP_BATCH_SIZE];
+    uint8_t                 rxBuffer[EVENTLOOP_BATCH_SIZE][EVENTLOOP_PACKET_SIZE];
+    // send queue
+    int                     txCount;
+    int                     txSock[EVENTLOOP_BATCH_SIZE];
+    struct mmsghdr          txMsg[EVENTLOOP_BATCH_SIZE];
+    struct iovec            txIov[EVENTLOOP_BATCH_SIZE];
+    struct sockaddr_storage txAddr[EVENTLOOP_BATCH_SIZE];
+    uint8_t                 txBuffer[EVENTLOOP_BATCH_SIZE][EVENTLOOP_PACKET_SIZE];
+};
+
+// the loop whose batch is being handled by this thread, if any
+static __thread eventloop_t * g_batchLoop = NULL;
+
+static void prv_flush(eventloop_t * loopP)
+{
+    int first;
+
+    // sendmmsg() works on one socket, the queue is sent by runs of the same socket
+    first = 0;
+    while (first < loopP->txCount)
+    {
+        int last;
+
+        last = first + 1;
+        while (last < loopP->txCount && loopP->txSock[last] == loopP->txSock[first]) last++;
+
+        while (first < last)
+        {
+            int nbSent;
+
+            nbSent = sendmmsg(loopP->txSock[first], loopP->txMsg + first, last - first, 0);
+            if (nbSent <= 0)
+            {
+                if (nbSent < 0 && errno == EINTR) continue;
+                // datagrams are unreliable anyway, drop the failing one
+                fprintf(stderr, "Error in sendmmsg(): %d\r\n", errno);
+                nbSent = 1;
+            }
+            first += nbSent;
+        }
+    }
+    loopP->txCount = 0;
+}
+
+static void prv_readSocket(eventloop_t * loopP,
+                           eventloop_source_t * sourceP)
+{
+    int batch;
+
+    for (batch = 0 ; batch < EVENTLOOP_MAX_BATCHES ; batch++)
+    {
+        int count;
+        int i;
+
+        for (i = 0 ; i < EVENTLOOP_BATCH_SIZE ; i++)
+        {
+            loopP->rxMsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        }
+
+        count = recvmmsg(sourceP->fd, loopP->rxMsg, EVENTLOOP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (count <= 0)
+        {
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                fprintf(stderr, "Error in recvmmsg(): %d\r\n", errno);
+            }
+            return;
+        }
+
+        g_batchLoop = loopP;
+        for (i = 0 ; i < count ; i++)
+        {
+            sourceP->datagramCallback(sourceP->fd,
+                                      loopP->rxBuffer[i],
+                                      loopP->rxMsg[i].msg_len,
+                                      loopP->rxAddr + i,
+                                      loopP->rxMsg[i].msg_hdr.msg_namelen,
+                                      sourceP->userData);
+        }
+        g_batchLoop = NULL;
+        prv_flush(loopP);
+
+        // the socket is empty
+        if (count < EVENTLOOP_BATCH_SIZE) return;
+    }
+}
+
+static int prv_addSource(eventloop_t * loopP,
+                         int fd,
+                         eventloop_datagram_callback_t datagramCallback,
+                         eventloop_fd_callback_t fdCallback,
+                         void * userData)
+{
+    struct epoll_event event;
+    eventloop_source_t * sourceP;
+
+    if (loopP->sourceCount == EVENTLOOP_MAX_SOURCES) return -1;
+
+    sourceP = loopP->sources + loopP->sourceCount;
+    sourceP->fd = fd;
+    sourceP->datagramCallback = datagramCallback;
+    sourceP->fdCallback = fdCallback;
+    sourceP->userData = userData;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = sourceP;
+    if (epoll_ctl(loopP->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) return -1;
+
+    loopP->sourceCount++;
+
+    return 0;
+}
+
+eventloop_t * eventloop_new(void)
+{
+    eventloop_t * loopP;
+    int i;
+
+    loopP = (eventloop_t *)malloc(sizeof(eventloop_t));
+    if (loopP == NULL) return NULL;
+    memset(loopP, 0, sizeof(eventloop_t));
+
+    loopP->epollFd = epoll_create1(0);
+    if (loopP->epollFd < 0)
+    {
+        free(loopP);
+        return NULL;
+    }
+
+    for (i = 0 ; i < EVENTLOOP_BATCH_SIZE ; i++)
+    {
+        loopP->rxIov[i].iov_base = loopP->rxBuffer[i];
+        loopP->rxIov[i].iov_len = EVENTLOOP_PACKET_SIZE;
+        loopP->rxMsg[i].msg_hdr.msg_name = loopP->rxAddr + i;
+        loopP->rxMsg[i].msg_hdr.msg_iov = loopP->rxIov + i;
+        loopP->rxMsg[i].msg_hdr.msg_iovlen = 1;
+
+        loopP->txIov[i].iov_base = loopP->txBuffer[i];
+        loopP->txMsg[i].msg_hdr.msg_name = loopP->txAddr + i;
+        loopP->txMsg[i].msg_hdr.msg_iov = loopP->txIov + i;
+        loopP->txMsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return loopP;
+}
+
+void eventloop_free(eventloop_t * loopP)
+{
+    if (loopP == NULL) return;
+
+    close(loopP->epollFd);
+    free(loopP);
+}
+
+int eventloop_add_socket(eventloop_t * loopP,
+                         int sock,
+                         eventloop_datagram_callback_t callback,
+                         void * userData)
+{
+    return prv_addSource(loopP, sock, callback, NULL, userData);
+}
+
+int eventloop_add_fd(eventloop_t * loopP,
+                     int fd,
+                     eventloop_fd_callback_t callback,
+                     void * userData)
+{
+    return prv_addSource(loopP, fd, NULL, callback, userData);
+}
+
+int eventloop_wait(eventloop_t * loopP,
+                   time_t timeout)
+{
+    struct epoll_event events[EVENTLOOP_MAX_SOURCES];
+    int count;
+    int i;
+
+    count = epoll_wait(loopP->epollFd, events, EVENTLOOP_MAX_SOURCES, (int)timeout * 1000);
+    if (count < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (i = 0 ; i < count ; i++)
+    {
+        eventloop_source_t * sourceP = (eventloop_source_t *)events[i].data.ptr;
+
+        if (sourceP->datagramCallback != NULL)
+        {
+            prv_readSocket(loopP, sourceP);
+        }
+        else
+        {
+            sourceP->fdCallback(sourceP->fd, sourceP->userData);
+        }
+    }
+
+    return count;
+}
+
+int eventloop_send(int sock,
+                   struct sockaddr * addr,
+                   socklen_t addrLen,
+                   struct iovec * iov,
+                   int iovCount)
+{
+    eventloop_t * loopP = g_batchLoop;
+    struct msghdr * hdrP;
+    size_t length;
+    int i;
+
+    if (loopP == NULL) return 0;
+
+    length = 0;
+    for (i = 0 ; i < iovCount ; i++)
+    {
+        length += iov[i].iov_len;
+    }
+    if (length > EVENTLOOP_PACKET_SIZE) return -1;
+
+    if (loopP->txCount == EVENTLOOP_BATCH_SIZE) prv_flush(loopP);
+
+    // the buffers belong to the caller, the datagram is copied
+    length = 0;
+    for (i = 0 ; i < iovCount ; i++)
+    {
+        memcpy(loopP->txBuffer[loopP->txCount] + length, iov[i].iov_base, iov[i].iov_len);
+        length += iov[i].iov_len;
+    }
+
+    hdrP = &(loopP->txMsg[loopP->txCount].msg_hdr);
+    memcpy(hdrP->msg_name, addr, addrLen);
+    hdrP->msg_namelen = addrLen;
+    loopP->txIov[loopP->txCount].iov_len = length;
+    loopP->txSock[loopP->txCount] = sock;
+    loopP->txCount++;
+
+    return 1;
+}
+
+void eventloop_flush(void)
+{
+    if (g_batchLoop != NULL) prv_flush(g_batchLoop);
+}
+
+bool eventloop_is_batching(void)
+{
+    return (g_batchLoop != NULL);
+}
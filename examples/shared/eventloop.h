@@ -0,0 +1,66 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Linux event loop based on epoll.
+ *
+ * Datagram sockets are drained with recvmmsg() by batches of
+ * EVENTLOOP_BATCH_SIZE datagrams. While a batch is being handled, the
+ * datagrams sent through eventloop_send() are copied into a queue which is
+ * flushed with sendmmsg() once the whole batch was handled.
+ */
+
+#ifndef EVENTLOOP_H_
+#define EVENTLOOP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef EVENTLOOP_BATCH_SIZE
+#define EVENTLOOP_BATCH_SIZE 32
+#endif
+
+typedef void (*eventloop_datagram_callback_t)(int sock, uint8_t * buffer, size_t length, struct sockaddr_storage * addr, socklen_t addrLen, void * userData);
+typedef void (*eventloop_fd_callback_t)(int fd, void * userData);
+
+typedef struct _eventloop_t eventloop_t;
+
+// returns a new loop or NULL.
+eventloop_t * eventloop_new(void);
+void eventloop_free(eventloop_t * loopP);
+
+// sock is a datagram socket, callback is called for each datagram received.
+int eventloop_add_socket(eventloop_t * loopP, int sock, eventloop_datagram_callback_t callback, void * userData);
+// callback is called when fd is readable, e.g. STDIN_FILENO.
+int eventloop_add_fd(eventloop_t * loopP, int fd, eventloop_fd_callback_t callback, void * userData);
+
+// waits at most timeout seconds and handles the ready sources.
+// returns the number of ready sources, 0 on timeout or -1 on error.
+int eventloop_wait(eventloop_t * loopP, time_t timeout);
+
+// queues a datagram if a batch is being handled.
+// returns 1 if the datagram was queued, 0 if the caller must send it itself, -1 on error.
+int eventloop_send(int sock, struct sockaddr * addr, socklen_t addrLen, struct iovec * iov, int iovCount);
+// sends the datagrams queued so far, before one sent directly to keep them in order.
+void eventloop_flush(void);
+// returns true while the calling thread handles a batch, i.e. eventloop_send() queues.
+bool eventloop_is_batching(void);
+
+#endif
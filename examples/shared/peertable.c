@@ -0,0 +1,256 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "peertable.h"
+
+// must be a power of two
+#define PEERTABLE_MIN_BUCKETS 64
+
+static bool prv_makeKey(const struct sockaddr * addr,
+                        size_t addrLen,
+                        peertable_key_t * keyP)
+{
+    memset(keyP, 0, sizeof(peertable_key_t));
+
+    if (addr->sa_family == AF_INET && addrLen >= sizeof(struct sockaddr_in))
+    {
+        const struct sockaddr_in * sinP = (const struct sockaddr_in *)addr;
+
+        keyP->family = AF_INET;
+        keyP->port = sinP->sin_port;
+        memcpy(keyP->address, &(sinP->sin_addr), 4);
+        return true;
+    }
+    if (addr->sa_family == AF_INET6 && addrLen >= sizeof(struct sockaddr_in6))
+    {
+        const struct sockaddr_in6 * sin6P = (const struct sockaddr_in6 *)addr;
+
+        keyP->port = sin6P->sin6_port;
+        if (IN6_IS_ADDR_V4MAPPED(&(sin6P->sin6_addr)))
+        {
+            keyP->family = AF_INET;
+            memcpy(keyP->address, sin6P->sin6_addr.s6_addr + 12, 4);
+        }
+        else
+        {
+            keyP->family = AF_INET6;
+            keyP->scope = sin6P->sin6_scope_id;
+            memcpy(keyP->address, &(sin6P->sin6_addr), 16);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+// FNV-1a
+static uint32_t prv_hash(const peertable_key_t * keyP)
+{
+    const uint8_t * byteP = (const uint8_t *)keyP;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0 ; i < sizeof(peertable_key_t) ; i++)
+    {
+        hash ^= byteP[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void prv_idleUnlink(peertable_t * tableP,
+                           peertable_node_t * nodeP)
+{
+    if (nodeP->idlePrev == NULL) tableP->idleHead = nodeP->idleNext;
+    else nodeP->idlePrev->idleNext = nodeP->idleNext;
+    if (nodeP->idleNext == NULL) tableP->idleTail = nodeP->idlePrev;
+    else nodeP->idleNext->idlePrev = nodeP->idlePrev;
+}
+
+static void prv_idleAppend(peertable_t * tableP,
+                           peertable_node_t * nodeP)
+{
+    nodeP->idleNext = NULL;
+    nodeP->idlePrev = tableP->idleTail;
+    if (tableP->idleTail == NULL) tableP->idleHead = nodeP;
+    else tableP->idleTail->idleNext = nodeP;
+    tableP->idleTail = nodeP;
+}
+
+static void prv_hashInsert(peertable_t * tableP,
+                           peertable_node_t * nodeP)
+{
+    peertable_node_t ** bucketP = tableP->buckets + (nodeP->hash & (tableP->bucketCount - 1));
+
+    nodeP->hashNext = *bucketP;
+    *bucketP = nodeP;
+}
+
+static int prv_grow(peertable_t * tableP)
+{
+    peertable_node_t ** oldBuckets = tableP->buckets;
+    size_t oldCount = tableP->bucketCount;
+    size_t i;
+
+    tableP->bucketCount = (oldCount == 0) ? PEERTABLE_MIN_BUCKETS : oldCount * 2;
+    tableP->buckets = (peertable_node_t **)calloc(tableP->bucketCount, sizeof(peertable_node_t *));
+    if (tableP->buckets == NULL)
+    {
+        tableP->buckets = oldBuckets;
+        tableP->bucketCount = oldCount;
+        return -1;
+    }
+
+    for (i = 0 ; i < oldCount ; i++)
+    {
+        while (oldBuckets[i] != NULL)
+        {
+            peertable_node_t * nodeP = oldBuckets[i];
+
+            oldBuckets[i] = nodeP->hashNext;
+            prv_hashInsert(tableP, nodeP);
+        }
+    }
+    free(oldBuckets);
+
+    return 0;
+}
+
+void peertable_init(peertable_t * tableP)
+{
+    memset(tableP, 0, sizeof(peertable_t));
+}
+
+void peertable_clear(peertable_t * tableP)
+{
+    free(tableP->buckets);
+    memset(tableP, 0, sizeof(peertable_t));
+}
+
+peertable_node_t * peertable_find(peertable_t * tableP,
+                                  const struct sockaddr * addr,
+                                  size_t addrLen)
+{
+    peertable_key_t key;
+    peertable_node_t * nodeP;
+    uint32_t hash;
+
+    if (tableP->count == 0) return NULL;
+    if (!prv_makeKey(addr, addrLen, &key)) return NULL;
+
+    hash = prv_hash(&key);
+    for (nodeP = tableP->buckets[hash & (tableP->bucketCount - 1)] ; nodeP != NULL ; nodeP = nodeP->hashNext)
+    {
+        if (nodeP->hash == hash
+         && memcmp(&(nodeP->key), &key, sizeof(peertable_key_t)) == 0)
+        {
+            return nodeP;
+        }
+    }
+
+    return NULL;
+}
+
+int peertable_add(peertable_t * tableP,
+                  peertable_node_t * nodeP,
+                  const struct sockaddr * addr,
+                  size_t addrLen,
+                  time_t now)
+{
+    if (!prv_makeKey(addr, addrLen, &(nodeP->key))) return -1;
+
+    // keep the chains one node long on average
+    if (tableP->count >= tableP->bucketCount
+     && prv_grow(tableP) != 0
+     && tableP->bucketCount == 0)
+    {
+        return -1;
+    }
+
+    nodeP->hash = prv_hash(&(nodeP->key));
+    nodeP->lastSeen = now;
+    prv_hashInsert(tableP, nodeP);
+    prv_idleAppend(tableP, nodeP);
+    tableP->count++;
+
+    return 0;
+}
+
+void peertable_remove(peertable_t * tableP,
+                      peertable_node_t * nodeP)
+{
+    peertable_node_t ** linkP;
+
+    linkP = tableP->buckets + (nodeP->hash & (tableP->bucketCount - 1));
+    while (*linkP != NULL && *linkP != nodeP)
+    {
+        linkP = &((*linkP)->hashNext);
+    }
+    if (*linkP == NULL) return;
+
+    *linkP = nodeP->hashNext;
+    prv_idleUnlink(tableP, nodeP);
+    tableP->count--;
+}
+
+void peertable_touch(peertable_t * tableP,
+                     peertable_node_t * nodeP,
+                     time_t now)
+{
+    nodeP->lastSeen = now;
+    if (tableP->idleTail != nodeP)
+    {
+        prv_idleUnlink(tableP, nodeP);
+        prv_idleAppend(tableP, nodeP);
+    }
+}
+
+int peertable_expire(peertable_t * tableP,
+                     time_t now,
+                     time_t timeout,
+                     peertable_expire_callback_t callback,
+                     void * userData)
+{
+    int count;
+
+    // peers kept by callback are seen now and go to the tail
+    count = 0;
+    while (tableP->idleHead != NULL
+        && now - tableP->idleHead->lastSeen > timeout)
+    {
+        peertable_node_t * nodeP = tableP->idleHead;
+
+        peertable_remove(tableP, nodeP);
+        if (callback(nodeP, userData))
+        {
+            count++;
+        }
+        else
+        {
+            prv_hashInsert(tableP, nodeP);
+            nodeP->lastSeen = now;
+            prv_idleAppend(tableP, nodeP);
+            tableP->count++;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,84 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+/*
+ * Hash table of peers keyed on (family, address, port).
+ *
+ * The nodes are embedded in the caller's structures. Besides the hash chains,
+ * nodes are kept in a list ordered by last activity so that idle peers can be
+ * found without walking the whole table. IPv4-mapped IPv6 addresses are the
+ * same key as the IPv4 address.
+ */
+
+#ifndef PEERTABLE_H_
+#define PEERTABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/socket.h>
+
+typedef struct
+{
+    uint16_t family;
+    uint16_t port;
+    uint32_t scope;
+    uint8_t  address[16];
+} peertable_key_t;
+
+typedef struct _peertable_node_t
+{
+    struct _peertable_node_t * hashNext;
+    struct _peertable_node_t * idlePrev;
+    struct _peertable_node_t * idleNext;
+    uint32_t                   hash;
+    time_t                     lastSeen;
+    peertable_key_t            key;
+} peertable_node_t;
+
+typedef struct
+{
+    peertable_node_t ** buckets;
+    size_t              bucketCount;
+    size_t              count;
+    // least recently seen first
+    peertable_node_t *  idleHead;
+    peertable_node_t *  idleTail;
+} peertable_t;
+
+// returns the structure of type TYPE embedding NODEP as its MEMBER.
+#define PEERTABLE_ENTRY(NODEP, TYPE, MEMBER) ((TYPE *)((uint8_t *)(NODEP) - offsetof(TYPE, MEMBER)))
+
+// nodeP was removed from the table. returns true once the peer is released,
+// false to put it back as if it was just seen.
+typedef bool (*peertable_expire_callback_t)(peertable_node_t * nodeP, void * userData);
+
+void peertable_init(peertable_t * tableP);
+// the nodes belong to the caller and are not released.
+void peertable_clear(peertable_t * tableP);
+
+peertable_node_t * peertable_find(peertable_t * tableP, const struct sockaddr * addr, size_t addrLen);
+int peertable_add(peertable_t * tableP, peertable_node_t * nodeP, const struct sockaddr * addr, size_t addrLen, time_t now);
+void peertable_remove(peertable_t * tableP, peertable_node_t * nodeP);
+void peertable_touch(peertable_t * tableP, peertable_node_t * nodeP, time_t now);
+
+// hands the peers not seen for more than timeout seconds to callback.
+// returns the number of peers released.
+int peertable_expire(peertable_t * tableP, time_t now, time_t timeout, peertable_expire_callback_t callback, void * userData);
+
+#endif
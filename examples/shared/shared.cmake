@@ -5,7 +5,8 @@ set(SHARED_SOURCES_DIR ${CMAKE_CURRENT_LIST_DIR})
 set(SHARED_SOURCES 
     ${SHARED_SOURCES_DIR}/commandline.c
     ${SHARED_SOURCES_DIR}/platform.c
-	${SHARED_SOURCES_DIR}/memtrace.c)
+	${SHARED_SOURCES_DIR}/memtrace.c
+    ${SHARED_SOURCES_DIR}/peertable.c)
 
 if(DTLS)
     include(${CMAKE_CURRENT_LIST_DIR}/tinydtls.cmake)
@@ -26,6 +27,21 @@ else()
 		${SHARED_SOURCES_DIR}/connection.c)
 
     set(SHARED_INCLUDE_DIRS ${SHARED_SOURCES_DIR})
+
+    # the payload of outgoing messages is handed to sendmsg() without being copied
+    set(SHARED_DEFINITIONS -DLWM2M_WITH_GATHER_SEND)
+
+    # the datagrams sent while the core handles a packet or a step are sent together
+    set(SHARED_DEFINITIONS ${SHARED_DEFINITIONS} -DLWM2M_WITH_SEND_QUEUE)
+
+    # recvmmsg() and sendmmsg() are Linux specific
+    if(CMAKE_SYSTEM_NAME STREQUAL "Linux")
+        set(SHARED_SOURCES
+            ${SHARED_SOURCES}
+            ${SHARED_SOURCES_DIR}/eventloop.c)
+
+        set(SHARED_DEFINITIONS ${SHARED_DEFINITIONS} -DWITH_EVENTLOOP)
+    endif()
 endif()
 
 
@@ -20,58 +20,428 @@
 #include "internals.h"
 #include "liblwm2m.h"
 
+#include <unistd.h>
 
-static void handle_12345(lwm2m_block1_data_t ** blk1,
-                                  uint16_t mid) {
-    uint8_t *buffer = "12345";
+#define BLOCK_SIZE 16
+#define TEST_OBJECT_ID 1024
+
+static uint8_t prv_handleBlock(lwm2m_context_t * contextP,
+                               lwm2m_block1_data_t ** blk1,
+                               const char * uri,
+                               uint16_t mid,
+                               uint32_t num,
+                               bool more,
+                               const char * payload,
+                               uint8_t ** resultBuffer,
+                               size_t * bsize)
+{
+    coap_packet_t message[1];
+    uint8_t st;
+
+    coap_init_message(message, COAP_TYPE_CON, COAP_PUT, mid);
+    coap_set_header_uri_path(message, uri);
+    coap_set_header_block1(message, num, more, BLOCK_SIZE);
+    coap_set_payload(message, payload, strlen(payload));
+    st = coap_block1_handler(contextP, blk1, message, resultBuffer, bsize);
+    coap_free_header(message);
+
+    return st;
+}
+
+static void handle_first(lwm2m_context_t * contextP,
+                         lwm2m_block1_data_t ** blk1,
+                         uint16_t mid) {
     size_t bsize;
     uint8_t *resultBuffer = NULL;
 
-    uint8_t st = coap_block1_handler(blk1, mid, buffer, 5, 5, 0, true, &resultBuffer, &bsize);
+    uint8_t st = prv_handleBlock(contextP, blk1, "/5/0/0", mid, 0, true, "0123456789ABCDEF", &resultBuffer, &bsize);
     CU_ASSERT_EQUAL(st, COAP_231_CONTINUE);
     CU_ASSERT_PTR_NULL(resultBuffer);
 }
 
-static void handle_67(lwm2m_block1_data_t ** blk1,
-                                  uint16_t mid) {
-    uint8_t *buffer = "67";
+static void handle_last(lwm2m_context_t * contextP,
+                        lwm2m_block1_data_t ** blk1,
+                        uint16_t mid) {
     size_t bsize;
     uint8_t *resultBuffer = NULL;
 
-    uint8_t st = coap_block1_handler(blk1, mid, buffer, 2, 5, 1, false, &resultBuffer, &bsize);
+    uint8_t st = prv_handleBlock(contextP, blk1, "/5/0/0", mid, 1, false, "67", &resultBuffer, &bsize);
     CU_ASSERT_EQUAL(st, NO_ERROR);
-    CU_ASSERT_PTR_NOT_NULL(*resultBuffer);
-    CU_ASSERT_EQUAL(bsize, 7);
-    CU_ASSERT_NSTRING_EQUAL(resultBuffer, "1234567", 7);
+    CU_ASSERT_PTR_NOT_NULL(resultBuffer);
+    CU_ASSERT_EQUAL(bsize, 18);
+    CU_ASSERT_NSTRING_EQUAL(resultBuffer, "0123456789ABCDEF67", 18);
 }
 
 
 static void test_block1_nominal(void)
 {
+    lwm2m_context_t * contextP = lwm2m_init(NULL);
     lwm2m_block1_data_t * blk1 = NULL;
 
-    handle_12345(&blk1, 123);
-    handle_67(&blk1, 346);
+    handle_first(contextP, &blk1, 123);
+    handle_last(contextP, &blk1, 346);
 
-    free_block1_buffer(blk1);
+    free_block1_buffer(contextP, blk1);
+    lwm2m_close(contextP);
 }
 
 static void test_block1_retransmit(void)
 {
+    lwm2m_context_t * contextP = lwm2m_init(NULL);
+    lwm2m_block1_data_t * blk1 = NULL;
+
+    handle_first(contextP, &blk1, 1);
+    handle_first(contextP, &blk1, 1);
+    handle_last(contextP, &blk1, 3);
+    handle_last(contextP, &blk1, 3);
+    handle_last(contextP, &blk1, 3);
+
+    free_block1_buffer(contextP, blk1);
+    lwm2m_close(contextP);
+}
+
+static void test_block1_concurrent(void)
+{
+    lwm2m_context_t * contextP = lwm2m_init(NULL);
+    lwm2m_block1_data_t * blk1 = NULL;
+    uint8_t * resultBuffer = NULL;
+    size_t bsize;
+    uint32_t num;
+
+    // two transfers interleaved on different resources
+    handle_first(contextP, &blk1, 10);
+    CU_ASSERT_EQUAL(prv_handleBlock(contextP, &blk1, "/5/0/1", 11, 0, true, "abcdefghijklmnop", &resultBuffer, &bsize), COAP_231_CONTINUE);
+    for (num = 1 ; num < 20 ; num++)
+    {
+        CU_ASSERT_EQUAL(prv_handleBlock(contextP, &blk1, "/5/0/1", 11 + num, num, true, "abcdefghijklmnop", &resultBuffer, &bsize), COAP_231_CONTINUE);
+    }
+    handle_last(contextP, &blk1, 40);
+    CU_ASSERT_EQUAL(prv_handleBlock(contextP, &blk1, "/5/0/1", 41, 20, false, "q", &resultBuffer, &bsize), NO_ERROR);
+    CU_ASSERT_EQUAL(bsize, 20 * BLOCK_SIZE + 1);
+    CU_ASSERT_NSTRING_EQUAL(resultBuffer + 19 * BLOCK_SIZE, "abcdefghijklmnopq", BLOCK_SIZE + 1);
+
+    // a block out of order is refused
+    CU_ASSERT_EQUAL(prv_handleBlock(contextP, &blk1, "/5/0/2", 50, 1, true, "abcdefghijklmnop", &resultBuffer, &bsize), COAP_408_REQ_ENTITY_INCOMPLETE);
+
+    free_block1_buffer(contextP, blk1);
+    lwm2m_close(contextP);
+}
+
+static void test_block1_limits(void)
+{
+    lwm2m_context_t * contextP = lwm2m_init(NULL);
     lwm2m_block1_data_t * blk1 = NULL;
+    coap_packet_t message[1];
+    uint8_t * resultBuffer = NULL;
+    size_t bsize;
+    time_t timeout = 1000;
+
+    // announced too large
+    coap_init_message(message, COAP_TYPE_CON, COAP_PUT, 1);
+    coap_set_header_uri_path(message, "/5/0/0");
+    coap_set_header_block1(message, 0, true, BLOCK_SIZE);
+    coap_set_header_size1(message, MAX_BLOCK1_SIZE);
+    coap_set_payload(message, "0123456789ABCDEF", BLOCK_SIZE);
+    CU_ASSERT_EQUAL(coap_block1_handler(contextP, &blk1, message, &resultBuffer, &bsize), COAP_413_ENTITY_TOO_LARGE);
+    CU_ASSERT_PTR_NULL(blk1);
+    coap_free_header(message);
+
+    // the buffer is reserved from Size1
+    coap_set_header_uri_path(message, "/5/0/0");
+    coap_set_header_size1(message, 100);
+    CU_ASSERT_EQUAL(coap_block1_handler(contextP, &blk1, message, &resultBuffer, &bsize), COAP_231_CONTINUE);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(blk1);
+    CU_ASSERT_EQUAL(blk1->block1bufferCapacity, 100);
+    coap_free_header(message);
+
+    // an idle transfer is released
+    timer_step(contextP, lwm2m_gettime() + COAP_EXCHANGE_LIFETIME + 1, &timeout);
+    CU_ASSERT_PTR_NULL(blk1);
+    CU_ASSERT_EQUAL(contextP->scheduler.count, 0);
+
+    lwm2m_close(contextP);
+}
+
+static uint8_t resultCode;
+
+static void prv_result(lwm2m_transaction_t * transacP,
+                       void * message)
+{
+    (void)transacP;
+
+    resultCode = ((coap_packet_t *)message)->code;
+}
+
+static const char * writeBody = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-_0123456789abcdef";
+static int readerCount;
+
+static const uint8_t * prv_reader(size_t offset,
+                                  size_t length,
+                                  uint8_t * buffer,
+                                  void * userData)
+{
+    (void)userData;
+
+    // the blocks are copied or sent from storage in turn
+    readerCount++;
+    if (readerCount % 2 == 0) return (const uint8_t *)writeBody + offset;
+    memcpy(buffer, writeBody + offset, length);
+
+    return buffer;
+}
+
+// acknowledges the block sent by a server as a client would, asking for blocks of size bytes.
+// returns the offset of the block
+static int prv_continue_block(lwm2m_context_t * contextP,
+                              connection_t * connP,
+                              int sock,
+                              uint16_t size,
+                              uint8_t * body)
+{
+    coap_packet_t request[1];
+    coap_packet_t response[1];
+    uint8_t buffer[128];
+    ssize_t received;
+    uint32_t num;
+    uint8_t more;
+    uint16_t blockSize;
+    uint32_t offset;
+
+    received = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received <= 0) return -1;
+    if (coap_parse_message(request, buffer, (uint16_t)received) != NO_ERROR) return -1;
+    if (request->code != COAP_PUT) return -1;
+    if (!coap_get_header_block1(request, &num, &more, &blockSize, &offset)) return -1;
+    if (offset + request->payload_len > strlen(writeBody)) return -1;
+    memcpy(body + offset, request->payload, request->payload_len);
+
+    coap_init_message(response, COAP_TYPE_ACK, more ? COAP_231_CONTINUE : COAP_204_CHANGED, request->mid);
+    coap_set_header_token(response, request->token, request->token_len);
+    coap_set_header_block1(response, num, more, MIN(size, blockSize));
+    received = coap_serialize_message(response, buffer);
+    lwm2m_handle_packet(contextP, buffer, (int)received, connP);
 
-    handle_12345(&blk1, 1);
-    handle_12345(&blk1, 1);
-    handle_67(&blk1, 3);
-    handle_67(&blk1, 3);
-    handle_67(&blk1, 3);
+    return (int)offset;
+}
+
+static void test_block1_transfer(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_transaction_t * transacP;
+    connection_t * connP;
+    lwm2m_uri_t uri;
+    uint8_t body[80];
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    // the client is the test itself
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    lwm2m_stringToUri("/1024/0/1", 9, &uri);
+    transacP = transaction_new(contextP, connP, COAP_PUT, NULL, &uri, 0x300, 4, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(transacP);
+    readerCount = 0;
+    CU_ASSERT_EQUAL_FATAL(transaction_setBlock1(contextP, transacP, 32, strlen(writeBody), NULL, prv_reader, NULL), 0);
+    transacP->callback = prv_result;
+    transaction_add(contextP, transacP);
+    CU_ASSERT_EQUAL(transaction_send(contextP, transacP), 0);
+
+    // the blocks follow the smaller size asked for by the client, the result is reported once
+    memset(body, 0, sizeof(body));
+    resultCode = 0;
+    CU_ASSERT_EQUAL(prv_continue_block(contextP, connP, sock, 16, body), 0);
+    CU_ASSERT_EQUAL(resultCode, 0);
+    CU_ASSERT_EQUAL(prv_continue_block(contextP, connP, sock, 16, body), 32);
+    CU_ASSERT_EQUAL(prv_continue_block(contextP, connP, sock, 16, body), 48);
+    CU_ASSERT_EQUAL(resultCode, 0);
+    CU_ASSERT_EQUAL(prv_continue_block(contextP, connP, sock, 16, body), 64);
+    CU_ASSERT_EQUAL(resultCode, COAP_204_CHANGED);
+    CU_ASSERT_EQUAL(readerCount, 4);
+    CU_ASSERT_EQUAL(memcmp(body, writeBody, sizeof(body)), 0);
+    CU_ASSERT_PTR_NULL(contextP->transactionList);
+
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static size_t streamOffset;
+static size_t streamLength;
+static int streamCount;
+static bool streamMore;
+
+static uint8_t prv_write_stream(uint16_t instanceId,
+                                uint16_t resourceId,
+                                size_t offset,
+                                uint8_t * buffer,
+                                size_t length,
+                                bool more,
+                                lwm2m_object_t * objectP)
+{
+    (void)instanceId;
+    (void)objectP;
+
+    if (resourceId != 1 || memcmp(buffer, writeBody + offset, length) != 0) return COAP_400_BAD_REQUEST;
+    streamCount++;
+    streamOffset = offset;
+    streamLength = offset + length;
+    streamMore = more;
+
+    return COAP_204_CHANGED;
+}
+
+// writes block num of 16 bytes of writeBody to /1024/0/1 and returns the code of the response
+static uint8_t prv_write_block(lwm2m_context_t * contextP,
+                               connection_t * connP,
+                               int sock,
+                               uint16_t mid,
+                               uint32_t num)
+{
+    coap_packet_t message[1];
+    coap_packet_t response[1];
+    uint8_t buffer[128];
+    size_t length;
+    ssize_t received;
+    uint8_t more;
+
+    more = (num + 1) * 16 < strlen(writeBody);
+    coap_init_message(message, COAP_TYPE_CON, COAP_PUT, mid);
+    coap_set_header_token(message, (const uint8_t *)"t", 1);
+    coap_set_header_uri_path(message, "/1024/0/1");
+    coap_set_header_content_type(message, LWM2M_CONTENT_OPAQUE);
+    coap_set_header_block1(message, num, more, 16);
+    coap_set_payload(message, writeBody + num * 16, more ? 16 : strlen(writeBody) - num * 16);
+    length = coap_serialize_message(message, buffer);
+    CU_ASSERT_FATAL(length > 0);
+
+    lwm2m_handle_packet(contextP, buffer, (int)length, connP);
+    received = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+    CU_ASSERT_FATAL(received > 0);
+    CU_ASSERT_EQUAL_FATAL(coap_parse_message(response, buffer, (uint16_t)received), NO_ERROR);
+
+    return response->code;
+}
+
+static void test_block1_stream(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t server;
+    connection_t * connP;
+    uint32_t num;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.writeStreamFunc = prv_write_stream;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    // the server is the test itself
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+    memset(&server, 0, sizeof(server));
+    server.sessionH = connP;
+    server.status = STATE_REGISTERED;
+    contextP->serverList = &server;
+
+    // each block is handed to the object as it arrives
+    streamCount = 0;
+    for (num = 0 ; num < 4 ; num++)
+    {
+        CU_ASSERT_EQUAL(prv_write_block(contextP, connP, sock, (uint16_t)(10 + num), num), COAP_231_CONTINUE);
+        CU_ASSERT_EQUAL(streamOffset, num * 16);
+        CU_ASSERT_TRUE(streamMore);
+    }
+    CU_ASSERT_EQUAL(streamCount, 4);
+    CU_ASSERT_PTR_NOT_NULL(server.block1Data);
+    CU_ASSERT_PTR_NULL(server.block1Data->block1buffer);
+
+    // a block out of order is refused without reaching the object
+    CU_ASSERT_EQUAL(prv_write_block(contextP, connP, sock, 20, 2), COAP_408_REQ_ENTITY_INCOMPLETE);
+    CU_ASSERT_EQUAL(streamCount, 4);
+
+    CU_ASSERT_EQUAL(prv_write_block(contextP, connP, sock, 14, 4), COAP_204_CHANGED);
+    CU_ASSERT_EQUAL(streamCount, 5);
+    CU_ASSERT_FALSE(streamMore);
+    CU_ASSERT_EQUAL(streamLength, strlen(writeBody));
+
+    contextP->serverList = NULL;
+    contextP->objectList = NULL;
+    free_block1_buffer(contextP, server.block1Data);
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static void test_block1_stream_after_reassembly(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t server;
+    connection_t * connP;
+    uint8_t * resultBuffer = NULL;
+    size_t bsize;
+    uint32_t num;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.writeStreamFunc = prv_write_stream;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+    memset(&server, 0, sizeof(server));
+    server.sessionH = connP;
+    server.status = STATE_REGISTERED;
+    contextP->serverList = &server;
+
+    // a payload reassembled for the URI leaves its transfer behind
+    CU_ASSERT_EQUAL(prv_handleBlock(contextP, &server.block1Data, "/1024/0/1", 30, 0, false, "0123", &resultBuffer, &bsize), NO_ERROR);
+    CU_ASSERT_PTR_NOT_NULL(server.block1Data->block1buffer);
+
+    // the same transfer is then streamed
+    streamCount = 0;
+    for (num = 0 ; num < 4 ; num++)
+    {
+        CU_ASSERT_EQUAL(prv_write_block(contextP, connP, sock, (uint16_t)(40 + num), num), COAP_231_CONTINUE);
+    }
+    CU_ASSERT_PTR_NULL(server.block1Data->block1buffer);
+    CU_ASSERT_EQUAL(prv_write_block(contextP, connP, sock, 44, 4), COAP_204_CHANGED);
+    CU_ASSERT_EQUAL(streamCount, 5);
+    CU_ASSERT_EQUAL(streamLength, strlen(writeBody));
 
-    free_block1_buffer(blk1);
+    contextP->serverList = NULL;
+    contextP->objectList = NULL;
+    free_block1_buffer(contextP, server.block1Data);
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
 }
 
 static struct TestTable table[] = {
         { "test of test_block1_nominal()", test_block1_nominal },
         { "test of test_block1_retransmit()", test_block1_retransmit },
+        { "test of test_block1_concurrent()", test_block1_concurrent },
+        { "test of test_block1_limits()", test_block1_limits },
+        { "test of test_block1_transfer()", test_block1_transfer },
+        { "test of test_block1_stream()", test_block1_stream },
+        { "test of test_block1_stream_after_reassembly()", test_block1_stream_after_reassembly },
         { NULL, NULL },
 };
 
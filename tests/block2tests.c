@@ -0,0 +1,342 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "connection.h"
+
+#include <unistd.h>
+
+#define TEST_OBJECT_ID  1024
+#define TEST_BLOCK_SIZE 64
+
+static int readCount;
+static char resourceValue[2 * MAX_BLOCK1_SIZE + 100];
+static size_t resourceLength;
+
+static uint8_t prv_read(uint16_t instanceId,
+                        int * numDataP,
+                        lwm2m_data_t ** dataArrayP,
+                        lwm2m_object_t * objectP)
+{
+    (void)instanceId;
+    (void)objectP;
+
+    readCount++;
+    if (*numDataP != 1) return COAP_404_NOT_FOUND;
+    lwm2m_data_encode_nstring(resourceValue, resourceLength, *dataArrayP);
+
+    return COAP_205_CONTENT;
+}
+
+// reads block num of /1024/0/1 as text and returns the response
+static void prv_read_block(lwm2m_context_t * contextP,
+                           connection_t * connP,
+                           int sock,
+                           uint16_t mid,
+                           uint32_t num,
+                           coap_packet_t * response,
+                           uint8_t * buffer,
+                           size_t size)
+{
+    coap_packet_t message[1];
+    uint8_t request[64];
+    size_t length;
+    ssize_t received;
+
+    coap_init_message(message, COAP_TYPE_CON, COAP_GET, mid);
+    coap_set_header_token(message, (const uint8_t *)"t", 1);
+    coap_set_header_uri_path(message, "/1024/0/1");
+    coap_set_header_accept(message, LWM2M_CONTENT_TEXT);
+    coap_set_header_block2(message, num, 0, TEST_BLOCK_SIZE);
+    length = coap_serialize_message(message, request);
+    CU_ASSERT_FATAL(length > 0);
+
+    lwm2m_handle_packet(contextP, request, (int)length, connP);
+    received = recv(sock, buffer, size, MSG_DONTWAIT);
+    CU_ASSERT_FATAL(received > 0);
+    CU_ASSERT_EQUAL_FATAL(coap_parse_message(response, buffer, (uint16_t)received), NO_ERROR);
+}
+
+static void test_block2_cache(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t server;
+    connection_t * connP;
+    coap_packet_t response[1];
+    uint8_t buffer[256];
+    uint8_t etag[4];
+    uint32_t num;
+    uint8_t more;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.readFunc = prv_read;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    // the server is the test itself
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+    memset(&server, 0, sizeof(server));
+    server.sessionH = connP;
+    server.status = STATE_REGISTERED;
+    contextP->serverList = &server;
+
+    resourceLength = 150;
+    memset(resourceValue, 'a', resourceLength);
+    readCount = 0;
+
+    // the first block reads the resource
+    prv_read_block(contextP, connP, sock, 1, 0, response, buffer, sizeof(buffer));
+    CU_ASSERT_EQUAL(response->code, COAP_205_CONTENT);
+    CU_ASSERT_EQUAL(readCount, 1);
+    CU_ASSERT_EQUAL_FATAL(response->etag_len, 4);
+    memcpy(etag, response->etag, 4);
+    CU_ASSERT_EQUAL(response->payload_len, TEST_BLOCK_SIZE);
+
+    // the following ones come from the cache, with the same ETag
+    resourceValue[0] = 'b';
+    for (num = 1 ; num < 3 ; num++)
+    {
+        prv_read_block(contextP, connP, sock, (uint16_t)(1 + num), num, response, buffer, sizeof(buffer));
+        CU_ASSERT_EQUAL(response->code, COAP_205_CONTENT);
+        CU_ASSERT_EQUAL(response->etag_len, 4);
+        CU_ASSERT_EQUAL(memcmp(response->etag, etag, 4), 0);
+        coap_get_header_block2(response, NULL, &more, NULL, NULL);
+        CU_ASSERT_EQUAL(more, num < 2 ? 1 : 0);
+        CU_ASSERT_EQUAL(response->payload_len, num < 2 ? TEST_BLOCK_SIZE : resourceLength - 2 * TEST_BLOCK_SIZE);
+    }
+    CU_ASSERT_EQUAL(readCount, 1);
+
+    // requesting the first block again reads the changed resource
+    prv_read_block(contextP, connP, sock, 4, 0, response, buffer, sizeof(buffer));
+    CU_ASSERT_EQUAL(readCount, 2);
+    CU_ASSERT_EQUAL(response->payload[0], 'b');
+    CU_ASSERT_NOT_EQUAL(memcmp(response->etag, etag, 4), 0);
+
+    // a dropped entry is read again
+    block2_clear(contextP);
+    prv_read_block(contextP, connP, sock, 5, 1, response, buffer, sizeof(buffer));
+    CU_ASSERT_EQUAL(readCount, 3);
+    CU_ASSERT_EQUAL(response->payload_len, TEST_BLOCK_SIZE);
+
+    contextP->serverList = NULL;
+    contextP->objectList = NULL;
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static void test_block2_cache_large(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t server;
+    connection_t * connP;
+    coap_packet_t response[1];
+    uint8_t buffer[256];
+    size_t offset;
+    uint32_t num;
+    uint8_t more;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.readFunc = prv_read;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+    memset(&server, 0, sizeof(server));
+    server.sessionH = connP;
+    server.status = STATE_REGISTERED;
+    contextP->serverList = &server;
+
+    // a body larger than the payloads reassembled by block1 is kept whole
+    resourceLength = sizeof(resourceValue);
+    for (offset = 0 ; offset < resourceLength ; offset++)
+    {
+        resourceValue[offset] = (char)('a' + offset % 26);
+    }
+    readCount = 0;
+
+    num = 0;
+    offset = 0;
+    do
+    {
+        prv_read_block(contextP, connP, sock, (uint16_t)(1 + num), num, response, buffer, sizeof(buffer));
+        CU_ASSERT_EQUAL_FATAL(response->code, COAP_205_CONTENT);
+        CU_ASSERT_EQUAL(memcmp(response->payload, resourceValue + offset, response->payload_len), 0);
+        offset += response->payload_len;
+        coap_get_header_block2(response, NULL, &more, NULL, NULL);
+        num++;
+    } while (more);
+
+    // only the first block read the resource
+    CU_ASSERT_EQUAL(offset, resourceLength);
+    CU_ASSERT_TRUE(num > 2);
+    CU_ASSERT_EQUAL(readCount, 1);
+
+    contextP->serverList = NULL;
+    contextP->objectList = NULL;
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static uint8_t resultCode;
+static uint8_t resultBody[64];
+static size_t resultLength;
+
+static void prv_result(lwm2m_transaction_t * transacP,
+                       void * message)
+{
+    coap_packet_t * packet = (coap_packet_t *)message;
+
+    (void)transacP;
+
+    resultCode = packet->code;
+    resultLength = packet->payload_len;
+    if (resultLength <= sizeof(resultBody)) memcpy(resultBody, packet->payload, resultLength);
+}
+
+// answers the block requested with the ACK sent by a client, returns the number of the block
+static int prv_answer_block(lwm2m_context_t * contextP,
+                            connection_t * connP,
+                            int sock,
+                            const char * body,
+                            size_t length,
+                            uint8_t etag)
+{
+    coap_packet_t request[1];
+    coap_packet_t response[1];
+    uint8_t buffer[128];
+    char * path;
+    ssize_t received;
+    uint32_t num;
+    uint16_t size;
+    uint32_t offset;
+
+    received = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received <= 0) return -1;
+    if (coap_parse_message(request, buffer, (uint16_t)received) != NO_ERROR) return -1;
+    // the request is the same, only its block changes
+    path = coap_get_multi_option_as_string(request->uri_path);
+    if (path == NULL) return -1;
+    num = strcmp(path, "/1024/0/1");
+    lwm2m_free(path);
+    if (num != 0) return -1;
+    if (!coap_get_header_block2(request, &num, NULL, &size, &offset)) return -1;
+
+    coap_init_message(response, COAP_TYPE_ACK, COAP_205_CONTENT, request->mid);
+    coap_set_header_token(response, request->token, request->token_len);
+    coap_set_header_etag(response, &etag, 1);
+    coap_set_header_block2(response, num, offset + size < length, size);
+    coap_set_payload(response, body + offset, MIN(size, length - offset));
+    received = coap_serialize_message(response, buffer);
+    lwm2m_handle_packet(contextP, buffer, (int)received, connP);
+
+    return (int)num;
+}
+
+static void prv_start_read(lwm2m_context_t * contextP,
+                           connection_t * connP,
+                           uint16_t mid)
+{
+    lwm2m_transaction_t * transacP;
+    lwm2m_uri_t uri;
+
+    lwm2m_stringToUri("/1024/0/1", 9, &uri);
+    transacP = transaction_new(contextP, connP, COAP_GET, NULL, &uri, mid, 4, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(transacP);
+    coap_set_header_block2(transacP->message, 0, 0, 16);
+    transacP->callback = prv_result;
+    transaction_add(contextP, transacP);
+    CU_ASSERT_EQUAL(transaction_send(contextP, transacP), 0);
+}
+
+static void test_block2_reassembly(void)
+{
+    lwm2m_context_t * contextP;
+    connection_t * connP;
+    const char * body = "0123456789abcdefghijklmnopqrstuvwxyzABCD";
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    // the client is the test itself
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    // the blocks are requested one after the other and reported once
+    resultCode = 0;
+    prv_start_read(contextP, connP, 0x100);
+    CU_ASSERT_EQUAL(prv_answer_block(contextP, connP, sock, body, 40, 1), 0);
+    CU_ASSERT_EQUAL(resultCode, 0);
+    CU_ASSERT_EQUAL(prv_answer_block(contextP, connP, sock, body, 40, 1), 1);
+    CU_ASSERT_EQUAL(resultCode, 0);
+    CU_ASSERT_EQUAL(prv_answer_block(contextP, connP, sock, body, 40, 1), 2);
+    CU_ASSERT_EQUAL(resultCode, COAP_205_CONTENT);
+    CU_ASSERT_EQUAL(resultLength, 40);
+    CU_ASSERT_EQUAL(memcmp(resultBody, body, 40), 0);
+    CU_ASSERT_PTR_NULL(contextP->transactionList);
+
+    // a block of another version of the body fails the read
+    resultCode = 0;
+    prv_start_read(contextP, connP, 0x200);
+    CU_ASSERT_EQUAL(prv_answer_block(contextP, connP, sock, body, 40, 1), 0);
+    CU_ASSERT_EQUAL(prv_answer_block(contextP, connP, sock, body, 40, 2), 1);
+    CU_ASSERT_EQUAL(resultCode, COAP_408_REQ_ENTITY_INCOMPLETE);
+    CU_ASSERT_PTR_NULL(contextP->transactionList);
+
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static struct TestTable table[] = {
+        { "test of test_block2_cache()", test_block2_cache },
+        { "test of test_block2_cache_large()", test_block2_cache_large },
+        { "test of test_block2_reassembly()", test_block2_reassembly },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_block2_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_block2", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
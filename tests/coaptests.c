@@ -0,0 +1,160 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "memtest.h"
+
+// serializes a GET on /3/0/1?a=1&bc=2
+static size_t prv_buildRequest(uint8_t * buffer)
+{
+    coap_packet_t message[1];
+
+    coap_init_message(message, COAP_TYPE_CON, COAP_GET, 0x1234);
+    coap_set_header_uri_path(message, "/3/0/1");
+    coap_set_header_uri_query(message, "a=1&bc=2");
+    return coap_serialize_message(message, buffer);
+}
+
+static void test_coap_parse_inline(void)
+{
+    uint8_t buffer[64];
+    size_t length;
+    coap_packet_t message[1];
+    multi_option_t * optionP;
+
+    length = prv_buildRequest(buffer);
+    CU_ASSERT_FATAL(length > 0);
+
+    MEMORY_TRACE_BEFORE;
+
+    CU_ASSERT_EQUAL(coap_parse_message(message, buffer, (uint16_t)length), NO_ERROR);
+    CU_ASSERT_EQUAL(message->mid, 0x1234);
+    CU_ASSERT_EQUAL(message->parsed_option_count, 5);
+
+    // no allocation: options are stored in the packet and point into the buffer
+    MEMORY_TRACE_AFTER_EQ;
+
+    optionP = message->uri_path;
+    CU_ASSERT_PTR_NOT_NULL_FATAL(optionP);
+    CU_ASSERT_PTR_EQUAL(optionP, &message->parsed_options[0]);
+    CU_ASSERT_EQUAL(optionP->len, 1);
+    CU_ASSERT_EQUAL(optionP->data[0], '3');
+    CU_ASSERT_TRUE(optionP->data > buffer && optionP->data < buffer + length);
+    optionP = optionP->next;
+    CU_ASSERT_PTR_NOT_NULL_FATAL(optionP);
+    CU_ASSERT_EQUAL(optionP->data[0], '0');
+    optionP = optionP->next;
+    CU_ASSERT_PTR_NOT_NULL_FATAL(optionP);
+    CU_ASSERT_EQUAL(optionP->data[0], '1');
+    CU_ASSERT_PTR_NULL(optionP->next);
+
+    optionP = message->uri_query;
+    CU_ASSERT_PTR_NOT_NULL_FATAL(optionP);
+    CU_ASSERT_EQUAL(optionP->len, 3);
+    CU_ASSERT_EQUAL(memcmp(optionP->data, "a=1", 3), 0);
+    optionP = optionP->next;
+    CU_ASSERT_PTR_NOT_NULL_FATAL(optionP);
+    CU_ASSERT_EQUAL(optionP->len, 4);
+    CU_ASSERT_EQUAL(memcmp(optionP->data, "bc=2", 4), 0);
+    CU_ASSERT_PTR_NULL(optionP->next);
+
+    coap_free_header(message);
+    CU_ASSERT_PTR_NULL(message->uri_path);
+    CU_ASSERT_PTR_NULL(message->uri_query);
+}
+
+static void test_coap_parse_many_options(void)
+{
+    uint8_t buffer[128];
+    size_t length;
+    coap_packet_t message[1];
+    multi_option_t * optionP;
+    int count;
+
+    coap_init_message(message, COAP_TYPE_CON, COAP_POST, 1);
+    coap_set_header_uri_path(message, "/rd");
+    coap_set_header_uri_query(message, "ep=test&lt=300&lwm2m=1.0&b=U&sms=123&a=1&b=2&c=3&d=4&e=5");
+    length = coap_serialize_message(message, buffer);
+    CU_ASSERT_FATAL(length > 0);
+
+    MEMORY_TRACE_BEFORE;
+
+    CU_ASSERT_EQUAL(coap_parse_message(message, buffer, (uint16_t)length), NO_ERROR);
+    CU_ASSERT_EQUAL(message->parsed_option_count, COAP_MAX_PARSED_OPTIONS);
+
+    count = 0;
+    for (optionP = message->uri_query ; optionP != NULL ; optionP = optionP->next)
+    {
+        count++;
+    }
+    CU_ASSERT_EQUAL(count, 10);
+    CU_ASSERT_EQUAL(message->uri_path->len, 2);
+
+    // options exceeding the packet storage are released
+    coap_free_header(message);
+
+    MEMORY_TRACE_AFTER_EQ;
+}
+
+static void test_coap_serialize_header(void)
+{
+    uint8_t payload[] = "</1/0>,</3/0>";
+    uint8_t full[128];
+    uint8_t header[128];
+    size_t fullLength;
+    size_t headerLength;
+    coap_packet_t message[1];
+
+    coap_init_message(message, COAP_TYPE_CON, COAP_POST, 0x4321);
+    coap_set_header_uri_path(message, "/rd");
+    coap_set_header_content_type(message, LWM2M_CONTENT_LINK);
+    coap_set_payload(message, payload, sizeof(payload) - 1);
+    fullLength = coap_serialize_message(message, full);
+    CU_ASSERT_FATAL(fullLength > sizeof(payload) - 1);
+
+    coap_init_message(message, COAP_TYPE_CON, COAP_POST, 0x4321);
+    coap_set_header_uri_path(message, "/rd");
+    coap_set_header_content_type(message, LWM2M_CONTENT_LINK);
+    coap_set_payload(message, payload, sizeof(payload) - 1);
+    headerLength = coap_serialize_header(message, header);
+
+    // the header followed by the untouched payload is the serialized message
+    CU_ASSERT_EQUAL(headerLength + sizeof(payload) - 1, fullLength);
+    CU_ASSERT_EQUAL(memcmp(header, full, headerLength), 0);
+    CU_ASSERT_EQUAL(header[headerLength - 1], 0xFF);
+    CU_ASSERT_EQUAL(memcmp(full + headerLength, payload, sizeof(payload) - 1), 0);
+    CU_ASSERT_TRUE(fullLength <= coap_serialize_get_size(message));
+}
+
+static struct TestTable table[] = {
+        { "test of test_coap_parse_inline()", test_coap_parse_inline },
+        { "test of test_coap_parse_many_options()", test_coap_parse_many_options },
+        { "test of test_coap_serialize_header()", test_coap_serialize_header },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_coap_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_coap", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
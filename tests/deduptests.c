@@ -0,0 +1,132 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "connection.h"
+
+#include <unistd.h>
+
+#define TEST_OBJECT_ID 1024
+
+static int executeCount;
+
+static uint8_t prv_execute(uint16_t instanceId,
+                           uint16_t resourceId,
+                           uint8_t * buffer,
+                           int length,
+                           lwm2m_object_t * objectP)
+{
+    (void)instanceId;
+    (void)resourceId;
+    (void)buffer;
+    (void)length;
+    (void)objectP;
+
+    executeCount++;
+    return COAP_204_CHANGED;
+}
+
+// CON POST /1024/0/1 with a one byte token
+static size_t prv_execute_request(uint16_t mid,
+                                  uint8_t * buffer)
+{
+    coap_packet_t message[1];
+
+    coap_init_message(message, COAP_TYPE_CON, COAP_POST, mid);
+    coap_set_header_token(message, (const uint8_t *)"t", 1);
+    coap_set_header_uri_path(message, "/1024/0/1");
+
+    return coap_serialize_message(message, buffer);
+}
+
+static void test_dedup_replay(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t server;
+    connection_t * connP;
+    uint8_t request[64];
+    uint8_t first[64];
+    uint8_t second[64];
+    ssize_t firstLength;
+    size_t length;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.executeFunc = prv_execute;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    // the server is the test itself
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+    memset(&server, 0, sizeof(server));
+    server.sessionH = connP;
+    server.status = STATE_REGISTERED;
+    contextP->serverList = &server;
+
+    executeCount = 0;
+    length = prv_execute_request(0x4242, request);
+    CU_ASSERT_FATAL(length > 0);
+    lwm2m_handle_packet(contextP, request, (int)length, connP);
+    CU_ASSERT_EQUAL(executeCount, 1);
+    firstLength = recv(sock, first, sizeof(first), MSG_DONTWAIT);
+    CU_ASSERT_FATAL(firstLength >= COAP_HEADER_LEN);
+    CU_ASSERT_EQUAL(first[1], COAP_204_CHANGED);
+
+    // the retransmission gets the same ACK without being executed again
+    lwm2m_handle_packet(contextP, request, (int)length, connP);
+    CU_ASSERT_EQUAL(executeCount, 1);
+    CU_ASSERT_EQUAL(recv(sock, second, sizeof(second), MSG_DONTWAIT), firstLength);
+    CU_ASSERT_EQUAL(memcmp(first, second, firstLength), 0);
+
+    // another message ID is another request
+    length = prv_execute_request(0x4243, request);
+    lwm2m_handle_packet(contextP, request, (int)length, connP);
+    CU_ASSERT_EQUAL(executeCount, 2);
+    CU_ASSERT(recv(sock, second, sizeof(second), MSG_DONTWAIT) > 0);
+    CU_ASSERT_EQUAL(contextP->dedup.index.count, 2);
+
+    contextP->serverList = NULL;
+    contextP->objectList = NULL;
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static struct TestTable table[] = {
+        { "test of test_dedup_replay()", test_dedup_replay },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_dedup_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_dedup", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
@@ -0,0 +1,145 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "memtest.h"
+
+#define ITEM_COUNT 300
+
+typedef struct
+{
+    uint16_t id;
+} item_t;
+
+static size_t prv_hash(void * itemP)
+{
+    return index_hashInt(((item_t *)itemP)->id);
+}
+
+// all items collide to stress linear probing and backward shift removal
+static size_t prv_badHash(void * itemP)
+{
+    (void)itemP;
+    return 7;
+}
+
+static bool prv_match(void * itemP, void * keyP)
+{
+    return ((item_t *)itemP)->id == *(uint16_t *)keyP;
+}
+
+static void prv_checkAll(lwm2m_index_t * indexP, item_t * items, bool * present, index_hash_callback_t hashFunc)
+{
+    uint16_t i;
+
+    for (i = 0 ; i < ITEM_COUNT ; i++)
+    {
+        void * found = index_find(indexP, hashFunc(&items[i]), prv_match, &i);
+        if (present[i])
+        {
+            CU_ASSERT_PTR_EQUAL(found, &items[i]);
+        }
+        else
+        {
+            CU_ASSERT_PTR_NULL(found);
+        }
+    }
+}
+
+static void prv_insertRemove(index_hash_callback_t hashFunc)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_index_t index;
+    item_t items[ITEM_COUNT];
+    bool present[ITEM_COUNT];
+    uint16_t i;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    MEMORY_TRACE_BEFORE;
+
+    memset(&index, 0, sizeof(index));
+    for (i = 0 ; i < ITEM_COUNT ; i++)
+    {
+        items[i].id = i;
+        present[i] = true;
+        CU_ASSERT_EQUAL(index_insert(contextP, &index, &items[i], hashFunc), 0);
+    }
+    CU_ASSERT_EQUAL(index.count, ITEM_COUNT);
+    prv_checkAll(&index, items, present, hashFunc);
+
+    for (i = 0 ; i < ITEM_COUNT ; i += 3)
+    {
+        index_remove(&index, &items[i], hashFunc);
+        present[i] = false;
+    }
+    prv_checkAll(&index, items, present, hashFunc);
+
+    // removing an absent item is harmless
+    index_remove(&index, &items[0], hashFunc);
+    prv_checkAll(&index, items, present, hashFunc);
+
+    for (i = 0 ; i < ITEM_COUNT ; i += 3)
+    {
+        CU_ASSERT_EQUAL(index_insert(contextP, &index, &items[i], hashFunc), 0);
+        present[i] = true;
+    }
+    CU_ASSERT_EQUAL(index.count, ITEM_COUNT);
+    prv_checkAll(&index, items, present, hashFunc);
+
+    index_clear(contextP, &index);
+    CU_ASSERT_EQUAL(index.count, 0);
+    CU_ASSERT_PTR_NULL(index.slots);
+
+    MEMORY_TRACE_AFTER_EQ;
+    lwm2m_close(contextP);
+}
+
+static void test_index_nominal(void)
+{
+    prv_insertRemove(prv_hash);
+}
+
+static void test_index_collisions(void)
+{
+    prv_insertRemove(prv_badHash);
+}
+
+static void test_index_hash_buffer(void)
+{
+    CU_ASSERT_EQUAL(index_hashBuffer((uint8_t *)"abc", 3), index_hashBuffer((uint8_t *)"abc", 3));
+    CU_ASSERT_NOT_EQUAL(index_hashBuffer((uint8_t *)"abc", 3), index_hashBuffer((uint8_t *)"abd", 3));
+}
+
+static struct TestTable table[] = {
+        { "test of test_index_nominal()", test_index_nominal },
+        { "test of test_index_collisions()", test_index_collisions },
+        { "test of test_index_hash_buffer()", test_index_hash_buffer },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_index_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_index", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
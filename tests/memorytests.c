@@ -0,0 +1,259 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "memtest.h"
+
+#define OBJECT_COUNT 20
+
+static int allocCount;
+static int freeCount;
+
+static void * prv_malloc(size_t size, void * userData)
+{
+    (*(int *)userData)++;
+    allocCount++;
+    return malloc(size);
+}
+
+static void prv_free(void * ptr, void * userData)
+{
+    (void)userData;
+    freeCount++;
+    free(ptr);
+}
+
+static void test_memory_pool(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_allocator_t allocator;
+    int userCount = 0;
+    void * objects[OBJECT_COUNT];
+    void * firstP;
+    int allocs;
+    int i;
+
+    allocCount = 0;
+    freeCount = 0;
+    allocator.mallocFunc = prv_malloc;
+    allocator.freeFunc = prv_free;
+    allocator.userData = &userCount;
+
+    contextP = lwm2m_init_with_allocator(NULL, &allocator);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    CU_ASSERT_EQUAL(allocCount, 1);
+    CU_ASSERT_EQUAL(userCount, 1);
+
+    for (i = 0 ; i < OBJECT_COUNT ; i++)
+    {
+        objects[i] = memory_poolAlloc(contextP, LWM2M_POOL_TRANSACTION);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(objects[i]);
+        memset(objects[i], 0xA5, sizeof(lwm2m_transaction_t));
+    }
+    // objects come by slabs
+    CU_ASSERT_TRUE(allocCount < 1 + OBJECT_COUNT);
+    allocs = allocCount;
+
+    firstP = objects[0];
+    for (i = 0 ; i < OBJECT_COUNT ; i++)
+    {
+        memory_poolFree(objects[i]);
+    }
+    CU_ASSERT_EQUAL(freeCount, 0);
+
+    // freed objects are reused without allocation
+    for (i = 0 ; i < OBJECT_COUNT ; i++)
+    {
+        objects[i] = memory_poolAlloc(contextP, LWM2M_POOL_TRANSACTION);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(objects[i]);
+    }
+    CU_ASSERT_EQUAL(allocCount, allocs);
+    CU_ASSERT_PTR_EQUAL(objects[OBJECT_COUNT - 1], firstP);
+    for (i = 0 ; i < OBJECT_COUNT ; i++)
+    {
+        memory_poolFree(objects[i]);
+    }
+
+    lwm2m_close(contextP);
+    CU_ASSERT_EQUAL(freeCount, allocCount);
+}
+
+static size_t prv_hash(void * itemP)
+{
+    return index_hashInt(*(uint16_t *)itemP);
+}
+
+static void prv_expired(lwm2m_context_t * contextP,
+                        void * itemP,
+                        time_t currentTime)
+{
+    (void)contextP;
+    (void)itemP;
+    (void)currentTime;
+}
+
+static void test_memory_tables(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_allocator_t allocator;
+    lwm2m_transaction_t * transacP;
+    lwm2m_timer_t timer;
+    lwm2m_index_t index;
+    uint16_t key = 42;
+    uint8_t payload[64];
+    int userCount = 0;
+    int allocs;
+
+    allocCount = 0;
+    freeCount = 0;
+    allocator.mallocFunc = prv_malloc;
+    allocator.freeFunc = prv_free;
+    allocator.userData = &userCount;
+
+    contextP = lwm2m_init_with_allocator(NULL, &allocator);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    // the index tables, the timer heap and the payloads of the transactions come from the allocator
+    allocs = allocCount;
+    memset(&index, 0, sizeof(index));
+    CU_ASSERT_EQUAL(index_insert(contextP, &index, &key, prv_hash), 0);
+    CU_ASSERT_EQUAL(allocCount, allocs + 1);
+
+    allocs = allocCount;
+    timer_init(&timer, prv_expired, NULL);
+    CU_ASSERT_EQUAL(timer_schedule(contextP, &timer, lwm2m_gettime() + 10), 0);
+    CU_ASSERT_EQUAL(allocCount, allocs + 1);
+
+    transacP = transaction_new(contextP, &userCount, COAP_PUT, NULL, NULL, 1, 0, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(transacP);
+    memset(payload, 'a', sizeof(payload));
+    allocs = allocCount;
+    CU_ASSERT_EQUAL(transaction_setBlock1(contextP, transacP, 16, sizeof(payload), payload, NULL, NULL), 0);
+    CU_ASSERT_EQUAL(allocCount, allocs + 1);
+    transaction_free(contextP, transacP);
+
+    timer_cancel(contextP, &timer);
+    index_clear(contextP, &index);
+    lwm2m_close(contextP);
+    CU_ASSERT_EQUAL(freeCount, allocCount);
+}
+
+static void test_memory_arena(void)
+{
+    lwm2m_context_t * contextP;
+    uint8_t * smallP;
+    uint8_t * bigP;
+    uint8_t * chunkP;
+
+    MEMORY_TRACE_BEFORE;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    smallP = (uint8_t *)memory_arenaAlloc(contextP, 3);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(smallP);
+    CU_ASSERT_TRUE(memory_arenaOwns(contextP, smallP));
+    CU_ASSERT_FALSE(memory_arenaOwns(contextP, contextP));
+
+    bigP = (uint8_t *)memory_arenaAlloc(contextP, 4000);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bigP);
+    memset(bigP, 0, 4000);
+    CU_ASSERT_TRUE(memory_arenaOwns(contextP, bigP));
+
+    // the chunks are merged on reset
+    memory_arenaReset(contextP);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP->arena.chunkList);
+    chunkP = (uint8_t *)memory_arenaAlloc(contextP, 4000);
+    CU_ASSERT_PTR_NOT_NULL(chunkP);
+    memory_arenaAlloc(contextP, 3);
+    memory_arenaReset(contextP);
+    CU_ASSERT_PTR_EQUAL(memory_arenaAlloc(contextP, 4000), chunkP);
+
+    lwm2m_close(contextP);
+
+    MEMORY_TRACE_AFTER_EQ;
+}
+
+static void test_memory_data_parse(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_data_t * dataP;
+    int size;
+    // instance 0 with resources 1 "ab" and 2 0x05
+    uint8_t tlv[] = {0x08, 0x00, 0x07, 0xC2, 0x01, 'a', 'b', 0xC1, 0x02, 0x05};
+
+    MEMORY_TRACE_BEFORE;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    size = data_parse(contextP, NULL, tlv, sizeof(tlv), LWM2M_CONTENT_TLV, &dataP);
+    CU_ASSERT_EQUAL_FATAL(size, 1);
+    CU_ASSERT_TRUE(memory_arenaOwns(contextP, dataP));
+    CU_ASSERT_EQUAL(dataP->type, LWM2M_TYPE_OBJECT_INSTANCE);
+    CU_ASSERT_EQUAL_FATAL(dataP->value.asChildren.count, 2);
+    CU_ASSERT_EQUAL(dataP->value.asChildren.array[0].value.asBuffer.length, 2);
+    CU_ASSERT_EQUAL(memcmp(dataP->value.asChildren.array[0].value.asBuffer.buffer, "ab", 2), 0);
+    CU_ASSERT_PTR_EQUAL(dataP->value.asChildren.array[1].value.asBuffer.buffer, tlv + 9);
+
+    data_free(contextP, size, dataP);
+    memory_arenaReset(contextP);
+
+#ifdef LWM2M_SUPPORT_JSON
+    {
+        const char * json = "{\"bn\":\"/3/0/\",\"e\":[{\"n\":\"1\",\"sv\":\"ab\"},{\"n\":\"7/0\",\"v\":5}]}";
+        lwm2m_uri_t uri;
+
+        lwm2m_stringToUri("/3/0", 4, &uri);
+        size = data_parse(contextP, &uri, (uint8_t *)json, strlen(json), LWM2M_CONTENT_JSON, &dataP);
+        CU_ASSERT_EQUAL_FATAL(size, 2);
+        CU_ASSERT_TRUE(memory_arenaOwns(contextP, dataP));
+        CU_ASSERT_EQUAL(dataP[0].type, LWM2M_TYPE_STRING);
+        CU_ASSERT_PTR_EQUAL(dataP[0].value.asBuffer.buffer, json + 34);
+        CU_ASSERT_EQUAL(dataP[1].type, LWM2M_TYPE_MULTIPLE_RESOURCE);
+        CU_ASSERT_TRUE(memory_arenaOwns(contextP, dataP[1].value.asChildren.array));
+        CU_ASSERT_EQUAL(dataP[1].value.asChildren.array[0].value.asInteger, 5);
+
+        data_free(contextP, size, dataP);
+        memory_arenaReset(contextP);
+    }
+#endif
+
+    lwm2m_close(contextP);
+
+    MEMORY_TRACE_AFTER_EQ;
+}
+
+static struct TestTable table[] = {
+        { "test of test_memory_pool()", test_memory_pool },
+        { "test of test_memory_tables()", test_memory_tables },
+        { "test of test_memory_arena()", test_memory_arena },
+        { "test of test_memory_data_parse()", test_memory_data_parse },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_memory_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_memory", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
@@ -0,0 +1,388 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "connection.h"
+
+#include <unistd.h>
+
+#define TEST_OBJECT_ID 1024
+
+static int readCount;
+static int64_t resourceValue;
+
+static uint8_t prv_read(uint16_t instanceId,
+                        int * numDataP,
+                        lwm2m_data_t ** dataArrayP,
+                        lwm2m_object_t * objectP)
+{
+    (void)instanceId;
+    (void)objectP;
+
+    readCount++;
+    if (*numDataP == 0)
+    {
+        // the instance has a single resource
+        *dataArrayP = lwm2m_data_new(1);
+        if (*dataArrayP == NULL) return COAP_500_INTERNAL_SERVER_ERROR;
+        (*dataArrayP)->id = 1;
+        *numDataP = 1;
+    }
+    if (*numDataP != 1) return COAP_404_NOT_FOUND;
+    lwm2m_data_encode_int(resourceValue, *dataArrayP);
+
+    return COAP_205_CONTENT;
+}
+
+// the server is the test itself
+static int prv_open_server(lwm2m_server_t * serverP)
+{
+    connection_t * connP;
+    int sock;
+
+    memset(serverP, 0, sizeof(lwm2m_server_t));
+    sock = test_open_loopback(&connP);
+    serverP->sessionH = connP;
+
+    return sock;
+}
+
+static int prv_count_notifications(int sock)
+{
+    uint8_t buffer[64];
+    int count = 0;
+
+    while (recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) count++;
+
+    return count;
+}
+
+static void test_observe_step(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t server;
+    lwm2m_uri_t uri;
+    lwm2m_attributes_t attr;
+    coap_packet_t message[1];
+    coap_packet_t response[1];
+    lwm2m_data_t * dataP;
+    time_t now;
+    time_t timeout;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.readFunc = prv_read;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    sock = prv_open_server(&server);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    lwm2m_stringToUri("/1024/0/1", 9, &uri);
+    resourceValue = 10;
+    dataP = lwm2m_data_new(1);
+    lwm2m_data_encode_int(resourceValue, dataP);
+    coap_init_message(message, COAP_TYPE_CON, COAP_GET, 1);
+    coap_init_message(response, COAP_TYPE_ACK, COAP_205_CONTENT, 1);
+    coap_set_header_token(message, (const uint8_t *)"ab", 2);
+    coap_set_header_observe(message, 0);
+    CU_ASSERT_EQUAL(observe_handleRequest(contextP, &uri, &server, 1, dataP, message, response), COAP_205_CONTENT);
+    lwm2m_data_free(1, dataP);
+
+    // nothing changed and no period: the resource is not read
+    readCount = 0;
+    now = lwm2m_gettime();
+    timeout = 60;
+    timer_step(contextP, now, &timeout);
+    CU_ASSERT_EQUAL(readCount, 0);
+    CU_ASSERT_EQUAL(timeout, 60);
+
+    // a change is read and notified once
+    resourceValue = 11;
+    lwm2m_resource_value_changed(contextP, &uri);
+    timer_step(contextP, now, &timeout);
+    CU_ASSERT_EQUAL(readCount, 1);
+    CU_ASSERT_EQUAL(prv_count_notifications(sock), 1);
+    timer_step(contextP, now, &timeout);
+    CU_ASSERT_EQUAL(readCount, 1);
+
+    // a change not crossing the step is read but not notified
+    memset(&attr, 0, sizeof(attr));
+    attr.toSet = LWM2M_ATTR_FLAG_STEP | LWM2M_ATTR_FLAG_MAX_PERIOD;
+    attr.step = 5;
+    attr.maxPeriod = 30;
+    CU_ASSERT_EQUAL(observe_setParameters(contextP, &uri, &server, &attr), COAP_204_CHANGED);
+    readCount = 0;
+    resourceValue = 12;
+    lwm2m_resource_value_changed(contextP, &uri);
+    timeout = 60;
+    timer_step(contextP, now, &timeout);
+    CU_ASSERT_EQUAL(readCount, 1);
+    CU_ASSERT_EQUAL(prv_count_notifications(sock), 0);
+    // the maximal period is the next deadline
+    CU_ASSERT(timeout <= 30 && timeout > 0);
+    timer_step(contextP, now + 10, &timeout);
+    CU_ASSERT_EQUAL(readCount, 1);
+
+    // the maximal period is notified without a change
+    timer_step(contextP, now + 31, &timeout);
+    CU_ASSERT_EQUAL(readCount, 2);
+    CU_ASSERT_EQUAL(prv_count_notifications(sock), 1);
+
+    // cancelling the observation stops its deadlines
+    observe_cancel(contextP, contextP->observedList->watcherList->lastMid, server.sessionH);
+    CU_ASSERT_PTR_NULL(contextP->observedList);
+    CU_ASSERT_EQUAL(contextP->scheduler.count, 0);
+
+    contextP->objectList = NULL;
+    lwm2m_close(contextP);
+    connection_free((connection_t *)server.sessionH);
+    close(sock);
+}
+
+static lwm2m_watcher_t * prv_observe(lwm2m_context_t * contextP,
+                                     const char * uriString,
+                                     lwm2m_server_t * serverP,
+                                     uint32_t observe)
+{
+    lwm2m_uri_t uri;
+    coap_packet_t message[1];
+    coap_packet_t response[1];
+    lwm2m_data_t * dataP;
+    lwm2m_observed_t * observedP;
+    uint8_t result;
+
+    lwm2m_stringToUri(uriString, strlen(uriString), &uri);
+    dataP = lwm2m_data_new(1);
+    lwm2m_data_encode_int(resourceValue, dataP);
+    coap_init_message(message, COAP_TYPE_CON, COAP_GET, 1);
+    coap_init_message(response, COAP_TYPE_ACK, COAP_205_CONTENT, 1);
+    coap_set_header_token(message, (const uint8_t *)"ab", 2);
+    coap_set_header_observe(message, observe);
+    result = observe_handleRequest(contextP, &uri, serverP, 1, dataP, message, response);
+    lwm2m_data_free(1, dataP);
+    if (result != COAP_205_CONTENT) return NULL;
+
+    observedP = observe_findByUri(contextP, &uri);
+    if (observedP == NULL) return NULL;
+    return observedP->watcherList;
+}
+
+static void test_observe_index(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t server;
+    lwm2m_watcher_t * objectWatcherP;
+    lwm2m_watcher_t * resourceWatcherP;
+    lwm2m_uri_t uri;
+    time_t now;
+    time_t timeout;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.readFunc = prv_read;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    sock = prv_open_server(&server);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    resourceValue = 1;
+    objectWatcherP = prv_observe(contextP, "/1024", &server, 0);
+    resourceWatcherP = prv_observe(contextP, "/1024/0/1", &server, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(objectWatcherP);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(resourceWatcherP);
+    CU_ASSERT_PTR_NULL(prv_observe(contextP, "/1024/0", &server, 1));
+
+    // the watchers have no MID before their first notification, a reset can not cancel them
+    CU_ASSERT_EQUAL(contextP->watcherMidIndex.count, 0);
+    observe_cancel(contextP, resourceWatcherP->lastMid, server.sessionH);
+    CU_ASSERT_PTR_NOT_NULL(contextP->observedList);
+
+    // a change of the resource reaches the object and the resource observations
+    lwm2m_stringToUri("/1024/0/1", 9, &uri);
+    lwm2m_resource_value_changed(contextP, &uri);
+    CU_ASSERT_TRUE(objectWatcherP->update);
+    CU_ASSERT_TRUE(resourceWatcherP->update);
+    now = lwm2m_gettime();
+    timeout = 60;
+    timer_step(contextP, now, &timeout);
+    CU_ASSERT_EQUAL(prv_count_notifications(sock), 2);
+    CU_ASSERT_EQUAL(contextP->watcherMidIndex.count, 2);
+
+    // another resource only reaches the object
+    lwm2m_stringToUri("/1024/0/2", 9, &uri);
+    lwm2m_resource_value_changed(contextP, &uri);
+    CU_ASSERT_TRUE(objectWatcherP->update);
+    CU_ASSERT_FALSE(resourceWatcherP->update);
+
+    // an instance reaches both
+    objectWatcherP->update = false;
+    lwm2m_stringToUri("/1024/0", 7, &uri);
+    lwm2m_resource_value_changed(contextP, &uri);
+    CU_ASSERT_TRUE(objectWatcherP->update);
+    CU_ASSERT_TRUE(resourceWatcherP->update);
+    timer_step(contextP, now, &timeout);
+    CU_ASSERT_EQUAL(prv_count_notifications(sock), 2);
+
+    // a reset cancels the watcher of the last notification it answers, for its peer only
+    observe_cancel(contextP, resourceWatcherP->lastMid, NULL);
+    lwm2m_stringToUri("/1024/0/1", 9, &uri);
+    CU_ASSERT_PTR_NOT_NULL(observe_findByUri(contextP, &uri));
+    observe_cancel(contextP, resourceWatcherP->lastMid, server.sessionH);
+    CU_ASSERT_PTR_NULL(observe_findByUri(contextP, &uri));
+    CU_ASSERT_EQUAL(contextP->observedIndex.count, 1);
+    CU_ASSERT_EQUAL(contextP->watcherMidIndex.count, 1);
+
+    // an observe cancellation only cancels its URI
+    CU_ASSERT_PTR_NULL(prv_observe(contextP, "/1024", &server, 1));
+    CU_ASSERT_PTR_NULL(contextP->observedList);
+    CU_ASSERT_EQUAL(contextP->observedIndex.count, 0);
+    CU_ASSERT_EQUAL(contextP->watcherMidIndex.count, 0);
+
+    contextP->objectList = NULL;
+    lwm2m_close(contextP);
+    connection_free((connection_t *)server.sessionH);
+    close(sock);
+}
+
+static int prv_receive_notification(int sock,
+                                    uint8_t * buffer,
+                                    size_t size,
+                                    coap_packet_t * message)
+{
+    ssize_t length;
+
+    length = recv(sock, buffer, size, MSG_DONTWAIT);
+    if (length <= 0) return -1;
+    if (coap_parse_message(message, buffer, (uint16_t)length) != NO_ERROR) return -1;
+
+    return 0;
+}
+
+static void test_observe_fanout(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_object_t object;
+    lwm2m_list_t instance;
+    lwm2m_server_t servers[3];
+    lwm2m_watcher_t * watchers[3];
+    uint8_t buffers[3][128];
+    coap_packet_t messages[3];
+    const uint8_t * tokenP;
+    uint32_t observe;
+    lwm2m_uri_t uri;
+    time_t timeout;
+    int socks[3];
+    int i;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    memset(&instance, 0, sizeof(instance));
+    memset(&object, 0, sizeof(object));
+    object.objID = TEST_OBJECT_ID;
+    object.instanceList = &instance;
+    object.readFunc = prv_read;
+    CU_ASSERT_EQUAL(lwm2m_add_object(contextP, &object), COAP_NO_ERROR);
+
+    resourceValue = 1;
+    for (i = 0 ; i < 3 ; i++)
+    {
+        socks[i] = prv_open_server(servers + i);
+        CU_ASSERT_FATAL(socks[i] >= 0);
+        watchers[i] = prv_observe(contextP, "/1024/0/1", servers + i, 0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(watchers[i]);
+    }
+    // the watchers are added in front of the list
+    CU_ASSERT_PTR_EQUAL(contextP->observedList->watcherList, watchers[2]);
+    // the first and last watchers share a template, the middle one gets its own
+    memcpy(watchers[0]->token, "wxyz1234", 8);
+    watchers[0]->tokenLen = 8;
+    watchers[0]->counter = 0x1000000 + 5;
+    watchers[1]->format = LWM2M_CONTENT_TEXT;
+    watchers[2]->tokenLen = 0;
+
+    resourceValue = 42;
+    readCount = 0;
+    lwm2m_stringToUri("/1024/0/1", 9, &uri);
+    lwm2m_resource_value_changed(contextP, &uri);
+    timeout = 60;
+    timer_step(contextP, lwm2m_gettime(), &timeout);
+
+    for (i = 0 ; i < 3 ; i++)
+    {
+        CU_ASSERT_EQUAL_FATAL(prv_receive_notification(socks[i], buffers[i], sizeof(buffers[i]), messages + i), 0);
+        CU_ASSERT_EQUAL(messages[i].type, COAP_TYPE_NON);
+        CU_ASSERT_EQUAL(messages[i].code, COAP_205_CONTENT);
+        CU_ASSERT_EQUAL(messages[i].mid, watchers[i]->lastMid);
+        CU_ASSERT_EQUAL((size_t)coap_get_header_token(messages + i, &tokenP), watchers[i]->tokenLen);
+        CU_ASSERT_EQUAL(memcmp(tokenP, watchers[i]->token, watchers[i]->tokenLen), 0);
+        CU_ASSERT_EQUAL(coap_get_header_observe(messages + i, &observe), 1);
+        CU_ASSERT_EQUAL(observe, (watchers[i]->counter - 1) & 0xFFFFFF);
+        CU_ASSERT_EQUAL(messages[i].content_type, (coap_content_type_t)watchers[i]->format);
+        CU_ASSERT_EQUAL(prv_count_notifications(socks[i]), 0);
+    }
+    CU_ASSERT_NOT_EQUAL(messages[0].mid, messages[2].mid);
+    CU_ASSERT_EQUAL(messages[0].payload_len, messages[2].payload_len);
+    CU_ASSERT_EQUAL(memcmp(messages[0].payload, messages[2].payload, messages[0].payload_len), 0);
+    CU_ASSERT_EQUAL(messages[1].payload_len, 2);
+    CU_ASSERT_EQUAL(memcmp(messages[1].payload, "42", 2), 0);
+    // the value was read once for all the watchers
+    CU_ASSERT_EQUAL(readCount, 1);
+
+    contextP->objectList = NULL;
+    lwm2m_close(contextP);
+    for (i = 0 ; i < 3 ; i++)
+    {
+        connection_free((connection_t *)servers[i].sessionH);
+        close(socks[i]);
+    }
+}
+
+static struct TestTable table[] = {
+        { "test of test_observe_step()", test_observe_step },
+        { "test of test_observe_index()", test_observe_index },
+        { "test of test_observe_fanout()", test_observe_fanout },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_observe_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_observe", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
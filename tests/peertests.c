@@ -0,0 +1,357 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "connection.h"
+
+#include <unistd.h>
+
+// returns the message ID of the datagram received or -1
+static int prv_receive(int sock,
+                       uint8_t * buffer,
+                       size_t size)
+{
+    if (recv(sock, buffer, size, MSG_DONTWAIT) < 4) return -1;
+    return (buffer[2] << 8) | buffer[3];
+}
+
+static void test_peer_estimate(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_peer_t * peerP;
+    lwm2m_peer_stats_t stats;
+    void * sessionH = &stats;
+    time_t timeout;
+    int i;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, sessionH, &stats), -1);
+    CU_ASSERT_EQUAL(peer_getRto(NULL, 100), 2000);
+
+    peerP = peer_acquire(contextP, sessionH, 100);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(peerP);
+    CU_ASSERT_PTR_EQUAL(peer_acquire(contextP, sessionH, 100), peerP);
+    CU_ASSERT_EQUAL(peerP->transactionCount, 2);
+    CU_ASSERT_EQUAL(peer_getRto(peerP, 100), 2000);
+
+    // strong samples, the clock granularity bounds the variance
+    peer_addSample(peerP, 100, 0, 0);
+    CU_ASSERT_EQUAL(peerP->stats.strongRto, 1000);
+    CU_ASSERT_EQUAL(peerP->stats.rto, 1500);
+    peer_addSample(peerP, 100, 0, 0);
+    CU_ASSERT_EQUAL(peerP->stats.rto, 1250);
+    CU_ASSERT_EQUAL(peerP->stats.strongSamples, 2);
+
+    // a weak sample weighs less
+    peer_addSample(peerP, 100, 5, 1);
+    CU_ASSERT_EQUAL(peerP->stats.weakRto, 7500);
+    CU_ASSERT_EQUAL(peerP->stats.rto, (7500 + 3 * 1250) / 4);
+    CU_ASSERT_EQUAL(peerP->stats.weakSamples, 1);
+
+    // too many retransmissions to match the ACK to a transmission
+    peer_addSample(peerP, 100, 5, 3);
+    CU_ASSERT_EQUAL(peerP->stats.weakSamples, 1);
+
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, sessionH, &stats), 0);
+    CU_ASSERT_EQUAL(stats.rto, peerP->stats.rto);
+
+    // a large timeout is aged once not updated for four times its value
+    peerP->stats.rto = 8000;
+    CU_ASSERT_EQUAL(peer_getRto(peerP, 132), 8000);
+    CU_ASSERT_EQUAL(peer_getRto(peerP, 133), 5000);
+
+    for (i = 0 ; i < 100 ; i++)
+    {
+        uint32_t initial = peer_initialTimeout(2000);
+
+        CU_ASSERT(initial >= 2000 && initial <= 3000);
+    }
+    CU_ASSERT_EQUAL(peer_nextTimeout(2000, 2500), 5000);
+    CU_ASSERT_EQUAL(peer_nextTimeout(4000, 5000), 7500);
+    CU_ASSERT_EQUAL(peer_nextTimeout(4000, 50000), 60000);
+
+    // the peer is forgotten once idle and released by its transactions
+    peer_release(peerP);
+    timeout = 1000;
+    timer_step(contextP, 100 + 1000, &timeout);
+    CU_ASSERT_EQUAL(contextP->peerIndex.count, 1);
+    peer_release(peerP);
+    timer_step(contextP, 100 + 2000, &timeout);
+    CU_ASSERT_EQUAL(contextP->peerIndex.count, 0);
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, sessionH, &stats), -1);
+
+    lwm2m_close(contextP);
+}
+
+static void test_peer_transaction(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_transaction_t * transacP;
+    lwm2m_peer_stats_t stats;
+    connection_t * connP;
+    coap_packet_t ack[1];
+    uint8_t buffer[64];
+    time_t now;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    transacP = transaction_new(contextP, connP, COAP_GET, NULL, NULL, 0x1234, 0, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(transacP);
+    transaction_add(contextP, transacP);
+    now = lwm2m_gettime();
+    CU_ASSERT_EQUAL(transaction_send(contextP, transacP), 0);
+    CU_ASSERT_EQUAL(prv_receive(sock, buffer, sizeof(buffer)), 0x1234);
+
+    // the first timeout is randomized from the default one
+    CU_ASSERT(transacP->retrans_time >= now + 2 && transacP->retrans_time <= now + 4);
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, connP, &stats), 0);
+    CU_ASSERT_EQUAL(stats.transmissions, 1);
+
+    coap_init_message(ack, COAP_TYPE_ACK, 0, 0x1234);
+    CU_ASSERT_TRUE(transaction_handleResponse(contextP, connP, ack, NULL));
+    CU_ASSERT_PTR_NULL(contextP->transactionList);
+
+    // the loopback answers within the clock resolution
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, connP, &stats), 0);
+    CU_ASSERT_EQUAL(stats.strongSamples, 1);
+    CU_ASSERT(stats.rto < 2000 || (stats.rto == 2500 && lwm2m_gettime() > now));
+
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static void test_peer_nstart(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_transaction_t * transactions[3];
+    lwm2m_peer_stats_t stats;
+    connection_t * connP;
+    coap_packet_t ack[1];
+    uint8_t buffer[64];
+    int sock;
+    int i;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    // one message is outstanding, the others wait in order
+    for (i = 0 ; i < 3 ; i++)
+    {
+        transactions[i] = transaction_new(contextP, connP, COAP_GET, NULL, NULL, 0x100 + i, 0, NULL);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(transactions[i]);
+        transaction_add(contextP, transactions[i]);
+        CU_ASSERT_EQUAL(transaction_send(contextP, transactions[i]), 0);
+    }
+    CU_ASSERT_EQUAL(prv_receive(sock, buffer, sizeof(buffer)), 0x100);
+    CU_ASSERT_EQUAL(prv_receive(sock, buffer, sizeof(buffer)), -1);
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, connP, &stats), 0);
+    CU_ASSERT_EQUAL(stats.inFlight, 1);
+    CU_ASSERT_EQUAL(stats.queueDepth, 2);
+    CU_ASSERT_EQUAL(stats.maxQueueDepth, 2);
+    CU_ASSERT_EQUAL(stats.queued, 2);
+
+    // the ACK releases the next one
+    coap_init_message(ack, COAP_TYPE_ACK, 0, 0x100);
+    CU_ASSERT_TRUE(transaction_handleResponse(contextP, connP, ack, NULL));
+    CU_ASSERT_EQUAL(prv_receive(sock, buffer, sizeof(buffer)), 0x101);
+    CU_ASSERT_EQUAL(prv_receive(sock, buffer, sizeof(buffer)), -1);
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, connP, &stats), 0);
+    CU_ASSERT_EQUAL(stats.inFlight, 1);
+    CU_ASSERT_EQUAL(stats.queueDepth, 1);
+    CU_ASSERT_EQUAL(stats.transmissions, 2);
+
+    // a removed transaction leaves the queue
+    transaction_remove(contextP, transactions[2]);
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, connP, &stats), 0);
+    CU_ASSERT_EQUAL(stats.queueDepth, 0);
+    coap_init_message(ack, COAP_TYPE_ACK, 0, 0x101);
+    CU_ASSERT_TRUE(transaction_handleResponse(contextP, connP, ack, NULL));
+    CU_ASSERT_EQUAL(prv_receive(sock, buffer, sizeof(buffer)), -1);
+    CU_ASSERT_EQUAL(lwm2m_peer_get_stats(contextP, connP, &stats), 0);
+    CU_ASSERT_EQUAL(stats.inFlight, 0);
+    CU_ASSERT_PTR_NULL(contextP->transactionList);
+
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static void test_peer_close(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_transaction_t * transacP;
+    lwm2m_server_t * serverP;
+    connection_t * connP;
+    coap_packet_t message[1];
+    uint8_t buffer[64];
+    ssize_t length;
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    serverP = (lwm2m_server_t *)lwm2m_malloc(sizeof(lwm2m_server_t));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(serverP);
+    memset(serverP, 0, sizeof(lwm2m_server_t));
+    serverP->sessionH = connP;
+    serverP->location = lwm2m_strdup("/rd/1");
+    serverP->status = STATE_REG_UPDATE_PENDING;
+    contextP->serverList = serverP;
+
+    // an Update is outstanding
+    transacP = transaction_new(contextP, connP, COAP_POST, NULL, NULL, 0x100, 4, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(transacP);
+    coap_set_header_uri_path(transacP->message, serverP->location);
+    transaction_add(contextP, transacP);
+    CU_ASSERT_EQUAL(transaction_send(contextP, transacP), 0);
+    CU_ASSERT_EQUAL(prv_receive(sock, buffer, sizeof(buffer)), 0x100);
+
+    // the Deregister does not wait for it
+    lwm2m_close(contextP);
+    length = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+    CU_ASSERT_FATAL(length > 0);
+    CU_ASSERT_EQUAL_FATAL(coap_parse_message(message, buffer, (uint16_t)length), NO_ERROR);
+    CU_ASSERT_EQUAL(message->code, COAP_DELETE);
+
+    connection_free(connP);
+    close(sock);
+}
+
+static bool failAlloc;
+
+static void * prv_malloc(size_t size, void * userData)
+{
+    (void)userData;
+    if (failAlloc) return NULL;
+    return malloc(size);
+}
+
+static void prv_free(void * ptr, void * userData)
+{
+    (void)userData;
+    free(ptr);
+}
+
+static void prv_ignore(lwm2m_context_t * contextP,
+                       void * itemP,
+                       time_t currentTime)
+{
+    (void)contextP;
+    (void)itemP;
+    (void)currentTime;
+}
+
+// fills the timer heap so that scheduling one more timer allocates
+static lwm2m_timer_t * prv_fillHeap(lwm2m_context_t * contextP,
+                                    time_t deadline)
+{
+    lwm2m_timer_t * timers;
+    size_t count;
+    size_t i;
+
+    count = contextP->scheduler.size - contextP->scheduler.count;
+    timers = (lwm2m_timer_t *)malloc((count + 1) * sizeof(lwm2m_timer_t));
+    for (i = 0 ; i < count ; i++)
+    {
+        timer_init(timers + i, prv_ignore, NULL);
+        CU_ASSERT_EQUAL(timer_schedule(contextP, timers + i, deadline), 0);
+    }
+
+    return timers;
+}
+
+static void test_peer_timer(void)
+{
+    lwm2m_context_t * contextP;
+    lwm2m_allocator_t allocator;
+    lwm2m_peer_t * peerP;
+    lwm2m_timer_t * idleTimers;
+    lwm2m_timer_t * busyTimers;
+    int session;
+    time_t now;
+
+    failAlloc = false;
+    allocator.mallocFunc = prv_malloc;
+    allocator.freeFunc = prv_free;
+    allocator.userData = NULL;
+    contextP = lwm2m_init_with_allocator(NULL, &allocator);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    now = lwm2m_gettime();
+
+    // an idle peer whose timer can not be scheduled again goes at once
+    peerP = peer_acquire(contextP, &session, now);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(peerP);
+    peer_release(peerP);
+    timer_cancel(contextP, &(peerP->timer));
+    idleTimers = prv_fillHeap(contextP, now + 100);
+    failAlloc = true;
+    peerP->timer.callback(contextP, peerP->timer.itemP, now);
+    failAlloc = false;
+    CU_ASSERT_EQUAL(contextP->peerIndex.count, 0);
+
+    // a busy one stays and gets its timer back when acquired
+    peerP = peer_acquire(contextP, &session, now);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(peerP);
+    timer_cancel(contextP, &(peerP->timer));
+    busyTimers = prv_fillHeap(contextP, now + 100);
+    failAlloc = true;
+    peerP->timer.callback(contextP, peerP->timer.itemP, now);
+    CU_ASSERT_EQUAL(contextP->peerIndex.count, 1);
+    CU_ASSERT_EQUAL(peerP->timer.position, 0);
+    CU_ASSERT_PTR_NULL(peer_acquire(contextP, &session, now));
+    failAlloc = false;
+    CU_ASSERT_PTR_EQUAL(peer_acquire(contextP, &session, now), peerP);
+    CU_ASSERT_NOT_EQUAL(peerP->timer.position, 0);
+    peer_release(peerP);
+    peer_release(peerP);
+
+    lwm2m_close(contextP);
+    free(idleTimers);
+    free(busyTimers);
+}
+
+static struct TestTable table[] = {
+        { "test of test_peer_estimate()", test_peer_estimate },
+        { "test of test_peer_transaction()", test_peer_transaction },
+        { "test of test_peer_nstart()", test_peer_nstart },
+        { "test of test_peer_close()", test_peer_close },
+        { "test of test_peer_timer()", test_peer_timer },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_peer_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_peer", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
@@ -0,0 +1,175 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "connection.h"
+
+#ifdef LWM2M_WITH_SEND_QUEUE
+
+#include <unistd.h>
+
+static uint8_t prv_receive(int sock)
+{
+    uint8_t buffer[16];
+
+    if (recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT) != 5) return 0;
+    return buffer[4];
+}
+
+static void test_sendqueue_order(void)
+{
+    lwm2m_context_t * contextP;
+    connection_t * connP = NULL;
+    // version 1, type, no token, code, message ID, one payload byte as marker
+    uint8_t con[] = {0x40, 0x01, 0x00, 0x01, 'c'};
+    uint8_t ack[] = {0x60, 0x44, 0x00, 0x02, 'a'};
+    uint8_t rst[] = {0x70, 0x00, 0x00, 0x03, 'r'};
+    uint8_t non[] = {0x50, 0x45, 0x00, 0x04};
+    uint8_t payload = 'n';
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    CU_ASSERT_FALSE(sendqueue_push(contextP, connP, con, sizeof(con), NULL, 0));
+    CU_ASSERT_EQUAL(prv_receive(sock), 0);
+
+    sendqueue_hold(contextP);
+    sendqueue_hold(contextP);
+    CU_ASSERT_TRUE(sendqueue_push(contextP, connP, con, sizeof(con), NULL, 0));
+    CU_ASSERT_TRUE(sendqueue_push(contextP, connP, ack, sizeof(ack), NULL, 0));
+    CU_ASSERT_TRUE(sendqueue_push(contextP, connP, non, sizeof(non), &payload, 1));
+    CU_ASSERT_TRUE(sendqueue_push(contextP, connP, rst, sizeof(rst), NULL, 0));
+    sendqueue_release(contextP);
+    CU_ASSERT_EQUAL(prv_receive(sock), 0);
+    sendqueue_release(contextP);
+
+    // acknowledgements first, each group in order
+    CU_ASSERT_EQUAL(prv_receive(sock), 'a');
+    CU_ASSERT_EQUAL(prv_receive(sock), 'r');
+    CU_ASSERT_EQUAL(prv_receive(sock), 'c');
+    CU_ASSERT_EQUAL(prv_receive(sock), 'n');
+    CU_ASSERT_EQUAL(prv_receive(sock), 0);
+    CU_ASSERT_EQUAL(contextP->sendQueue.count, 0);
+
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static void test_sendqueue_grow(void)
+{
+    lwm2m_context_t * contextP;
+    connection_t * connP = NULL;
+    uint8_t header[] = {0x50, 0x45, 0x00, 0x00};
+    uint8_t payload[400];
+    uint8_t buffer[sizeof(header) + sizeof(payload)];
+    int sock;
+    int i;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    // more datagrams and more bytes than the initial sizes, copied before growing
+    sendqueue_hold(contextP);
+    for (i = 0 ; i < 20 ; i++)
+    {
+        header[3] = (uint8_t)i;
+        memset(payload, i, sizeof(payload));
+        CU_ASSERT_TRUE(sendqueue_push(contextP, connP, header, sizeof(header), payload, sizeof(payload)));
+    }
+    sendqueue_release(contextP);
+
+    for (i = 0 ; i < 20 ; i++)
+    {
+        CU_ASSERT_EQUAL(recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT), sizeof(buffer));
+        CU_ASSERT_EQUAL(buffer[3], i);
+        CU_ASSERT_EQUAL(buffer[sizeof(buffer) - 1], i);
+    }
+
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static void test_sendqueue_gather(void)
+{
+    lwm2m_context_t * contextP;
+    connection_t * connP = NULL;
+    uint8_t header[] = {0x40, 0x02, 0x00, 0x01};
+    uint8_t payload[] = {'g'};
+    uint8_t other[] = {'o'};
+    int sock;
+
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    sock = test_open_loopback(&connP);
+    CU_ASSERT_FATAL(sock >= 0);
+
+    // the payload is read when flushing, not when pushing
+    sendqueue_hold(contextP);
+    CU_ASSERT_TRUE(sendqueue_pushGather(contextP, connP, header, sizeof(header), payload, sizeof(payload)));
+    header[3] = 0x02;
+    CU_ASSERT_TRUE(sendqueue_pushGather(contextP, connP, header, sizeof(header), other, sizeof(other)));
+    CU_ASSERT_EQUAL(contextP->sendQueue.dataLength, 2 * sizeof(header));
+    payload[0] = 'G';
+    sendqueue_release(contextP);
+
+    CU_ASSERT_EQUAL(prv_receive(sock), 'G');
+    CU_ASSERT_EQUAL(prv_receive(sock), 'o');
+    CU_ASSERT_EQUAL(prv_receive(sock), 0);
+
+    // a forgotten datagram is not sent
+    sendqueue_hold(contextP);
+    CU_ASSERT_TRUE(sendqueue_pushGather(contextP, connP, header, sizeof(header), payload, sizeof(payload)));
+    CU_ASSERT_TRUE(sendqueue_pushGather(contextP, connP, header, sizeof(header), other, sizeof(other)));
+    sendqueue_forget(contextP, connP, payload);
+    CU_ASSERT_EQUAL(contextP->sendQueue.count, 1);
+    sendqueue_release(contextP);
+
+    CU_ASSERT_EQUAL(prv_receive(sock), 'o');
+    CU_ASSERT_EQUAL(prv_receive(sock), 0);
+
+    lwm2m_close(contextP);
+    connection_free(connP);
+    close(sock);
+}
+
+static struct TestTable table[] = {
+        { "test of test_sendqueue_order()", test_sendqueue_order },
+        { "test of test_sendqueue_grow()", test_sendqueue_grow },
+        { "test of test_sendqueue_gather()", test_sendqueue_gather },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_sendqueue_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_sendqueue", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
+
+#endif
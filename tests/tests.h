@@ -19,6 +19,7 @@
 #define TESTS_H_
 
 #include "CUnit/CUError.h"
+#include "connection.h"
 
 struct TestTable {
     const char* name;
@@ -26,11 +27,24 @@ struct TestTable {
 };
 
 CU_ErrorCode add_tests(CU_pSuite pSuite, struct TestTable* testTable);
+// opens a socket on an ephemeral port and a connection to it on the loopback. Returns the socket or -1.
+int test_open_loopback(connection_t ** connPP);
 CU_ErrorCode create_uri_suit();
 CU_ErrorCode create_tlv_suit();
 CU_ErrorCode create_object_read_suit();
 CU_ErrorCode create_convert_numbers_suit();
 CU_ErrorCode create_tlv_json_suit();
 CU_ErrorCode create_block1_suit();
+CU_ErrorCode create_index_suit();
+CU_ErrorCode create_timer_suit();
+CU_ErrorCode create_coap_suit();
+CU_ErrorCode create_memory_suit();
+CU_ErrorCode create_observe_suit();
+CU_ErrorCode create_peer_suit();
+CU_ErrorCode create_dedup_suit();
+CU_ErrorCode create_block2_suit();
+#ifdef LWM2M_WITH_SEND_QUEUE
+CU_ErrorCode create_sendqueue_suit();
+#endif
 
 #endif /* TESTS_H_ */
@@ -0,0 +1,166 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2016 Bosch Software Innovations GmbH, Germany.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * The Eclipse Distribution License is available at
+ *    http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Bosch Software Innovations GmbH - Please refer to git log
+ *
+ *******************************************************************************/
+
+#include "tests.h"
+#include "CUnit/Basic.h"
+#include "internals.h"
+#include "memtest.h"
+
+#define TIMER_COUNT 100
+
+typedef struct
+{
+    lwm2m_timer_t timer;
+    int fired;
+} item_t;
+
+static time_t lastFired;
+static bool inOrder;
+
+static void prv_callback(lwm2m_context_t * contextP,
+                         void * itemP,
+                         time_t currentTime)
+{
+    item_t * item = (item_t *)itemP;
+
+    (void)contextP;
+    (void)currentTime;
+
+    if (item->timer.deadline < lastFired) inOrder = false;
+    lastFired = item->timer.deadline;
+    item->fired++;
+}
+
+static void test_timer_order(void)
+{
+    lwm2m_context_t context;
+    item_t items[TIMER_COUNT];
+    time_t timeout;
+    int i;
+
+    MEMORY_TRACE_BEFORE;
+
+    memset(&context, 0, sizeof(context));
+    for (i = 0 ; i < TIMER_COUNT ; i++)
+    {
+        memset(&items[i], 0, sizeof(item_t));
+        timer_init(&items[i].timer, prv_callback, &items[i]);
+        // deadlines in [10, 46] in scrambled order
+        CU_ASSERT_EQUAL(timer_schedule(&context, &items[i].timer, 10 + (i * 17) % 37), 0);
+    }
+    CU_ASSERT_EQUAL(context.scheduler.count, TIMER_COUNT);
+
+    // move some timers earlier and later, cancel others
+    CU_ASSERT_EQUAL(timer_schedule(&context, &items[1].timer, 5), 0);
+    CU_ASSERT_EQUAL(timer_schedule(&context, &items[2].timer, 100), 0);
+    timer_cancel(&context, &items[3].timer);
+    timer_cancel(&context, &items[3].timer);
+    CU_ASSERT_EQUAL(context.scheduler.count, TIMER_COUNT - 1);
+
+    timeout = 60;
+    lastFired = 0;
+    inOrder = true;
+    timer_step(&context, 4, &timeout);
+    CU_ASSERT_EQUAL(timeout, 1);
+    CU_ASSERT_EQUAL(items[1].fired, 0);
+
+    timer_step(&context, 5, &timeout);
+    CU_ASSERT_EQUAL(items[1].fired, 1);
+    CU_ASSERT_EQUAL(context.scheduler.count, TIMER_COUNT - 2);
+
+    timeout = 60;
+    timer_step(&context, 50, &timeout);
+    CU_ASSERT_TRUE(inOrder);
+    CU_ASSERT_EQUAL(timeout, 50);
+    CU_ASSERT_EQUAL(context.scheduler.count, 1);
+    for (i = 0 ; i < TIMER_COUNT ; i++)
+    {
+        if (i == 2 || i == 3)
+        {
+            CU_ASSERT_EQUAL(items[i].fired, 0);
+        }
+        else
+        {
+            CU_ASSERT_EQUAL(items[i].fired, 1);
+            CU_ASSERT_EQUAL(items[i].timer.position, 0);
+        }
+    }
+
+    timer_clear(&context);
+    CU_ASSERT_EQUAL(context.scheduler.count, 0);
+    CU_ASSERT_PTR_NULL(context.scheduler.heap);
+
+    MEMORY_TRACE_AFTER_EQ;
+}
+
+static void prv_rescheduleCallback(lwm2m_context_t * contextP,
+                                   void * itemP,
+                                   time_t currentTime)
+{
+    item_t * item = (item_t *)itemP;
+
+    item->fired++;
+    if (item->fired < 3)
+    {
+        CU_ASSERT_EQUAL(timer_schedule(contextP, &item->timer, currentTime + 10), 0);
+    }
+}
+
+static void test_timer_reschedule(void)
+{
+    lwm2m_context_t context;
+    item_t item;
+    time_t timeout;
+
+    MEMORY_TRACE_BEFORE;
+
+    memset(&context, 0, sizeof(context));
+    memset(&item, 0, sizeof(item));
+    timer_init(&item.timer, prv_rescheduleCallback, &item);
+    CU_ASSERT_EQUAL(timer_schedule(&context, &item.timer, 10), 0);
+
+    timeout = 60;
+    timer_step(&context, 10, &timeout);
+    CU_ASSERT_EQUAL(item.fired, 1);
+    CU_ASSERT_EQUAL(timeout, 10);
+
+    timer_step(&context, 20, &timeout);
+    timer_step(&context, 30, &timeout);
+    timer_step(&context, 40, &timeout);
+    CU_ASSERT_EQUAL(item.fired, 3);
+    CU_ASSERT_EQUAL(context.scheduler.count, 0);
+
+    timer_clear(&context);
+
+    MEMORY_TRACE_AFTER_EQ;
+}
+
+static struct TestTable table[] = {
+        { "test of test_timer_order()", test_timer_order },
+        { "test of test_timer_reschedule()", test_timer_reschedule },
+        { NULL, NULL },
+};
+
+CU_ErrorCode create_timer_suit() {
+    CU_pSuite pSuite = NULL;
+    pSuite = CU_add_suite("Suite_timer", NULL, NULL);
+
+    if (NULL == pSuite) {
+        return CU_get_error();
+    }
+    return add_tests(pSuite, table);
+}
@@ -384,6 +384,65 @@ static void test_10(void)
     test_data("/12/0", LWM2M_CONTENT_JSON, data1, 17, "10b");
 }
 
+static void test_11(void)
+{
+    const char * buffer = "{\"bn\":\"/3/0/\",\"e\":[                 \
+                         {\"n\":\"0\",\"sv\":\"Open Mobile Alliance\"},  \
+                         {\"n\":\"7/0\",\"v\":3800},                     \
+                         {\"n\":\"7/1\",\"v\":-5.5},                     \
+                         {\"n\":\"15\",\"sv\":\"a \\\"quoted\\\" value\"}, \
+                         {\"n\":\"16\",\"bv\":true}]                     \
+                      }";
+    size_t length = strlen(buffer);
+    lwm2m_uri_t uri;
+    json_parser_t parser;
+    lwm2m_data_t * wholeP;
+    lwm2m_data_t * chunkedP;
+    lwm2m_media_type_t format = LWM2M_CONTENT_TLV;
+    uint8_t * wholeBuffer;
+    uint8_t * chunkedBuffer;
+    uint8_t chunk[5];
+    size_t index;
+    int wholeSize;
+    int chunkedSize;
+    int wholeLength;
+    int chunkedLength;
+
+    lwm2m_stringToUri("/3/0", 4, &uri);
+    wholeSize = lwm2m_data_parse(&uri, (uint8_t *)buffer, length, LWM2M_CONTENT_JSON, &wholeP);
+    CU_ASSERT_EQUAL_FATAL(wholeSize, 4);
+
+    // chunks are reused so that values split over them must be copied
+    json_parserInit(&parser, false);
+    for (index = 0 ; index < length ; index += sizeof(chunk))
+    {
+        size_t chunkLen = length - index < sizeof(chunk) ? length - index : sizeof(chunk);
+
+        memcpy(chunk, buffer + index, chunkLen);
+        CU_ASSERT_EQUAL_FATAL(json_parserFeed(&parser, chunk, chunkLen), 0);
+        memset(chunk, '?', sizeof(chunk));
+    }
+    chunkedSize = json_parserFinish(&parser, NULL, &uri, &chunkedP);
+    CU_ASSERT_EQUAL_FATAL(chunkedSize, wholeSize);
+
+    wholeLength = lwm2m_data_serialize(&uri, wholeSize, wholeP, &format, &wholeBuffer);
+    chunkedLength = lwm2m_data_serialize(&uri, chunkedSize, chunkedP, &format, &chunkedBuffer);
+    CU_ASSERT_TRUE_FATAL(wholeLength > 0);
+    CU_ASSERT_EQUAL_FATAL(chunkedLength, wholeLength);
+    CU_ASSERT_EQUAL(memcmp(wholeBuffer, chunkedBuffer, wholeLength), 0);
+
+    lwm2m_free(wholeBuffer);
+    lwm2m_free(chunkedBuffer);
+    lwm2m_data_free(wholeSize, wholeP);
+    lwm2m_data_free(chunkedSize, chunkedP);
+
+    // an incomplete input is an error
+    json_parserInit(&parser, false);
+    CU_ASSERT_EQUAL(json_parserFeed(&parser, (uint8_t *)buffer, length / 2), 0);
+    CU_ASSERT_EQUAL(json_parserFinish(&parser, NULL, &uri, &chunkedP), -1);
+    CU_ASSERT_PTR_NULL(chunkedP);
+}
+
 static struct TestTable table[] = {
         { "test of test_1()", test_1 },
         { "test of test_2()", test_2 },
@@ -395,6 +454,7 @@ static struct TestTable table[] = {
         { "test of test_8()", test_8 },
         { "test of test_9()", test_9 },
         { "test of test_10()", test_10 },
+        { "test of test_11()", test_11 },
         { NULL, NULL },
 };
 
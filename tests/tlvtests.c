@@ -156,6 +156,79 @@ static void test_tlv_parse()
     MEMORY_TRACE_AFTER_EQ;
 }
 
+#define TLV_INSTANCE_COUNT 300
+
+static void test_tlv_parse_large()
+{
+    // MultiResource 5 {ResourceInstance i {i & 0xFF}}, ids above 255 use the 16 bits form
+    uint8_t buffer[4 + TLV_INSTANCE_COUNT * 4];
+    size_t length;
+    lwm2m_context_t * contextP;
+    lwm2m_data_t * dataP;
+    lwm2m_data_t * arenaP;
+    int result;
+    int i;
+
+    length = 4;
+    for (i = 0 ; i < TLV_INSTANCE_COUNT ; i++)
+    {
+        if (i < 256)
+        {
+            buffer[length++] = 0x41;
+        }
+        else
+        {
+            buffer[length++] = 0x61;
+            buffer[length++] = i >> 8;
+        }
+        buffer[length++] = i & 0xFF;
+        buffer[length++] = i & 0xFF;
+    }
+    buffer[0] = 0x90;
+    buffer[1] = 5;
+    buffer[2] = (length - 4) >> 8;
+    buffer[3] = (length - 4) & 0xFF;
+
+    MEMORY_TRACE_BEFORE;
+
+    result = lwm2m_data_parse(NULL, buffer, length, LWM2M_CONTENT_TLV, &dataP);
+    CU_ASSERT_EQUAL_FATAL(result, 1);
+    CU_ASSERT_EQUAL(dataP->type, LWM2M_TYPE_MULTIPLE_RESOURCE);
+    CU_ASSERT_EQUAL_FATAL(dataP->value.asChildren.count, TLV_INSTANCE_COUNT);
+    for (i = 0 ; i < TLV_INSTANCE_COUNT ; i++)
+    {
+        lwm2m_data_t * subP = dataP->value.asChildren.array + i;
+
+        CU_ASSERT_EQUAL(subP->id, i);
+        CU_ASSERT_EQUAL(subP->value.asBuffer.length, 1);
+        CU_ASSERT_EQUAL(subP->value.asBuffer.buffer[0], i & 0xFF);
+    }
+
+    // in the context arena, values point into the buffer
+    contextP = lwm2m_init(NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(contextP);
+    result = tlv_parse(contextP, buffer, length, &arenaP);
+    CU_ASSERT_EQUAL_FATAL(result, 1);
+    CU_ASSERT_EQUAL_FATAL(arenaP->value.asChildren.count, TLV_INSTANCE_COUNT);
+    CU_ASSERT_PTR_EQUAL(arenaP->value.asChildren.array, arenaP + 1);
+    for (i = 0 ; i < TLV_INSTANCE_COUNT ; i++)
+    {
+        lwm2m_data_t * subP = arenaP->value.asChildren.array + i;
+
+        CU_ASSERT_EQUAL(subP->id, i);
+        CU_ASSERT_EQUAL(subP->type, LWM2M_TYPE_OPAQUE);
+        CU_ASSERT_EQUAL(subP->value.asBuffer.length, 1);
+        CU_ASSERT_TRUE(subP->value.asBuffer.buffer > buffer && subP->value.asBuffer.buffer < buffer + length);
+        CU_ASSERT_EQUAL(subP->value.asBuffer.buffer[0], i & 0xFF);
+    }
+    data_free(contextP, result, arenaP);
+    lwm2m_close(contextP);
+
+    lwm2m_data_free(1, dataP);
+
+    MEMORY_TRACE_AFTER_EQ;
+}
+
 static void test_tlv_serialize()
 {
     MEMORY_TRACE_BEFORE;
@@ -395,6 +468,7 @@ static struct TestTable table[] = {
         { "test of lwm2m_data_free()", test_tlv_free },
         { "test of lwm2m_decodeTLV()", test_decodeTLV },
         { "test of lwm2m_data_parse()", test_tlv_parse },
+        { "test of lwm2m_data_parse() with many records", test_tlv_parse_large },
         { "test of lwm2m_data_serialize()", test_tlv_serialize },
         { "test of lwm2m_data_encode_int() and lwm2m_data_decode_int()", test_tlv_int },
         { "test of lwm2m_data_encode_bool()and lwm2m_data_decode_bool()", test_tlv_bool },
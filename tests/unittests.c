@@ -48,6 +48,25 @@ CU_ErrorCode add_tests(CU_pSuite pSuite, struct TestTable* testTable)
     return CUE_SUCCESS;
 }
 
+int test_open_loopback(connection_t ** connPP)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    char host[] = "127.0.0.1";
+    char port[8];
+    int sock;
+
+    sock = create_socket("0", AF_INET);
+    if (sock < 0) return -1;
+    if (getsockname(sock, (struct sockaddr *)&addr, &addrLen) != 0) return -1;
+
+    snprintf(port, sizeof(port), "%hu", ntohs(addr.sin_port));
+    *connPP = connection_create(NULL, sock, host, port, AF_INET);
+    if (*connPP == NULL) return -1;
+
+    return sock;
+}
+
 int main()
 {
    /* initialize the CUnit test registry */
@@ -58,6 +77,48 @@ int main()
        goto exit;
    }
 
+    if (CUE_SUCCESS != create_index_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_timer_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_coap_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_memory_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_observe_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_peer_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_dedup_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_block1_suit()) {
+       goto exit;
+   }
+
+    if (CUE_SUCCESS != create_block2_suit()) {
+       goto exit;
+   }
+
+#ifdef LWM2M_WITH_SEND_QUEUE
+    if (CUE_SUCCESS != create_sendqueue_suit()) {
+       goto exit;
+   }
+#endif
+
    CU_basic_set_mode(CU_BRM_VERBOSE);
    CU_basic_run_tests();
 exit: